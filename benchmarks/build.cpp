@@ -0,0 +1,118 @@
+// Copyright (C) 2022-2023 Jonathan Müller and lauf contributors
+// SPDX-License-Identifier: BSL-1.0
+
+#include <cstdio>
+#include <lauf/asm/builder.h>
+#include <lauf/asm/module.h>
+#include <lauf/lib/int.h>
+#include <lauf/runtime/builtin.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define ANKERL_NANOBENCH_IMPLEMENT
+#include <nanobench.h>
+
+namespace
+{
+constexpr auto function_count = 4096u;
+constexpr auto literal_count  = 16384u;
+
+bool build_function(lauf_asm_builder* b, lauf_asm_module* mod, size_t index, void* user_data)
+{
+    auto fn = static_cast<lauf_asm_function**>(user_data)[index];
+    lauf_asm_build(b, mod, fn);
+
+    // A loop that sums the numbers [0, input), so it isn't folded away.
+    auto loop = lauf_asm_declare_block(b, 2);
+    auto body = lauf_asm_declare_block(b, 2);
+    auto exit = lauf_asm_declare_block(b, 2);
+
+    lauf_asm_inst_uint(b, index);
+    lauf_asm_inst_jump(b, loop);
+
+    lauf_asm_build_block(b, loop);
+    lauf_asm_inst_pick(b, 1);
+    lauf_asm_inst_branch(b, body, exit);
+
+    lauf_asm_build_block(b, body);
+    lauf_asm_inst_pick(b, 1);
+    lauf_asm_inst_call_builtin(b, lauf_lib_int_uadd(LAUF_LIB_INT_OVERFLOW_WRAP));
+    lauf_asm_inst_roll(b, 1);
+    lauf_asm_inst_uint(b, 1);
+    lauf_asm_inst_call_builtin(b, lauf_lib_int_usub(LAUF_LIB_INT_OVERFLOW_WRAP));
+    lauf_asm_inst_roll(b, 1);
+    lauf_asm_inst_jump(b, loop);
+
+    lauf_asm_build_block(b, exit);
+    lauf_asm_inst_pop(b, 1);
+    lauf_asm_inst_return(b);
+
+    return lauf_asm_build_finish(b);
+}
+
+// Builds a function that creates many different string literals, each one twice.
+void build_literals(lauf_asm_builder* b, lauf_asm_module* mod)
+{
+    auto fn = lauf_asm_add_function(mod, "literals", {0, 0});
+    lauf_asm_build(b, mod, fn);
+
+    char buffer[32];
+    for (auto i = 0u; i != literal_count; ++i)
+    {
+        std::snprintf(buffer, sizeof(buffer), "literal %u", i / 2);
+        lauf_asm_inst_global_addr(b, lauf_asm_build_string_literal(b, buffer));
+        lauf_asm_inst_pop(b, 0);
+    }
+
+    lauf_asm_inst_return(b);
+    lauf_asm_build_finish(b);
+}
+} // namespace
+
+int main()
+{
+    ankerl::nanobench::Bench bench;
+    bench.minEpochTime(std::chrono::milliseconds(500));
+    bench.batch(function_count).unit("function");
+
+    auto benchmark = [&](const std::string& name, std::size_t thread_count) {
+        bench.run(name, [&] {
+            auto mod = lauf_asm_create_module("benchmark");
+
+            std::vector<lauf_asm_function*> fns;
+            fns.reserve(function_count);
+            for (auto i = 0u; i != function_count; ++i)
+                fns.push_back(lauf_asm_add_function(mod, "fn", {1, 1}));
+
+            if (thread_count == 0)
+            {
+                auto b = lauf_asm_create_builder(lauf_asm_default_build_options);
+                for (auto i = 0u; i != function_count; ++i)
+                    build_function(b, mod, i, fns.data());
+                lauf_asm_destroy_builder(b);
+            }
+            else
+            {
+                lauf_asm_module_build_parallel(mod, lauf_asm_default_build_options, thread_count,
+                                               function_count, &build_function, fns.data());
+            }
+
+            lauf_asm_destroy_module(mod);
+        });
+    };
+
+    benchmark("sequential", 0);
+    for (auto thread_count = 1u; thread_count <= std::thread::hardware_concurrency();
+         thread_count *= 2)
+        benchmark("parallel/" + std::to_string(thread_count), thread_count);
+
+    bench.batch(literal_count).unit("literal");
+    bench.run("literals", [&] {
+        auto mod = lauf_asm_create_module("benchmark");
+        auto b   = lauf_asm_create_builder(lauf_asm_default_build_options);
+        build_literals(b, mod);
+        lauf_asm_destroy_builder(b);
+        lauf_asm_destroy_module(mod);
+    });
+}
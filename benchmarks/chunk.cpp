@@ -36,6 +36,16 @@ void bm_add(lauf_asm_builder* b)
     lauf_asm_inst_return(b);
 }
 
+// Same as bm_add, but alternates between two different chunks, so every rebuild misses the cache.
+void bm_add_uncached(lauf_asm_builder* b)
+{
+    static int counter = 0;
+    lauf_asm_inst_sint(b, 42 + counter++ % 2);
+    lauf_asm_inst_sint(b, 11);
+    lauf_asm_inst_call_builtin(b, lauf_lib_int_sadd(LAUF_LIB_INT_OVERFLOW_PANIC));
+    lauf_asm_inst_return(b);
+}
+
 void bm_multiply(lauf_asm_builder* b)
 {
     lauf_asm_inst_sint(b, 4);
@@ -74,6 +84,7 @@ int main(int argc, char* argv[])
 
     LAUF_BENCHMARK(bm_constant);
     LAUF_BENCHMARK(bm_add);
+    LAUF_BENCHMARK(bm_add_uncached);
     LAUF_BENCHMARK(bm_multiply);
 
     lauf_asm_destroy_builder(builder);
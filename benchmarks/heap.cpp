@@ -0,0 +1,217 @@
+// Copyright (C) 2022-2023 Jonathan Müller and lauf contributors
+// SPDX-License-Identifier: BSL-1.0
+
+#include <cstdio>
+#include <lauf/asm/builder.h>
+#include <lauf/asm/module.h>
+#include <lauf/asm/program.h>
+#include <lauf/asm/type.h>
+#include <lauf/lib/heap.h>
+#include <lauf/lib/int.h>
+#include <lauf/runtime/builtin.h>
+#include <lauf/runtime/value.h>
+#include <lauf/vm.h>
+#include <string>
+#include <utility>
+
+#define ANKERL_NANOBENCH_IMPLEMENT
+#include <nanobench.h>
+
+namespace
+{
+constexpr auto iteration_count = 100000u;
+constexpr auto object_count    = 4096u;
+constexpr auto gc_object_count = 256 * 1024u;
+constexpr auto gc_count        = 10u;
+
+// Builds a function that repeatedly allocates two objects, but frees them in non-LIFO order:
+// the first one is freed immediately, the second one only in the next iteration.
+// It returns the address of the last allocation.
+lauf_asm_function* build_churn(lauf_asm_builder* b, lauf_asm_module* mod)
+{
+    auto fn = lauf_asm_add_function(mod, "churn", {0, 1});
+    lauf_asm_build(b, mod, fn);
+
+    auto alloc = [&] {
+        lauf_asm_inst_uint(b, alignof(void*));
+        lauf_asm_inst_uint(b, 2 * sizeof(void*));
+        lauf_asm_inst_call_builtin(b, lauf_lib_heap_alloc);
+    };
+
+    auto loop = lauf_asm_declare_block(b, 2);
+    auto body = lauf_asm_declare_block(b, 2);
+    auto exit = lauf_asm_declare_block(b, 2);
+
+    // => counter keep
+    lauf_asm_inst_uint(b, iteration_count);
+    alloc();
+    lauf_asm_inst_jump(b, loop);
+
+    lauf_asm_build_block(b, loop);
+    lauf_asm_inst_pick(b, 1);
+    lauf_asm_inst_branch(b, body, exit);
+
+    lauf_asm_build_block(b, body);
+    // => counter keep x y
+    alloc();
+    alloc();
+    // Free x, which is not the most recent allocation.
+    lauf_asm_inst_roll(b, 1);
+    lauf_asm_inst_call_builtin(b, lauf_lib_heap_free);
+    // Free keep, which is older.
+    lauf_asm_inst_roll(b, 1);
+    lauf_asm_inst_call_builtin(b, lauf_lib_heap_free);
+    // => (counter - 1) y
+    lauf_asm_inst_roll(b, 1);
+    lauf_asm_inst_uint(b, 1);
+    lauf_asm_inst_call_builtin(b, lauf_lib_int_usub(LAUF_LIB_INT_OVERFLOW_WRAP));
+    lauf_asm_inst_roll(b, 1);
+    lauf_asm_inst_jump(b, loop);
+
+    lauf_asm_build_block(b, exit);
+    lauf_asm_inst_roll(b, 1);
+    lauf_asm_inst_pop(b, 0);
+    lauf_asm_inst_return(b);
+
+    lauf_asm_build_finish(b);
+    return fn;
+}
+
+// Builds a function that allocates many small objects and leaves them for process teardown,
+// like a short-lived request handler.
+lauf_asm_function* build_teardown(lauf_asm_builder* b, lauf_asm_module* mod)
+{
+    auto fn = lauf_asm_add_function(mod, "teardown", {0, 0});
+    lauf_asm_build(b, mod, fn);
+
+    auto loop = lauf_asm_declare_block(b, 1);
+    auto body = lauf_asm_declare_block(b, 1);
+    auto exit = lauf_asm_declare_block(b, 1);
+
+    lauf_asm_inst_uint(b, object_count);
+    lauf_asm_inst_jump(b, loop);
+
+    lauf_asm_build_block(b, loop);
+    lauf_asm_inst_pick(b, 0);
+    lauf_asm_inst_branch(b, body, exit);
+
+    lauf_asm_build_block(b, body);
+    lauf_asm_inst_uint(b, alignof(void*));
+    lauf_asm_inst_uint(b, 4 * sizeof(void*));
+    lauf_asm_inst_call_builtin(b, lauf_lib_heap_alloc);
+    lauf_asm_inst_pop(b, 0);
+    lauf_asm_inst_uint(b, 1);
+    lauf_asm_inst_call_builtin(b, lauf_lib_int_usub(LAUF_LIB_INT_OVERFLOW_WRAP));
+    lauf_asm_inst_jump(b, loop);
+
+    lauf_asm_build_block(b, exit);
+    lauf_asm_inst_pop(b, 0);
+    lauf_asm_inst_return(b);
+
+    lauf_asm_build_finish(b);
+    return fn;
+}
+// Builds a function that creates a big heap of objects referenced from an array,
+// and then garbage collects it repeatedly.
+lauf_asm_function* build_gc(lauf_asm_builder* b, lauf_asm_module* mod)
+{
+    auto fn = lauf_asm_add_function(mod, "gc", {0, 0});
+    lauf_asm_build(b, mod, fn);
+
+    auto loop = lauf_asm_declare_block(b, 2);
+    auto body = lauf_asm_declare_block(b, 2);
+    auto exit = lauf_asm_declare_block(b, 2);
+
+    // => array counter
+    lauf_asm_inst_layout(b, lauf_asm_type_value.layout);
+    lauf_asm_inst_uint(b, gc_object_count);
+    lauf_asm_inst_call_builtin(b, lauf_lib_heap_alloc_array);
+    lauf_asm_inst_uint(b, gc_object_count);
+    lauf_asm_inst_jump(b, loop);
+
+    lauf_asm_build_block(b, loop);
+    lauf_asm_inst_pick(b, 0);
+    lauf_asm_inst_branch(b, body, exit);
+
+    lauf_asm_build_block(b, body);
+    lauf_asm_inst_uint(b, 1);
+    lauf_asm_inst_call_builtin(b, lauf_lib_int_usub(LAUF_LIB_INT_OVERFLOW_WRAP));
+    // array[counter] = alloc()
+    lauf_asm_inst_layout(b, lauf_asm_type_value.layout);
+    lauf_asm_inst_call_builtin(b, lauf_lib_heap_alloc);
+    lauf_asm_inst_pick(b, 2);
+    lauf_asm_inst_pick(b, 2);
+    lauf_asm_inst_array_element(b, lauf_asm_type_value.layout);
+    lauf_asm_inst_store_field(b, lauf_asm_type_value, 0);
+    lauf_asm_inst_jump(b, loop);
+
+    lauf_asm_build_block(b, exit);
+    lauf_asm_inst_pop(b, 0);
+    for (auto i = 0u; i != gc_count; ++i)
+    {
+        lauf_asm_inst_call_builtin(b, lauf_lib_heap_gc);
+        lauf_asm_inst_pop(b, 0);
+    }
+    lauf_asm_inst_pop(b, 0);
+    lauf_asm_inst_return(b);
+
+    lauf_asm_build_finish(b);
+    return fn;
+}
+} // namespace
+
+int main()
+{
+    auto vm      = lauf_create_vm(lauf_default_vm_options);
+    auto mod     = lauf_asm_create_module("benchmark");
+    auto builder = lauf_asm_create_builder(lauf_asm_default_build_options);
+
+    auto churn    = lauf_asm_create_program(mod, build_churn(builder, mod));
+    auto teardown = lauf_asm_create_program(mod, build_teardown(builder, mod));
+
+    ankerl::nanobench::Bench b;
+    b.minEpochTime(std::chrono::milliseconds(500));
+    for (auto [allocator_name, allocator] :
+         {std::pair("malloc", lauf_vm_malloc_allocator), std::pair("slab", lauf_vm_slab_allocator)})
+    {
+        lauf_vm_set_allocator(vm, allocator);
+
+        lauf_runtime_value result;
+        b.run(std::string("churn/") + allocator_name, [&] {
+            auto success = lauf_vm_execute(vm, &churn, nullptr, &result);
+            ankerl::nanobench::doNotOptimizeAway(success);
+        });
+        // As freed allocations are reused, the allocation index stays small regardless of the
+        // number of iterations.
+        std::printf("allocation index of last allocation: %u\n",
+                    unsigned(result.as_address.allocation));
+
+        b.run(std::string("teardown/") + allocator_name, [&] {
+            auto success = lauf_vm_execute(vm, &teardown, nullptr, nullptr);
+            ankerl::nanobench::doNotOptimizeAway(success);
+        });
+    }
+
+    auto gc = lauf_asm_create_program(mod, build_gc(builder, mod));
+    for (auto thread_count : {1u, 2u, 4u, 0u})
+    {
+        auto options            = lauf_default_vm_options;
+        options.gc_thread_count = thread_count;
+        auto gc_vm              = lauf_create_vm(options);
+
+        b.run("gc/threads=" + std::to_string(thread_count), [&] {
+            auto success = lauf_vm_execute(gc_vm, &gc, nullptr, nullptr);
+            ankerl::nanobench::doNotOptimizeAway(success);
+        });
+
+        lauf_destroy_vm(gc_vm);
+    }
+
+    lauf_asm_destroy_program(gc);
+    lauf_asm_destroy_program(teardown);
+    lauf_asm_destroy_program(churn);
+    lauf_asm_destroy_builder(builder);
+    lauf_asm_destroy_module(mod);
+    lauf_destroy_vm(vm);
+}
+
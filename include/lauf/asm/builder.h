@@ -40,6 +40,14 @@ typedef struct lauf_asm_build_options
     /// Handler called when attempting to build an ill-formed body.
     /// If it returns, lauf will attempt to repair the error.
     void (*error_handler)(const char* fn_name, const char* context, const char* msg);
+
+    /// The maximal number of instructions a call may execute to be evaluated while building.
+    ///
+    /// If non-zero, a call to a pure function whose arguments are all constants is evaluated by the
+    /// builder and replaced by its results. A function is pure if it does not contain loops or
+    /// recursion, does not access mutable globals, and only calls pure functions and constant
+    /// foldable builtins. A value of zero disables build-time evaluation.
+    size_t const_eval_step_limit;
 } lauf_asm_build_options;
 
 /// The default build options.
@@ -61,7 +69,9 @@ void lauf_asm_build(lauf_asm_builder* b, lauf_asm_module* mod, lauf_asm_function
 
 /// Starts building a chunk of code.
 ///
-/// If the chunk already contains code, it will be cleared first.
+/// If the chunk already contains code, it is replaced once the build is finished.
+/// If the new code is identical to the existing code, the existing instructions are kept, and, for
+/// a pure chunk without inputs, so is the result of its previous execution.
 /// If a previous build wasn't finished yet; discards it.
 void lauf_asm_build_chunk(lauf_asm_builder* b, lauf_asm_module* mod, lauf_asm_chunk* chunk,
                           lauf_asm_signature sig);
@@ -72,6 +82,44 @@ void lauf_asm_build_chunk(lauf_asm_builder* b, lauf_asm_module* mod, lauf_asm_ch
 /// Returns true if the body is well-formed, false otherwise.
 bool lauf_asm_build_finish(lauf_asm_builder* b);
 
+/// Statistics about the optimizations done while building.
+typedef struct lauf_asm_build_stats
+{
+    /// The number of stack shuffle instructions (pop, pick, roll, ...) that were eliminated.
+    size_t eliminated_shuffles;
+    /// The number of local variable loads and stores that were eliminated by passing the values
+    /// as block parameters instead.
+    size_t eliminated_local_accesses;
+    /// The number of function calls that were evaluated while building.
+    size_t evaluated_calls;
+} lauf_asm_build_stats;
+
+/// Returns the statistics of the most recent build.
+///
+/// They are reset by `lauf_asm_build()` and `lauf_asm_build_chunk()` and complete after
+/// `lauf_asm_build_finish()`.
+lauf_asm_build_stats lauf_asm_build_get_stats(lauf_asm_builder* b);
+
+//=== parallel building ===//
+/// Callback for `lauf_asm_module_build_parallel()`.
+///
+/// It is called with the builder of the current thread and should build the `index`th function by
+/// calling `lauf_asm_build()` and `lauf_asm_build_finish()`.
+/// It returns `true` on success, `false` otherwise.
+typedef bool lauf_asm_parallel_build_fn(lauf_asm_builder* b, lauf_asm_module* mod, size_t index,
+                                        void* user_data);
+
+/// Calls `fn` for every index in `[0, count)` on `thread_count` threads (including the calling
+/// one), each with their own builder created using `options`.
+///
+/// The builders allocate the instructions and debug locations of the functions in memory owned by
+/// their thread, which is handed to the module at the end, so they don't contend on the module
+/// while finishing a build. If `thread_count` is zero, it uses the number of hardware threads.
+/// Returns `true` if all calls of `fn` returned `true`.
+bool lauf_asm_module_build_parallel(lauf_asm_module* mod, lauf_asm_build_options options,
+                                    size_t thread_count, size_t count,
+                                    lauf_asm_parallel_build_fn* fn, void* user_data);
+
 //=== global data ===//
 /// Adds a constant global containing the specified data to the module of the builder.
 ///
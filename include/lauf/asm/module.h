@@ -116,6 +116,12 @@ void lauf_asm_define_data_global(lauf_asm_module* mod, lauf_asm_global* global,
 void lauf_asm_set_global_debug_name(lauf_asm_module* mod, lauf_asm_global* global,
                                     const char* name);
 
+/// Sets the pointer map of a global variable for precise garbage collection.
+/// See `lauf_runtime_set_pointer_map()` for the meaning of the arguments; if it cannot be
+/// represented, the global is scanned conservatively.
+void lauf_asm_set_global_pointer_map(lauf_asm_module* mod, lauf_asm_global* global,
+                                     size_t element_size, uint64_t pointer_map);
+
 /// Whether or not the global is defined.
 bool lauf_asm_global_has_definition(const lauf_asm_global* global);
 
@@ -45,6 +45,17 @@ void lauf_asm_link_module(lauf_asm_program* program, const lauf_asm_module* mod)
 
 void lauf_asm_destroy_program(lauf_asm_program program);
 
+/// Prepares the program for fast process startup.
+///
+/// This builds an image of the memory of all mutable globals once; constant globals are always
+/// shared by all processes.
+/// Every process then maps it copy-on-write instead of copying the globals on startup,
+/// and zero-initialized globals aren't touched until they're used.
+/// Linking other modules afterwards discards the image.
+///
+/// Returns false if this is not supported; the program can still be executed normally.
+bool lauf_asm_prepare_program(lauf_asm_program* program);
+
 //=== native definition ===//
 typedef bool (*lauf_asm_native_function)(void* user_data, lauf_runtime_process* process,
                                          const lauf_runtime_value* input,
@@ -27,6 +27,16 @@ extern const lauf_runtime_builtin lauf_lib_heap_alloc;
 /// Signature: alignment:uint size:uint count:uint => addr:address
 extern const lauf_runtime_builtin lauf_lib_heap_alloc_array;
 
+/// Allocates new heap memory for an array with a pointer map using the allocator of the VM.
+///
+/// It behaves like `lauf_lib_heap_alloc_array`, but additionally calls
+/// `lauf_runtime_set_pointer_map()` with the element layout and pointer map, so the garbage
+/// collector only considers the specified values of each element. If the pointer map cannot be
+/// represented, the memory is scanned conservatively as usual.
+///
+/// Signature: alignment:uint size:uint count:uint pointer_map:uint => addr:address
+extern const lauf_runtime_builtin lauf_lib_heap_alloc_typed;
+
 /// Frees previously allocated heap memory.
 ///
 /// Signature: addr:address => _
@@ -47,6 +57,14 @@ extern const lauf_runtime_builtin lauf_lib_heap_transfer_local;
 /// Signature: _ => total_bytes_freed:uint
 extern const lauf_runtime_builtin lauf_lib_heap_gc;
 
+/// Calls `lauf_runtime_gc_step()`.
+/// Signature: budget_bytes:uint => finished:uint
+extern const lauf_runtime_builtin lauf_lib_heap_gc_step;
+
+/// Calls `lauf_runtime_gc_minor()`.
+/// Signature: _ => bytes_freed:uint
+extern const lauf_runtime_builtin lauf_lib_heap_gc_minor;
+
 /// Calls `lauf_runtime_declare_reachable()`.
 /// Signature: addr:address => _
 extern const lauf_runtime_builtin lauf_lib_heap_declare_reachable;
@@ -67,17 +67,22 @@ extern const lauf_runtime_builtin lauf_lib_memory_int_to_addr;
 
 /// Adds an offset to an address.
 ///
+/// For allocations bigger than 4 GiB, the result is in the segment that contains it (see
+/// `lauf_runtime_get_allocation()`).
+///
 /// Signature: addr:address offset:sint => (addr + offset):address
 lauf_runtime_builtin lauf_lib_memory_addr_add(lauf_lib_memory_addr_overflow overflow);
 
 /// Subtracts an offset from an address.
 ///
+/// Like `lauf_lib_memory_addr_add`, it can move to a different segment.
+///
 /// Signature: addr:address offset:sint => (addr - offset):address
 lauf_runtime_builtin lauf_lib_memory_addr_sub(lauf_lib_memory_addr_overflow overflow);
 
 /// Returns the distance in bytes between two addresses.
 ///
-/// The addresses must be in the same allocation.
+/// The addresses must be in the same allocation, but can be in different segments of it.
 ///
 /// Signature: addr1:address addr2:address => (addr1 - addr2):sint
 extern const lauf_runtime_builtin lauf_lib_memory_addr_distance;
@@ -82,6 +82,15 @@ typedef struct lauf_runtime_allocation
 } lauf_runtime_allocation;
 
 /// Returns metadata of an allocation.
+///
+/// As addresses have a 32bit offset, allocations bigger than 4 GiB are split into segments of
+/// 2 GiB. Each segment has its own address, and the address arithmetic builtins of
+/// `lauf/lib/memory.h` move between the segments of an allocation; any other access is limited to
+/// a single segment.
+/// Segments cannot be split. Segmented heap allocations need to be freed explicitly, as the garbage
+/// collector doesn't free them. It still looks for addresses in all of their segments on every
+/// collection, so they should have a pointer map.
+/// For them, this function describes the entire allocation, not just the segment.
 bool lauf_runtime_get_allocation(lauf_runtime_process* p, lauf_runtime_address addr,
                                  lauf_runtime_allocation* result);
 
@@ -104,14 +113,56 @@ lauf_runtime_address lauf_runtime_add_heap_allocation(lauf_runtime_process* p, v
 /// It is marked as freed, but not actually freed.
 bool lauf_runtime_leak_heap_allocation(lauf_runtime_process* p, lauf_runtime_address addr);
 
+/// Maps a host file into a new static allocation and returns its address.
+///
+/// The file is not copied; bytecode accesses the pages of the file directly.
+/// `perms` must include `LAUF_RUNTIME_PERM_READ`. With `LAUF_RUNTIME_PERM_WRITE`, bytecode can
+/// write it as well, but the changes are private to the process and not written back to the file.
+/// The garbage collector does not look for addresses in it.
+///
+/// The file is unmapped when the process is destroyed, or earlier by `lauf_runtime_unmap_file()`.
+/// Returns `lauf_runtime_address_null` if the file could not be mapped.
+lauf_runtime_address lauf_runtime_map_file(lauf_runtime_process* p, const char* path,
+                                           lauf_runtime_permission perms);
+
+/// Unmaps a file mapped by `lauf_runtime_map_file()`, which invalidates all addresses into it.
+bool lauf_runtime_unmap_file(lauf_runtime_process* p, lauf_runtime_address addr);
+
 /// Frees all heap allocated memory and fibers that are not reachable.
 ///
 /// It uses a conservative tracing algorithm that assumes anything that could be a valid address is
 /// one. Addresses with invalid offsets do not keep the allocation alive.
 ///
+/// For processes with many allocations, marking and sweeping is done on `gc_thread_count` threads
+/// (see `lauf_vm_options`). Heap memory is only freed on other threads when using
+/// `lauf_vm_malloc_allocator`, as other allocators are not required to be thread-safe.
+///
 /// Returns the total number of bytes freed.
 size_t lauf_runtime_gc(lauf_runtime_process* p);
 
+/// Performs a step of an incremental garbage collection.
+///
+/// It starts a new collection if none is in progress, and then does work proportional to scanning
+/// `budget_bytes` of memory. Marking the stacks and allocations modified during the collection is
+/// done without interruption in the final marking step. Between steps, the process can continue
+/// executing; allocations that are created or become reachable in the mean time are not freed.
+/// Calling `lauf_runtime_gc()` finishes a collection in progress.
+///
+/// Returns `true` if the collection has finished, `false` if more steps are necessary.
+/// If `bytes_freed` is not null, it is set to the number of bytes freed by this step.
+bool lauf_runtime_gc_step(lauf_runtime_process* p, size_t budget_bytes, size_t* bytes_freed);
+
+/// Frees heap allocated memory and fibers that have been created since the last collection and are
+/// not reachable.
+///
+/// It requires the `generational_gc` option of the VM, otherwise it does nothing.
+/// Older allocations are not scanned in full, only the ones that have been modified since the last
+/// collection, as only they can refer to young allocations. Surviving allocations become old.
+/// It does nothing while an incremental collection is in progress.
+///
+/// Returns the total number of bytes freed.
+size_t lauf_runtime_gc_minor(lauf_runtime_process* p);
+
 /// Poisons the allocation an address is in.
 ///
 /// It may not be accessed until un-poisoned again, but can be freed.
@@ -150,6 +201,22 @@ bool lauf_runtime_declare_reachable(lauf_runtime_process* p, lauf_runtime_addres
 /// Unmarks a heap allocation as reachable for the purposes of garbage collection.
 bool lauf_runtime_undeclare_reachable(lauf_runtime_process* p, lauf_runtime_address addr);
 
+/// Sets the pointer map of a heap allocation for precise garbage collection.
+///
+/// The allocation is treated as an array of elements of `element_size` bytes, which must be a
+/// multiple of `sizeof(lauf_runtime_value)` and contain at most 56 values.
+/// Bit i of `pointer_map` is set if the i-th value of each element can contain an address; only
+/// those are considered by the garbage collector. A pointer map of zero means the allocation does
+/// not contain any addresses and it is not scanned at all, regardless of the element size.
+///
+/// For a heap allocation that is segmented because it is bigger than 4 GiB, the address can be any
+/// segment and the pointer map applies to the entire allocation.
+///
+/// Returns false if the allocation is not a heap allocation, has been split, or the pointer map is
+/// invalid. Splitting the allocation resets its pointer map.
+bool lauf_runtime_set_pointer_map(lauf_runtime_process* p, lauf_runtime_address addr,
+                                  size_t element_size, uint64_t pointer_map);
+
 /// Marks an (arbitrary) allocation as weak for the purposes of garbage collection.
 ///
 /// When determening whether an allocation is reachable, any addresses inside weak allocations are
@@ -144,6 +144,49 @@ bool lauf_runtime_set_step_limit(lauf_runtime_process* process, size_t new_limit
 /// for the step limit to work. If the step limit is unlimited, does nothing.
 bool lauf_runtime_increment_step(lauf_runtime_process* process);
 
+//=== heap limit ===//
+/// Limits the heap memory that can be allocated by the `lauf.heap` builtins.
+///
+/// Allocations that would exceed `max_heap_size` bytes or `max_heap_allocations` allocations of
+/// live heap memory panic. A value of zero means unlimited.
+/// The size limit cannot be increased beyond the `max_heap_size` provided in the VM config;
+/// if it would, returns false and leaves the limits unchanged.
+bool lauf_runtime_set_heap_limit(lauf_runtime_process* process, size_t max_heap_size,
+                                 size_t max_heap_allocations);
+
+//=== statistics ===//
+/// Counters about the resources used by a process.
+typedef struct lauf_runtime_stats
+{
+    /// The number of bytes in heap allocations that haven't been freed yet, and the maximum so far.
+    size_t heap_size;
+    size_t peak_heap_size;
+    /// The number of heap allocations that haven't been freed yet.
+    size_t heap_allocation_count;
+    /// The number of entries in the allocation table, including the ones of freed allocations.
+    size_t allocation_table_size;
+
+    /// How often the vstack or cstack of a fiber had to grow.
+    size_t vstack_grow_count;
+    size_t cstack_grow_count;
+    /// The number of bytes the page allocator of the VM has mapped.
+    /// It is shared by all processes of the VM and includes memory cached for re-use.
+    size_t vm_mapped_bytes;
+
+    /// The number of garbage collections that have finished, the bytes of heap memory they freed,
+    /// and the time spent collecting garbage in nanoseconds.
+    size_t   gc_count;
+    size_t   gc_bytes_freed;
+    uint64_t gc_pause_ns;
+
+    /// The number of calls to functions that weren't defined in their module, but at runtime
+    /// (e.g. native functions).
+    size_t undefined_function_call_count;
+} lauf_runtime_stats;
+
+/// Returns the current statistics of the process.
+lauf_runtime_stats lauf_runtime_get_stats(lauf_runtime_process* process);
+
 LAUF_HEADER_END
 
 #endif // LAUF_RUNTIME_PROCESS_H_INCLUDED
@@ -0,0 +1,58 @@
+// Copyright (C) 2022-2023 Jonathan Müller and lauf contributors
+// SPDX-License-Identifier: BSL-1.0
+
+#ifndef LAUF_RUNTIME_SNAPSHOT_H_INCLUDED
+#define LAUF_RUNTIME_SNAPSHOT_H_INCLUDED
+
+#include <lauf/config.h>
+
+LAUF_HEADER_START
+
+typedef struct lauf_asm_program     lauf_asm_program;
+typedef struct lauf_runtime_process lauf_runtime_process;
+typedef struct lauf_writer          lauf_writer;
+
+/// A copy of the state of a process, from which new processes can be started.
+///
+/// It contains the allocations of the process, the contents of heap memory and mutable globals,
+/// and all fibers including their stacks.
+/// Native globals are not copied: they refer to memory owned by the host.
+typedef struct lauf_runtime_snapshot lauf_runtime_snapshot;
+
+/// Captures the state of the process.
+///
+/// The process must be at a quiescent point: no fiber may be running and no garbage collection
+/// may be in progress, e.g. after `lauf_runtime_resume()` returned as the fiber was suspended.
+/// It also doesn't support heap allocations that have been split, or allocations bigger than 4 GiB.
+/// Returns NULL if those conditions aren't met.
+///
+/// The process is not modified and can continue running.
+/// The snapshot refers to the program of the process, which must outlive it.
+lauf_runtime_snapshot* lauf_runtime_snapshot_process(lauf_runtime_process* process);
+
+/// The program of the snapshotted process.
+const lauf_asm_program* lauf_runtime_snapshot_program(const lauf_runtime_snapshot* snapshot);
+
+void lauf_runtime_destroy_snapshot(lauf_runtime_snapshot* snapshot);
+
+//=== serialization ===//
+/// Writes the snapshot in a binary format, so it can be resumed by a different process.
+///
+/// Pointers into the code of the program are stored as indices, but the format is otherwise
+/// specific to the lauf version and architecture.
+/// Native pointers stored in values are not translated.
+/// Returns false if the snapshot refers to code that is not part of its program.
+bool lauf_runtime_write_snapshot(const lauf_runtime_snapshot* snapshot, lauf_writer* writer);
+
+/// Reads a snapshot written by `lauf_runtime_write_snapshot()`.
+///
+/// The program must have been built from the same modules as the program of the snapshot.
+/// Returns NULL if the data isn't a valid snapshot of the program.
+/// The structure of the data is checked, but the contents of the stacks are trusted.
+lauf_runtime_snapshot* lauf_runtime_read_snapshot(const lauf_asm_program* program,
+                                                  const void* data, size_t size);
+
+LAUF_HEADER_END
+
+#endif // LAUF_RUNTIME_SNAPSHOT_H_INCLUDED
+
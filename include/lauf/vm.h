@@ -8,9 +8,10 @@
 
 LAUF_HEADER_START
 
-typedef struct lauf_asm_program     lauf_asm_program;
-typedef struct lauf_runtime_process lauf_runtime_process;
-typedef union lauf_runtime_value    lauf_runtime_value;
+typedef struct lauf_asm_program      lauf_asm_program;
+typedef struct lauf_runtime_process  lauf_runtime_process;
+typedef struct lauf_runtime_snapshot lauf_runtime_snapshot;
+typedef union lauf_runtime_value     lauf_runtime_value;
 
 //=== vm options ===//
 typedef struct lauf_vm_panic_handler
@@ -30,6 +31,15 @@ typedef struct lauf_vm_allocator
 extern const lauf_vm_allocator lauf_vm_null_allocator;
 extern const lauf_vm_allocator lauf_vm_malloc_allocator;
 
+/// An allocator that uses memory pages owned by the VM; it is not thread-safe.
+///
+/// Small allocations are served from size-class slabs, big ones get their own pages.
+/// When a process finishes, all of its memory is released at once instead of per allocation.
+/// Memory leaked with `lauf_runtime_leak_heap_allocation()` is kept until it is freed using the
+/// allocator or the VM is destroyed.
+/// The user data is ignored; the VM sets it when the allocator is installed.
+extern const lauf_vm_allocator lauf_vm_slab_allocator;
+
 typedef struct lauf_vm_options
 {
     /// The initial size of the value stack in elements.
@@ -42,6 +52,18 @@ typedef struct lauf_vm_options
     /// The initial size of the call stack, it can grow bigger if necessary.
     size_t initial_cstack_size_in_bytes;
 
+    /// Whether big blocks of memory of the VM, like stacks and the allocation table, are backed by
+    /// transparent huge pages if the OS supports it. This reduces TLB misses when they are big.
+    bool use_huge_pages;
+    /// Whether memory of the VM is faulted in when it is mapped instead of on first access.
+    /// The VM then also prepares the memory of the initial stacks when it is created,
+    /// so starting a process doesn't page fault.
+    bool prefault_pages;
+    /// The VM caches the memory of stacks and other internal data structures that are no longer
+    /// needed for re-use. Once the cache exceeds the limit, memory is returned to the OS.
+    /// A value of zero means unlimited.
+    size_t max_page_cache_size_in_bytes;
+
     /// The initial max step value (see lauf_lib_limits_set_step_limit).
     /// A value of zero means unlimited.
     size_t step_limit;
@@ -51,6 +73,24 @@ typedef struct lauf_vm_options
     /// The allocator used when the program wants to allocate heap memory.
     lauf_vm_allocator allocator;
 
+    /// Whether allocations are tracked by age for `lauf_runtime_gc_minor()`.
+    /// This makes every write to old memory slightly more expensive.
+    bool generational_gc;
+    /// The number of threads `lauf_runtime_gc()` uses for marking and sweeping big heaps,
+    /// including the calling thread. If it is zero, it uses the number of hardware threads.
+    size_t gc_thread_count;
+
+    /// Heap memory allocated by the `lauf.heap` builtins automatically triggers a garbage
+    /// collection once the live heap memory would exceed a threshold. Initially, the threshold is
+    /// `gc_min_heap_threshold`; after a collection it is the live heap memory times
+    /// `gc_heap_growth_factor`, but at least the minimum. A minimum of zero disables automatic
+    /// collection.
+    size_t gc_min_heap_threshold;
+    double gc_heap_growth_factor;
+    /// Allocations of the `lauf.heap` builtins that would exceed the maximum amount of live heap
+    /// memory panic. A value of zero means unlimited.
+    size_t max_heap_size;
+
     // Arbitrary user data.
     void* user_data;
 } lauf_vm_options;
@@ -82,6 +122,16 @@ void* lauf_vm_get_user_data(lauf_vm* vm);
 /// but does not start running it yet; use `lauf_runtime_resume()` for that.
 lauf_runtime_process* lauf_vm_start_process(lauf_vm* vm, const lauf_asm_program* program);
 
+/// Starts a new process in the state captured by the snapshot.
+///
+/// It copies the memory and fibers of the snapshot, so the initialization work done before the
+/// snapshot was taken doesn't have to be repeated.
+/// The current fiber is the one that was current when the snapshot was taken;
+/// use `lauf_runtime_resume()` to continue running a fiber.
+/// Returns NULL if memory of the snapshot could not be allocated.
+lauf_runtime_process* lauf_vm_start_process_from_snapshot(lauf_vm*                     vm,
+                                                          const lauf_runtime_snapshot* snapshot);
+
 /// Executes the program on the VM.
 ///
 /// `input` is an array that contains as many values as specified by the input signature of the
@@ -95,6 +145,9 @@ lauf_runtime_process* lauf_vm_start_process(lauf_vm* vm, const lauf_asm_program*
 /// If a fiber suspends, it will repeatedly resume it until the main fiber finishes.
 /// It returns `true` if execution finished without panicing, `false` otherwise.
 /// If it returns `false`, `output` has not been modified.
+///
+/// If the program was created from a pure chunk without inputs that has already been executed
+/// successfully, the cached outputs of that execution are returned instead.
 bool lauf_vm_execute(lauf_vm* vm, const lauf_asm_program* program, //
                      const lauf_runtime_value* input, lauf_runtime_value* output);
 
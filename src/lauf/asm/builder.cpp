@@ -3,12 +3,18 @@
 
 #include <lauf/asm/builder.hpp>
 
+#include <algorithm>
+#include <atomic>
 #include <cstdio>
 #include <cstdlib>
 
+#include <lauf/asm/program.h>
+#include <lauf/asm/verifier.hpp>
 #include <lauf/runtime/builtin.h>
 #include <lauf/runtime/stack.hpp>
 #include <lauf/support/array.hpp>
+#include <thread>
+#include <vector>
 
 void lauf_asm_builder::error(const char* context, const char* msg)
 {
@@ -39,17 +45,27 @@ void add_pop_top_n(lauf_asm_builder* b, std::size_t count)
         case lauf::asm_op::branch_le:
         case lauf::asm_op::branch_ge:
         case lauf::asm_op::branch_gt:
+        case lauf::asm_op::jump_long:
+        case lauf::asm_op::branch_eq_long:
+        case lauf::asm_op::branch_ne_long:
+        case lauf::asm_op::branch_lt_long:
+        case lauf::asm_op::branch_le_long:
+        case lauf::asm_op::branch_ge_long:
+        case lauf::asm_op::branch_gt_long:
         case lauf::asm_op::panic:
         case lauf::asm_op::exit:
         case lauf::asm_op::setup_local_alloc:
         case lauf::asm_op::local_alloc:
         case lauf::asm_op::local_alloc_aligned:
         case lauf::asm_op::local_storage:
+        case lauf::asm_op::select_unchecked:
+        case lauf::asm_op::deref_unchecked:
             assert(false && "not added at this point");
             break;
 
         case lauf::asm_op::local_addr:
             --b->local_addr_count;
+            --b->locals.front(b->cur->insts.back().local_addr.index).addr_count;
             // fallthrough
         case lauf::asm_op::push:
         case lauf::asm_op::pushn:
@@ -83,6 +99,7 @@ void add_pop_top_n(lauf_asm_builder* b, std::size_t count)
 
         // Instructions that we can't remove due to side-effects.
         case lauf::asm_op::call:
+        case lauf::asm_op::call_long:
         case lauf::asm_op::call_indirect:
         case lauf::asm_op::call_builtin:
         case lauf::asm_op::call_builtin_no_regs:
@@ -98,6 +115,9 @@ void add_pop_top_n(lauf_asm_builder* b, std::size_t count)
         case lauf::asm_op::roll:
         case lauf::asm_op::swap:
         case lauf::asm_op::select:
+        // The end of a long instruction, which we don't bother to remove.
+        case lauf::asm_op::offset_ext:
+        case lauf::asm_op::function_addr_long:
         // We never remove pop_top; it was added because we couldn't pop the last time, so why
         // should it be possible now.
         case lauf::asm_op::pop_top:
@@ -116,6 +136,7 @@ const lauf_asm_build_options lauf_asm_default_build_options = {
         std::fprintf(stderr, "[lauf build error] %s() of '%s': %s\n", context, fn_name, msg);
         std::abort();
     },
+    0,
 };
 
 lauf_asm_builder* lauf_asm_create_builder(lauf_asm_build_options options)
@@ -125,6 +146,8 @@ lauf_asm_builder* lauf_asm_create_builder(lauf_asm_build_options options)
 
 void lauf_asm_destroy_builder(lauf_asm_builder* b)
 {
+    if (b->const_eval_vm != nullptr)
+        lauf_destroy_vm(b->const_eval_vm);
     lauf_asm_builder::destroy(b);
 }
 
@@ -139,19 +162,524 @@ void lauf_asm_build_chunk(lauf_asm_builder* b, lauf_asm_module* mod, lauf_asm_ch
                           lauf_asm_signature sig)
 {
     LAUF_BUILD_ASSERT(chunk->fn->module == mod, "invalid module");
-    chunk->reset();
+    // The existing code is only replaced when the build is finished.
+    if (chunk->fn->sig.input_count != sig.input_count
+        || chunk->fn->sig.output_count != sig.output_count)
+        chunk->cached_outputs = nullptr;
     chunk->fn->sig = sig;
     b->reset(mod, chunk->fn, chunk);
 }
 
 namespace
 {
+bool is_shuffle(lauf::asm_op op)
+{
+    switch (op)
+    {
+    case lauf::asm_op::pop:
+    case lauf::asm_op::pop_top:
+    case lauf::asm_op::pick:
+    case lauf::asm_op::dup:
+    case lauf::asm_op::roll:
+    case lauf::asm_op::swap:
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+// Computes a shuffle sequence with the same effect as `run` and writes it to `out`.
+// Returns false if it isn't shorter than the original one.
+bool minimize_shuffles(lauf_asm_builder* b, const lauf::array<lauf_asm_inst>& run,
+                       lauf::array<lauf_asm_inst>& out)
+{
+    // We identify each value on the stack by its stack index at the beginning of the run.
+    // First, we need to know how many values from the stack the run touches.
+    std::ptrdiff_t depth  = 0;
+    std::ptrdiff_t height = 0; // relative to the beginning of the run
+    for (auto inst : run)
+    {
+        auto idx = std::ptrdiff_t(inst.pop.idx);
+        if (idx + 1 > depth + height)
+            depth = idx + 1 - height;
+
+        if (inst.op() == lauf::asm_op::pick || inst.op() == lauf::asm_op::dup)
+            ++height;
+        else if (inst.op() == lauf::asm_op::pop || inst.op() == lauf::asm_op::pop_top)
+            --height;
+    }
+    if (depth > UINT16_MAX)
+        return false;
+
+    // Simulate the run on the identities; stacks are stored bottom first.
+    auto erase = [](lauf::array<std::uint16_t>& stack, std::size_t pos) {
+        std::memmove(stack.data() + pos, stack.data() + pos + 1,
+                     (stack.size() - pos - 1) * sizeof(std::uint16_t));
+        stack.pop_back();
+    };
+    auto find = [](const lauf::array<std::uint16_t>& stack, std::uint16_t value) {
+        for (auto pos = stack.size(); pos != 0; --pos)
+            if (stack[pos - 1] == value)
+                return pos - 1;
+        return stack.size();
+    };
+
+    lauf::array<std::uint16_t> target;
+    for (auto i = depth; i != 0; --i)
+        target.push_back(*b, std::uint16_t(i - 1));
+    for (auto inst : run)
+    {
+        auto pos = target.size() - 1 - inst.pop.idx;
+        switch (inst.op())
+        {
+        case lauf::asm_op::pick:
+        case lauf::asm_op::dup:
+            target.push_back(*b, target[pos]);
+            break;
+        case lauf::asm_op::roll:
+        case lauf::asm_op::swap: {
+            auto value = target[pos];
+            erase(target, pos);
+            target.push_back(*b, value);
+            break;
+        }
+        case lauf::asm_op::pop:
+        case lauf::asm_op::pop_top:
+            erase(target, pos);
+            break;
+        default:
+            assert(false && "not a shuffle instruction");
+            break;
+        }
+    }
+
+    // Values at the bottom that remain in place don't need to be touched.
+    std::size_t keep = 0;
+    while (keep < target.size() && keep < std::size_t(depth)
+           && target[keep] == std::size_t(depth) - 1 - keep)
+        ++keep;
+
+    lauf::array<std::uint16_t> stack;
+    for (auto i = depth; i != 0; --i)
+        stack.push_back(*b, std::uint16_t(i - 1));
+
+    auto emit = [&](lauf::asm_op op, std::size_t pos) {
+        auto idx = stack.size() - 1 - pos;
+        if (idx > UINT16_MAX || out.size() >= run.size())
+            return false;
+
+        lauf_asm_inst inst;
+        inst.pop = {op, std::uint16_t(idx)};
+        out.push_back(*b, inst);
+        return true;
+    };
+    auto is_used_after = [&](std::uint16_t value, std::size_t target_pos) {
+        for (auto i = target_pos; i != target.size(); ++i)
+            if (target[i] == value)
+                return true;
+        return false;
+    };
+
+    // Pop all values that are no longer needed.
+    for (auto pos = stack.size(); pos != keep; --pos)
+        if (!is_used_after(stack[pos - 1], keep))
+        {
+            if (!emit(pos == stack.size() ? lauf::asm_op::pop_top : lauf::asm_op::pop, pos - 1))
+                return false;
+            erase(stack, pos - 1);
+        }
+
+    // All remaining values are used; the ones that are already in the correct place stay there.
+    while (keep < target.size() && keep < stack.size() && target[keep] == stack[keep])
+        ++keep;
+    auto moved_end = stack.size();
+
+    // Build the rest on top: roll values on their last use, pick them otherwise.
+    for (auto i = keep; i != target.size(); ++i)
+    {
+        auto value = target[i];
+
+        auto pos = keep;
+        while (pos != moved_end && stack[pos] != value)
+            ++pos;
+        if (pos != moved_end && !is_used_after(value, i + 1))
+        {
+            if (pos + 1 != stack.size())
+            {
+                if (!emit(pos + 2 == stack.size() ? lauf::asm_op::swap : lauf::asm_op::roll, pos))
+                    return false;
+            }
+
+            erase(stack, pos);
+            stack.push_back(*b, value);
+            --moved_end;
+        }
+        else
+        {
+            pos = find(stack, value);
+            assert(pos != stack.size());
+            if (!emit(pos + 1 == stack.size() ? lauf::asm_op::dup : lauf::asm_op::pick, pos))
+                return false;
+
+            stack.push_back(*b, value);
+        }
+    }
+    assert(moved_end == keep);
+
+    return out.size() < run.size();
+}
+
+// Replaces sequences of stack shuffle instructions by shorter ones with the same effect.
+void eliminate_shuffles(lauf_asm_builder* b, lauf_asm_block& block)
+{
+    lauf::array<lauf_asm_inst> run, replacement;
+
+    auto debug_loc = block.debug_locations.begin();
+    auto remap_debug_locations
+        = [&, end = block.debug_locations.end()](std::size_t read_end, std::size_t write_idx) {
+              for (; debug_loc != end && debug_loc->inst_idx < read_end; ++debug_loc)
+                  debug_loc->inst_idx = std::uint32_t(write_idx);
+          };
+
+    auto        write     = block.insts.begin();
+    std::size_t write_idx = 0;
+    std::size_t read_idx  = 0;
+    for (auto read = block.insts.begin(); read != block.insts.end();)
+    {
+        if (!is_shuffle(read->op()))
+        {
+            remap_debug_locations(read_idx + 1, write_idx);
+            *write = *read;
+            ++write;
+            ++write_idx;
+            ++read;
+            ++read_idx;
+            continue;
+        }
+
+        run.clear(*b);
+        for (; read != block.insts.end() && is_shuffle(read->op()); ++read)
+            run.push_back(*b, *read);
+
+        remap_debug_locations(read_idx + run.size(), write_idx);
+        read_idx += run.size();
+
+        replacement.clear(*b);
+        auto& result = run.size() > 1 && minimize_shuffles(b, run, replacement) ? replacement : run;
+        b->stats.eliminated_shuffles += run.size() - result.size();
+        for (auto inst : result)
+        {
+            *write = inst;
+            ++write;
+            ++write_idx;
+        }
+    }
+    remap_debug_locations(std::size_t(-1), write_idx);
+
+    for (auto i = write_idx; i != read_idx; ++i)
+        block.insts.pop_back();
+}
+
+//=== local promotion ===//
+// Local variables of the value type whose address doesn't escape are only accessed using
+// load/store_local_value, so every frame offset used by them is a separate slot.
+// If all predecessors of a block store to slots right before jumping to it, and the block
+// immediately loads them again, we can instead pass the values as additional block parameters.
+//
+// We can only do it if the slot isn't needed afterwards, so we track the liveness of up to 64
+// slots.
+struct promotion_slots
+{
+    std::uint16_t offsets[64];
+    std::size_t   count = 0;
+
+    std::uint64_t mask_of(std::uint16_t offset) const
+    {
+        for (auto i = 0u; i != count; ++i)
+            if (offsets[i] == offset)
+                return std::uint64_t(1) << i;
+        return 0;
+    }
+};
+
+bool is_promotable_access(lauf_asm_builder* b, lauf_asm_inst inst, lauf::asm_op op)
+{
+    if (inst.op() != op)
+        return false;
+
+    auto& local = b->locals.front(inst.load_local_value.index);
+    return local.addr_count == 0;
+}
+
+// The number of leading loads of distinct slots in the block.
+std::size_t leading_loads(lauf_asm_builder* b, const lauf_asm_block& block)
+{
+    std::size_t   result = 0;
+    std::uint16_t seen[64];
+    for (auto& inst : block.insts)
+    {
+        if (result == 64 || !is_promotable_access(b, inst, lauf::asm_op::load_local_value))
+            break;
+
+        for (auto i = 0u; i != result; ++i)
+            if (seen[i] == inst.load_local_value.offset)
+                return result;
+
+        seen[result] = inst.load_local_value.offset;
+        ++result;
+    }
+    return result;
+}
+
+// The number of trailing stores of the predecessor that match the leading loads of dest.
+std::size_t matching_stores(lauf_asm_builder* b, const lauf_asm_block& pred,
+                            const lauf_asm_block& dest, std::size_t max)
+{
+    auto size = pred.insts.size();
+
+    std::size_t result = 0;
+    while (result < max && result < size)
+    {
+        auto store = pred.insts.back(result);
+        auto load  = dest.insts.front(result);
+        if (!is_promotable_access(b, store, lauf::asm_op::store_local_value)
+            || store.store_local_value.offset != load.load_local_value.offset)
+            break;
+
+        ++result;
+    }
+    return result;
+}
+
+// Returns the slots read before they're written, starting at the specified instruction.
+std::uint64_t slots_used(const promotion_slots& slots, const lauf_asm_block& block,
+                         std::size_t begin, std::uint64_t& killed)
+{
+    std::uint64_t result = 0;
+    killed               = 0;
+
+    std::size_t idx = 0;
+    for (auto& inst : block.insts)
+    {
+        if (idx++ < begin)
+            continue;
+
+        if (inst.op() == lauf::asm_op::load_local_value)
+            result |= slots.mask_of(inst.load_local_value.offset) & ~killed;
+        else if (inst.op() == lauf::asm_op::store_local_value)
+            killed |= slots.mask_of(inst.store_local_value.offset);
+    }
+    return result;
+}
+
+void erase_front(lauf_asm_builder* b, lauf_asm_block& block, std::size_t n)
+{
+    lauf::array<lauf_asm_inst> insts;
+    insts.resize_uninitialized(*b, block.insts.size());
+    block.insts.copy_to(insts.data());
+
+    block.insts.reset();
+    for (auto i = n; i != insts.size(); ++i)
+        block.insts.push_back(*b, insts[i]);
+
+    for (auto& loc : block.debug_locations)
+        loc.inst_idx = loc.inst_idx > n ? std::uint32_t(loc.inst_idx - n) : 0;
+}
+
+void erase_back(lauf_asm_block& block, std::size_t n)
+{
+    for (auto i = 0u; i != n; ++i)
+        block.insts.pop_back();
+
+    for (auto& loc : block.debug_locations)
+        if (loc.inst_idx > block.insts.size())
+            loc.inst_idx = std::uint32_t(block.insts.size());
+}
+
+void promote_locals(lauf_asm_builder* b)
+{
+    if (b->blocks.size() == 1)
+        return;
+
+    auto is_jump_to = [](const lauf_asm_block& pred, const lauf_asm_block* dest) {
+        return pred.terminator == lauf_asm_block::jump && pred.next[0] == dest;
+    };
+    auto is_pred_of = [](const lauf_asm_block& pred, const lauf_asm_block* dest) {
+        switch (pred.terminator)
+        {
+        case lauf_asm_block::jump:
+            return pred.next[0] == dest;
+        case lauf_asm_block::branch_ne_eq:
+        case lauf_asm_block::branch_lt_ge:
+        case lauf_asm_block::branch_le_gt:
+            return pred.next[0] == dest || pred.next[1] == dest;
+        default:
+            return false;
+        }
+    };
+
+    // For each block, determine how many values could be promoted, ignoring liveness.
+    lauf::array<std::size_t> promotable;
+    promotable.resize_uninitialized(*b, b->blocks.size());
+
+    promotion_slots slots;
+    auto            block_idx = std::size_t(0);
+    for (auto& dest : b->blocks)
+    {
+        auto& count = promotable[block_idx++];
+        if (&dest == &b->blocks.front())
+        {
+            // The entry block receives the function arguments.
+            count = 0;
+            continue;
+        }
+
+        count           = leading_loads(b, dest);
+        auto has_preds  = false;
+        for (auto& pred : b->blocks)
+        {
+            if (count == 0)
+                break;
+            if (!is_pred_of(pred, &dest))
+                continue;
+
+            has_preds = true;
+            if (!is_jump_to(pred, &dest))
+                count = 0;
+            else
+                count = matching_stores(b, pred, dest, count);
+        }
+        if (!has_preds || std::size_t(dest.sig.input_count) + count > UINT8_MAX)
+            count = 0;
+
+        auto idx = std::size_t(0);
+        for (auto& inst : dest.insts)
+        {
+            if (idx == count)
+                break;
+
+            if (slots.mask_of(inst.load_local_value.offset) == 0)
+            {
+                if (slots.count == 64)
+                {
+                    // Can't track it.
+                    count = idx;
+                    break;
+                }
+                slots.offsets[slots.count++] = inst.load_local_value.offset;
+            }
+            ++idx;
+        }
+    }
+    if (slots.count == 0)
+        return;
+
+    // Compute the slots live at the beginning of each block.
+    lauf::array<std::uint64_t> live_in, gen, kill;
+    live_in.resize_uninitialized(*b, b->blocks.size());
+    gen.resize_uninitialized(*b, b->blocks.size());
+    kill.resize_uninitialized(*b, b->blocks.size());
+    block_idx = 0;
+    for (auto& block : b->blocks)
+    {
+        gen[block_idx]     = slots_used(slots, block, 0, kill[block_idx]);
+        live_in[block_idx] = gen[block_idx];
+        ++block_idx;
+    }
+
+    auto index_of = [&](const lauf_asm_block* block) {
+        auto idx = std::size_t(0);
+        for (auto& cur : b->blocks)
+        {
+            if (&cur == block)
+                return idx;
+            ++idx;
+        }
+        return idx;
+    };
+    auto live_out = [&](const lauf_asm_block& block) {
+        std::uint64_t result = 0;
+        switch (block.terminator)
+        {
+        case lauf_asm_block::branch_ne_eq:
+        case lauf_asm_block::branch_lt_ge:
+        case lauf_asm_block::branch_le_gt:
+            result |= live_in[index_of(block.next[1])];
+            // fallthrough
+        case lauf_asm_block::jump:
+            result |= live_in[index_of(block.next[0])];
+            break;
+        default:
+            break;
+        }
+        return result;
+    };
+    for (auto changed = true; changed;)
+    {
+        changed   = false;
+        block_idx = 0;
+        for (auto& block : b->blocks)
+        {
+            auto new_live_in = gen[block_idx] | (live_out(block) & ~kill[block_idx]);
+            if (new_live_in != live_in[block_idx])
+            {
+                live_in[block_idx] = new_live_in;
+                changed            = true;
+            }
+            ++block_idx;
+        }
+    }
+
+    // Promote the values that are dead after the leading loads.
+    block_idx = 0;
+    for (auto& dest : b->blocks)
+    {
+        auto count = promotable[block_idx++];
+        for (; count > 0; --count)
+        {
+            std::uint64_t killed;
+            auto          live_after = slots_used(slots, dest, count, killed);
+            live_after |= live_out(dest) & ~killed;
+
+            std::uint64_t promoted = 0;
+            auto          idx      = std::size_t(0);
+            for (auto& inst : dest.insts)
+            {
+                if (idx++ == count)
+                    break;
+                promoted |= slots.mask_of(inst.load_local_value.offset);
+            }
+
+            if ((promoted & live_after) == 0)
+                break;
+        }
+        if (count == 0)
+            continue;
+
+        for (auto& pred : b->blocks)
+            if (is_jump_to(pred, &dest))
+            {
+                erase_back(pred, count);
+                pred.sig.output_count = std::uint8_t(pred.sig.output_count + count);
+                b->stats.eliminated_local_accesses += count;
+            }
+
+        erase_front(b, dest, count);
+        dest.sig.input_count = std::uint8_t(dest.sig.input_count + count);
+        b->stats.eliminated_local_accesses += count;
+    }
+}
+
 // Returns an upper bound on the number of reachable instructions.
 // Also validates terminator of blocks and sets reachable information.
-std::size_t estimate_inst_count(const char* context, lauf_asm_builder* b)
+// If the function is too big for 24 bit jump offsets, sets long_jumps.
+std::size_t estimate_inst_count(const char* context, lauf_asm_builder* b, bool& long_jumps)
 {
     // setup_local_alloc + local_alloc instructions
     auto result = 1 + b->locals.size();
+    // Number of jump and branch instructions.
+    auto jump_count = std::size_t(0);
 
     if (b->blocks.size() == 1)
     {
@@ -161,6 +689,7 @@ std::size_t estimate_inst_count(const char* context, lauf_asm_builder* b)
         result += 1; // block instruction
         result += entry->insts.size();
         result += 2; // at most two terminator instructions
+        jump_count += 1;
 
         if (entry->terminator == lauf_asm_block::unterminated)
             b->error(context, "unterminated block");
@@ -196,6 +725,7 @@ std::size_t estimate_inst_count(const char* context, lauf_asm_builder* b)
             case lauf_asm_block::jump:
                 recurse(recurse, cur->next[0]);
                 ++result;
+                jump_count += 1;
                 break;
             case lauf_asm_block::branch_ne_eq:
             case lauf_asm_block::branch_lt_ge:
@@ -203,12 +733,19 @@ std::size_t estimate_inst_count(const char* context, lauf_asm_builder* b)
                 recurse(recurse, cur->next[0]);
                 recurse(recurse, cur->next[1]);
                 result += 2;
+                jump_count += 2;
                 break;
             }
         };
         visit(visit, &b->blocks.front());
     }
 
+    // Jumps can't be longer than the function, so we only need long jumps for big functions.
+    // They require an additional offset_ext instruction each.
+    long_jumps = !lauf::fits_short_offset(std::ptrdiff_t(result));
+    if (long_jumps)
+        result += jump_count;
+
     return result;
 }
 
@@ -216,14 +753,31 @@ lauf_asm_inst* emit_prologue(lauf_asm_inst* ip, lauf_asm_builder* b)
 {
     if (b->local_addr_count > 0)
     {
-        // As soon as we have one variable whose address is taken, we have to setup allocations for
-        // all of them. This is because the index in local_addr is wrong otherwise.
-        *ip++ = LAUF_BUILD_INST_VALUE(setup_local_alloc, b->locals.size());
+        // Only variables whose address escapes, i.e. that still have a local_addr instruction,
+        // need an allocation. The index in local_addr is later patched to refer to it.
+        b->local_alloc_count = 0;
+        for (auto& local : b->locals)
+            if (local.addr_count > 0)
+                local.alloc_index = b->local_alloc_count++;
+
+        *ip++ = LAUF_BUILD_INST_VALUE(setup_local_alloc, b->local_alloc_count);
 
+        // We emit one instruction per variable, so the i-th one always belongs to the i-th
+        // variable.
         for (auto& local : b->locals)
         {
             assert(local.layout.alignment >= alignof(void*));
-            if (local.layout.alignment == alignof(void*))
+            if (local.addr_count == 0)
+            {
+                // The variable is only accessed using load/store_local_value, which computes the
+                // address relative to the frame. We just need to reserve the same space the
+                // allocation would have taken.
+                auto space = local.layout.size;
+                if (local.layout.alignment > alignof(void*))
+                    space += local.layout.alignment;
+                *ip++ = LAUF_BUILD_INST_VALUE(local_storage, space);
+            }
+            else if (local.layout.alignment == alignof(void*))
                 *ip++ = LAUF_BUILD_INST_LAYOUT(local_alloc, local.layout);
             else
                 *ip++ = LAUF_BUILD_INST_LAYOUT(local_alloc_aligned, local.layout);
@@ -257,9 +811,33 @@ lauf_asm_inst* emit_prologue(lauf_asm_inst* ip, lauf_asm_builder* b)
     return ip;
 }
 
+constexpr lauf::asm_op long_jump_op(lauf::asm_op op)
+{
+    switch (op)
+    {
+    case lauf::asm_op::jump:
+        return lauf::asm_op::jump_long;
+    case lauf::asm_op::branch_eq:
+        return lauf::asm_op::branch_eq_long;
+    case lauf::asm_op::branch_ne:
+        return lauf::asm_op::branch_ne_long;
+    case lauf::asm_op::branch_lt:
+        return lauf::asm_op::branch_lt_long;
+    case lauf::asm_op::branch_le:
+        return lauf::asm_op::branch_le_long;
+    case lauf::asm_op::branch_ge:
+        return lauf::asm_op::branch_ge_long;
+    case lauf::asm_op::branch_gt:
+        return lauf::asm_op::branch_gt_long;
+    default:
+        assert(false);
+        return op;
+    }
+}
+
 // Also sets offset of basic blocks.
 LAUF_NOINLINE lauf_asm_inst* emit_body(lauf_asm_inst* ip, lauf_asm_builder* b,
-                                       const lauf_asm_inst* insts)
+                                       const lauf_asm_inst* insts, bool long_jumps)
 {
     auto get_next_block = [end = b->blocks.end()](auto next_iter) {
         do
@@ -280,16 +858,16 @@ LAUF_NOINLINE lauf_asm_inst* emit_body(lauf_asm_inst* ip, lauf_asm_builder* b,
     patches.reserve(*b, 2 * b->blocks.size());
 
     auto emit_jump = [&](lauf::asm_op op, const lauf_asm_block* dest) {
-        ip->jump.op = op;
+        ip->jump.op = long_jumps ? long_jump_op(op) : op;
         patches.push_back_unchecked({ip, dest});
-        ++ip;
+        ip += long_jumps ? 2 : 1;
     };
 
     for (auto block = b->blocks.begin(); block != b->blocks.end(); ++block)
     {
         if (!block->reachable)
             continue;
-        block->offset = std::uint16_t(ip - insts);
+        block->offset = std::uint32_t(ip - insts);
 
         auto sig = block->sig;
         *ip++    = LAUF_BUILD_INST_SIGNATURE(block, sig.input_count, sig.output_count, 0);
@@ -304,7 +882,7 @@ LAUF_NOINLINE lauf_asm_inst* emit_body(lauf_asm_inst* ip, lauf_asm_builder* b,
 
         case lauf_asm_block::return_:
             if (b->local_addr_count > 0)
-                *ip++ = LAUF_BUILD_INST_VALUE(return_free, b->locals.size());
+                *ip++ = LAUF_BUILD_INST_VALUE(return_free, b->local_alloc_count);
             else
                 *ip++ = LAUF_BUILD_INST_NONE(return_);
             break;
@@ -372,19 +950,23 @@ LAUF_NOINLINE lauf_asm_inst* emit_body(lauf_asm_inst* ip, lauf_asm_builder* b,
         assert(insts[dest->offset].op() == lauf::asm_op::block);
         auto dest_offset = dest->offset + 1;
 
-        jump->jump.offset = std::int32_t(dest_offset - cur_offset);
+        if (long_jumps)
+            lauf::set_long_offset(jump, jump->op(), dest_offset - cur_offset);
+        else
+            jump->jump.offset = std::int32_t(dest_offset - cur_offset);
     }
 
     return ip;
 }
 
 // Optimized version if the function only has a single basic block.
-lauf_asm_inst* emit_linear_body(lauf_asm_inst* ip, lauf_asm_builder* b, const lauf_asm_inst* insts)
+lauf_asm_inst* emit_linear_body(lauf_asm_inst* ip, lauf_asm_builder* b, const lauf_asm_inst* insts,
+                                bool long_jumps)
 {
     assert(b->blocks.size() == 1);
 
     auto entry    = &b->blocks.front();
-    entry->offset = std::uint16_t(ip - insts);
+    entry->offset = std::uint32_t(ip - insts);
 
     auto sig = entry->sig;
     *ip++    = LAUF_BUILD_INST_SIGNATURE(block, sig.input_count, sig.output_count, 0);
@@ -399,7 +981,7 @@ lauf_asm_inst* emit_linear_body(lauf_asm_inst* ip, lauf_asm_builder* b, const la
 
     case lauf_asm_block::return_:
         if (b->local_addr_count > 0)
-            *ip++ = LAUF_BUILD_INST_VALUE(return_free, b->locals.size());
+            *ip++ = LAUF_BUILD_INST_VALUE(return_free, b->local_alloc_count);
         else
             *ip++ = LAUF_BUILD_INST_NONE(return_);
         break;
@@ -417,7 +999,15 @@ lauf_asm_inst* emit_linear_body(lauf_asm_inst* ip, lauf_asm_builder* b, const la
         // We always jump to the beginning of the basic block again, since it's the only one.
         auto cur_offset  = ip - insts;
         auto dest_offset = entry->offset + 1;
-        *ip++            = LAUF_BUILD_INST_OFFSET(jump, dest_offset - cur_offset);
+        if (long_jumps)
+        {
+            lauf::set_long_offset(ip, lauf::asm_op::jump_long, dest_offset - cur_offset);
+            ip += 2;
+        }
+        else
+        {
+            *ip++ = LAUF_BUILD_INST_OFFSET(jump, dest_offset - cur_offset);
+        }
         break;
     }
     }
@@ -425,34 +1015,269 @@ lauf_asm_inst* emit_linear_body(lauf_asm_inst* ip, lauf_asm_builder* b, const la
     return ip;
 }
 
+// Precondition: allocation indices have been computed by the prologue.
+void patch_local_addr(lauf_asm_inst* begin, lauf_asm_inst* end, lauf_asm_builder* b)
+{
+    if (b->local_addr_count == 0)
+        return;
+
+    for (auto ip = begin; ip != end; ++ip)
+        if (ip->op() == lauf::asm_op::local_addr)
+            ip->local_addr.index
+                = std::uint8_t(b->locals.front(ip->local_addr.index).alloc_index);
+}
+
 // Precondition: offset has been computed during body emission.
-void emit_debug_location(lauf_asm_builder* b)
+void emit_debug_location(lauf_asm_builder* b, lauf::array<lauf::inst_debug_location>& result)
 {
-    auto impl = [&](auto& cont, lauf::arena_base& arena) {
-        for (auto& block : b->blocks)
+    for (auto& block : b->blocks)
+    {
+        if (!block.reachable)
+            continue;
+
+        for (auto loc : block.debug_locations)
         {
-            if (!block.reachable)
-                continue;
+            // We also have the initial block instruction that affects the inst_idx.
+            loc.inst_idx += block.offset + 1;
+            result.push_back(*b, loc);
+        }
+    }
+}
 
-            for (auto loc : block.debug_locations)
-            {
-                // We also have the initial block instruction that affects the inst_idx.
-                loc.inst_idx += block.offset + 1;
-                cont.push_back(arena, loc);
-            }
+//=== chunk cache ===//
+// Instructions don't necessarily initialize all bits, so we can't compare or hash them directly.
+constexpr std::uint32_t operand_bits(lauf::asm_inst_none)
+{
+    return 0;
+}
+constexpr std::uint32_t operand_bits(lauf::asm_inst_offset inst)
+{
+    return std::uint32_t(inst.offset) & 0xFF'FFFF;
+}
+constexpr std::uint32_t operand_bits(lauf::asm_inst_signature inst)
+{
+    return std::uint32_t(inst.input_count) | std::uint32_t(inst.output_count) << 8
+           | std::uint32_t(inst.flags) << 16;
+}
+constexpr std::uint32_t operand_bits(lauf::asm_inst_layout inst)
+{
+    return std::uint32_t(inst.alignment_log2) | std::uint32_t(inst.size) << 8;
+}
+constexpr std::uint32_t operand_bits(lauf::asm_inst_value inst)
+{
+    return inst.value;
+}
+constexpr std::uint32_t operand_bits(lauf::asm_inst_stack_idx inst)
+{
+    return inst.idx;
+}
+constexpr std::uint32_t operand_bits(lauf::asm_inst_local_addr inst)
+{
+    return std::uint32_t(inst.index) | std::uint32_t(inst.offset) << 8;
+}
+
+std::uint32_t canonical_encoding(lauf_asm_inst inst)
+{
+    switch (inst.op())
+    {
+#define LAUF_ASM_INST(Name, Type)                                                                  \
+    case lauf::asm_op::Name:                                                                       \
+        return std::uint32_t(inst.op()) | operand_bits(inst.Name) << 8;
+#include <lauf/asm/instruction.def.hpp>
+#undef LAUF_ASM_INST
+
+    case lauf::asm_op::count:
+        break;
+    }
+    assert(false && "invalid instruction");
+    return 0;
+}
+
+std::uint64_t hash_insts(const lauf_asm_inst* insts, std::size_t count)
+{
+    // FNV-1a over the canonical encoding.
+    auto hash = std::uint64_t(0xcbf2'9ce4'8422'2325);
+    for (auto ip = insts; ip != insts + count; ++ip)
+    {
+        hash ^= canonical_encoding(*ip);
+        hash *= 0x100'0000'01b3;
+    }
+    return hash;
+}
+
+bool is_same_code(const lauf_asm_chunk* chunk, std::uint64_t hash, const lauf_asm_inst* prev_insts,
+                  std::size_t                                    prev_inst_count,
+                  const lauf::array<lauf::inst_debug_location>& locations)
+{
+    auto fn = chunk->fn;
+    if (chunk->inst_hash != hash || prev_inst_count != fn->inst_count
+        || chunk->inst_debug_locations.size() != locations.size())
+        return false;
+
+    for (auto i = 0u; i != fn->inst_count; ++i)
+        if (canonical_encoding(prev_insts[i]) != canonical_encoding(fn->insts[i]))
+            return false;
+
+    auto cur = locations.begin();
+    for (auto& loc : chunk->inst_debug_locations)
+    {
+        if (loc.inst_idx != cur->inst_idx || !loc.matches(cur->location))
+            return false;
+        ++cur;
+    }
+
+    return true;
+}
+
+// The function of the chunk currently refers to the temporary instructions of the build.
+// Unless they're the same as the previous instructions, copies them into the chunk.
+void finish_chunk(lauf_asm_builder* b, lauf_asm_inst* prev_insts, std::size_t prev_inst_count,
+                  const lauf::array<lauf::inst_debug_location>& locations)
+{
+    auto chunk = b->chunk;
+    auto fn    = chunk->fn;
+
+    auto hash = hash_insts(fn->insts, fn->inst_count);
+    if (prev_insts != nullptr && is_same_code(chunk, hash, prev_insts, prev_inst_count, locations))
+    {
+        // We can keep the existing code, and the result of its previous execution.
+        fn->insts = prev_insts;
+        return;
+    }
+
+    chunk->clear_code();
+
+    auto insts = chunk->allocate<lauf_asm_inst>(fn->inst_count);
+    std::memcpy(insts, fn->insts, fn->inst_count * sizeof(lauf_asm_inst));
+    for (auto loc : locations)
+        chunk->inst_debug_locations.push_back(*chunk, loc);
+    chunk->inst_hash = hash;
+
+    fn->insts = insts;
+}
+
+//=== build-time evaluation ===//
+// Returns an upper bound on the number of instructions executed by a call to fn if it is pure,
+// zero otherwise.
+std::uint32_t compute_const_eval_cost(const lauf_asm_function* fn)
+{
+    auto cost = std::uint64_t(fn->inst_count);
+    for (auto ip = fn->insts; ip != fn->insts + fn->inst_count; ++ip)
+    {
+        switch (ip->op())
+        {
+        case lauf::asm_op::jump:
+        case lauf::asm_op::branch_eq:
+        case lauf::asm_op::branch_ne:
+        case lauf::asm_op::branch_lt:
+        case lauf::asm_op::branch_le:
+        case lauf::asm_op::branch_ge:
+        case lauf::asm_op::branch_gt:
+            // All branches use the same layout.
+            if (ip->jump.offset <= 0)
+                // A loop, we can't bound the number of executed instructions.
+                return 0;
+            break;
+        case lauf::asm_op::jump_long:
+        case lauf::asm_op::branch_eq_long:
+        case lauf::asm_op::branch_ne_long:
+        case lauf::asm_op::branch_lt_long:
+        case lauf::asm_op::branch_le_long:
+        case lauf::asm_op::branch_ge_long:
+        case lauf::asm_op::branch_gt_long:
+            if (lauf::long_offset(ip) <= 0)
+                return 0;
+            break;
+
+        case lauf::asm_op::call:
+        case lauf::asm_op::call_long: {
+            auto callee = lauf::uncompress_pointer_offset<lauf_asm_function>(
+                fn, ip->op() == lauf::asm_op::call ? ip->call.offset : lauf::long_offset(ip));
+            // This is zero for impure functions and functions that haven't been built yet,
+            // which includes fn itself.
+            if (callee->const_eval_cost == 0)
+                return 0;
+            cost += callee->const_eval_cost;
+            break;
         }
-    };
 
-    if (b->chunk != nullptr)
+        case lauf::asm_op::call_builtin_sig:
+            if ((ip->call_builtin_sig.flags & LAUF_RUNTIME_BUILTIN_NO_PROCESS) == 0
+                || (ip->call_builtin_sig.flags & LAUF_RUNTIME_BUILTIN_CONSTANT_FOLD) == 0)
+                return 0;
+            break;
+
+        case lauf::asm_op::load_global_value: {
+            auto global = lauf::find_global(fn->module, ip->global_addr.value);
+            if (global == nullptr || global->is_mutable || !global->has_definition())
+                return 0;
+            break;
+        }
+
+        case lauf::asm_op::global_addr:
+            // The result would be baked into the code as an integer, but the allocation index of
+            // the global depends on the program the module is linked into.
+            return 0;
+
+        case lauf::asm_op::call_indirect:
+        case lauf::asm_op::function_addr:
+        case lauf::asm_op::function_addr_long:
+        case lauf::asm_op::fiber_resume:
+        case lauf::asm_op::fiber_transfer:
+        case lauf::asm_op::fiber_suspend:
+        case lauf::asm_op::store_global_value:
+            return 0;
+
+        default:
+            break;
+        }
+    }
+
+    return cost < UINT32_MAX ? std::uint32_t(cost) : UINT32_MAX;
+}
+
+void panic_handler_ignore(void*, lauf_runtime_process*, const char*) {}
+
+bool try_const_eval_call(lauf_asm_builder* b, const lauf_asm_function* callee)
+{
+    if (b->options.const_eval_step_limit == 0 || callee->const_eval_cost == 0
+        || callee->const_eval_cost > b->options.const_eval_step_limit)
+        return false;
+
+    if (b->cur->vstack.size() < callee->sig.input_count)
+        return false;
+
+    lauf_runtime_value input[UINT8_MAX];
+    for (auto i = 0u; i != callee->sig.input_count; ++i)
     {
-        impl(b->chunk->inst_debug_locations, *b->chunk);
+        // The top of the vstack is the last argument.
+        auto value = b->cur->vstack.pick(callee->sig.input_count - 1 - i);
+        if (value.type != lauf::builder_vstack::value::constant)
+            return false;
+        input[i] = value.as_constant;
     }
-    else
+
+    if (b->const_eval_vm == nullptr)
     {
-        lauf::array<lauf::inst_debug_location> cont;
-        impl(cont, *b);
-        lauf::add_debug_locations(b->mod, cont.data(), cont.size());
+        auto options          = lauf_default_vm_options;
+        options.panic_handler = {nullptr, &panic_handler_ignore};
+        b->const_eval_vm      = lauf_create_vm(options);
     }
+
+    lauf_runtime_value output[UINT8_MAX];
+    auto               program = lauf_asm_create_program(b->mod, callee);
+    if (!lauf_vm_execute(b->const_eval_vm, &program, input, output))
+        // It paniced, so we keep the call as-is.
+        return false;
+
+    // Pop the input values as the call would.
+    [[maybe_unused]] auto popped = b->cur->vstack.pop(callee->sig.input_count);
+    add_pop_top_n(b, callee->sig.input_count);
+    for (auto i = 0u; i != callee->sig.output_count; ++i)
+        lauf_asm_inst_uint(b, output[i].as_uint);
+
+    ++b->stats.evaluated_calls;
+    return true;
 }
 } // namespace
 
@@ -460,11 +1285,20 @@ bool lauf_asm_build_finish(lauf_asm_builder* b)
 {
     constexpr auto context = LAUF_BUILD_ASSERT_CONTEXT;
 
-    auto insts = [&] {
-        auto inst_count = estimate_inst_count(context, b);
+    promote_locals(b);
+    for (auto& block : b->blocks)
+        eliminate_shuffles(b, block);
+
+    auto long_jumps = false;
+    auto insts      = [&] {
+        auto inst_count = estimate_inst_count(context, b, long_jumps);
         if (b->chunk != nullptr)
-            // If we have a chunk, we allocate the memory for the instructions there.
-            return b->chunk->allocate<lauf_asm_inst>(inst_count);
+            // If we have a chunk, we emit into temporary memory first,
+            // as we keep the existing code of the chunk if it is the same.
+            return b->allocate<lauf_asm_inst>(inst_count);
+        else if (b->build_arena_mod == b->mod)
+            // We're building in parallel, so we use the memory owned by our thread.
+            return b->build_arena->allocate<lauf_asm_inst>(inst_count);
         else
             // For a normal function, we allocate the memory from the module.
             return lauf::allocate_instructions(b->mod, inst_count);
@@ -473,17 +1307,21 @@ bool lauf_asm_build_finish(lauf_asm_builder* b)
     auto ip = insts;
     ip      = emit_prologue(insts, b);
     if (b->blocks.size() == 1)
-        ip = emit_linear_body(ip, b, insts);
+        ip = emit_linear_body(ip, b, insts, long_jumps);
     else
-        ip = emit_body(ip, b, insts);
+        ip = emit_body(ip, b, insts, long_jumps);
+    patch_local_addr(insts, ip, b);
     auto inst_count = ip - insts;
+    if (std::uint32_t(inst_count) != inst_count)
+        b->error(context, "too many instructions");
 
-    emit_debug_location(b);
+    lauf::array<lauf::inst_debug_location> debug_locations;
+    emit_debug_location(b, debug_locations);
 
-    b->fn->insts      = insts;
-    b->fn->inst_count = std::uint16_t(inst_count);
-    if (b->fn->inst_count != inst_count)
-        b->error(context, "too many instructions");
+    auto prev_insts      = b->fn->insts;
+    auto prev_inst_count = b->fn->inst_count;
+    b->fn->insts         = insts;
+    b->fn->inst_count    = std::uint32_t(inst_count);
 
     b->fn->max_vstack_size = [&] {
         auto result = std::size_t(0);
@@ -499,26 +1337,79 @@ bool lauf_asm_build_finish(lauf_asm_builder* b)
     }();
     b->fn->max_cstack_size = sizeof(lauf_runtime_stack_frame) + b->local_allocation_size;
 
+    b->fn->verified        = false;
+    b->fn->const_eval_cost = 0;
+    if (!b->errored)
+        lauf::verify(*b, b->fn);
+
+    if (b->chunk != nullptr)
+    {
+        finish_chunk(b, prev_insts, prev_inst_count, debug_locations);
+    }
+    else if (b->build_arena_mod == b->mod)
+    {
+        auto memory = b->build_arena->allocate<lauf::inst_debug_location>(debug_locations.size());
+        std::copy(debug_locations.begin(), debug_locations.end(), memory);
+        b->fn->debug_locations      = memory;
+        b->fn->debug_location_count = debug_locations.size();
+    }
+    else
+    {
+        lauf::add_debug_locations(b->mod, b->fn, debug_locations.data(), debug_locations.size());
+    }
+
+    // This is set last: once it is non-zero, other threads may evaluate calls to the function.
+    if (!b->errored)
+        b->fn->const_eval_cost = compute_const_eval_cost(b->fn);
+
     return !b->errored;
 }
 
-lauf_asm_global* lauf_asm_build_data_literal(lauf_asm_builder* b, const unsigned char* ptr,
-                                             size_t size)
+lauf_asm_build_stats lauf_asm_build_get_stats(lauf_asm_builder* b)
 {
-    // TODO: avoid TOCTOU.
-    for (auto global = lauf::get_globals(b->mod).first; global != nullptr; global = global->next)
-    {
-        if (global->is_mutable)
-            // Can't use a mutable global.
-            continue;
+    return b->stats;
+}
 
-        if (size == global->size && std::memcmp(global->memory, ptr, global->size) == 0)
-            return global;
-    }
+bool lauf_asm_module_build_parallel(lauf_asm_module* mod, lauf_asm_build_options options,
+                                    size_t thread_count, size_t count,
+                                    lauf_asm_parallel_build_fn* fn, void* user_data)
+{
+    if (thread_count == 0)
+        thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+    if (thread_count > count)
+        thread_count = std::max(count, std::size_t(1));
+
+    std::atomic<std::size_t> next_index(0);
+    std::atomic<bool>        success(true);
+    auto                     worker = [&] {
+        auto b             = lauf_asm_create_builder(options);
+        b->build_arena_mod = mod;
+        b->build_arena     = lauf::acquire_build_arena(mod);
+
+        // Indices are handed out one at a time, so threads that build smaller functions take more.
+        for (auto index = next_index++; index < count; index = next_index++)
+            if (!fn(b, mod, index, user_data))
+                success = false;
+
+        lauf::release_build_arena(mod, b->build_arena);
+        lauf_asm_destroy_builder(b);
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(thread_count - 1);
+    for (auto i = 1u; i < thread_count; ++i)
+        threads.emplace_back(worker);
+    worker();
+    for (auto& thread : threads)
+        thread.join();
 
-    auto global = lauf_asm_add_global(b->mod, LAUF_ASM_GLOBAL_READ_ONLY);
-    lauf_asm_define_data_global(b->mod, global, {size, lauf_asm_type_value.layout.alignment}, ptr);
-    return global;
+    return success;
+}
+
+lauf_asm_global* lauf_asm_build_data_literal(lauf_asm_builder* b, const unsigned char* ptr,
+                                             size_t size)
+{
+    return lauf::get_constant_global(b->mod, ptr, size, lauf_asm_type_value.layout.alignment);
 }
 
 lauf_asm_global* lauf_asm_build_string_literal(lauf_asm_builder* b, const char* str)
@@ -604,7 +1495,7 @@ void lauf_asm_build_debug_location(lauf_asm_builder* b, lauf_asm_debug_location
     LAUF_BUILD_CHECK_CUR;
 
     if (b->cur->debug_locations.empty() || !b->cur->debug_locations.back().matches(loc))
-        b->cur->debug_locations.push_back(*b, {b->fn->function_idx, uint16_t(b->cur->insts.size()),
+        b->cur->debug_locations.push_back(*b, {b->fn->function_idx, uint32_t(b->cur->insts.size()),
                                                loc});
 }
 
@@ -731,14 +1622,39 @@ void lauf_asm_inst_panic(lauf_asm_builder* b)
     b->cur             = nullptr;
 }
 
+namespace
+{
+// Adds an instruction that refers to the function, using the long version if necessary.
+void add_function_inst(lauf_asm_builder* b, lauf::asm_op op, lauf::asm_op long_op,
+                       const lauf_asm_function* fn)
+{
+    auto offset = lauf::compress_pointer_offset(b->fn, fn);
+    if (lauf::fits_short_offset(offset))
+    {
+        lauf_asm_inst inst;
+        inst.call = {op, std::int32_t(offset)};
+        b->cur->insts.push_back(*b, inst);
+    }
+    else
+    {
+        lauf_asm_inst insts[2];
+        lauf::set_long_offset(insts, long_op, offset);
+        b->cur->insts.push_back(*b, insts[0]);
+        b->cur->insts.push_back(*b, insts[1]);
+    }
+}
+} // namespace
+
 void lauf_asm_inst_call(lauf_asm_builder* b, const lauf_asm_function* callee)
 {
     LAUF_BUILD_CHECK_CUR;
 
+    if (try_const_eval_call(b, callee))
+        return;
+
     LAUF_BUILD_ASSERT(b->cur->vstack.pop(callee->sig.input_count), "missing input values for call");
 
-    auto offset = lauf::compress_pointer_offset(b->fn, callee);
-    b->cur->insts.push_back(*b, LAUF_BUILD_INST_OFFSET(call, offset));
+    add_function_inst(b, lauf::asm_op::call, lauf::asm_op::call_long, callee);
 
     b->cur->vstack.push_output(*b, callee->sig.output_count);
 }
@@ -775,8 +1691,7 @@ void lauf_asm_inst_call_indirect(lauf_asm_builder* b, lauf_asm_signature sig)
     if (auto callee = get_constant_function(b->mod, *fn_addr, sig))
     {
         add_pop_top_n(b, 1);
-        auto offset = lauf::compress_pointer_offset(b->fn, callee);
-        b->cur->insts.push_back(*b, LAUF_BUILD_INST_OFFSET(call, offset));
+        add_function_inst(b, lauf::asm_op::call, lauf::asm_op::call_long, callee);
     }
     else
     {
@@ -1018,12 +1933,14 @@ void lauf_asm_inst_local_addr(lauf_asm_builder* b, lauf_asm_local* local)
     LAUF_BUILD_CHECK_CUR;
 
     ++b->local_addr_count;
+    ++local->addr_count;
     b->cur->insts.push_back(*b,
                             LAUF_BUILD_INST_LOCAL_ADDR(local_addr, local->index, local->offset));
     b->cur->vstack.push(*b, [&] {
         lauf::builder_vstack::value result;
-        result.type     = result.local_addr;
-        result.as_local = local;
+        result.type            = result.local_addr;
+        result.as_local.local  = local;
+        result.as_local.offset = 0;
         return result;
     }());
 }
@@ -1032,8 +1949,7 @@ void lauf_asm_inst_function_addr(lauf_asm_builder* b, const lauf_asm_function* f
 {
     LAUF_BUILD_CHECK_CUR;
 
-    auto offset = lauf::compress_pointer_offset(b->fn, function);
-    b->cur->insts.push_back(*b, LAUF_BUILD_INST_OFFSET(function_addr, offset));
+    add_function_inst(b, lauf::asm_op::function_addr, lauf::asm_op::function_addr_long, function);
     b->cur->vstack.push_constant(*b, [&] {
         lauf_runtime_value result;
         result.as_function_address.index        = function->function_idx;
@@ -1192,6 +2108,27 @@ void lauf_asm_inst_select(lauf_asm_builder* b, uint16_t count)
     b->cur->vstack.push_output(*b, 1);
 }
 
+namespace
+{
+// Pushes the result of adding a constant offset to the address.
+void push_member_addr(lauf_asm_builder* b, lauf::builder_vstack::value addr, std::size_t offset)
+{
+    if (addr.type == addr.local_addr)
+    {
+        // We keep track of it, so we can still access it relative to the frame.
+        lauf::builder_vstack::value result;
+        result.type            = result.local_addr;
+        result.as_local.local  = addr.as_local.local;
+        result.as_local.offset = addr.as_local.offset + offset;
+        b->cur->vstack.push(*b, result);
+    }
+    else
+    {
+        b->cur->vstack.push_output(*b, 1);
+    }
+}
+} // namespace
+
 void lauf_asm_inst_array_element(lauf_asm_builder* b, lauf_asm_layout element_layout)
 {
     LAUF_BUILD_CHECK_CUR;
@@ -1201,15 +2138,22 @@ void lauf_asm_inst_array_element(lauf_asm_builder* b, lauf_asm_layout element_la
 
     auto index = b->cur->vstack.pop();
     LAUF_BUILD_ASSERT(index, "missing index");
-    LAUF_BUILD_ASSERT(b->cur->vstack.pop(1), "missing address");
+    auto addr = b->cur->vstack.pop();
+    LAUF_BUILD_ASSERT(addr, "missing address");
 
     if (index->type == index->constant)
     {
         add_pop_top_n(b, 1);
         auto offset = index->as_constant.as_sint * lauf_sint(multiple);
         if (offset > 0)
+        {
             b->cur->insts.push_back(*b, LAUF_BUILD_INST_VALUE(aggregate_member, lauf_uint(offset)));
-        b->cur->vstack.push_output(*b, 1);
+            push_member_addr(b, *addr, std::size_t(offset));
+        }
+        else
+        {
+            b->cur->vstack.push(*b, *addr);
+        }
     }
     else
     {
@@ -1232,9 +2176,10 @@ void lauf_asm_inst_aggregate_member(lauf_asm_builder* b, size_t member_index,
 
     if (offset > 0)
     {
-        LAUF_BUILD_ASSERT(b->cur->vstack.pop(1), "missing address");
+        auto addr = b->cur->vstack.pop();
+        LAUF_BUILD_ASSERT(addr, "missing address");
         b->cur->insts.push_back(*b, LAUF_BUILD_INST_VALUE(aggregate_member, offset));
-        b->cur->vstack.push_output(*b, 1);
+        push_member_addr(b, *addr, offset);
     }
 }
 
@@ -1247,6 +2192,12 @@ enum load_store_constant
     load_store_global,
 };
 
+// The offset of the local value relative to the stack frame.
+std::uint16_t local_value_offset(lauf::builder_vstack::value addr)
+{
+    return std::uint16_t(addr.as_local.local->offset + addr.as_local.offset);
+}
+
 load_store_constant load_store_constant_folding(lauf_asm_module*            mod,
                                                 lauf::builder_vstack::value addr,
                                                 lauf_asm_type type, bool store)
@@ -1257,12 +2208,14 @@ load_store_constant load_store_constant_folding(lauf_asm_module*            mod,
 
     if (addr.type == addr.local_addr)
     {
-        auto local_layout = addr.as_local->layout;
+        auto local_layout = addr.as_local.local->layout;
         if (local_layout.alignment > alignof(void*))
             // Don't know the offset for over aligned data yet.
             return load_store_dynamic;
 
-        if (local_layout.size < type.layout.size || local_layout.alignment < type.layout.alignment)
+        if (local_layout.size < addr.as_local.offset + type.layout.size
+            || local_layout.alignment < type.layout.alignment
+            || addr.as_local.offset % type.layout.alignment != 0)
             return load_store_dynamic;
 
         return load_store_local;
@@ -1270,24 +2223,18 @@ load_store_constant load_store_constant_folding(lauf_asm_module*            mod,
     else if (addr.type == addr.constant)
     {
         // TOCTOU is okay, we just can't constant fold because of it.
-        auto globals = lauf::get_globals(mod);
-
         auto constant_addr = addr.as_constant.as_address;
-        if (constant_addr.allocation >= globals.count && constant_addr.generation != 0
-            && constant_addr.offset != 0)
-            return load_store_dynamic;
-
-        for (auto global = globals.first; global != nullptr; global = global->next)
-            if (global->allocation_idx == constant_addr.allocation && global->has_definition())
-            {
-                if (store && !global->is_mutable)
-                    return load_store_dynamic;
+        auto global        = lauf::find_global(mod, constant_addr.allocation);
+        if (global != nullptr && global->has_definition())
+        {
+            if (store && !global->is_mutable)
+                return load_store_dynamic;
 
-                if (global->size < type.layout.size || global->alignment < type.layout.alignment)
-                    return load_store_dynamic;
+            if (global->size < type.layout.size || global->alignment < type.layout.alignment)
+                return load_store_dynamic;
 
-                return load_store_global;
-            }
+            return load_store_global;
+        }
     }
 
     return load_store_dynamic;
@@ -1306,9 +2253,9 @@ void lauf_asm_inst_load_field(lauf_asm_builder* b, lauf_asm_type type, size_t fi
     if (constant_folding == load_store_local)
     {
         add_pop_top_n(b, 1);
-        b->cur->insts.push_back(*b,
-                                LAUF_BUILD_INST_LOCAL_ADDR(load_local_value, addr->as_local->index,
-                                                           addr->as_local->offset));
+        b->cur->insts.push_back(*b, LAUF_BUILD_INST_LOCAL_ADDR(load_local_value,
+                                                               addr->as_local.local->index,
+                                                               local_value_offset(*addr)));
         b->cur->vstack.push_output(*b, 1);
     }
     else if (constant_folding == load_store_global)
@@ -1350,9 +2297,9 @@ void lauf_asm_inst_store_field(lauf_asm_builder* b, lauf_asm_type type, size_t f
     if (constant_folding == load_store_local)
     {
         add_pop_top_n(b, 1);
-        b->cur->insts.push_back(*b,
-                                LAUF_BUILD_INST_LOCAL_ADDR(store_local_value, addr->as_local->index,
-                                                           addr->as_local->offset));
+        b->cur->insts.push_back(*b, LAUF_BUILD_INST_LOCAL_ADDR(store_local_value,
+                                                               addr->as_local.local->index,
+                                                               local_value_offset(*addr)));
         LAUF_BUILD_ASSERT(b->cur->vstack.pop(1), "missing value");
     }
     else if (constant_folding == load_store_global)
@@ -12,6 +12,7 @@
 #include <lauf/support/arena.hpp>
 #include <lauf/support/array.hpp>
 #include <lauf/support/array_list.hpp>
+#include <lauf/vm.h>
 #include <optional>
 
 //=== vstack ===//
@@ -42,9 +43,14 @@ public:
         lauf_asm_value id   = invalid_asm_value;
         union
         {
-            char                  as_unknown;
-            lauf_runtime_value    as_constant;
-            const lauf_asm_local* as_local;
+            char               as_unknown;
+            lauf_runtime_value as_constant;
+            struct
+            {
+                const lauf_asm_local* local;
+                // Constant byte offset into the local.
+                std::size_t offset;
+            } as_local;
         };
     };
 
@@ -170,7 +176,7 @@ struct lauf_asm_block
 {
     lauf_asm_signature   sig;
     bool                 reachable = false;
-    std::uint16_t        offset    = 0;
+    std::uint32_t        offset    = 0;
     lauf::builder_vstack vstack;
 
     lauf::array_list<lauf_asm_inst>             insts;
@@ -200,6 +206,11 @@ struct lauf_asm_local
     std::uint16_t   index;
     // UINT16_MAX if unknown for layout.alignment > alignof(void*)
     std::uint16_t offset;
+    // Number of local_addr instructions referring to it.
+    // Only if it is non-zero, does the address escape and we need an allocation for it.
+    std::uint32_t addr_count = 0;
+    // Index of the allocation relative to the first local allocation, if it has one.
+    std::uint16_t alloc_index = 0;
 };
 
 struct lauf_asm_builder : lauf::intrinsic_arena<lauf_asm_builder>
@@ -216,9 +227,20 @@ struct lauf_asm_builder : lauf::intrinsic_arena<lauf_asm_builder>
     std::uint16_t                    local_allocation_size = 0;
     // Number of local_addr instructions.
     std::uint16_t local_addr_count = 0;
+    // Number of locals that need an allocation, computed by the prologue.
+    std::uint16_t local_alloc_count = 0;
 
     lauf_asm_value next_value = {0};
 
+    lauf_asm_build_stats stats = {};
+
+    // Created lazily for build-time evaluation of calls.
+    lauf_vm* const_eval_vm = nullptr;
+
+    // If set, functions of its module allocate their memory from it instead of the module.
+    lauf_asm_module*          build_arena_mod = nullptr;
+    lauf::module_build_arena* build_arena     = nullptr;
+
     bool errored = false;
 
     explicit lauf_asm_builder(lauf::arena_key key, lauf_asm_build_options options)
@@ -241,9 +263,12 @@ struct lauf_asm_builder : lauf::intrinsic_arena<lauf_asm_builder>
         locals.reset();
         local_allocation_size = 0;
         local_addr_count      = 0;
+        local_alloc_count     = 0;
 
         next_value._id = 0;
 
+        stats = {};
+
         errored = false;
     }
 
@@ -22,6 +22,19 @@ LAUF_ASM_INST(branch_le, asm_inst_offset)
 LAUF_ASM_INST(branch_ge, asm_inst_offset)
 LAUF_ASM_INST(branch_gt, asm_inst_offset)
 
+// Same as jump and branch_XX, but for offsets that don't fit into 24 bits.
+// The offset stores the upper bits, the immediately following offset_ext the lower 24 bits.
+LAUF_ASM_INST(jump_long, asm_inst_offset)
+LAUF_ASM_INST(branch_eq_long, asm_inst_offset)
+LAUF_ASM_INST(branch_ne_long, asm_inst_offset)
+LAUF_ASM_INST(branch_lt_long, asm_inst_offset)
+LAUF_ASM_INST(branch_le_long, asm_inst_offset)
+LAUF_ASM_INST(branch_ge_long, asm_inst_offset)
+LAUF_ASM_INST(branch_gt_long, asm_inst_offset)
+
+// The lower 24 bits of the offset of the preceding XX_long instruction; never executed.
+LAUF_ASM_INST(offset_ext, asm_inst_value)
+
 // lauf_asm_inst_panic()
 LAUF_ASM_INST(panic, asm_inst_none)
 // lauf_asm_inst_panic_if()
@@ -35,6 +48,8 @@ LAUF_ASM_INST(exit, asm_inst_none)
 // The offset is the difference between the address of the current function and the called function
 // divided by sizeof(void*).
 LAUF_ASM_INST(call, asm_inst_offset)
+// Same, but for offsets that don't fit into 24 bits; followed by offset_ext.
+LAUF_ASM_INST(call_long, asm_inst_offset)
 
 // lauf_asm_inst_call_indirect()
 // data is function index
@@ -78,6 +93,8 @@ LAUF_ASM_INST(global_addr, asm_inst_value)
 // The offset is the difference between the address of the current function and the called function
 // divided by sizeof(void*).
 LAUF_ASM_INST(function_addr, asm_inst_offset)
+// Same, but for offsets that don't fit into 24 bits; followed by offset_ext.
+LAUF_ASM_INST(function_addr_long, asm_inst_offset)
 
 // lauf_asm_inst_local_addr()
 // The value is the index of the local allocation.
@@ -102,6 +119,8 @@ LAUF_ASM_INST(swap, asm_inst_stack_idx)
 
 // lauf_asm_inst_select()
 LAUF_ASM_INST(select, asm_inst_stack_idx)
+// Same, but the verifier has proven that the index is in range.
+LAUF_ASM_INST(select_unchecked, asm_inst_stack_idx)
 
 //=== memory ===//
 // Setups a call frame for local allocations.
@@ -127,6 +146,9 @@ LAUF_ASM_INST(aggregate_member, asm_inst_value)
 // Signature: address => native_ptr
 LAUF_ASM_INST(deref_const, asm_inst_layout)
 LAUF_ASM_INST(deref_mut, asm_inst_layout)
+// Same, but the verifier has proven that the address is a valid local allocation of the current
+// frame, and that the layout fits at its offset.
+LAUF_ASM_INST(deref_unchecked, asm_inst_layout)
 
 // lauf_asm_inst_load/store_field() for locals and the value type.
 // Signature: _ => value
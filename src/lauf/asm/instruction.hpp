@@ -126,5 +126,29 @@ union lauf_asm_inst
     }
 };
 
+namespace lauf
+{
+constexpr bool fits_short_offset(std::ptrdiff_t offset)
+{
+    return offset >= -(std::ptrdiff_t(1) << 23) && offset < (std::ptrdiff_t(1) << 23);
+}
+
+// Returns the offset of a XX_long instruction, which is split between it and the following
+// offset_ext.
+constexpr std::ptrdiff_t long_offset(const lauf_asm_inst* ip)
+{
+    assert(ip[1].op() == asm_op::offset_ext);
+    return std::ptrdiff_t(ip->jump_long.offset) * (std::ptrdiff_t(1) << 24)
+           + std::ptrdiff_t(ip[1].offset_ext.value);
+}
+
+// Sets the offset of a XX_long instruction and the following offset_ext.
+inline void set_long_offset(lauf_asm_inst* ip, asm_op op, std::ptrdiff_t offset)
+{
+    ip[0].jump_long  = {op, std::int32_t(offset >> 24)};
+    ip[1].offset_ext = {asm_op::offset_ext, std::uint32_t(offset & 0xFF'FFFF)};
+}
+} // namespace lauf
+
 #endif // SRC_LAUF_ASM_INSTRUCTION_HPP_INCLUDED
 
@@ -7,6 +7,8 @@
 #include <mutex>
 #include <shared_mutex>
 #include <string_view>
+#include <unordered_map>
+#include <vector>
 
 #include <lauf/asm/type.h>
 
@@ -21,7 +23,14 @@ struct lauf_asm_module : lauf::intrinsic_arena<lauf_asm_module>
     lauf_asm_chunk*                             chunks          = nullptr;
     std::uint32_t                               globals_count   = 0;
     std::uint32_t                               functions_count = 0;
-    lauf::array_list<lauf::inst_debug_location> inst_debug_locations;
+    // Incremented whenever a global is added or defined.
+    std::size_t globals_version = 0;
+    // All globals indexed by their allocation index.
+    std::vector<lauf_asm_global*> globals_by_idx;
+    // Index of the data of all constant globals, to quickly find one with the same data.
+    std::unordered_map<std::string_view, lauf_asm_global*> constant_globals;
+    // Build arenas that are currently not used by any builder.
+    lauf::module_build_arena* build_arenas = nullptr;
 
     lauf_asm_module(lauf::arena_key key, const char* name)
     : lauf::intrinsic_arena<lauf_asm_module>(key), name(this->strdup(name))
@@ -36,14 +45,27 @@ struct lauf_asm_module : lauf::intrinsic_arena<lauf_asm_module>
             lauf_asm_chunk::destroy(chunk);
             chunk = next;
         }
+
+        auto arena = build_arenas;
+        while (arena != nullptr)
+        {
+            auto next = arena->next;
+            lauf::module_build_arena::destroy(arena);
+            arena = next;
+        }
     }
 };
 
-void lauf::add_debug_locations(lauf_asm_module* mod, const inst_debug_location* ptr, size_t count)
+void lauf::add_debug_locations(lauf_asm_module* mod, lauf_asm_function* fn,
+                               const inst_debug_location* ptr, size_t count)
 {
     std::unique_lock lock(mod->mutex);
+    auto memory = mod->allocate<inst_debug_location>(count);
     for (auto i = 0u; i != count; ++i)
-        mod->inst_debug_locations.push_back(*mod, ptr[i]);
+        memory[i] = ptr[i];
+
+    fn->debug_locations      = memory;
+    fn->debug_location_count = count;
 }
 
 lauf_asm_inst* lauf::allocate_instructions(lauf_asm_module* mod, size_t inst_count)
@@ -52,29 +74,116 @@ lauf_asm_inst* lauf::allocate_instructions(lauf_asm_module* mod, size_t inst_cou
     return mod->allocate<lauf_asm_inst>(inst_count);
 }
 
+namespace
+{
+std::string_view data_of(const unsigned char* ptr, std::size_t size)
+{
+    return std::string_view(reinterpret_cast<const char*>(ptr), size);
+}
+
+void define_data_global(lauf_asm_module* mod, lauf_asm_global* global, lauf_asm_layout layout,
+                        const void* data)
+{
+    // Processes use the memory of constant globals directly, so it needs the proper alignment.
+    global->memory = mod->memdup(data, layout.size, layout.alignment);
+    if (!global->is_mutable)
+        mod->constant_globals.emplace(data_of(global->memory, global->size), global);
+}
+} // namespace
+
+lauf_asm_global* lauf::get_constant_global(lauf_asm_module* mod, const unsigned char* ptr,
+                                           size_t size, size_t alignment)
+{
+    auto data = data_of(ptr, size);
+    {
+        std::shared_lock lock(mod->mutex);
+        auto             iter = mod->constant_globals.find(data);
+        if (iter != mod->constant_globals.end())
+            return iter->second;
+    }
+
+    std::unique_lock lock(mod->mutex);
+    // Another thread could have added it in the mean time.
+    auto iter = mod->constant_globals.find(data);
+    if (iter != mod->constant_globals.end())
+        return iter->second;
+
+    auto global       = mod->construct<lauf_asm_global>(mod, false);
+    global->size      = size;
+    global->alignment = std::uint16_t(alignment);
+    define_data_global(mod, global, {size, alignment}, ptr);
+    return global;
+}
+
+lauf::module_build_arena* lauf::acquire_build_arena(lauf_asm_module* mod)
+{
+    std::unique_lock lock(mod->mutex);
+    if (mod->build_arenas != nullptr)
+    {
+        auto arena        = mod->build_arenas;
+        mod->build_arenas = arena->next;
+        return arena;
+    }
+
+    return lauf::module_build_arena::create();
+}
+
+void lauf::release_build_arena(lauf_asm_module* mod, module_build_arena* arena)
+{
+    std::unique_lock lock(mod->mutex);
+    arena->next       = mod->build_arenas;
+    mod->build_arenas = arena;
+}
+
 lauf::module_list<lauf_asm_global> lauf::get_globals(const lauf_asm_module* mod)
 {
     std::shared_lock lock(mod->mutex);
     return {mod->globals, mod->globals_count};
 }
 
+const lauf_asm_global* lauf::find_global(const lauf_asm_module* mod, std::uint32_t allocation_idx)
+{
+    std::shared_lock lock(mod->mutex);
+    if (allocation_idx >= mod->globals_by_idx.size())
+        return nullptr;
+    return mod->globals_by_idx[allocation_idx];
+}
+
+std::size_t lauf::get_globals_version(const lauf_asm_module* mod)
+{
+    std::shared_lock lock(mod->mutex);
+    return mod->globals_version;
+}
+
 lauf::module_list<lauf_asm_function> lauf::get_functions(const lauf_asm_module* mod)
 {
     std::shared_lock lock(mod->mutex);
     return {mod->functions, mod->functions_count};
 }
 
+lauf::module_list<lauf_asm_chunk> lauf::get_chunks(const lauf_asm_module* mod)
+{
+    std::shared_lock lock(mod->mutex);
+
+    auto count = std::size_t(0);
+    for (auto chunk = mod->chunks; chunk != nullptr; chunk = chunk->next)
+        ++count;
+    return {mod->chunks, count};
+}
+
 lauf_asm_global::lauf_asm_global(lauf_asm_module* mod, bool is_mutable)
 : next(mod->globals), memory(nullptr), size(0), allocation_idx(mod->globals_count),
   alignment(alignof(lauf_uint)), is_mutable(is_mutable)
 {
     mod->globals = this;
+    mod->globals_by_idx.push_back(this);
     ++mod->globals_count;
+    ++mod->globals_version;
 }
 
 lauf_asm_function::lauf_asm_function(lauf_asm_module* mod, const char* name, lauf_asm_signature sig)
 : next(mod->functions), module(mod), name(mod->strdup(name)), sig(sig),
-  function_idx(std::uint16_t(mod->functions_count))
+  function_idx(mod->functions_count)
 {
     mod->functions = this;
     ++mod->functions_count;
@@ -163,12 +272,12 @@ const lauf_asm_chunk* lauf_asm_find_chunk_of_instruction(const lauf_asm_module*
 
 namespace
 {
-lauf_asm_debug_location find_debug_location(
-    const lauf::array_list<lauf::inst_debug_location>& locations, const lauf_asm_function* fn,
-    const lauf_asm_inst* ip)
+template <typename Range>
+lauf_asm_debug_location find_debug_location(const Range& locations, const lauf_asm_function* fn,
+                                            const lauf_asm_inst* ip)
 {
     auto fn_idx = fn->function_idx;
-    auto ip_idx = uint16_t(lauf_asm_get_instruction_index(fn, ip));
+    auto ip_idx = uint32_t(lauf_asm_get_instruction_index(fn, ip));
 
     auto have_found_fn = false;
     auto result        = lauf_asm_debug_location_null;
@@ -188,19 +297,30 @@ lauf_asm_debug_location find_debug_location(
     }
     return result;
 }
+
+struct debug_location_range
+{
+    const lauf::inst_debug_location* first;
+    std::size_t                      count;
+
+    auto begin() const
+    {
+        return first;
+    }
+    auto end() const
+    {
+        return first + count;
+    }
+};
 } // namespace
 
 lauf_asm_debug_location lauf_asm_find_debug_location_of_instruction(const lauf_asm_module* mod,
                                                                     const lauf_asm_inst*   ip)
 {
-    std::shared_lock lock(mod->mutex);
-
-    if (mod->inst_debug_locations.empty() && mod->chunks == nullptr)
-        // Early exit, no debug locations are stored anywhere.
-        return lauf_asm_debug_location_null;
-
     if (auto fn = lauf_asm_find_function_of_instruction(mod, ip))
-        return find_debug_location(mod->inst_debug_locations, fn, ip);
+        return find_debug_location(debug_location_range{fn->debug_locations,
+                                                        fn->debug_location_count},
+                                   fn, ip);
 
     if (auto chunk = lauf_asm_find_chunk_of_instruction(mod, ip))
         return find_debug_location(chunk->inst_debug_locations, chunk->fn, ip);
@@ -219,14 +339,22 @@ void lauf_asm_define_data_global(lauf_asm_module* mod, lauf_asm_global* global,
                                  lauf_asm_layout layout, const void* data)
 {
     assert(layout.size > 0);
+    std::unique_lock lock(mod->mutex);
+    if (!global->is_mutable && global->memory != nullptr)
+    {
+        // The global is redefined, so it must no longer be found by its old data.
+        auto iter = mod->constant_globals.find(data_of(global->memory, global->size));
+        if (iter != mod->constant_globals.end() && iter->second == global)
+            mod->constant_globals.erase(iter);
+        global->memory = nullptr;
+    }
+
     global->size      = layout.size;
     global->alignment = std::uint16_t(layout.alignment);
 
     if (data != nullptr)
-    {
-        std::unique_lock lock(mod->mutex);
-        global->memory = mod->memdup(data, layout.size);
-    }
+        define_data_global(mod, global, layout, data);
+    ++mod->globals_version;
 }
 
 void lauf_asm_set_global_debug_name(lauf_asm_module* mod, lauf_asm_global* global, const char* name)
@@ -235,6 +363,14 @@ void lauf_asm_set_global_debug_name(lauf_asm_module* mod, lauf_asm_global* globa
     global->name = mod->strdup(name);
 }
 
+void lauf_asm_set_global_pointer_map(lauf_asm_module*, lauf_asm_global* global,
+                                     size_t element_size, uint64_t pointer_map)
+{
+    assert(element_size > 0);
+    global->pointer_map_element_size = element_size;
+    global->pointer_map              = pointer_map;
+}
+
 bool lauf_asm_global_has_definition(const lauf_asm_global* global)
 {
     return global->has_definition();
@@ -6,15 +6,18 @@
 
 #include <lauf/asm/instruction.hpp>
 #include <lauf/asm/module.h>
+#include <lauf/runtime/value.h>
 #include <lauf/support/arena.hpp>
 #include <lauf/support/array_list.hpp>
 
+#include <atomic>
+
 namespace lauf
 {
 struct inst_debug_location
 {
-    std::uint16_t           function_idx;
-    std::uint16_t           inst_idx;
+    std::uint32_t           function_idx;
+    std::uint32_t           inst_idx;
     lauf_asm_debug_location location;
 
     bool matches(lauf_asm_debug_location other) const
@@ -23,10 +26,31 @@ struct inst_debug_location
     }
 };
 
-void add_debug_locations(lauf_asm_module* mod, const inst_debug_location* ptr, size_t count);
+void add_debug_locations(lauf_asm_module* mod, lauf_asm_function* fn,
+                         const inst_debug_location* ptr, size_t count);
 
 lauf_asm_inst* allocate_instructions(lauf_asm_module* mod, size_t inst_count);
 
+// Returns a constant global that contains exactly the specified data, or adds a new one.
+lauf_asm_global* get_constant_global(lauf_asm_module* mod, const unsigned char* ptr, size_t size,
+                                     size_t alignment);
+
+// Memory for the instructions and debug locations of functions built by one thread.
+// It is owned by the module, but used exclusively by one builder at a time, so allocating from it
+// doesn't require locking the module.
+struct module_build_arena : intrinsic_arena<module_build_arena>
+{
+    module_build_arena* next = nullptr;
+
+    explicit module_build_arena(arena_key key) : intrinsic_arena<module_build_arena>(key) {}
+};
+
+// Takes an unused build arena of the module, or creates a new one.
+module_build_arena* acquire_build_arena(lauf_asm_module* mod);
+// Gives the arena back to the module, the memory it allocated remains valid.
+// Every acquired arena must be released before the module is destroyed.
+void release_build_arena(lauf_asm_module* mod, module_build_arena* arena);
+
 template <typename T>
 struct module_list
 {
@@ -36,6 +60,12 @@ struct module_list
 
 module_list<lauf_asm_global>   get_globals(const lauf_asm_module* mod);
 module_list<lauf_asm_function> get_functions(const lauf_asm_module* mod);
+module_list<lauf_asm_chunk>    get_chunks(const lauf_asm_module* mod);
+
+// Incremented whenever a global of the module is added or defined.
+std::size_t get_globals_version(const lauf_asm_module* mod);
+// Returns the global with the specified allocation index, or nullptr if there is none.
+const lauf_asm_global* find_global(const lauf_asm_module* mod, std::uint32_t allocation_idx);
 } // namespace lauf
 
 struct lauf_asm_global
@@ -51,6 +81,10 @@ struct lauf_asm_global
 
     const char* name = nullptr;
 
+    // Pointer map for precise garbage collection, if the element size is non-zero.
+    std::size_t   pointer_map_element_size = 0;
+    std::uint64_t pointer_map              = 0;
+
     explicit lauf_asm_global(lauf_asm_module* mod, bool is_mutable);
 
     bool has_definition() const
@@ -69,17 +103,31 @@ struct lauf_asm_function
     bool               exported = false;
 
     lauf_asm_inst* insts           = nullptr;
-    std::uint16_t  inst_count      = 0;
-    std::uint16_t  function_idx    = UINT16_MAX;
+    std::uint32_t  inst_count      = 0;
+    std::uint32_t  function_idx    = UINT32_MAX;
     std::uint16_t  max_vstack_size = 0;
     // Includes size for stack frame as well.
     std::uint16_t max_cstack_size = 0;
+    // Upper bound on the number of instructions executed by a call if the function is pure and can
+    // be evaluated while building, zero otherwise.
+    // It is atomic, as it is set once the function has been finished, possibly by another thread.
+    std::atomic<std::uint32_t> const_eval_cost = 0;
+    // Whether the instructions have been verified by lauf::verify(),
+    // which allows them to use unchecked instructions.
+    bool verified = false;
+
+    // The chunk if the function is part of one.
+    lauf_asm_chunk* chunk = nullptr;
+
+    // Sorted by instruction index; the debug locations of a chunk are stored in the chunk instead.
+    const lauf::inst_debug_location* debug_locations      = nullptr;
+    std::size_t                      debug_location_count = 0;
 
     explicit lauf_asm_function(lauf_asm_module* mod, const char* name, lauf_asm_signature sig);
 
-    explicit lauf_asm_function(lauf_asm_chunk*, lauf_asm_module* mod, const char* name,
+    explicit lauf_asm_function(lauf_asm_chunk* chunk, lauf_asm_module* mod, const char* name,
                                lauf_asm_signature sig)
-    : next(nullptr), module(mod), name(name), sig(sig)
+    : next(nullptr), module(mod), name(name), sig(sig), chunk(chunk)
     {}
 };
 
@@ -94,14 +142,61 @@ struct lauf_asm_chunk : lauf::intrinsic_arena<lauf_asm_chunk>
     // Since a chunk is temporary, we can't store the debug locations in the module.
     lauf::array_list<lauf::inst_debug_location> inst_debug_locations;
 
+    // Everything besides the chunk itself the outputs of an execution depend on.
+    struct cache_key
+    {
+        // The constant globals the chunk reads.
+        std::size_t globals_version;
+        // Whether the execution panics depends on the limits of the VM.
+        std::size_t step_limit;
+        std::size_t max_vstack_size;
+        std::size_t max_cstack_size;
+
+        friend bool operator==(const cache_key& lhs, const cache_key& rhs)
+        {
+            return lhs.globals_version == rhs.globals_version && lhs.step_limit == rhs.step_limit
+                   && lhs.max_vstack_size == rhs.max_vstack_size
+                   && lhs.max_cstack_size == rhs.max_cstack_size;
+        }
+    };
+
+    // Hash of the instructions, used to detect a rebuild that produces the same code.
+    std::uint64_t inst_hash = 0;
+    // The outputs of the most recent execution, if the chunk is pure and takes no inputs.
+    lauf_runtime_value* cached_outputs = nullptr;
+    cache_key           cached_key     = {};
+
     explicit lauf_asm_chunk(lauf::arena_key key, lauf_asm_module* mod);
 
-    void reset()
+    // Returns the cached outputs, if they were computed under the same conditions.
+    const lauf_runtime_value* get_cached_outputs(const cache_key& key) const
+    {
+        if (cached_outputs == nullptr || !(cached_key == key))
+            return nullptr;
+        return cached_outputs;
+    }
+
+    // Remembers the outputs of an execution, if it can be re-used.
+    void cache_outputs(const cache_key& key, const lauf_runtime_value* outputs)
+    {
+        // A pure function without inputs always produces the same outputs.
+        if (fn->sig.input_count != 0 || fn->const_eval_cost == 0)
+            return;
+
+        if (cached_outputs == nullptr)
+            cached_outputs = allocate<lauf_runtime_value>(fn->sig.output_count);
+        for (auto i = 0u; i != fn->sig.output_count; ++i)
+            cached_outputs[i] = outputs[i];
+        cached_key = key;
+    }
+
+    // Frees the instructions and debug locations, but keeps the function itself.
+    void clear_code()
     {
         clear();
         inst_debug_locations.reset();
-
-        *fn = lauf_asm_function(this, fn->module, "<chunk>", lauf_asm_signature{0, 0});
+        inst_hash      = 0;
+        cached_outputs = nullptr;
     }
 };
 
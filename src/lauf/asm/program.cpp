@@ -5,7 +5,10 @@
 
 #include <lauf/asm/module.hpp>
 #include <lauf/asm/program.hpp>
+#include <lauf/support/page_allocator.hpp>
 #include <string_view>
+#include <sys/mman.h>
+#include <unistd.h>
 #include <unordered_map>
 
 lauf_asm_program lauf_asm_create_program(const lauf_asm_module* mod, const lauf_asm_function* entry)
@@ -53,6 +56,9 @@ void lauf_asm_link_modules(lauf_asm_program* program, const lauf_asm_module* con
 
         extra.add_module(mods[i]);
     }
+
+    // The image doesn't contain the globals of the new modules.
+    extra.discard_global_image();
 }
 
 void lauf_asm_link_module(lauf_asm_program* program, const lauf_asm_module* mod)
@@ -63,7 +69,145 @@ void lauf_asm_link_module(lauf_asm_program* program, const lauf_asm_module* mod)
 void lauf_asm_destroy_program(lauf_asm_program program)
 {
     if (auto extra = lauf::try_get_extra_data(program))
+    {
+        extra->discard_global_image();
         lauf::program_extra_data::destroy(extra);
+    }
+}
+
+void lauf::program_extra_data::discard_global_image()
+{
+    if (image.fd != -1)
+        ::close(image.fd);
+    image.fd   = -1;
+    image.size = 0;
+}
+
+namespace
+{
+std::size_t global_count_of(const lauf_asm_program& program)
+{
+    auto result = lauf::get_globals(program._mod).count;
+    if (auto extra = lauf::try_get_extra_data(program))
+        for (auto submod : extra->submodules)
+            result += lauf::get_globals(submod.mod).count;
+    return result;
+}
+
+std::size_t global_version_of(const lauf_asm_program& program)
+{
+    auto result = lauf::get_globals_version(program._mod);
+    if (auto extra = lauf::try_get_extra_data(program))
+        for (auto submod : extra->submodules)
+            result += lauf::get_globals_version(submod.mod);
+    return result;
+}
+} // namespace
+
+const lauf::global_image* lauf::get_global_image(const lauf_asm_program& program)
+{
+    auto extra = lauf::try_get_extra_data(program);
+    if (extra == nullptr || extra->image.fd == -1)
+        return nullptr;
+
+    // Globals added or defined after lauf_asm_prepare_program() aren't part of the image.
+    auto& image = extra->image;
+    if (image.global_version != global_version_of(program)
+        || image.global_count != global_count_of(program))
+        return nullptr;
+
+    return &image;
+}
+
+bool lauf_asm_prepare_program(lauf_asm_program* program)
+{
+#if defined(__linux__)
+    auto& extra = lauf::get_extra_data(program);
+    extra.discard_global_image();
+
+    auto global_version = global_version_of(*program);
+    auto global_count   = global_count_of(*program);
+    if (extra.image.offsets_capacity < global_count)
+    {
+        extra.image.offsets = static_cast<std::size_t*>(
+            extra.allocate(global_count * sizeof(std::size_t), alignof(std::size_t)));
+        extra.image.offsets_capacity = global_count;
+    }
+    auto offsets = extra.image.offsets;
+
+    // Globals with data come first, zero-initialized globals are at the end.
+    // That way, the zeroes don't need to be written and are never touched until used.
+    auto size      = std::size_t(0);
+    auto supported = true;
+    auto assign    = [&](bool with_memory) {
+        return [&, with_memory](std::size_t index, const lauf_asm_global& global) {
+            // Constant globals are shared between processes anyway.
+            if (!global.is_mutable || !global.has_definition()
+                || (global.memory != nullptr) != with_memory)
+                return;
+
+            // The image is mapped at a page boundary, so we can't have bigger alignments.
+            if (global.alignment > lauf::page_allocator::page_size)
+                supported = false;
+
+            size           = lauf::round_to_multiple_of_alignment(size, global.alignment);
+            offsets[index] = size;
+            size += global.size;
+        };
+    };
+    lauf::for_each_global(*program, assign(true));
+    lauf::for_each_global(*program, assign(false));
+    if (!supported)
+        return false;
+    else if (size == 0)
+        // There is nothing to copy in the first place.
+        return true;
+
+    auto fd = ::memfd_create("lauf_global_image", MFD_CLOEXEC);
+    if (fd == -1)
+        return false;
+    if (::ftruncate(fd, off_t(size)) != 0)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    auto success = true;
+    lauf::for_each_global(*program, [&](std::size_t index, const lauf_asm_global& global) {
+        if (!global.is_mutable || !global.has_definition() || global.memory == nullptr)
+            return;
+
+        auto data      = static_cast<const unsigned char*>(global.memory);
+        auto remaining = std::size_t(global.size);
+        auto offset    = offsets[index];
+        while (success && remaining > 0)
+        {
+            auto written = ::pwrite(fd, data, remaining, off_t(offset));
+            if (written <= 0)
+                success = false;
+            else
+            {
+                data += written;
+                remaining -= std::size_t(written);
+                offset += std::size_t(written);
+            }
+        }
+    });
+    if (!success)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    extra.image.fd             = fd;
+    extra.image.size           = size;
+    extra.image.global_count   = global_count;
+    extra.image.global_version = global_version;
+    return true;
+#else
+    (void)program;
+    return false;
+#endif
 }
 
 void lauf_asm_define_native_global(lauf_asm_program* program, const lauf_asm_global* global,
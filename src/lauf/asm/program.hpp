@@ -52,11 +52,29 @@ struct submodule
     std::size_t            global_allocation_offset;
 };
 
+// An image of the memory of all defined globals, created by lauf_asm_prepare_program().
+// Processes map it copy-on-write instead of copying every global.
+struct global_image
+{
+    // A memory file of the given size, or -1 if there is no image.
+    int         fd   = -1;
+    std::size_t size = 0;
+    // Offset of each global in the image, indexed by allocation index.
+    // The array is kept when the image is discarded, so preparing again can reuse it.
+    std::size_t* offsets          = nullptr;
+    std::size_t  offsets_capacity = 0;
+    // The number of globals and the sum of the global versions of all modules at the time the
+    // image was created; if they have changed since, the image is stale.
+    std::size_t global_count   = 0;
+    std::size_t global_version = 0;
+};
+
 struct program_extra_data : lauf::intrinsic_arena<program_extra_data>
 {
     lauf::array_list<submodule>                  submodules;
     lauf::array_list<extern_function_definition> fn_defs;
     lauf::array_list<native_global_definition>   global_defs;
+    lauf::global_image                           image;
 
     program_extra_data(lauf::arena_key key) : lauf::intrinsic_arena<program_extra_data>(key) {}
 
@@ -89,6 +107,8 @@ struct program_extra_data : lauf::intrinsic_arena<program_extra_data>
         return nullptr;
     }
 
+    void discard_global_image();
+
     std::size_t global_allocation_offset_of(const lauf_asm_module* mod) const
     {
         for (auto submod : submodules)
@@ -98,6 +118,9 @@ struct program_extra_data : lauf::intrinsic_arena<program_extra_data>
     }
 };
 
+// Returns the global image of the program, or nullptr if there is none or it is stale.
+const global_image* get_global_image(const lauf_asm_program& program);
+
 inline lauf::program_extra_data* try_get_extra_data(lauf_asm_program program)
 {
     return static_cast<lauf::program_extra_data*>(program._extra_data);
@@ -110,6 +133,25 @@ inline lauf::program_extra_data& get_extra_data(lauf_asm_program* program)
 
     return *static_cast<lauf::program_extra_data*>(program->_extra_data);
 }
+
+// Calls f(index, global) for all globals of the program, indexed in the same order as
+// lauf::memory::init() assigns allocation indices.
+template <typename Fn>
+void for_each_global(const lauf_asm_program& program, Fn f)
+{
+    auto offset = std::size_t(0);
+    auto visit  = [&](const lauf_asm_module* mod) {
+        auto globals = lauf::get_globals(mod);
+        for (auto global = globals.first; global != nullptr; global = global->next)
+            f(std::uint32_t(offset + global->allocation_idx), *global);
+        offset += globals.count;
+    };
+
+    visit(program._mod);
+    if (auto extra = lauf::try_get_extra_data(program))
+        for (auto submod : extra->submodules)
+            visit(submod.mod);
+}
 } // namespace lauf
 
 #endif // SRC_LAUF_ASM_PROGRAM_HPP_INCLUDED
@@ -0,0 +1,457 @@
+// Copyright (C) 2022-2023 Jonathan Müller and lauf contributors
+// SPDX-License-Identifier: BSL-1.0
+
+#include <lauf/asm/verifier.hpp>
+
+#include <lauf/asm/type.h>
+#include <lauf/runtime/builtin.h>
+#include <lauf/runtime/value.h>
+#include <lauf/support/array.hpp>
+
+namespace
+{
+// What we know about a value on the vstack.
+struct abstract_value
+{
+    enum kind_t : std::uint8_t
+    {
+        unknown,
+        // The value is a known constant.
+        constant,
+        // The value is either 0 or 1.
+        boolean,
+        // The value is the address of a local allocation of the current frame at a known offset.
+        local_addr,
+    } kind = unknown;
+    std::uint8_t local_index = 0;
+    // The constant value or the offset into the local allocation.
+    std::uint64_t value = 0;
+};
+
+class abstract_vstack
+{
+public:
+    std::size_t size() const
+    {
+        return _stack.size();
+    }
+
+    void reset(lauf::arena_base& arena, std::size_t input_count)
+    {
+        _stack.clear(arena);
+        for (auto i = 0u; i != input_count; ++i)
+            _stack.push_back(arena, {});
+    }
+
+    void push(lauf::arena_base& arena, abstract_value value = {})
+    {
+        _stack.push_back(arena, value);
+    }
+    void push_output(lauf::arena_base& arena, std::size_t n)
+    {
+        for (auto i = 0u; i != n; ++i)
+            _stack.push_back(arena, {});
+    }
+
+    [[nodiscard]] bool pop(std::size_t n)
+    {
+        if (_stack.size() < n)
+            return false;
+
+        for (auto i = 0u; i != n; ++i)
+            _stack.pop_back();
+        return true;
+    }
+
+    abstract_value& top(std::size_t stack_idx = 0)
+    {
+        return _stack[_stack.size() - 1 - stack_idx];
+    }
+
+    // Removes the value at the stack index.
+    void erase(std::size_t stack_idx)
+    {
+        for (auto i = _stack.size() - 1 - stack_idx; i != _stack.size() - 1; ++i)
+            _stack[i] = _stack[i + 1];
+        _stack.pop_back();
+    }
+
+    // Moves the value at the stack index to the top.
+    void roll(std::size_t stack_idx)
+    {
+        auto value = top(stack_idx);
+        for (auto i = _stack.size() - 1 - stack_idx; i != _stack.size() - 1; ++i)
+            _stack[i] = _stack[i + 1];
+        top() = value;
+    }
+
+private:
+    lauf::array<abstract_value> _stack;
+};
+} // namespace
+
+bool lauf::verify(arena_base& arena, lauf_asm_function* fn)
+{
+    fn->verified = false;
+    if (fn->insts == nullptr || fn->inst_count == 0)
+        return false;
+
+    auto begin = fn->insts;
+    auto end   = fn->insts + fn->inst_count;
+    auto ip    = begin;
+
+    //=== prologue ===//
+    // The layout of each local allocation, indexed by the allocation index.
+    lauf::array<lauf_asm_layout> local_allocs;
+    auto                         expected_local_alloc_count = std::size_t(0);
+    if (ip->op() == lauf::asm_op::setup_local_alloc)
+    {
+        expected_local_alloc_count = ip->setup_local_alloc.value;
+        ++ip;
+    }
+    for (; ip != end; ++ip)
+    {
+        if (ip->op() == lauf::asm_op::local_alloc)
+            local_allocs.push_back(arena, {ip->local_alloc.size, alignof(void*)});
+        else if (ip->op() == lauf::asm_op::local_alloc_aligned)
+            local_allocs.push_back(arena, {ip->local_alloc_aligned.size,
+                                           ip->local_alloc_aligned.alignment()});
+        else if (ip->op() != lauf::asm_op::local_storage)
+            break;
+    }
+    if (local_allocs.size() != expected_local_alloc_count)
+        return false;
+    if (ip == end || ip->op() != lauf::asm_op::block
+        || ip->block.input_count != fn->sig.input_count)
+        return false;
+
+    //=== body ===//
+    auto global_count = lauf::get_globals(fn->module).count;
+
+    // Instructions whose runtime checks are redundant.
+    lauf::array<lauf_asm_inst*> unchecked;
+
+    abstract_vstack vstack;
+    // Whether the previous instruction continues with the next one.
+    auto falls_through = false;
+
+    auto is_valid_jump = [&](const lauf_asm_inst* inst, std::ptrdiff_t offset) {
+        auto dest = inst + offset;
+        // The destination is the first instruction after the block instruction.
+        if (dest <= begin || dest >= end || dest[-1].op() != lauf::asm_op::block)
+            return false;
+        return vstack.size() == dest[-1].block.input_count;
+    };
+    // Consumes the offset_ext instruction of a long instruction.
+    auto has_offset_ext = [&] {
+        if (ip + 1 == end || ip[1].op() != lauf::asm_op::offset_ext)
+            return false;
+        ++ip;
+        return true;
+    };
+
+    for (; ip != end; ++ip)
+    {
+        if (ip->op() == lauf::asm_op::block)
+        {
+            if (falls_through && vstack.size() != ip->block.input_count)
+                return false;
+
+            vstack.reset(arena, ip->block.input_count);
+            falls_through = true;
+            continue;
+        }
+        else if (!falls_through)
+        {
+            // Unreachable instructions aren't emitted.
+            return false;
+        }
+
+        switch (ip->op())
+        {
+        case lauf::asm_op::nop:
+            break;
+
+        case lauf::asm_op::return_:
+            if (vstack.size() != fn->sig.output_count)
+                return false;
+            falls_through = false;
+            break;
+        case lauf::asm_op::return_free:
+            if (vstack.size() != fn->sig.output_count
+                || ip->return_free.value != local_allocs.size())
+                return false;
+            falls_through = false;
+            break;
+
+        case lauf::asm_op::jump:
+            if (!is_valid_jump(ip, ip->jump.offset))
+                return false;
+            falls_through = false;
+            break;
+        case lauf::asm_op::branch_eq:
+        case lauf::asm_op::branch_ne:
+        case lauf::asm_op::branch_lt:
+        case lauf::asm_op::branch_le:
+        case lauf::asm_op::branch_ge:
+        case lauf::asm_op::branch_gt:
+            // All branches use the same layout.
+            if (!vstack.pop(1) || !is_valid_jump(ip, ip->branch_eq.offset))
+                return false;
+            break;
+        case lauf::asm_op::jump_long: {
+            auto inst = ip;
+            if (!has_offset_ext() || !is_valid_jump(inst, lauf::long_offset(inst)))
+                return false;
+            falls_through = false;
+            break;
+        }
+        case lauf::asm_op::branch_eq_long:
+        case lauf::asm_op::branch_ne_long:
+        case lauf::asm_op::branch_lt_long:
+        case lauf::asm_op::branch_le_long:
+        case lauf::asm_op::branch_ge_long:
+        case lauf::asm_op::branch_gt_long: {
+            auto inst = ip;
+            if (!has_offset_ext() || !vstack.pop(1)
+                || !is_valid_jump(inst, lauf::long_offset(inst)))
+                return false;
+            break;
+        }
+
+        case lauf::asm_op::panic:
+            if (!vstack.pop(1))
+                return false;
+            falls_through = false;
+            break;
+        case lauf::asm_op::panic_if:
+            if (!vstack.pop(2))
+                return false;
+            break;
+
+        case lauf::asm_op::call:
+        case lauf::asm_op::call_long: {
+            auto offset = std::ptrdiff_t(ip->call.offset);
+            if (ip->op() == lauf::asm_op::call_long)
+            {
+                if (!has_offset_ext())
+                    return false;
+                offset = lauf::long_offset(ip - 1);
+            }
+
+            auto callee = lauf::uncompress_pointer_offset<lauf_asm_function>(fn, offset);
+            if (!vstack.pop(callee->sig.input_count))
+                return false;
+            vstack.push_output(arena, callee->sig.output_count);
+            break;
+        }
+        case lauf::asm_op::call_indirect:
+            if (!vstack.pop(ip->call_indirect.input_count + 1u))
+                return false;
+            vstack.push_output(arena, ip->call_indirect.output_count);
+            break;
+        case lauf::asm_op::call_builtin:
+        case lauf::asm_op::call_builtin_no_regs: {
+            if (ip + 1 == end || ip[1].op() != lauf::asm_op::call_builtin_sig)
+                return false;
+            ++ip;
+
+            auto sig = ip->call_builtin_sig;
+            if (!vstack.pop(sig.input_count))
+                return false;
+            vstack.push_output(arena, sig.output_count);
+            if ((sig.flags & LAUF_RUNTIME_BUILTIN_ALWAYS_PANIC) != 0)
+                falls_through = false;
+            break;
+        }
+
+        case lauf::asm_op::fiber_resume:
+        case lauf::asm_op::fiber_transfer:
+            // All fiber instructions use the same layout.
+            if (!vstack.pop(ip->fiber_resume.input_count + 1u))
+                return false;
+            vstack.push_output(arena, ip->fiber_resume.output_count);
+            break;
+        case lauf::asm_op::fiber_suspend:
+            if (!vstack.pop(ip->fiber_suspend.input_count))
+                return false;
+            vstack.push_output(arena, ip->fiber_suspend.output_count);
+            break;
+
+        case lauf::asm_op::push:
+            vstack.push(arena, {abstract_value::constant, 0, ip->push.value});
+            break;
+        case lauf::asm_op::pushn:
+            vstack.push(arena, {abstract_value::constant, 0, ~std::uint64_t(ip->pushn.value)});
+            break;
+        case lauf::asm_op::push2:
+        case lauf::asm_op::push3: {
+            if (vstack.size() < 1)
+                return false;
+
+            auto& top = vstack.top();
+            if (top.kind != abstract_value::constant)
+                top = {};
+            else if (ip->op() == lauf::asm_op::push2)
+                top.value |= std::uint64_t(ip->push2.value) << 24;
+            else
+                top.value |= std::uint64_t(ip->push3.value) << 48;
+            break;
+        }
+
+        case lauf::asm_op::global_addr:
+            if (ip->global_addr.value >= global_count)
+                return false;
+            vstack.push(arena);
+            break;
+        case lauf::asm_op::function_addr:
+            vstack.push(arena);
+            break;
+        case lauf::asm_op::function_addr_long:
+            if (!has_offset_ext())
+                return false;
+            vstack.push(arena);
+            break;
+        case lauf::asm_op::local_addr:
+            if (ip->local_addr.index >= local_allocs.size())
+                return false;
+            vstack.push(arena, {abstract_value::local_addr, ip->local_addr.index, 0});
+            break;
+        case lauf::asm_op::cc:
+            if (vstack.size() < 1)
+                return false;
+            vstack.top() = {abstract_value::boolean, 0, 0};
+            break;
+
+        case lauf::asm_op::pop:
+        case lauf::asm_op::pop_top:
+            if (vstack.size() <= ip->pop.idx)
+                return false;
+            vstack.erase(ip->pop.idx);
+            break;
+        case lauf::asm_op::pick:
+        case lauf::asm_op::dup:
+            if (vstack.size() <= ip->pick.idx)
+                return false;
+            vstack.push(arena, vstack.top(ip->pick.idx));
+            break;
+        case lauf::asm_op::roll:
+        case lauf::asm_op::swap:
+            if (vstack.size() <= ip->roll.idx)
+                return false;
+            vstack.roll(ip->roll.idx);
+            break;
+        case lauf::asm_op::select:
+        case lauf::asm_op::select_unchecked: {
+            if (vstack.size() < ip->select.idx + 2u)
+                return false;
+
+            auto index = vstack.top();
+            if ((index.kind == abstract_value::constant && index.value <= ip->select.idx)
+                || (index.kind == abstract_value::boolean && ip->select.idx >= 1))
+                unchecked.push_back(arena, ip);
+
+            [[maybe_unused]] auto popped = vstack.pop(ip->select.idx + 2u);
+            vstack.push(arena);
+            break;
+        }
+
+        case lauf::asm_op::array_element: {
+            if (vstack.size() < 2)
+                return false;
+
+            auto index = vstack.top(0);
+            auto addr  = vstack.top(1);
+            [[maybe_unused]] auto popped = vstack.pop(2);
+            if (addr.kind == abstract_value::local_addr && index.kind == abstract_value::constant
+                && lauf_sint(index.value) >= 0 && index.value <= UINT16_MAX)
+            {
+                addr.value += ip->array_element.value * index.value;
+                vstack.push(arena, addr);
+            }
+            else
+            {
+                vstack.push(arena);
+            }
+            break;
+        }
+        case lauf::asm_op::aggregate_member:
+            if (vstack.size() < 1)
+                return false;
+            if (vstack.top().kind == abstract_value::local_addr)
+                vstack.top().value += ip->aggregate_member.value;
+            else
+                vstack.top() = {};
+            break;
+        case lauf::asm_op::deref_const:
+        case lauf::asm_op::deref_mut:
+        case lauf::asm_op::deref_unchecked: {
+            if (vstack.size() < 1)
+                return false;
+
+            // The address of a local allocation is valid until the function returns,
+            // so it is enough to check the offset.
+            auto addr = vstack.top();
+            if (addr.kind == abstract_value::local_addr)
+            {
+                auto alloc  = local_allocs[addr.local_index];
+                auto layout = ip->deref_const;
+                if (addr.value + layout.size <= alloc.size
+                    && layout.alignment() <= alloc.alignment
+                    && addr.value % layout.alignment() == 0)
+                    unchecked.push_back(arena, ip);
+            }
+
+            vstack.top() = {};
+            break;
+        }
+
+        case lauf::asm_op::load_local_value:
+            if (ip->load_local_value.offset + sizeof(lauf_runtime_value) > fn->max_cstack_size)
+                return false;
+            vstack.push(arena);
+            break;
+        case lauf::asm_op::store_local_value:
+            if (ip->store_local_value.offset + sizeof(lauf_runtime_value) > fn->max_cstack_size
+                || !vstack.pop(1))
+                return false;
+            break;
+        case lauf::asm_op::load_global_value:
+            if (ip->load_global_value.value >= global_count)
+                return false;
+            vstack.push(arena);
+            break;
+        case lauf::asm_op::store_global_value:
+            if (ip->store_global_value.value >= global_count || !vstack.pop(1))
+                return false;
+            break;
+
+        case lauf::asm_op::block:
+        case lauf::asm_op::exit:
+        case lauf::asm_op::offset_ext:
+        case lauf::asm_op::call_builtin_sig:
+        case lauf::asm_op::setup_local_alloc:
+        case lauf::asm_op::local_alloc:
+        case lauf::asm_op::local_alloc_aligned:
+        case lauf::asm_op::local_storage:
+        case lauf::asm_op::count:
+            return false;
+        }
+
+        if (vstack.size() > fn->max_vstack_size)
+            return false;
+    }
+    if (falls_through)
+        return false;
+
+    for (auto inst : unchecked)
+    {
+        if (inst->op() == lauf::asm_op::select)
+            inst->select_unchecked.op = lauf::asm_op::select_unchecked;
+        else if (inst->op() != lauf::asm_op::select_unchecked)
+            inst->deref_unchecked.op = lauf::asm_op::deref_unchecked;
+    }
+
+    fn->verified = true;
+    return true;
+}
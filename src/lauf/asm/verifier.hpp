@@ -0,0 +1,21 @@
+// Copyright (C) 2022-2023 Jonathan Müller and lauf contributors
+// SPDX-License-Identifier: BSL-1.0
+
+#ifndef SRC_LAUF_ASM_VERIFIER_HPP_INCLUDED
+#define SRC_LAUF_ASM_VERIFIER_HPP_INCLUDED
+
+#include <lauf/asm/module.hpp>
+#include <lauf/support/arena.hpp>
+
+namespace lauf
+{
+// Verifies that the instructions of a finished function are well-formed:
+// instructions only access values of the current basic block, branches target the beginning of a
+// block with a matching signature, and all indices are in range.
+//
+// If it succeeds, it sets `fn->verified` and replaces instructions whose runtime checks are
+// statically known to pass by their unchecked version.
+bool verify(arena_base& arena, lauf_asm_function* fn);
+} // namespace lauf
+
+#endif // SRC_LAUF_ASM_VERIFIER_HPP_INCLUDED
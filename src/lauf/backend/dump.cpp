@@ -164,6 +164,37 @@ void dump_function(lauf_writer* writer, lauf_backend_dump_options opts, const la
         case lauf::asm_op::branch_gt:
             writer->format("branch.gt <%04zx>", ip + ip->branch_gt.offset - fn->insts);
             break;
+        case lauf::asm_op::jump_long:
+            writer->format("jump.long <%04zx>", ip + lauf::long_offset(ip) - fn->insts);
+            ++ip; // skip offset_ext
+            break;
+        case lauf::asm_op::branch_eq_long:
+            writer->format("branch.eq.long <%04zx>", ip + lauf::long_offset(ip) - fn->insts);
+            ++ip; // skip offset_ext
+            break;
+        case lauf::asm_op::branch_ne_long:
+            writer->format("branch.ne.long <%04zx>", ip + lauf::long_offset(ip) - fn->insts);
+            ++ip; // skip offset_ext
+            break;
+        case lauf::asm_op::branch_lt_long:
+            writer->format("branch.lt.long <%04zx>", ip + lauf::long_offset(ip) - fn->insts);
+            ++ip; // skip offset_ext
+            break;
+        case lauf::asm_op::branch_le_long:
+            writer->format("branch.le.long <%04zx>", ip + lauf::long_offset(ip) - fn->insts);
+            ++ip; // skip offset_ext
+            break;
+        case lauf::asm_op::branch_ge_long:
+            writer->format("branch.ge.long <%04zx>", ip + lauf::long_offset(ip) - fn->insts);
+            ++ip; // skip offset_ext
+            break;
+        case lauf::asm_op::branch_gt_long:
+            writer->format("branch.gt.long <%04zx>", ip + lauf::long_offset(ip) - fn->insts);
+            ++ip; // skip offset_ext
+            break;
+        case lauf::asm_op::offset_ext:
+            writer->format("offset_ext 0x%X", ip->offset_ext.value);
+            break;
         case lauf::asm_op::panic:
             writer->write("panic");
             break;
@@ -179,6 +210,13 @@ void dump_function(lauf_writer* writer, lauf_backend_dump_options opts, const la
             writer->format("call @'%s'", callee->name);
             break;
         }
+        case lauf::asm_op::call_long: {
+            auto callee
+                = lauf::uncompress_pointer_offset<lauf_asm_function>(fn, lauf::long_offset(ip));
+            writer->format("call.long @'%s'", callee->name);
+            ++ip; // skip offset_ext
+            break;
+        }
         case lauf::asm_op::call_indirect: {
             writer->write("call_indirect");
             break;
@@ -233,6 +271,13 @@ void dump_function(lauf_writer* writer, lauf_backend_dump_options opts, const la
             writer->format("function_addr @'%s'", callee->name);
             break;
         }
+        case lauf::asm_op::function_addr_long: {
+            auto callee
+                = lauf::uncompress_pointer_offset<lauf_asm_function>(fn, lauf::long_offset(ip));
+            writer->format("function_addr.long @'%s'", callee->name);
+            ++ip; // skip offset_ext
+            break;
+        }
         case lauf::asm_op::local_addr: {
             writer->format("local_addr %u <%zx>", ip->local_addr.index,
                            ip->local_addr.offset - sizeof(lauf_runtime_stack_frame));
@@ -276,6 +321,7 @@ void dump_function(lauf_writer* writer, lauf_backend_dump_options opts, const la
             writer->format("roll %d", ip->roll.idx);
             break;
         case lauf::asm_op::select:
+        case lauf::asm_op::select_unchecked:
             writer->format("select %d", ip->select.idx + 1);
             break;
 
@@ -300,6 +346,10 @@ void dump_function(lauf_writer* writer, lauf_backend_dump_options opts, const la
         case lauf::asm_op::deref_mut:
             writer->format("deref_mut (%u, %zu)", ip->deref_mut.size, ip->deref_mut.alignment());
             break;
+        case lauf::asm_op::deref_unchecked:
+            writer->format("deref_unchecked (%u, %zu)", ip->deref_unchecked.size,
+                           ip->deref_unchecked.alignment());
+            break;
         case lauf::asm_op::array_element:
             writer->format("array_element [%u]", ip->array_element.value);
             break;
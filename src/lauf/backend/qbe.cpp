@@ -8,6 +8,7 @@
 #include <lauf/asm/module.hpp>
 #include <lauf/asm/type.h>
 #include <lauf/runtime/builtin.h>
+#include <lauf/runtime/stack.hpp>
 
 #include <lauf/lib/bits.h>
 #include <lauf/lib/heap.h>
@@ -21,8 +22,11 @@ namespace
 constexpr lauf_backend_qbe_extern_function default_externs[] = {
     {"lauf_heap_alloc", &lauf_lib_heap_alloc},
     {"lauf_heap_alloc_array", &lauf_lib_heap_alloc_array},
+    {"lauf_heap_alloc_typed", &lauf_lib_heap_alloc_typed},
     {"lauf_heap_free", &lauf_lib_heap_free},
     {"lauf_heap_gc", &lauf_lib_heap_gc},
+    {"lauf_heap_gc_step", &lauf_lib_heap_gc_step},
+    {"lauf_heap_gc_minor", &lauf_lib_heap_gc_minor},
     {"lauf_memory_copy", &lauf_lib_memory_copy},
     {"lauf_memory_fill", &lauf_lib_memory_fill},
     {"lauf_memory_cmp", &lauf_lib_memory_cmp},
@@ -103,6 +107,62 @@ void codegen_function(lauf::qbe_writer& writer, const lauf_backend_qbe_options&
 
     auto next_block = [id = fn->inst_count]() mutable { return lauf::qbe_block(id++); };
     auto next_alloc = [id = 0]() mutable { return lauf::qbe_alloc(id++); };
+    // The prologue has one instruction per local, but only the ones with local_alloc are counted
+    // by the index of local_addr.
+    auto local_addr_alloc = [&](std::size_t alloc_index) {
+        assert(fn->insts[0].op() == lauf::asm_op::setup_local_alloc);
+        for (auto ip = fn->insts + 1;; ++ip)
+        {
+            assert(ip->op() == lauf::asm_op::local_alloc
+                   || ip->op() == lauf::asm_op::local_alloc_aligned
+                   || ip->op() == lauf::asm_op::local_storage);
+            if (ip->op() == lauf::asm_op::local_storage)
+                continue;
+
+            if (alloc_index == 0)
+                return lauf::qbe_alloc(unsigned(ip - (fn->insts + 1)));
+            --alloc_index;
+        }
+    };
+
+    // load/store_local_value address memory relative to the stack frame, so we need to find the
+    // local whose frame space contains the offset and add the remaining offset into it.
+    auto local_value_ptr = [&](std::size_t offset) -> lauf::qbe_value {
+        auto ip = fn->insts;
+        if (ip->op() == lauf::asm_op::setup_local_alloc)
+            ++ip;
+
+        auto start = sizeof(lauf_runtime_stack_frame);
+        for (auto id = 0u;; ++ip, ++id)
+        {
+            auto space = [&] {
+                switch (ip->op())
+                {
+                case lauf::asm_op::local_alloc:
+                    return std::size_t(ip->local_alloc.size);
+                case lauf::asm_op::local_alloc_aligned:
+                    return std::size_t(ip->local_alloc_aligned.size)
+                           + ip->local_alloc_aligned.alignment();
+                case lauf::asm_op::local_storage:
+                    return std::size_t(ip->local_storage.value);
+                default:
+                    assert(false && "offset outside of the locals");
+                    return std::size_t(0);
+                }
+            }();
+
+            if (offset < start + space)
+            {
+                if (offset == start)
+                    return lauf::qbe_alloc(id);
+
+                writer.binary_op(lauf::qbe_reg::tmp, lauf::qbe_type::value, "add",
+                                 lauf::qbe_alloc(id), std::uintmax_t(offset - start));
+                return lauf::qbe_reg::tmp;
+            }
+            start += space;
+        }
+    };
 
     auto write_call
         = [&](lauf::qbe_value callee, std::uint8_t input_count, std::uint8_t output_count) {
@@ -213,6 +273,46 @@ void codegen_function(lauf::qbe_writer& writer, const lauf_backend_qbe_options&
             writer.jnz(lauf::qbe_reg::tmp, block_id(ip + ip->branch_gt.offset), block_id(ip + 1));
             break;
 
+        case lauf::asm_op::jump_long:
+            writer.jmp(block_id(ip + lauf::long_offset(ip)));
+            ++ip; // skip offset_ext
+            break;
+        case lauf::asm_op::branch_eq_long:
+            writer.jnz(pop_reg(), block_id(ip + 2), block_id(ip + lauf::long_offset(ip)));
+            ++ip; // skip offset_ext
+            break;
+        case lauf::asm_op::branch_ne_long:
+            writer.jnz(pop_reg(), block_id(ip + lauf::long_offset(ip)), block_id(ip + 2));
+            ++ip; // skip offset_ext
+            break;
+        case lauf::asm_op::branch_lt_long:
+            writer.comparison(lauf::qbe_reg::tmp, lauf::qbe_cc::slt, lauf::qbe_type::value,
+                              pop_reg(), std::uintmax_t(0));
+            writer.jnz(lauf::qbe_reg::tmp, block_id(ip + lauf::long_offset(ip)), block_id(ip + 2));
+            ++ip; // skip offset_ext
+            break;
+        case lauf::asm_op::branch_le_long:
+            writer.comparison(lauf::qbe_reg::tmp, lauf::qbe_cc::sle, lauf::qbe_type::value,
+                              pop_reg(), std::uintmax_t(0));
+            writer.jnz(lauf::qbe_reg::tmp, block_id(ip + lauf::long_offset(ip)), block_id(ip + 2));
+            ++ip; // skip offset_ext
+            break;
+        case lauf::asm_op::branch_ge_long:
+            writer.comparison(lauf::qbe_reg::tmp, lauf::qbe_cc::sge, lauf::qbe_type::value,
+                              pop_reg(), std::uintmax_t(0));
+            writer.jnz(lauf::qbe_reg::tmp, block_id(ip + lauf::long_offset(ip)), block_id(ip + 2));
+            ++ip; // skip offset_ext
+            break;
+        case lauf::asm_op::branch_gt_long:
+            writer.comparison(lauf::qbe_reg::tmp, lauf::qbe_cc::sgt, lauf::qbe_type::value,
+                              pop_reg(), std::uintmax_t(0));
+            writer.jnz(lauf::qbe_reg::tmp, block_id(ip + lauf::long_offset(ip)), block_id(ip + 2));
+            ++ip; // skip offset_ext
+            break;
+        case lauf::asm_op::offset_ext:
+            // Processed by the XX_long instruction.
+            break;
+
         case lauf::asm_op::panic:
             writer.panic(pop_reg());
             dead_code = true;
@@ -237,6 +337,13 @@ void codegen_function(lauf::qbe_writer& writer, const lauf_backend_qbe_options&
             write_call(callee->name, callee->sig.input_count, callee->sig.output_count);
             break;
         }
+        case lauf::asm_op::call_long: {
+            auto callee
+                = lauf::uncompress_pointer_offset<lauf_asm_function>(fn, lauf::long_offset(ip));
+            write_call(callee->name, callee->sig.input_count, callee->sig.output_count);
+            ++ip; // skip offset_ext
+            break;
+        }
         case lauf::asm_op::call_indirect:
             write_call(pop_reg(), ip->call_indirect.input_count, ip->call_indirect.output_count);
             break;
@@ -696,8 +803,15 @@ void codegen_function(lauf::qbe_writer& writer, const lauf_backend_qbe_options&
             writer.copy(push_reg(), lauf::qbe_type::value, callee->name);
             break;
         }
+        case lauf::asm_op::function_addr_long: {
+            auto callee
+                = lauf::uncompress_pointer_offset<lauf_asm_function>(fn, lauf::long_offset(ip));
+            writer.copy(push_reg(), lauf::qbe_type::value, callee->name);
+            ++ip; // skip offset_ext
+            break;
+        }
         case lauf::asm_op::local_addr:
-            writer.copy(push_reg(), lauf::qbe_type::value, lauf::qbe_alloc(ip->local_addr.index));
+            writer.copy(push_reg(), lauf::qbe_type::value, local_addr_alloc(ip->local_addr.index));
             break;
 
         case lauf::asm_op::cc: {
@@ -757,7 +871,8 @@ void codegen_function(lauf::qbe_writer& writer, const lauf_backend_qbe_options&
             break;
         }
 
-        case lauf::asm_op::select: {
+        case lauf::asm_op::select:
+        case lauf::asm_op::select_unchecked: {
             auto index = pop_reg();
             auto end   = next_block();
             for (auto i = 0u; i <= ip->select.idx; ++i)
@@ -823,16 +938,19 @@ void codegen_function(lauf::qbe_writer& writer, const lauf_backend_qbe_options&
         }
         case lauf::asm_op::deref_const:
         case lauf::asm_op::deref_mut:
+        case lauf::asm_op::deref_unchecked:
             // Addresses are already pointers, so dereference does nothing.
             break;
-        case lauf::asm_op::load_local_value:
-            writer.load(push_reg(), lauf::qbe_type::value,
-                        lauf::qbe_alloc(ip->load_local_value.index));
+        case lauf::asm_op::load_local_value: {
+            auto ptr = local_value_ptr(ip->load_local_value.offset);
+            writer.load(push_reg(), lauf::qbe_type::value, ptr);
             break;
-        case lauf::asm_op::store_local_value:
-            writer.store(lauf::qbe_type::value, pop_reg(),
-                         lauf::qbe_alloc(ip->store_local_value.index));
+        }
+        case lauf::asm_op::store_local_value: {
+            auto ptr = local_value_ptr(ip->store_local_value.offset);
+            writer.store(lauf::qbe_type::value, pop_reg(), ptr);
             break;
+        }
         case lauf::asm_op::load_global_value:
             writer.load(push_reg(), lauf::qbe_type::value,
                         lauf::qbe_data(ip->load_global_value.value));
@@ -7,6 +7,7 @@
 #include <lauf/runtime/builtin.h>
 #include <lauf/runtime/memory.h>
 #include <lauf/runtime/process.h>
+#include <lauf/runtime/process.hpp>
 #include <lauf/runtime/value.h>
 #include <lauf/support/align.hpp>
 #include <lauf/vm.h>
@@ -16,6 +17,9 @@ LAUF_RUNTIME_BUILTIN(lauf_lib_heap_alloc, 2, 1, LAUF_RUNTIME_BUILTIN_DEFAULT, "a
     auto size      = vstack_ptr[0].as_uint;
     auto alignment = vstack_ptr[1].as_uint;
 
+    if (!process->memory.reserve_heap(process, size))
+        return lauf_runtime_panic(process, "out of memory");
+
     auto allocator = lauf_vm_get_allocator(lauf_runtime_get_vm(process));
     auto memory    = allocator.heap_alloc(allocator.user_data, size, alignment);
     if (memory == nullptr)
@@ -44,8 +48,37 @@ LAUF_RUNTIME_BUILTIN(lauf_lib_heap_alloc_array, 3, 1, LAUF_RUNTIME_BUILTIN_DEFAU
     LAUF_TAIL_CALL return lauf_lib_heap_alloc.impl(ip, vstack_ptr, frame_ptr, process);
 }
 
-LAUF_RUNTIME_BUILTIN(lauf_lib_heap_free, 1, 0, LAUF_RUNTIME_BUILTIN_DEFAULT, "free",
+LAUF_RUNTIME_BUILTIN(lauf_lib_heap_alloc_typed, 4, 1, LAUF_RUNTIME_BUILTIN_DEFAULT, "alloc_typed",
                      &lauf_lib_heap_alloc_array)
+{
+    auto pointer_map = vstack_ptr[0].as_uint;
+    auto count       = vstack_ptr[1].as_uint;
+    auto size        = vstack_ptr[2].as_uint;
+    auto alignment   = vstack_ptr[3].as_uint;
+
+    auto element_size = lauf::round_to_multiple_of_alignment(size, alignment);
+    auto memory_size  = element_size * count;
+
+    if (!process->memory.reserve_heap(process, memory_size))
+        return lauf_runtime_panic(process, "out of memory");
+
+    auto allocator = lauf_vm_get_allocator(lauf_runtime_get_vm(process));
+    auto memory    = allocator.heap_alloc(allocator.user_data, memory_size, alignment);
+    if (memory == nullptr)
+        return lauf_runtime_panic(process, "out of memory");
+
+    auto address = lauf_runtime_add_heap_allocation(process, memory, memory_size);
+    // If the pointer map cannot be represented, the memory is scanned conservatively.
+    lauf_runtime_set_pointer_map(process, address, element_size, pointer_map);
+
+    vstack_ptr += 3;
+    vstack_ptr[0].as_address = address;
+
+    LAUF_RUNTIME_BUILTIN_DISPATCH;
+}
+
+LAUF_RUNTIME_BUILTIN(lauf_lib_heap_free, 1, 0, LAUF_RUNTIME_BUILTIN_DEFAULT, "free",
+                     &lauf_lib_heap_alloc_typed)
 {
     auto address = vstack_ptr[0].as_address;
     ++vstack_ptr;
@@ -73,6 +106,9 @@ LAUF_RUNTIME_BUILTIN(lauf_lib_heap_transfer_local, 1, 1, LAUF_RUNTIME_BUILTIN_DE
 
     if (alloc.source == LAUF_RUNTIME_LOCAL_ALLOCATION)
     {
+        if (!process->memory.reserve_heap(process, alloc.size))
+            return lauf_runtime_panic(process, "out of memory");
+
         auto allocator = lauf_vm_get_allocator(lauf_runtime_get_vm(process));
         auto memory    = allocator.heap_alloc(allocator.user_data, alloc.size, alignof(void*));
         if (memory == nullptr)
@@ -97,8 +133,30 @@ LAUF_RUNTIME_BUILTIN(lauf_lib_heap_gc, 0, 1, LAUF_RUNTIME_BUILTIN_NO_PANIC, "gc"
     LAUF_RUNTIME_BUILTIN_DISPATCH;
 }
 
+LAUF_RUNTIME_BUILTIN(lauf_lib_heap_gc_step, 1, 1, LAUF_RUNTIME_BUILTIN_NO_PANIC, "gc_step",
+                     &lauf_lib_heap_gc)
+{
+    auto budget = vstack_ptr[0].as_uint;
+
+    auto finished         = lauf_runtime_gc_step(process, budget, nullptr);
+    vstack_ptr[0].as_uint = finished ? 1 : 0;
+
+    LAUF_RUNTIME_BUILTIN_DISPATCH;
+}
+
+LAUF_RUNTIME_BUILTIN(lauf_lib_heap_gc_minor, 0, 1, LAUF_RUNTIME_BUILTIN_NO_PANIC, "gc_minor",
+                     &lauf_lib_heap_gc_step)
+{
+    auto bytes_freed = lauf_runtime_gc_minor(process);
+
+    --vstack_ptr;
+    vstack_ptr[0].as_uint = bytes_freed;
+
+    LAUF_RUNTIME_BUILTIN_DISPATCH;
+}
+
 LAUF_RUNTIME_BUILTIN(lauf_lib_heap_declare_reachable, 1, 0, LAUF_RUNTIME_BUILTIN_VM_DIRECTIVE,
-                     "declare_reachable", &lauf_lib_heap_gc)
+                     "declare_reachable", &lauf_lib_heap_gc_minor)
 {
     auto addr = vstack_ptr[0].as_address;
     ++vstack_ptr;
@@ -8,6 +8,7 @@
 #include <lauf/runtime/builtin.h>
 #include <lauf/runtime/memory.h>
 #include <lauf/runtime/process.h>
+#include <lauf/runtime/process.hpp>
 #include <lauf/runtime/value.h>
 
 LAUF_RUNTIME_BUILTIN(lauf_lib_memory_poison, 1, 0, LAUF_RUNTIME_BUILTIN_VM_DIRECTIVE, "poison",
@@ -92,25 +93,27 @@ LAUF_RUNTIME_BUILTIN(lauf_lib_memory_int_to_addr, 2, 1, LAUF_RUNTIME_BUILTIN_DEF
 
 namespace
 {
-std::uint32_t addr_offset(lauf_runtime_address addr, lauf_sint offset)
+lauf_runtime_address addr_offset(lauf_runtime_process* process, lauf_runtime_address addr,
+                                 lauf_sint offset)
 {
     lauf_sint result;
     auto      overflow = __builtin_add_overflow(lauf_sint(addr.offset), offset, &result);
-    if (LAUF_UNLIKELY(overflow || result < 0 || result > UINT32_MAX))
-        result = UINT32_MAX;
+    if (LAUF_LIKELY(!overflow && result >= 0 && std::size_t(result) < lauf::max_segment_size))
+        return {addr.allocation, addr.generation, std::uint32_t(result)};
 
-    return std::uint32_t(result);
+    // The result might be in a different segment.
+    return process->memory.offset_address(addr, offset);
 }
 
 template <bool Strict>
-bool validate_addr_offset(lauf_runtime_process* process, lauf_runtime_address addr,
-                          std::uint32_t new_offset)
+bool validate_addr_offset(lauf_runtime_process* process, lauf_runtime_address new_addr)
 {
-    lauf_runtime_allocation alloc;
-    if (!lauf_runtime_get_allocation(process, addr, &alloc))
+    // new_addr has the allocation of the original address, unless it moved to another segment.
+    auto alloc = process->memory.try_get(new_addr);
+    if (alloc == nullptr)
         return lauf_runtime_panic(process, "invalid address");
 
-    if ((Strict && new_offset >= alloc.size) || (!Strict && new_offset > alloc.size))
+    if ((Strict && new_addr.offset >= alloc->size) || (!Strict && new_addr.offset > alloc->size))
         return lauf_runtime_panic(process, "address overflow");
 
     return true;
@@ -122,10 +125,10 @@ LAUF_RUNTIME_BUILTIN(addr_add_invalidate, 2, 1, LAUF_RUNTIME_BUILTIN_NO_PANIC,
     auto addr   = vstack_ptr[1].as_address;
     auto offset = vstack_ptr[0].as_sint;
 
-    auto new_offset = addr_offset(addr, offset);
+    auto new_addr = addr_offset(process, addr, offset);
 
     ++vstack_ptr;
-    vstack_ptr[0].as_address = {addr.allocation, addr.generation, new_offset};
+    vstack_ptr[0].as_address = new_addr;
     LAUF_RUNTIME_BUILTIN_DISPATCH;
 }
 LAUF_RUNTIME_BUILTIN(addr_add_panic, 2, 1, LAUF_RUNTIME_BUILTIN_DEFAULT, "addr_add_panic",
@@ -134,12 +137,12 @@ LAUF_RUNTIME_BUILTIN(addr_add_panic, 2, 1, LAUF_RUNTIME_BUILTIN_DEFAULT, "addr_a
     auto addr   = vstack_ptr[1].as_address;
     auto offset = vstack_ptr[0].as_sint;
 
-    auto new_offset = addr_offset(addr, offset);
-    if (!validate_addr_offset<false>(process, addr, new_offset))
+    auto new_addr = addr_offset(process, addr, offset);
+    if (!validate_addr_offset<false>(process, new_addr))
         return false;
 
     ++vstack_ptr;
-    vstack_ptr[0].as_address = {addr.allocation, addr.generation, new_offset};
+    vstack_ptr[0].as_address = new_addr;
     LAUF_RUNTIME_BUILTIN_DISPATCH;
 }
 LAUF_RUNTIME_BUILTIN(addr_add_panic_strict, 2, 1, LAUF_RUNTIME_BUILTIN_DEFAULT,
@@ -148,12 +151,12 @@ LAUF_RUNTIME_BUILTIN(addr_add_panic_strict, 2, 1, LAUF_RUNTIME_BUILTIN_DEFAULT,
     auto addr   = vstack_ptr[1].as_address;
     auto offset = vstack_ptr[0].as_sint;
 
-    auto new_offset = addr_offset(addr, offset);
-    if (!validate_addr_offset<true>(process, addr, new_offset))
+    auto new_addr = addr_offset(process, addr, offset);
+    if (!validate_addr_offset<true>(process, new_addr))
         return false;
 
     ++vstack_ptr;
-    vstack_ptr[0].as_address = {addr.allocation, addr.generation, new_offset};
+    vstack_ptr[0].as_address = new_addr;
     LAUF_RUNTIME_BUILTIN_DISPATCH;
 }
 
@@ -163,10 +166,10 @@ LAUF_RUNTIME_BUILTIN(addr_sub_invalidate, 2, 1, LAUF_RUNTIME_BUILTIN_NO_PANIC,
     auto addr   = vstack_ptr[1].as_address;
     auto offset = vstack_ptr[0].as_sint;
 
-    auto new_offset = addr_offset(addr, -offset);
+    auto new_addr = addr_offset(process, addr, -offset);
 
     ++vstack_ptr;
-    vstack_ptr[0].as_address = {addr.allocation, addr.generation, new_offset};
+    vstack_ptr[0].as_address = new_addr;
     LAUF_RUNTIME_BUILTIN_DISPATCH;
 }
 LAUF_RUNTIME_BUILTIN(addr_sub_panic, 2, 1, LAUF_RUNTIME_BUILTIN_DEFAULT, "addr_sub_panic",
@@ -175,12 +178,12 @@ LAUF_RUNTIME_BUILTIN(addr_sub_panic, 2, 1, LAUF_RUNTIME_BUILTIN_DEFAULT, "addr_s
     auto addr   = vstack_ptr[1].as_address;
     auto offset = vstack_ptr[0].as_sint;
 
-    auto new_offset = addr_offset(addr, -offset);
-    if (!validate_addr_offset<false>(process, addr, new_offset))
+    auto new_addr = addr_offset(process, addr, -offset);
+    if (!validate_addr_offset<false>(process, new_addr))
         return false;
 
     ++vstack_ptr;
-    vstack_ptr[0].as_address = {addr.allocation, addr.generation, new_offset};
+    vstack_ptr[0].as_address = new_addr;
     LAUF_RUNTIME_BUILTIN_DISPATCH;
 }
 LAUF_RUNTIME_BUILTIN(addr_sub_panic_strict, 2, 1, LAUF_RUNTIME_BUILTIN_DEFAULT,
@@ -189,12 +192,12 @@ LAUF_RUNTIME_BUILTIN(addr_sub_panic_strict, 2, 1, LAUF_RUNTIME_BUILTIN_DEFAULT,
     auto addr   = vstack_ptr[1].as_address;
     auto offset = vstack_ptr[0].as_sint;
 
-    auto new_offset = addr_offset(addr, -offset);
-    if (!validate_addr_offset<true>(process, addr, new_offset))
+    auto new_addr = addr_offset(process, addr, -offset);
+    if (!validate_addr_offset<true>(process, new_addr))
         return false;
 
     ++vstack_ptr;
-    vstack_ptr[0].as_address = {addr.allocation, addr.generation, new_offset};
+    vstack_ptr[0].as_address = new_addr;
     LAUF_RUNTIME_BUILTIN_DISPATCH;
 }
 } // namespace
@@ -231,10 +234,21 @@ LAUF_RUNTIME_BUILTIN(lauf_lib_memory_addr_distance, 2, 1, LAUF_RUNTIME_BUILTIN_D
     auto lhs = vstack_ptr[1].as_address;
     auto rhs = vstack_ptr[0].as_address;
 
-    if (lhs.allocation != rhs.allocation || lhs.generation != rhs.generation)
-        return lauf_runtime_panic(process, "addresses are from different allocations");
-
     auto distance = lauf_sint(lhs.offset) - lauf_sint(rhs.offset);
+    if (lhs.allocation != rhs.allocation || lhs.generation != rhs.generation)
+    {
+        // They can still be in different segments of the same allocation.
+        auto segments = process->memory.try_get(lhs) != nullptr
+                            ? process->memory.get_segments(lhs.allocation)
+                            : nullptr;
+        if (segments == nullptr || lhs.generation != rhs.generation
+            || segments->segment_of(rhs.allocation) == segments->count)
+            return lauf_runtime_panic(process, "addresses are from different allocations");
+
+        auto segment_distance = lauf_sint(segments->segment_of(lhs.allocation))
+                                - lauf_sint(segments->segment_of(rhs.allocation));
+        distance += segment_distance * lauf_sint(lauf::max_segment_size);
+    }
 
     ++vstack_ptr;
     vstack_ptr[0].as_sint = distance;
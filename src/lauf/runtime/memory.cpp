@@ -3,15 +3,100 @@
 
 #include <lauf/runtime/memory.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <fcntl.h>
 #include <lauf/asm/module.hpp>
 #include <lauf/asm/program.hpp>
 #include <lauf/runtime/process.hpp>
 #include <lauf/vm.hpp>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
 
 namespace
 {
+// Adds the time and the bytes freed until it is destroyed to the statistics.
+class gc_stats_scope
+{
+public:
+    explicit gc_stats_scope(lauf::gc_stats& stats, const std::size_t& bytes_freed)
+    : _stats(stats), _bytes_freed(bytes_freed), _initial_bytes_freed(bytes_freed),
+      _start(std::chrono::steady_clock::now())
+    {}
+
+    gc_stats_scope(const gc_stats_scope&)            = delete;
+    gc_stats_scope& operator=(const gc_stats_scope&) = delete;
+
+    ~gc_stats_scope()
+    {
+        auto pause = std::chrono::steady_clock::now() - _start;
+        _stats.pause_ns += std::uint64_t(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(pause).count());
+        _stats.bytes_freed += _bytes_freed - _initial_bytes_freed;
+    }
+
+private:
+    lauf::gc_stats&                       _stats;
+    const std::size_t&                    _bytes_freed;
+    std::size_t                           _initial_bytes_freed;
+    std::chrono::steady_clock::time_point _start;
+};
+
+// Calls mark() for every value of the allocation that can contain an address.
+template <typename Mark>
+std::size_t scan_allocation(const lauf::allocation& alloc, const lauf::pointer_map* map, Mark mark)
+{
+    if (alloc.size < sizeof(lauf_runtime_address) || alloc.is_gc_weak)
+        return sizeof(lauf::allocation);
+
+    if (map != nullptr)
+    {
+        // We only need to look at the words that can contain addresses.
+        // The memory is properly aligned, which was checked when setting the map.
+        auto work = sizeof(lauf::allocation);
+        if (map->mask == 0)
+            return work;
+
+        auto element_size = map->element_words * sizeof(lauf_runtime_value);
+        auto element      = static_cast<lauf_runtime_value*>(alloc.ptr);
+        for (auto end = element + alloc.size / element_size * map->element_words; element != end;
+             element += map->element_words)
+        {
+            for (auto mask = std::uint64_t(map->mask); mask != 0; mask &= mask - 1)
+                work += mark(element[__builtin_ctzll(mask)].as_address);
+        }
+
+        // A segment can end in the middle of an element.
+        auto rest_words = alloc.size % element_size / sizeof(lauf_runtime_value);
+        for (auto mask = std::uint64_t(map->mask) & ((std::uint64_t(1) << rest_words) - 1);
+             mask != 0; mask &= mask - 1)
+            work += mark(element[__builtin_ctzll(mask)].as_address);
+        return work;
+    }
+
+    // Assume the allocation contains an array of values.
+    // For that we need to align the pointer properly.
+    // (We've done a size check already, so the initial offset is fine)
+    auto offset = lauf::align_offset(alloc.ptr, alignof(lauf_runtime_value));
+    auto ptr
+        = reinterpret_cast<lauf_runtime_value*>(static_cast<unsigned char*>(alloc.ptr) + offset);
+
+    auto work = sizeof(lauf::allocation);
+    for (auto end = ptr + (alloc.size - offset) / sizeof(lauf_runtime_value); ptr != end; ++ptr)
+        work += mark(ptr->as_address);
+    return work;
+}
+
+// Sets size to the actual size of the global, which can be bigger than the size of the allocation.
 lauf::allocation allocate_global(lauf::arena_base& arena, const lauf_asm_program& program,
-                                 const lauf_asm_global& global)
+                                 const lauf_asm_global& global, unsigned char* image_ptr,
+                                 std::size_t& size)
 {
     lauf::allocation result;
     result.source     = global.is_mutable ? lauf::allocation_source::static_mut_memory
@@ -30,19 +115,28 @@ lauf::allocation allocate_global(lauf::arena_base& arena, const lauf_asm_program
         if (definition != nullptr)
         {
             result.ptr = definition->ptr;
-            // If bigger than 32bit, only the lower parts are addressable.
-            result.size = std::uint32_t(definition->size);
+            size       = definition->size;
         }
         else
         {
             result.status = lauf::allocation_status::freed;
             result.ptr    = nullptr;
-            result.size   = 0;
+            size          = 0;
         }
     }
     else
     {
-        if (global.memory != nullptr)
+        if (!global.is_mutable && global.memory != nullptr)
+        {
+            // The memory can never be written, so all processes can share the module's copy.
+            result.ptr = const_cast<unsigned char*>(global.memory);
+        }
+        else if (image_ptr != nullptr)
+        {
+            // The memory is a copy-on-write mapping of the global image.
+            result.ptr = image_ptr;
+        }
+        else if (global.memory != nullptr)
         {
             result.ptr = arena.memdup(global.memory, global.size, global.alignment);
         }
@@ -52,25 +146,66 @@ lauf::allocation allocate_global(lauf::arena_base& arena, const lauf_asm_program
             std::memset(result.ptr, 0, global.size);
         }
 
-        // If bigger than 32bit, only the lower parts are addressable.
-        result.size = std::uint32_t(global.size);
+        size = global.size;
     }
 
+    // If it is bigger than 32bit, it is split into segments later on.
+    result.size = std::uint32_t(std::min<std::size_t>(size, UINT32_MAX));
     return result;
 }
 } // namespace
 
 void lauf::memory::init(lauf_vm* vm, const lauf_asm_program* program)
 {
+    _gc_generational       = vm->generational_gc;
+    _gc_min_heap_threshold = vm->gc_min_heap_threshold;
+    _gc_heap_growth_factor = vm->gc_heap_growth_factor;
+    _max_heap_size         = vm->max_heap_size;
+    _max_heap_count        = SIZE_MAX;
+    update_heap_threshold(0);
+    _peak_heap_size = 0;
+    _gc_stats       = {};
+
+    auto extra = lauf::try_get_extra_data(*program);
+    auto image = lauf::get_global_image(*program);
+    if (image != nullptr)
+    {
+        auto ptr = ::mmap(nullptr, image->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, image->fd, 0);
+        if (ptr != MAP_FAILED) // NOLINT: macro
+        {
+            _global_image      = static_cast<unsigned char*>(ptr);
+            _global_image_size = image->size;
+        }
+    }
+
+    // Globals that need to be split into segments, once all globals have their allocation.
+    std::vector<std::pair<std::uint32_t, std::size_t>> segmented_globals;
+
     auto add_globals = [&](const lauf_asm_module* mod, std::size_t offset) {
         auto globals = lauf::get_globals(mod);
         _allocations.resize_uninitialized(vm->page_allocator, _allocations.size() + globals.count);
         for (auto global = globals.first; global != nullptr; global = global->next)
-            _allocations[offset + global->allocation_idx] = allocate_global(*vm, *program, *global);
+        {
+            auto index          = std::uint32_t(offset + global->allocation_idx);
+            auto image_ptr
+                = _global_image != nullptr && global->is_mutable && global->has_definition()
+                      ? _global_image + image->offsets[index]
+                      : nullptr;
+            auto size           = std::size_t(0);
+            _allocations[index] = allocate_global(*vm, *program, *global, image_ptr, size);
+            if (size > UINT32_MAX)
+                segmented_globals.emplace_back(index, size);
+
+            lauf::pointer_map map;
+            if (global->pointer_map_element_size != 0
+                && lauf::make_pointer_map(map, global->pointer_map_element_size,
+                                          global->pointer_map))
+                set_pointer_map(vm->page_allocator, index, map);
+        }
     };
 
     add_globals(program->_mod, 0);
-    if (auto extra = lauf::try_get_extra_data(*program))
+    if (extra != nullptr)
     {
         for (auto& submod : extra->submodules)
         {
@@ -78,16 +213,262 @@ void lauf::memory::init(lauf_vm* vm, const lauf_asm_program* program)
             add_globals(submod.mod, submod.global_allocation_offset);
         }
     }
+
+    for (auto [index, size] : segmented_globals)
+        add_segments(vm->page_allocator, index, size);
 }
 
 void lauf::memory::clear(lauf_vm* vm)
 {
     _allocations.clear(vm->page_allocator);
+    _heap_size  = 0;
+    _heap_count = 0;
+    _pointer_maps.clear(vm->page_allocator);
+    _free_slots.clear(vm->page_allocator);
+    _segments.clear(vm->page_allocator);
+
+    for (auto& mapping : _file_mappings)
+        if (mapping.size > 0)
+            ::munmap(mapping.ptr, mapping.size);
+    _file_mappings.clear(vm->page_allocator);
+
+    _gc_phase  = gc_phase::idle;
+    _gc_cursor = 0;
+    _gc_worklist.clear(vm->page_allocator);
+    _gc_dirty.clear(vm->page_allocator);
+    _gc_nursery.clear(vm->page_allocator);
+
+    if (_global_image != nullptr)
+    {
+        ::munmap(_global_image, _global_image_size);
+        _global_image      = nullptr;
+        _global_image_size = 0;
+    }
 }
 
 void lauf::memory::destroy(lauf_vm* vm)
 {
     _allocations.shrink_to_fit(vm->page_allocator);
+    _pointer_maps.shrink_to_fit(vm->page_allocator);
+    _free_slots.shrink_to_fit(vm->page_allocator);
+    _segments.shrink_to_fit(vm->page_allocator);
+    _file_mappings.shrink_to_fit(vm->page_allocator);
+    _gc_worklist.shrink_to_fit(vm->page_allocator);
+    _gc_dirty.shrink_to_fit(vm->page_allocator);
+    _gc_nursery.shrink_to_fit(vm->page_allocator);
+}
+
+void lauf::memory::restore(page_allocator& allocator, const allocation* allocations,
+                           std::size_t count, const pointer_map* pointer_maps,
+                           std::uint8_t cur_generation)
+{
+    assert(count >= _allocations.size());
+    _allocations.resize_uninitialized(allocator, count);
+    _heap_size  = 0;
+    _heap_count = 0;
+    for (auto index = std::uint32_t(0); index != count; ++index)
+    {
+        auto alloc = allocations[index];
+        // There is no collection in progress, so all allocations are old and clean.
+        alloc.is_gc_young    = false;
+        alloc.is_gc_dirty    = false;
+        _allocations[index] = alloc;
+
+        if (alloc.status == allocation_status::freed)
+            _free_slots.push_back(allocator, index);
+        else if (alloc.source == allocation_source::heap_memory
+                 && alloc.split == allocation_split::unsplit)
+        {
+            _heap_size += alloc.size;
+            ++_heap_count;
+        }
+
+        if (alloc.has_pointer_map)
+        {
+            if (index >= _pointer_maps.size())
+                _pointer_maps.resize_uninitialized(allocator, index + 1);
+            _pointer_maps[index] = pointer_maps[index];
+        }
+    }
+
+    _cur_generation = cur_generation;
+    _peak_heap_size = _heap_size;
+    update_heap_threshold(0);
+}
+
+void lauf::memory::add_segments(page_allocator& allocator, std::uint32_t first, std::size_t size)
+{
+    assert(size > UINT32_MAX);
+    auto count = std::uint32_t((size + max_segment_size - 1) / max_segment_size);
+    auto rest  = std::uint32_t(_allocations.size());
+    _allocations.reserve(allocator, _allocations.size() + count - 1);
+
+    auto& first_segment = _allocations[first];
+    first_segment.size  = std::uint32_t(max_segment_size);
+    first_segment.split = allocation_split::split_first;
+
+    for (auto segment = std::uint32_t(1); segment != count; ++segment)
+    {
+        auto offset           = segment * max_segment_size;
+        auto alloc            = first_segment;
+        alloc.ptr             = static_cast<unsigned char*>(first_segment.ptr) + offset;
+        alloc.size            = std::uint32_t(std::min(max_segment_size, size - offset));
+        alloc.split           = segment + 1 == count ? allocation_split::split_last
+                                                     : allocation_split::split_middle;
+        // The elements of a pointer map need not line up with the segment.
+        alloc.has_pointer_map = false;
+
+        gc_track_new(allocator, alloc, rest + segment - 1);
+        _allocations.push_back_unchecked(alloc);
+    }
+
+    _segments.push_back(allocator, {size, first, rest, count});
+}
+
+lauf_runtime_address lauf::memory::new_segmented_allocation(page_allocator& allocator,
+                                                            allocation alloc, std::size_t size)
+{
+    if (LAUF_LIKELY(size <= UINT32_MAX))
+    {
+        alloc.size = std::uint32_t(size);
+        return new_allocation(allocator, alloc);
+    }
+
+    auto is_heap = alloc.source == allocation_source::heap_memory;
+    if (is_heap)
+    {
+        // The garbage collector can't free split allocations.
+        alloc.gc = gc_tracking::reachable_explicit;
+
+        // new_allocation() only counts unsplit allocations towards the heap size.
+        _heap_size += size;
+        ++_heap_count;
+        if (_heap_size > _peak_heap_size)
+            _peak_heap_size = _heap_size;
+    }
+
+    // As the segments are explicitly reachable, they are roots of every collection.
+    // Unless a pointer map is set, they are scanned conservatively.
+    alloc.split = allocation_split::split_first;
+    auto addr   = new_allocation(allocator, alloc);
+    add_segments(allocator, addr.allocation, size);
+    return addr;
+}
+
+bool lauf::memory::set_pointer_map(page_allocator& allocator, const segment_list& segments,
+                                   pointer_map map)
+{
+    if (map.mask != 0
+        && !lauf::is_aligned(_allocations[segments.first].ptr, alignof(lauf_runtime_value)))
+        return false;
+
+    // The segments need not start at an element boundary, so we rotate the mask such that bit 0
+    // is the first value of the segment.
+    auto element_words = std::size_t(map.element_words);
+    for (auto segment = std::uint32_t(0); segment != segments.count; ++segment)
+    {
+        auto shift = segment * (max_segment_size / sizeof(lauf_runtime_value)) % element_words;
+        auto mask  = std::uint64_t(map.mask);
+        if (shift != 0)
+            mask = ((mask >> shift) | (mask << (element_words - shift)))
+                   & ((std::uint64_t(1) << element_words) - 1);
+
+        auto segment_map = map;
+        segment_map.mask = mask & ((std::uint64_t(1) << 56) - 1);
+        set_pointer_map(allocator, segments[segment], segment_map);
+    }
+    return true;
+}
+
+void lauf::memory::disable_scanning(page_allocator& allocator, std::uint32_t index)
+{
+    // A pointer map without addresses means it is not scanned at all.
+    if (auto segments = get_segments(index))
+        set_pointer_map(allocator, *segments, {1, 0});
+    else
+        set_pointer_map(allocator, index, {1, 0});
+}
+
+lauf_runtime_address lauf::memory::offset_address(lauf_runtime_address addr,
+                                                  lauf_sint           offset) const
+{
+    auto segments = addr.allocation < _allocations.size() ? get_segments(addr.allocation) : nullptr;
+    if (segments == nullptr)
+    {
+        lauf_sint result;
+        auto      overflow = __builtin_add_overflow(lauf_sint(addr.offset), offset, &result);
+        if (overflow || result < 0 || result > UINT32_MAX)
+            result = UINT32_MAX;
+        return {addr.allocation, addr.generation, std::uint32_t(result)};
+    }
+
+    // We compute the offset in the entire allocation and find the segment that contains it.
+    auto      segment = segments->segment_of(addr.allocation);
+    lauf_sint result;
+    auto      overflow = __builtin_add_overflow(lauf_sint(segment * max_segment_size + addr.offset),
+                                                offset, &result);
+    if (overflow || result < 0 || std::size_t(result) > segments->size)
+        return {addr.allocation, addr.generation, UINT32_MAX};
+
+    // The end of the allocation is the end of the last segment.
+    segment = std::min(std::uint32_t(std::size_t(result) / max_segment_size), segments->count - 1);
+    return {(*segments)[segment], addr.generation,
+            std::uint32_t(std::size_t(result) - segment * max_segment_size)};
+}
+
+void lauf::memory::free_segments(page_allocator& allocator, const segment_list* segments)
+{
+    auto list = *segments;
+    if (_allocations[list.first].source == allocation_source::heap_memory)
+    {
+        _heap_size -= list.size;
+        --_heap_count;
+    }
+
+    for (auto segment = std::uint32_t(0); segment != list.count; ++segment)
+        free(allocator, list[segment]);
+
+    // The order of the lists doesn't matter.
+    _segments[std::size_t(segments - _segments.begin())] = _segments.back();
+    _segments.pop_back();
+}
+
+lauf_runtime_address lauf::memory::new_file_mapping(page_allocator& allocator, allocation alloc,
+                                                    std::size_t size)
+{
+    auto addr = new_segmented_allocation(allocator, alloc, size);
+    // The file is data, so the garbage collector doesn't need to look at it.
+    disable_scanning(allocator, std::uint32_t(addr.allocation));
+
+    _file_mappings.push_back(allocator, {alloc.ptr, size, std::uint32_t(addr.allocation)});
+    return addr;
+}
+
+bool lauf::memory::unmap_file(page_allocator& allocator, lauf_runtime_address addr)
+{
+    auto alloc = try_get(addr);
+    if (alloc == nullptr || alloc->status == allocation_status::freed)
+        return false;
+
+    auto segments = get_segments(addr.allocation);
+    auto first    = segments != nullptr ? segments->first : std::uint32_t(addr.allocation);
+    for (auto& mapping : _file_mappings)
+        if (mapping.allocation == first)
+        {
+            if (mapping.size > 0)
+                ::munmap(mapping.ptr, mapping.size);
+
+            if (segments != nullptr)
+                free_segments(allocator, segments);
+            else
+                free(allocator, first);
+
+            mapping = _file_mappings.back();
+            _file_mappings.pop_back();
+            return true;
+        }
+
+    return false;
 }
 
 const void* lauf_runtime_get_const_ptr(lauf_runtime_process* p, lauf_runtime_address addr,
@@ -103,7 +484,10 @@ void* lauf_runtime_get_mut_ptr(lauf_runtime_process* p, lauf_runtime_address add
                                lauf_asm_layout layout)
 {
     if (auto alloc = p->memory.try_get(addr); alloc != nullptr && !lauf::is_const(alloc->source))
+    {
+        p->memory.write_barrier(p->vm->page_allocator, addr.allocation);
         return const_cast<void*>(lauf::checked_offset(*alloc, addr, layout));
+    }
     else
         return nullptr;
 }
@@ -116,10 +500,25 @@ bool lauf_runtime_get_address(lauf_runtime_process* p, lauf_runtime_address* all
         return false;
 
     auto offset = static_cast<const unsigned char*>(ptr) - static_cast<unsigned char*>(alloc->ptr);
-    if (offset < 0 || offset >= alloc->size)
+    if (offset >= 0 && offset < alloc->size)
+    {
+        allocation->offset = std::uint32_t(offset);
+        return true;
+    }
+
+    // The pointer can be in a different segment of the allocation.
+    auto segments = p->memory.get_segments(allocation->allocation);
+    if (segments == nullptr)
         return false;
 
-    allocation->offset = std::uint32_t(offset);
+    offset = static_cast<const unsigned char*>(ptr)
+             - static_cast<unsigned char*>(p->memory[segments->first].ptr);
+    if (offset < 0 || std::size_t(offset) >= segments->size)
+        return false;
+
+    auto segment           = std::size_t(offset) / lauf::max_segment_size;
+    allocation->allocation = (*segments)[segment];
+    allocation->offset     = std::uint32_t(std::size_t(offset) - segment * lauf::max_segment_size);
     return true;
 }
 
@@ -182,8 +581,17 @@ bool lauf_runtime_get_allocation(lauf_runtime_process* p, lauf_runtime_address a
     if (alloc == nullptr)
         return false;
 
-    result->ptr  = alloc->ptr;
-    result->size = alloc->size;
+    if (auto segments = p->memory.get_segments(addr.allocation))
+    {
+        // We describe the entire allocation, not just the segment.
+        result->ptr  = p->memory[segments->first].ptr;
+        result->size = segments->size;
+    }
+    else
+    {
+        result->ptr  = alloc->ptr;
+        result->size = alloc->size;
+    }
 
     if (lauf::is_usable(alloc->status))
         result->permission
@@ -226,15 +634,13 @@ lauf_runtime_address lauf_runtime_add_static_const_allocation(lauf_runtime_proce
 
     // Runtime check ensures its not written.
     alloc.ptr = const_cast<void*>(ptr);
-    // If bigger than 32bit, only the lower parts are addressable.
-    alloc.size = std::uint32_t(size);
 
     alloc.source     = lauf::allocation_source::static_const_memory;
     alloc.status     = lauf::allocation_status::allocated;
     alloc.gc         = lauf::gc_tracking::reachable_explicit;
     alloc.generation = p->memory.cur_generation();
 
-    return p->memory.new_allocation(p->vm->page_allocator, alloc);
+    return p->memory.new_segmented_allocation(p->vm->page_allocator, alloc, size);
 }
 
 lauf_runtime_address lauf_runtime_add_static_mut_allocation(lauf_runtime_process* p, void* ptr,
@@ -243,71 +649,129 @@ lauf_runtime_address lauf_runtime_add_static_mut_allocation(lauf_runtime_process
     lauf::allocation alloc;
 
     alloc.ptr = ptr;
-    // If bigger than 32bit, only the lower parts are addressable.
-    alloc.size = std::uint32_t(size);
 
     alloc.source     = lauf::allocation_source::static_mut_memory;
     alloc.status     = lauf::allocation_status::allocated;
     alloc.gc         = lauf::gc_tracking::reachable_explicit;
     alloc.generation = p->memory.cur_generation();
 
-    return p->memory.new_allocation(p->vm->page_allocator, alloc);
+    return p->memory.new_segmented_allocation(p->vm->page_allocator, alloc, size);
 }
 
 lauf_runtime_address lauf_runtime_add_heap_allocation(lauf_runtime_process* p, void* ptr,
                                                       size_t size)
 {
     auto alloc = lauf::make_heap_alloc(ptr, size, p->memory.cur_generation());
-    return p->memory.new_allocation(p->vm->page_allocator, alloc);
+    return p->memory.new_segmented_allocation(p->vm->page_allocator, alloc, size);
 }
 
 bool lauf_runtime_leak_heap_allocation(lauf_runtime_process* p, lauf_runtime_address addr)
 {
     auto alloc = p->memory.try_get(addr);
     if (alloc == nullptr || !lauf::can_be_freed(alloc->status)
-        || alloc->source != lauf::allocation_source::heap_memory
-        || alloc->split != lauf::allocation_split::unsplit)
+        || alloc->source != lauf::allocation_source::heap_memory)
         return false;
-    alloc->status = lauf::allocation_status::freed;
+
+    auto vm = p->vm;
+    if (alloc->split != lauf::allocation_split::unsplit)
+    {
+        // Of the split allocations, only the segments of one can be freed, all at once.
+        auto segments = p->memory.get_segments(addr.allocation);
+        if (segments == nullptr)
+            return false;
+
+        // The slab allocator frees everything at the end of the process, unless we tell it not to.
+        if (vm->uses_slab_allocator())
+            vm->slab_allocator.leak(vm->page_allocator, p->memory[segments->first].ptr);
+        p->memory.free_segments(vm->page_allocator, segments);
+        return true;
+    }
+
+    if (vm->uses_slab_allocator())
+        vm->slab_allocator.leak(vm->page_allocator, alloc->ptr);
+    p->memory.free(vm->page_allocator, addr.allocation);
     return true;
 }
 
-size_t lauf_runtime_gc(lauf_runtime_process* p)
+lauf_runtime_address lauf_runtime_map_file(lauf_runtime_process* p, const char* path,
+                                           lauf_runtime_permission perms)
 {
-    auto                                marker = p->vm->get_marker();
-    lauf::array_list<lauf::allocation*> pending_allocations;
+    if ((perms & LAUF_RUNTIME_PERM_READ) == 0)
+        return lauf_runtime_address_null;
 
-    auto mark_reachable = [&](lauf::allocation* alloc) {
-        if (alloc->status != lauf::allocation_status::freed
-            && alloc->gc == lauf::gc_tracking::unreachable)
-        {
-            // It is a not freed allocation that we didn't know was reachable yet, add it.
-            alloc->gc = lauf::gc_tracking::reachable;
-            pending_allocations.push_back(*p->vm, alloc);
-        }
-    };
-    auto process_reachable_memory = [&](lauf::allocation* alloc) {
-        if (alloc->size < sizeof(lauf_runtime_address) || alloc->is_gc_weak)
-            return;
-
-        // Assume the allocation contains an array of values.
-        // For that we need to align the pointer properly.
-        // (We've done a size check already, so the initial offset is fine)
-        auto offset = lauf::align_offset(alloc->ptr, alignof(lauf_runtime_value));
-        auto ptr    = reinterpret_cast<lauf_runtime_value*>(static_cast<unsigned char*>(alloc->ptr)
-                                                         + offset);
-
-        for (auto end = ptr + (alloc->size - offset) / sizeof(lauf_runtime_value); ptr != end;
-             ++ptr)
-        {
-            auto ptr_alloc = p->memory.try_get(ptr->as_address);
-            if (ptr_alloc != nullptr && ptr->as_address.offset <= ptr_alloc->size)
-                mark_reachable(ptr_alloc);
-        }
-    };
+    auto fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return lauf_runtime_address_null;
+
+    struct stat info;
+    if (::fstat(fd, &info) != 0 || !S_ISREG(info.st_mode))
+    {
+        ::close(fd);
+        return lauf_runtime_address_null;
+    }
+
+    auto  size = static_cast<std::size_t>(info.st_size);
+    void* ptr  = nullptr;
+    if (size > 0)
+    {
+        // The mapping is private, so writes don't change the file.
+        auto prot = (perms & LAUF_RUNTIME_PERM_WRITE) != 0 ? PROT_READ | PROT_WRITE : PROT_READ;
+        ptr       = ::mmap(nullptr, size, prot, MAP_PRIVATE, fd, 0);
+    }
+    // The mapping stays valid after closing the file.
+    ::close(fd);
+    if (ptr == MAP_FAILED) // NOLINT: macro
+        return lauf_runtime_address_null;
+
+    lauf::allocation alloc;
+    alloc.ptr        = ptr;
+    alloc.source     = (perms & LAUF_RUNTIME_PERM_WRITE) != 0
+                           ? lauf::allocation_source::static_mut_memory
+                           : lauf::allocation_source::static_const_memory;
+    alloc.status     = lauf::allocation_status::allocated;
+    alloc.gc         = lauf::gc_tracking::reachable_explicit;
+    alloc.generation = p->memory.cur_generation();
+
+    return p->memory.new_file_mapping(p->vm->page_allocator, alloc, size);
+}
+
+bool lauf_runtime_unmap_file(lauf_runtime_process* p, lauf_runtime_address addr)
+{
+    return p->memory.unmap_file(p->vm->page_allocator, addr);
+}
+
+std::size_t lauf::memory::gc_mark_reachable(lauf_runtime_process* p, lauf_runtime_address addr)
+{
+    auto alloc = try_get(addr);
+    if (alloc != nullptr && addr.offset <= alloc->size
+        && alloc->status != lauf::allocation_status::freed
+        && alloc->gc == lauf::gc_tracking::unreachable
+        // A minor collection only cares about young allocations.
+        && (_gc_phase != gc_phase::minor || alloc->is_gc_young))
+    {
+        // It is a not freed allocation that we didn't know was reachable yet, add it.
+        alloc->gc = lauf::gc_tracking::reachable;
+        _gc_worklist.push_back(p->vm->page_allocator, addr.allocation);
+    }
+
+    return sizeof(lauf_runtime_value);
+}
+
+std::size_t lauf::memory::gc_scan(lauf_runtime_process* p, const allocation& alloc,
+                                  const pointer_map* map)
+{
+    return scan_allocation(alloc, map, [&](lauf_runtime_address addr) {
+        return gc_mark_reachable(p, addr);
+    });
+}
+
+std::size_t lauf::memory::gc_scan_stacks(lauf_runtime_process* p)
+{
+    auto work = std::size_t(0);
 
     // Mark the current fiber as reachable.
-    mark_reachable(&p->memory[p->cur_fiber->handle_allocation]);
+    if (p->cur_fiber != nullptr)
+        work += gc_mark_reachable(p, lauf_runtime_get_fiber_handle(p->cur_fiber));
 
     // Mark allocations reachable by addresses in the vstack and call stack as reachable.
     // We allow the stacks from all fibers, even unreachable ones.
@@ -316,20 +780,22 @@ size_t lauf_runtime_gc(lauf_runtime_process* p)
     for (auto fiber = lauf_runtime_iterate_fibers(p); fiber != nullptr;
          fiber      = lauf_runtime_iterate_fibers_next(fiber))
     {
+        // A fiber that is done has nothing on its stacks anymore.
+        if (fiber->status == lauf_runtime_fiber::done)
+            continue;
+
+        // Only a running fiber has its state in the registers, not in the suspension point.
+        auto uses_regs = fiber == p->cur_fiber && fiber->status == lauf_runtime_fiber::running;
+
         // Iterate over the vstack.
-        for (auto cur = lauf_runtime_get_vstack_ptr(p, fiber);
+        for (auto cur = uses_regs ? p->regs.vstack_ptr : fiber->suspension_point.vstack_ptr;
              cur != lauf_runtime_get_vstack_base(fiber); ++cur)
-        {
-            auto alloc = p->memory.try_get(cur->as_address);
-            if (alloc != nullptr && cur->as_address.offset <= alloc->size)
-                mark_reachable(alloc);
-        }
+            work += gc_mark_reachable(p, cur->as_address);
 
         // Iterate over memory in the call stack.
         // This is necessary because we do not generate local allocations if their address is never
         // taken. However, they're still reachable and can contain pointers.
-        for (auto frame
-             = fiber == p->cur_fiber ? p->regs.frame_ptr : fiber->suspension_point.frame_ptr;
+        for (auto frame = uses_regs ? p->regs.frame_ptr : fiber->suspension_point.frame_ptr;
              !frame->is_trampoline_frame(); frame = frame->prev)
         {
             // We create a dummy allocation for the entire stack frame.
@@ -338,67 +804,525 @@ size_t lauf_runtime_gc(lauf_runtime_process* p)
                 = lauf::make_local_alloc(frame + 1,
                                          frame->next_offset - sizeof(lauf_runtime_stack_frame),
                                          frame->local_generation);
-            process_reachable_memory(&alloc);
+            work += gc_scan(p, alloc);
         }
     }
 
-    // Process memory from explicitly reachable allocations.
-    // This covers local allocations again, but it doesn't matter.
-    for (auto& alloc : p->memory)
+    return work;
+}
+
+std::size_t lauf::memory::gc_sweep(lauf_runtime_process* p, std::uint32_t index)
+{
+    auto& alloc       = _allocations[index];
+    auto  bytes_freed = std::size_t(0);
+
+    if (alloc.source == lauf::allocation_source::heap_memory
+        && alloc.status != lauf::allocation_status::freed
+        && alloc.split == lauf::allocation_split::unsplit
+        && alloc.gc == lauf::gc_tracking::unreachable)
+    {
+        // It is an unreachable allocation that we can free.
+        auto allocator = p->vm->heap_allocator;
+        allocator.free_alloc(allocator.user_data, alloc.ptr, alloc.size);
+        free(p->vm->page_allocator, index);
+        bytes_freed = alloc.size;
+    }
+    else if (alloc.source == lauf::allocation_source::fiber_memory
+             && alloc.status != lauf::allocation_status::freed
+             && alloc.gc == lauf::gc_tracking::unreachable)
     {
-        // Non-heap non-fiber memory should always be reachable.
-        assert(alloc.source == lauf::allocation_source::heap_memory
-               || alloc.source == lauf::allocation_source::fiber_memory
-               || alloc.gc == lauf::gc_tracking::reachable_explicit);
+        assert(alloc.split == lauf::allocation_split::unsplit);
 
-        if (alloc.gc == lauf::gc_tracking::reachable_explicit
-            && alloc.status != lauf::allocation_status::freed)
-            process_reachable_memory(&alloc);
+        // It is a fiber we can destroy.
+        lauf_runtime_fiber::destroy(p, static_cast<lauf_runtime_fiber*>(alloc.ptr));
+        assert(alloc.status == lauf::allocation_status::freed);
+    }
+
+    // Need to reset GC tracking for next GC run.
+    if (alloc.gc != lauf::gc_tracking::reachable_explicit)
+        alloc.gc = lauf::gc_tracking::unreachable;
+
+    return bytes_freed;
+}
+
+bool lauf::memory::gc_step(lauf_runtime_process* p, std::size_t budget, std::size_t& bytes_freed,
+                           std::size_t thread_count)
+{
+    gc_stats_scope stats(_gc_stats, bytes_freed);
+    auto           work = std::size_t(0);
+
+    // Starting threads only pays off for big heaps.
+    // We can only do it if the collection finishes in this step, as the process doesn't run
+    // concurrently then.
+    auto is_parallel = budget == SIZE_MAX && thread_count > 1
+                       && _allocations.size() >= parallel_gc_min_allocations;
+
+    if (_gc_phase == gc_phase::idle)
+    {
+        _gc_phase  = gc_phase::mark_roots;
+        _gc_cursor = 0;
+    }
+
+    if (_gc_phase == gc_phase::mark_roots)
+    {
+        // Explicitly reachable allocations are the roots; everything else starts out unreachable.
+        for (; _gc_cursor < _allocations.size() && work < budget; ++_gc_cursor)
+        {
+            auto& alloc = _allocations[_gc_cursor];
+            work += sizeof(allocation);
+
+            // Non-heap non-fiber memory should always be reachable.
+            assert(alloc.source == lauf::allocation_source::heap_memory
+                   || alloc.source == lauf::allocation_source::fiber_memory
+                   || alloc.gc == lauf::gc_tracking::reachable_explicit);
+
+            if (alloc.gc != lauf::gc_tracking::reachable_explicit)
+                alloc.gc = lauf::gc_tracking::unreachable;
+            else if (alloc.status != lauf::allocation_status::freed)
+                _gc_worklist.push_back(p->vm->page_allocator, _gc_cursor);
+        }
+        if (_gc_cursor < _allocations.size())
+            return false;
+
+        // We scan the stacks now, so most of the work is done incrementally.
+        // As they change, we need to scan them again at the end of marking.
+        work += gc_scan_stacks(p);
+        _gc_phase = gc_phase::mark;
+    }
+
+    if (_gc_phase == gc_phase::mark)
+    {
+        if (is_parallel)
+            work += gc_mark_parallel(p, thread_count);
+
+        // Recursively mark everything as reachable from reachable allocations.
+        while (!_gc_worklist.empty() && work < budget)
+        {
+            auto index = _gc_worklist.back();
+            _gc_worklist.pop_back();
+
+            // The allocation might have been removed or freed in the mean time.
+            if (index < _allocations.size()
+                && _allocations[index].status != lauf::allocation_status::freed)
+                work += gc_scan(p, index);
+        }
+        if (!_gc_worklist.empty())
+            return false;
+
+        // Finish marking without interruption:
+        // The stacks might refer to new allocations, and modified allocations that have been
+        // scanned already might as well.
+        gc_scan_stacks(p);
+        for (auto index : _gc_dirty)
+        {
+            if (index >= _allocations.size())
+                continue;
+
+            auto& alloc       = _allocations[index];
+            alloc.is_gc_dirty = false;
+            if (alloc.status != lauf::allocation_status::freed
+                && alloc.gc != lauf::gc_tracking::unreachable)
+                gc_scan(p, index);
+        }
+        _gc_dirty.clear(p->vm->page_allocator);
+
+        while (!_gc_worklist.empty())
+        {
+            auto index = _gc_worklist.back();
+            _gc_worklist.pop_back();
+            gc_scan(p, index);
+        }
+
+        // All allocations that survive the collection are old now, so there are no pointers from
+        // old to young allocations.
+        for (auto index : _gc_nursery)
+            if (index < _allocations.size())
+                _allocations[index].is_gc_young = false;
+        _gc_nursery.clear(p->vm->page_allocator);
+
+        _gc_phase  = gc_phase::sweep;
+        _gc_cursor = 0;
     }
 
-    // Recursively mark everything as reachable from reachable allocations.
-    while (!pending_allocations.empty())
+    assert(_gc_phase == gc_phase::sweep);
+    if (is_parallel && _gc_cursor == 0)
     {
-        auto alloc = pending_allocations.back();
-        pending_allocations.pop_back();
-        process_reachable_memory(alloc);
+        bytes_freed += gc_sweep_parallel(p, thread_count);
+        _gc_cursor = std::uint32_t(_allocations.size());
     }
 
     // Free unreachable heap memory.
-    auto allocator   = p->vm->heap_allocator;
-    auto bytes_freed = std::size_t(0);
-    for (auto& alloc : p->memory)
+    for (; _gc_cursor < _allocations.size() && work < budget; ++_gc_cursor)
     {
-        if (alloc.source == lauf::allocation_source::heap_memory
-            && alloc.status != lauf::allocation_status::freed
-            && alloc.split == lauf::allocation_split::unsplit
-            && alloc.gc == lauf::gc_tracking::unreachable)
+        work += sizeof(allocation);
+        bytes_freed += gc_sweep(p, _gc_cursor);
+    }
+    if (_gc_cursor < _allocations.size())
+        return false;
+
+    _gc_phase = gc_phase::idle;
+    ++_gc_stats.count;
+    update_heap_threshold(0);
+    return true;
+}
+
+namespace
+{
+// Indices of allocations a thread needs to scan.
+// The thread works on a private stack, and shares work in batches with other threads.
+struct gc_work_deque
+{
+    static constexpr std::size_t batch_size = 64;
+
+    std::vector<std::uint32_t> local;
+    std::mutex                 mutex;
+    std::deque<std::uint32_t>  shared;
+
+    void push(std::uint32_t index)
+    {
+        local.push_back(index);
+        if (local.size() >= 2 * batch_size)
         {
-            // It is an unreachable allocation that we can free.
-            allocator.free_alloc(allocator.user_data, alloc.ptr, alloc.size);
-            alloc.status = lauf::allocation_status::freed;
-            bytes_freed += alloc.size;
+            // Share the oldest indices, as they are the furthest away from our current work.
+            std::lock_guard lock(mutex);
+            auto end = local.begin() + std::ptrdiff_t(batch_size);
+            shared.insert(shared.end(), local.begin(), end);
+            local.erase(local.begin(), end);
         }
-        else if (alloc.source == lauf::allocation_source::fiber_memory
-                 && alloc.status != lauf::allocation_status::freed
-                 && alloc.gc == lauf::gc_tracking::unreachable)
+    }
+
+    bool pop(std::uint32_t& index)
+    {
+        if (local.empty() && !take(*this))
+            return false;
+
+        index = local.back();
+        local.pop_back();
+        return true;
+    }
+
+    // Moves a batch of shared indices from other into the local stack.
+    bool take(gc_work_deque& other)
+    {
+        std::lock_guard lock(other.mutex);
+        auto            end = other.shared.begin()
+                   + std::ptrdiff_t(std::min(other.shared.size(), batch_size));
+        if (end == other.shared.begin())
+            return false;
+
+        local.insert(local.end(), other.shared.begin(), end);
+        other.shared.erase(other.shared.begin(), end);
+        return true;
+    }
+};
+
+template <typename Fn>
+void run_on_threads(std::size_t thread_count, Fn fn)
+{
+    std::vector<std::thread> threads;
+    threads.reserve(thread_count - 1);
+    for (auto i = std::size_t(1); i < thread_count; ++i)
+        threads.emplace_back(fn, i);
+    fn(std::size_t(0));
+    for (auto& thread : threads)
+        thread.join();
+}
+} // namespace
+
+std::size_t lauf::memory::gc_mark_parallel(lauf_runtime_process* p, std::size_t thread_count)
+{
+    // Threads can't modify the allocations they don't own, so marks are kept in a bitmap.
+    std::vector<std::atomic<std::uint64_t>> marks((_allocations.size() + 63) / 64);
+    std::vector<gc_work_deque>              deques(thread_count);
+    std::atomic<std::size_t>                work(0);
+
+    for (auto i = std::size_t(0); i != _gc_worklist.size(); ++i)
+        deques[i % thread_count].local.push_back(_gc_worklist[i]);
+    _gc_worklist.clear(p->vm->page_allocator);
+
+    // Marking is finished once all threads are out of work.
+    // As only the owning thread adds work to its deque, no thread can produce more work then.
+    std::atomic<std::size_t> idle_count(0);
+
+    run_on_threads(thread_count, [&](std::size_t thread_idx) {
+        auto& self        = deques[thread_idx];
+        auto  thread_work = std::size_t(0);
+        auto  mark        = [&](lauf_runtime_address addr) {
+            auto alloc = try_get(addr);
+            if (alloc != nullptr && addr.offset <= alloc->size
+                && alloc->status != lauf::allocation_status::freed
+                && alloc->gc == lauf::gc_tracking::unreachable)
+            {
+                auto bit = std::uint64_t(1) << (addr.allocation % 64);
+                if ((marks[addr.allocation / 64].fetch_or(bit, std::memory_order_relaxed) & bit)
+                    == 0)
+                    self.push(addr.allocation);
+            }
+            return sizeof(lauf_runtime_value);
+        };
+        auto steal = [&] {
+            // We're not idle while stealing, as we might get work.
+            --idle_count;
+            for (auto i = std::size_t(1); i < thread_count; ++i)
+                if (self.take(deques[(thread_idx + i) % thread_count]))
+                    return true;
+            ++idle_count;
+            return false;
+        };
+
+        while (true)
         {
-            assert(alloc.split == lauf::allocation_split::unsplit);
+            auto index = std::uint32_t(0);
+            if (!self.pop(index))
+            {
+                ++idle_count;
+                for (auto attempt = 0; idle_count < thread_count && !steal(); ++attempt)
+                {
+                    // Back off, so we don't take time away from threads that have work,
+                    // in case there are more threads than cores.
+                    if (attempt < 16)
+                        std::this_thread::yield();
+                    else
+                        std::this_thread::sleep_for(std::chrono::microseconds(50));
+                }
+                if (!self.pop(index))
+                    break;
+            }
+
+            auto& alloc = _allocations[index];
+            if (alloc.status != lauf::allocation_status::freed)
+                thread_work += scan_allocation(alloc,
+                                               alloc.has_pointer_map ? &_pointer_maps[index]
+                                                                     : nullptr,
+                                               mark);
+        }
 
-            // It is a fiber we can destroy.
-            lauf_runtime_fiber::destroy(p, static_cast<lauf_runtime_fiber*>(alloc.ptr));
-            assert(alloc.status == lauf::allocation_status::freed);
+        work += thread_work;
+    });
+
+    for (auto word = std::size_t(0); word != marks.size(); ++word)
+        for (auto bits = marks[word].load(std::memory_order_relaxed); bits != 0; bits &= bits - 1)
+            _allocations[word * 64 + std::size_t(__builtin_ctzll(bits))].gc
+                = lauf::gc_tracking::reachable;
+
+    return work;
+}
+
+std::size_t lauf::memory::gc_sweep_parallel(lauf_runtime_process* p, std::size_t thread_count)
+{
+    // The allocator of the VM doesn't need to be thread-safe, unless it is malloc.
+    auto allocator        = p->vm->heap_allocator;
+    auto free_in_parallel = allocator.free_alloc == lauf_vm_malloc_allocator.free_alloc;
+
+    // Each thread handles a range of the allocation table and remembers what needs to be freed.
+    // Updating the table itself and destroying fibers is done afterwards.
+    struct range_result
+    {
+        std::vector<std::uint32_t> heap;
+        std::vector<std::uint32_t> fibers;
+        std::size_t                bytes_freed = 0;
+    };
+    std::vector<range_result> results(thread_count);
+
+    auto range_size = (_allocations.size() + thread_count - 1) / thread_count;
+    run_on_threads(thread_count, [&](std::size_t thread_idx) {
+        auto& result = results[thread_idx];
+        auto  begin  = thread_idx * range_size;
+        auto  end    = std::min(begin + range_size, _allocations.size());
+        for (auto index = begin; index < end; ++index)
+        {
+            auto& alloc = _allocations[index];
+            if (alloc.source == lauf::allocation_source::heap_memory
+                && alloc.status != lauf::allocation_status::freed
+                && alloc.split == lauf::allocation_split::unsplit
+                && alloc.gc == lauf::gc_tracking::unreachable)
+            {
+                if (free_in_parallel)
+                    allocator.free_alloc(allocator.user_data, alloc.ptr, alloc.size);
+                result.heap.push_back(std::uint32_t(index));
+                result.bytes_freed += alloc.size;
+            }
+            else if (alloc.source == lauf::allocation_source::fiber_memory
+                     && alloc.status != lauf::allocation_status::freed
+                     && alloc.gc == lauf::gc_tracking::unreachable)
+            {
+                result.fibers.push_back(std::uint32_t(index));
+            }
+            else if (alloc.gc != lauf::gc_tracking::reachable_explicit)
+            {
+                // Need to reset GC tracking for next GC run.
+                alloc.gc = lauf::gc_tracking::unreachable;
+            }
         }
+    });
 
-        // Need to reset GC tracking for next GC run.
-        if (alloc.gc != lauf::gc_tracking::reachable_explicit)
-            alloc.gc = lauf::gc_tracking::unreachable;
+    auto bytes_freed = std::size_t(0);
+    for (auto& result : results)
+    {
+        for (auto index : result.heap)
+        {
+            auto& alloc = _allocations[index];
+            if (!free_in_parallel)
+                allocator.free_alloc(allocator.user_data, alloc.ptr, alloc.size);
+            free(p->vm->page_allocator, index);
+        }
+        for (auto index : result.fibers)
+            lauf_runtime_fiber::destroy(p,
+                                        static_cast<lauf_runtime_fiber*>(_allocations[index].ptr));
+        bytes_freed += result.bytes_freed;
+    }
+    return bytes_freed;
+}
+
+bool lauf::memory::reserve_heap_slow(lauf_runtime_process* p, std::size_t size)
+{
+    if (_gc_min_heap_threshold != 0)
+    {
+        // A minor collection is cheaper, and might already free enough memory.
+        if (_gc_generational)
+            gc_minor(p);
+        if (_heap_size + size > _heap_threshold)
+            lauf_runtime_gc(p);
+
+        // The next collection should only happen once the heap has grown after this allocation.
+        update_heap_threshold(size);
+    }
+
+    return (_max_heap_size == 0 || _heap_size + size <= _max_heap_size)
+           && _heap_count < _max_heap_count;
+}
+
+void lauf::memory::update_heap_threshold(std::size_t additional_size)
+{
+    auto threshold = std::size_t(SIZE_MAX);
+    if (_gc_min_heap_threshold != 0)
+    {
+        auto grown = static_cast<double>(_heap_size + additional_size) * _gc_heap_growth_factor;
+        threshold  = grown >= static_cast<double>(SIZE_MAX) ? SIZE_MAX : std::size_t(grown);
+        if (threshold < _gc_min_heap_threshold)
+            threshold = _gc_min_heap_threshold;
+    }
+
+    // We need to check allocations that would exceed the maximal heap size.
+    if (_max_heap_size != 0 && threshold > _max_heap_size)
+        threshold = _max_heap_size;
+
+    _heap_threshold = threshold;
+}
+
+void lauf::memory::compact_gc_nursery()
+{
+    // We clear the young flag of every index we keep, so its duplicates are dropped.
+    auto size = std::size_t(0);
+    for (auto index : _gc_nursery)
+    {
+        if (index >= _allocations.size() || !_allocations[index].is_gc_young)
+            continue;
+
+        auto& alloc       = _allocations[index];
+        alloc.is_gc_young = false;
+        // A freed allocation doesn't need to be swept, and its slot is added again when reused.
+        if (alloc.status != lauf::allocation_status::freed)
+            _gc_nursery[size++] = index;
     }
+    _gc_nursery.shrink(size);
+
+    for (auto index : _gc_nursery)
+        _allocations[index].is_gc_young = true;
+}
+
+std::size_t lauf::memory::gc_minor(lauf_runtime_process* p)
+{
+    if (!_gc_generational || _gc_phase != gc_phase::idle)
+        return 0;
+    _gc_phase = gc_phase::minor;
 
-    p->vm->unwind(marker);
+    auto           bytes_freed = std::size_t(0);
+    gc_stats_scope stats(_gc_stats, bytes_freed);
+
+    // The roots are the stacks and old allocations that have been modified since the last
+    // collection, as only they can point to young allocations.
+    gc_scan_stacks(p);
+    for (auto index : _gc_dirty)
+    {
+        if (index >= _allocations.size() || !_allocations[index].is_gc_dirty)
+            continue;
+
+        auto& alloc       = _allocations[index];
+        alloc.is_gc_dirty = false;
+        if (alloc.status != lauf::allocation_status::freed)
+            gc_scan(p, index);
+    }
+    _gc_dirty.clear(p->vm->page_allocator);
+
+    // Young allocations might be roots as well.
+    for (auto index : _gc_nursery)
+    {
+        if (index >= _allocations.size())
+            continue;
+
+        auto& alloc = _allocations[index];
+        if (alloc.is_gc_young && alloc.gc == lauf::gc_tracking::reachable_explicit
+            && alloc.status != lauf::allocation_status::freed)
+            gc_scan(p, index);
+    }
+
+    // Recursively mark all young allocations reachable from the roots.
+    while (!_gc_worklist.empty())
+    {
+        auto index = _gc_worklist.back();
+        _gc_worklist.pop_back();
+        gc_scan(p, index);
+    }
+
+    // Free unreachable young allocations, the others become old.
+    for (auto index : _gc_nursery)
+    {
+        if (index >= _allocations.size() || !_allocations[index].is_gc_young)
+            continue;
+
+        _allocations[index].is_gc_young = false;
+        bytes_freed += gc_sweep(p, index);
+    }
+    _gc_nursery.clear(p->vm->page_allocator);
+
+    _gc_phase = gc_phase::idle;
+    ++_gc_stats.count;
+    update_heap_threshold(0);
     return bytes_freed;
 }
 
+size_t lauf_runtime_gc(lauf_runtime_process* p)
+{
+    auto bytes_freed = std::size_t(0);
+
+    // A collection that is already in progress does not free allocations that became unreachable
+    // after it started, so we finish it and do a full one afterwards.
+    auto thread_count = p->vm->gc_thread_count;
+    if (thread_count == 0)
+        thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+
+    if (p->memory.is_gc_in_progress())
+        p->memory.gc_step(p, SIZE_MAX, bytes_freed, thread_count);
+    p->memory.gc_step(p, SIZE_MAX, bytes_freed, thread_count);
+
+    return bytes_freed;
+}
+
+size_t lauf_runtime_gc_minor(lauf_runtime_process* p)
+{
+    return p->memory.gc_minor(p);
+}
+
+bool lauf_runtime_gc_step(lauf_runtime_process* p, size_t budget_bytes, size_t* bytes_freed)
+{
+    auto freed  = std::size_t(0);
+    auto result = p->memory.gc_step(p, budget_bytes, freed);
+    if (bytes_freed != nullptr)
+        *bytes_freed = freed;
+    return result;
+}
+
 bool lauf_runtime_poison_allocation(lauf_runtime_process* p, lauf_runtime_address addr)
 {
     auto alloc = p->memory.try_get(addr);
@@ -423,12 +1347,17 @@ bool lauf_runtime_split_allocation(lauf_runtime_process* p, lauf_runtime_address
                                    lauf_runtime_address* addr1, lauf_runtime_address* addr2)
 {
     auto alloc = p->memory.try_get(addr);
-    if (alloc == nullptr || !lauf::is_usable(alloc->status) || addr.offset >= alloc->size)
+    if (alloc == nullptr || !lauf::is_usable(alloc->status) || addr.offset >= alloc->size
+        // Segments have a fixed size.
+        || p->memory.get_segments(addr.allocation) != nullptr)
         return false;
 
     // We create a new allocation as a copy, but with modified pointer and size.
     // If the original allocation was unsplit or the last split, the new allocation is the end of
     // the allocation. Otherwise, it is somewhere in the middle.
+    // The pointer map no longer matches the elements of the splits, so we scan everything.
+    alloc->has_pointer_map = false;
+
     auto new_alloc = *alloc;
     new_alloc.ptr  = static_cast<unsigned char*>(new_alloc.ptr) + addr.offset;
     new_alloc.size -= addr.offset;
@@ -465,7 +1394,10 @@ bool lauf_runtime_merge_allocation(lauf_runtime_process* p, lauf_runtime_address
         || alloc1->split == lauf::allocation_split::unsplit
         || alloc2->split == lauf::allocation_split::unsplit
         // And they must be adjacent.
-        || static_cast<unsigned char*>(alloc1->ptr) + alloc1->size != alloc2->ptr)
+        || static_cast<unsigned char*>(alloc1->ptr) + alloc1->size != alloc2->ptr
+        // Segments have a fixed size.
+        || p->memory.get_segments(addr1.allocation) != nullptr
+        || p->memory.get_segments(addr2.allocation) != nullptr)
         return false;
 
     // alloc1 grows to cover alloc2.
@@ -488,7 +1420,7 @@ bool lauf_runtime_merge_allocation(lauf_runtime_process* p, lauf_runtime_address
     }
 
     // We don't need alloc2 anymore.
-    alloc2->status = lauf::allocation_status::freed;
+    p->memory.free(p->vm->page_allocator, addr2.allocation);
     return true;
 }
 
@@ -498,6 +1430,8 @@ bool lauf_runtime_declare_reachable(lauf_runtime_process* p, lauf_runtime_addres
     if (alloc == nullptr || alloc->source != lauf::allocation_source::heap_memory)
         return false;
     alloc->gc = lauf::gc_tracking::reachable_explicit;
+    // A collection in progress needs to scan it, even if it hasn't been reachable before.
+    p->memory.write_barrier(p->vm->page_allocator, addr.allocation);
     return true;
 }
 
@@ -506,7 +1440,41 @@ bool lauf_runtime_undeclare_reachable(lauf_runtime_process* p, lauf_runtime_addr
     auto alloc = p->memory.try_get(addr);
     if (alloc == nullptr || alloc->source != lauf::allocation_source::heap_memory)
         return false;
-    alloc->gc = lauf::gc_tracking::unreachable;
+    // A collection in progress might have skipped it as it was already reachable.
+    alloc->gc = p->memory.unmarked_gc_tracking(addr.allocation);
+    return true;
+}
+
+bool lauf_runtime_set_pointer_map(lauf_runtime_process* p, lauf_runtime_address addr,
+                                  size_t element_size, uint64_t pointer_map)
+{
+    auto alloc = p->memory.try_get(addr);
+    if (alloc == nullptr || alloc->source != lauf::allocation_source::heap_memory)
+        return false;
+
+    lauf::pointer_map map;
+    if (!lauf::make_pointer_map(map, element_size, pointer_map))
+        return false;
+
+    if (alloc->split != lauf::allocation_split::unsplit)
+    {
+        // The pointer map of a segmented allocation describes all of its segments.
+        auto segments = p->memory.get_segments(addr.allocation);
+        if (segments == nullptr)
+            return false;
+
+        auto list = *segments;
+        if (!p->memory.set_pointer_map(p->vm->page_allocator, list, map))
+            return false;
+        for (auto segment = std::uint32_t(0); segment != list.count; ++segment)
+            p->memory.write_barrier(p->vm->page_allocator, list[segment]);
+        return true;
+    }
+
+    if (!p->memory.set_pointer_map(p->vm->page_allocator, addr.allocation, map))
+        return false;
+    // A collection in progress might have skipped addresses that are now considered.
+    p->memory.write_barrier(p->vm->page_allocator, addr.allocation);
     return true;
 }
 
@@ -525,6 +1493,8 @@ bool lauf_runtime_undeclare_weak(lauf_runtime_process* p, lauf_runtime_address a
     if (alloc == nullptr)
         return false;
     alloc->is_gc_weak = false;
+    // A collection in progress might have skipped its memory.
+    p->memory.write_barrier(p->vm->page_allocator, addr.allocation);
     return true;
 }
 
@@ -12,9 +12,10 @@
 #include <lauf/support/align.hpp>
 #include <lauf/support/array.hpp>
 
-typedef struct lauf_asm_program   lauf_asm_program;
-typedef struct lauf_vm            lauf_vm;
-typedef struct lauf_runtime_fiber lauf_runtime_fiber;
+typedef struct lauf_asm_program     lauf_asm_program;
+typedef struct lauf_vm              lauf_vm;
+typedef struct lauf_runtime_fiber   lauf_runtime_fiber;
+typedef struct lauf_runtime_process lauf_runtime_process;
 
 //=== allocation ===//
 namespace lauf
@@ -77,6 +78,38 @@ enum class gc_tracking : std::uint8_t
     reachable_explicit,
 };
 
+// Which words of an allocation can contain addresses, for precise garbage collection.
+// The allocation is an array of elements consisting of `element_words` values.
+struct pointer_map
+{
+    std::uint64_t element_words : 8;
+    // Bit i is set if the i-th value of an element can contain an address.
+    std::uint64_t mask : 56;
+};
+static_assert(sizeof(pointer_map) == sizeof(std::uint64_t));
+
+// Returns false if the pointer map cannot be represented.
+constexpr bool make_pointer_map(pointer_map& result, std::size_t element_size,
+                                std::uint64_t mask)
+{
+    if (mask == 0)
+    {
+        // The element size doesn't matter if it doesn't contain addresses.
+        result = {1, 0};
+        return true;
+    }
+
+    auto element_words = element_size / sizeof(lauf_runtime_value);
+    if (element_size % sizeof(lauf_runtime_value) != 0 || element_words > 56
+        || (mask >> element_words) != 0)
+        return false;
+
+    // The masks are no-ops due to the checks above.
+    result.element_words = element_words & 0xFF;
+    result.mask          = mask & ((std::uint64_t(1) << 56) - 1);
+    return true;
+}
+
 struct allocation
 {
     void*             ptr;
@@ -87,6 +120,13 @@ struct allocation
     allocation_split  split : 2      = allocation_split::unsplit;
     gc_tracking       gc : 2         = gc_tracking::unreachable;
     bool              is_gc_weak : 1 = false;
+    // allocation has been modified while the GC was marking, or it is old and has been modified
+    // since the last collection.
+    bool is_gc_dirty : 1 = false;
+    // allocation has been created since the last collection.
+    bool is_gc_young : 1 = false;
+    // allocation has an entry in the pointer map table, otherwise every word is scanned.
+    bool has_pointer_map : 1 = false;
 
     constexpr void* unchecked_offset(std::uint32_t offset) const
     {
@@ -129,6 +169,44 @@ constexpr lauf::allocation make_fiber_alloc(lauf_runtime_fiber* f)
     return alloc;
 }
 
+// Allocations whose size doesn't fit into the 32bit offset of an address are split into segments
+// of that size, except for the last one.
+constexpr std::size_t max_segment_size = std::size_t(1) << 31;
+
+// The allocations that make up the segments of an allocation.
+struct segment_list
+{
+    // The size of the entire allocation.
+    std::size_t   size;
+    std::uint32_t first;
+    // The remaining segments are the allocations [rest, rest + count - 1).
+    std::uint32_t rest;
+    std::uint32_t count;
+
+    std::uint32_t operator[](std::size_t segment) const
+    {
+        return segment == 0 ? first : std::uint32_t(rest + segment - 1);
+    }
+
+    // Returns count if the allocation isn't one of the segments.
+    std::uint32_t segment_of(std::uint32_t index) const
+    {
+        if (index == first)
+            return 0;
+        else if (index >= rest && index - rest < count - 1)
+            return index - rest + 1;
+        else
+            return count;
+    }
+};
+
+// Memory of a file mapped by lauf_runtime_map_file().
+struct file_mapping
+{
+    void*         ptr;
+    std::size_t   size;
+    std::uint32_t allocation;
+};
 } // namespace lauf
 
 namespace lauf
@@ -163,6 +241,29 @@ inline const void* checked_offset(lauf::allocation alloc, lauf_runtime_address a
 
 namespace lauf
 {
+enum class gc_phase : std::uint8_t
+{
+    // No collection is in progress.
+    idle,
+    // Doing a minor collection of young allocations.
+    minor,
+    // Collecting the explicitly reachable allocations as roots.
+    mark_roots,
+    // Tracing allocations reachable from the roots.
+    mark,
+    // Freeing unreachable allocations.
+    sweep,
+};
+
+// Totals over all collections of a process.
+struct gc_stats
+{
+    // The number of collections that have finished.
+    std::size_t   count       = 0;
+    std::size_t   bytes_freed = 0;
+    std::uint64_t pause_ns    = 0;
+};
+
 /// The memory of a process.
 class memory
 {
@@ -201,7 +302,35 @@ public:
 
     lauf_runtime_address new_allocation(page_allocator& allocator, allocation alloc)
     {
+        if (alloc.source == lauf::allocation_source::heap_memory
+            && alloc.split == lauf::allocation_split::unsplit)
+        {
+            _heap_size += alloc.size;
+            ++_heap_count;
+            if (_heap_size > _peak_heap_size)
+                _peak_heap_size = _heap_size;
+        }
+
+        // Try to reuse the slot of a freed allocation first.
+        while (!_free_slots.empty())
+        {
+            auto index = _free_slots.back();
+            _free_slots.pop_back();
+
+            // The slot might have been removed by remove_freed() or reused in the mean time.
+            if (index >= _allocations.size()
+                || _allocations[index].status != lauf::allocation_status::freed)
+                continue;
+
+            // We bump the generation, so addresses of the previous allocation are rejected.
+            alloc.generation = std::uint8_t(_allocations[index].generation + 1);
+            gc_track_new(allocator, alloc, index);
+            _allocations[index] = alloc;
+            return {index, alloc.generation, 0};
+        }
+
         auto index = _allocations.size();
+        gc_track_new(allocator, alloc, std::uint32_t(index));
         _allocations.push_back(allocator, alloc);
         return {std::uint32_t(index), alloc.generation, 0};
     }
@@ -233,6 +362,130 @@ public:
         return alloc;
     }
 
+    // Marks the allocation as freed and allows its slot to be reused by new_allocation().
+    void free(page_allocator& allocator, std::uint32_t index)
+    {
+        auto& alloc = _allocations[index];
+        if (alloc.source == lauf::allocation_source::heap_memory
+            && alloc.split == lauf::allocation_split::unsplit)
+        {
+            _heap_size -= alloc.size;
+            --_heap_count;
+        }
+
+        alloc.status = lauf::allocation_status::freed;
+        _free_slots.push_back(allocator, index);
+    }
+
+    //=== segmented allocations ===//
+    // Adds an allocation of the given size, ignoring alloc.size.
+    // If it is too big for a single allocation, it is split into segments.
+    lauf_runtime_address new_segmented_allocation(page_allocator& allocator, allocation alloc,
+                                                  std::size_t size);
+
+    bool has_segments() const
+    {
+        return !_segments.empty();
+    }
+
+    // Returns the segments the allocation belongs to, or nullptr if it isn't a segment.
+    const segment_list* get_segments(std::uint32_t index) const
+    {
+        // Only split allocations can be segments.
+        if (LAUF_LIKELY(_allocations[index].split == allocation_split::unsplit))
+            return nullptr;
+
+        for (auto& segments : _segments)
+            if (segments.segment_of(index) != segments.count)
+                return &segments;
+        return nullptr;
+    }
+
+    // Moves the address by offset bytes, which can move it into a different segment.
+    // If the result is outside of the allocation, its offset is UINT32_MAX.
+    lauf_runtime_address offset_address(lauf_runtime_address addr, lauf_sint offset) const;
+
+    // Frees all segments of an allocation.
+    void free_segments(page_allocator& allocator, const segment_list* segments);
+
+    //=== file mappings ===//
+    // Adds an allocation for a file mapping, which is unmapped by clear() at the latest.
+    lauf_runtime_address new_file_mapping(page_allocator& allocator, allocation alloc,
+                                          std::size_t size);
+
+    // Unmaps the file and frees its allocation, returns false if addr isn't a file mapping.
+    bool unmap_file(page_allocator& allocator, lauf_runtime_address addr);
+
+    //=== heap size ===//
+    // The number of bytes in heap allocations that haven't been freed yet.
+    std::size_t heap_size() const
+    {
+        return _heap_size;
+    }
+    // The maximal heap size so far.
+    std::size_t peak_heap_size() const
+    {
+        return _peak_heap_size;
+    }
+    // The number of heap allocations that haven't been freed yet.
+    std::size_t heap_count() const
+    {
+        return _heap_count;
+    }
+
+    // The number of entries in the nursery of the generational GC.
+    std::size_t gc_nursery_size() const
+    {
+        return _gc_nursery.size();
+    }
+
+    // Sets the quotas of the process, zero means unlimited.
+    void set_heap_limit(std::size_t max_heap_size, std::size_t max_heap_count)
+    {
+        _max_heap_size  = max_heap_size;
+        _max_heap_count = max_heap_count == 0 ? SIZE_MAX : max_heap_count;
+        update_heap_threshold(0);
+    }
+
+    // Must be called by builtins before allocating heap memory of the given size.
+    // It collects garbage if the heap grows beyond the threshold of the VM's policy.
+    // Returns false if the allocation would exceed the maximal heap size or allocation count.
+    bool reserve_heap(lauf_runtime_process* p, std::size_t size)
+    {
+        if (LAUF_LIKELY(_heap_size + size <= _heap_threshold && _heap_count < _max_heap_count))
+            return true;
+        return reserve_heap_slow(p, size);
+    }
+
+    // Returns false if the memory of the allocation isn't aligned for addresses.
+    bool set_pointer_map(page_allocator& allocator, std::uint32_t index, pointer_map map)
+    {
+        auto& alloc = _allocations[index];
+        if (map.mask != 0 && !lauf::is_aligned(alloc.ptr, alignof(lauf_runtime_value)))
+            return false;
+
+        if (index >= _pointer_maps.size())
+            _pointer_maps.resize_uninitialized(allocator, index + 1);
+        _pointer_maps[index]  = map;
+        alloc.has_pointer_map = true;
+        return true;
+    }
+
+    // Sets the pointer map of all segments, as if they were a single allocation.
+    bool set_pointer_map(page_allocator& allocator, const segment_list& segments, pointer_map map);
+
+    const pointer_map* get_pointer_map(std::uint32_t index) const
+    {
+        return _allocations[index].has_pointer_map ? &_pointer_maps[index] : nullptr;
+    }
+
+    //=== snapshot ===//
+    // Replaces the allocations created by init() with the ones of a snapshot.
+    // They must already point to the memory of this process.
+    // pointer_maps is indexed by allocation index.
+    void restore(page_allocator& allocator, const allocation* allocations, std::size_t count,
+                 const pointer_map* pointer_maps, std::uint8_t cur_generation);
+
     //=== local allocations ===//
     bool needs_to_grow(std::size_t additional_allocations) const
     {
@@ -270,9 +523,170 @@ public:
         ++_cur_generation;
     }
 
+    // This function is called after the local allocations of a frame have been freed and
+    // remove_freed() was called.
+    // Allocations that could not be removed as they weren't at the back are reused instead.
+    void recycle_freed(page_allocator& allocator, std::uint32_t first_index, std::uint32_t count)
+    {
+        for (auto index = first_index; index < first_index + count && index < _allocations.size();
+             ++index)
+            _free_slots.push_back(allocator, index);
+    }
+
+    //=== garbage collection ===//
+    const gc_stats& gc_statistics() const
+    {
+        return _gc_stats;
+    }
+
+    bool is_gc_in_progress() const
+    {
+        return _gc_phase != gc_phase::idle;
+    }
+
+    bool is_gc_marking() const
+    {
+        return _gc_phase == gc_phase::mark_roots || _gc_phase == gc_phase::mark;
+    }
+
+    // Must be called before an allocation is modified.
+    // While marking, it remembers the allocation, so its memory is scanned again.
+    // With generational GC, it remembers old allocations, as they can now point to young ones.
+    void write_barrier(page_allocator& allocator, std::uint32_t index)
+    {
+        if (LAUF_LIKELY(!_gc_generational && !is_gc_marking()))
+            return;
+
+        // Local memory is always scanned through the stacks.
+        auto& alloc = _allocations[index];
+        if (!alloc.is_gc_dirty && alloc.source != lauf::allocation_source::local_memory
+            && (is_gc_marking() || !alloc.is_gc_young))
+        {
+            alloc.is_gc_dirty = true;
+            _gc_dirty.push_back(allocator, index);
+        }
+    }
+
+    // The GC state an allocation that is neither known to be reachable nor explicitly reachable
+    // needs to have, so it survives a collection in progress.
+    gc_tracking unmarked_gc_tracking(std::uint32_t index) const
+    {
+        switch (_gc_phase)
+        {
+        case gc_phase::idle:
+        case gc_phase::minor:
+            return gc_tracking::unreachable;
+        case gc_phase::mark_roots:
+            // Allocations after the cursor will be reset anyway.
+            return index < _gc_cursor ? gc_tracking::reachable : gc_tracking::unreachable;
+        case gc_phase::mark:
+            return gc_tracking::reachable;
+        case gc_phase::sweep:
+            // Allocations before the cursor have been swept already.
+            return index < _gc_cursor ? gc_tracking::unreachable : gc_tracking::reachable;
+        }
+        return gc_tracking::unreachable;
+    }
+
+    // Performs garbage collection work of roughly budget bytes.
+    // Returns true if the collection has finished.
+    // If the budget is unlimited, marking and sweeping can use multiple threads.
+    bool gc_step(lauf_runtime_process* p, std::size_t budget, std::size_t& bytes_freed,
+                 std::size_t thread_count = 1);
+
+    // Collects young allocations only, returns the number of bytes freed.
+    std::size_t gc_minor(lauf_runtime_process* p);
+
 private:
+    // Shrinks the allocation at index first to the first segment of size bytes,
+    // and adds the remaining segments at the end.
+    void add_segments(page_allocator& allocator, std::uint32_t first, std::size_t size);
+    // Sets a pointer map, so the allocation and all of its segments are never scanned.
+    void disable_scanning(page_allocator& allocator, std::uint32_t index);
+
+    void gc_track_new(page_allocator& allocator, allocation& alloc, std::uint32_t index)
+    {
+        if (LAUF_UNLIKELY(_gc_phase != gc_phase::idle) && alloc.gc == gc_tracking::unreachable)
+            alloc.gc = unmarked_gc_tracking(index);
+
+        if (_gc_generational
+            && (alloc.source == lauf::allocation_source::heap_memory
+                || alloc.source == lauf::allocation_source::fiber_memory))
+        {
+            alloc.is_gc_young = true;
+
+            // A reused slot whose previous allocation was young is still in the nursery.
+            if (index < _allocations.size() && _allocations[index].is_gc_young)
+                return;
+
+            // Without collections, the nursery would otherwise grow with every slot that is
+            // removed by remove_freed() and added again.
+            if (LAUF_UNLIKELY(_gc_nursery.size() >= 2 * _allocations.size() + 64))
+                compact_gc_nursery();
+            _gc_nursery.push_back(allocator, index);
+        }
+    }
+    // Removes duplicate indices and indices of allocations that are freed or no longer exist.
+    void compact_gc_nursery();
+
+    std::size_t gc_mark_reachable(lauf_runtime_process* p, lauf_runtime_address addr);
+    // Scans all words of alloc unless it has a pointer map.
+    std::size_t gc_scan(lauf_runtime_process* p, const allocation& alloc,
+                        const pointer_map* map = nullptr);
+    std::size_t gc_scan(lauf_runtime_process* p, std::uint32_t index)
+    {
+        auto& alloc = _allocations[index];
+        return gc_scan(p, alloc, alloc.has_pointer_map ? &_pointer_maps[index] : nullptr);
+    }
+    std::size_t gc_scan_stacks(lauf_runtime_process* p);
+    std::size_t gc_sweep(lauf_runtime_process* p, std::uint32_t index);
+
+    bool reserve_heap_slow(lauf_runtime_process* p, std::size_t size);
+    // Computes the heap size that triggers the next automatic collection.
+    void update_heap_threshold(std::size_t additional_size);
+
+    static constexpr std::size_t parallel_gc_min_allocations = 4 * 1024;
+    // Drains the worklist.
+    std::size_t gc_mark_parallel(lauf_runtime_process* p, std::size_t thread_count);
+    // Sweeps all allocations, returns the number of bytes freed.
+    std::size_t gc_sweep_parallel(lauf_runtime_process* p, std::size_t thread_count);
+
     lauf::array<allocation> _allocations;
-    std::uint8_t            _cur_generation = 0;
+    std::size_t             _heap_size      = 0;
+    std::size_t             _heap_count     = 0;
+    std::size_t             _peak_heap_size = 0;
+    // Once the heap size would exceed it, reserve_heap() needs to do something.
+    std::size_t _heap_threshold          = SIZE_MAX;
+    std::size_t _gc_min_heap_threshold   = 0;
+    double      _gc_heap_growth_factor   = 0;
+    std::size_t _max_heap_size           = 0;
+    std::size_t _max_heap_count          = SIZE_MAX;
+    // Indexed by allocation index, but only valid for allocations that have a pointer map.
+    lauf::array<pointer_map> _pointer_maps;
+    // Indices of freed allocations whose slot can be reused.
+    // May contain stale entries, which are skipped by new_allocation().
+    lauf::array<std::uint32_t> _free_slots;
+    std::uint8_t               _cur_generation = 0;
+    // All allocations that are split into segments.
+    lauf::array<segment_list> _segments;
+    // All files mapped by the process that haven't been unmapped yet.
+    lauf::array<file_mapping> _file_mappings;
+
+    gc_phase _gc_phase = gc_phase::idle;
+    // Index of the next allocation visited by the mark_roots or sweep phase.
+    std::uint32_t _gc_cursor = 0;
+    // Indices of allocations that are reachable but haven't been scanned yet.
+    lauf::array<std::uint32_t> _gc_worklist;
+    // Indices of allocations that have been modified while marking,
+    // or old allocations that have been modified since the last collection.
+    lauf::array<std::uint32_t> _gc_dirty;
+    // Indices of young allocations, if generational GC is enabled.
+    lauf::array<std::uint32_t> _gc_nursery;
+    bool                       _gc_generational = false;
+    gc_stats                   _gc_stats;
+    // Copy-on-write mapping of the global image of the program, if it has one.
+    unsigned char* _global_image      = nullptr;
+    std::size_t    _global_image_size = 0;
 };
 } // namespace lauf
 
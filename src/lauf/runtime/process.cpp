@@ -43,7 +43,7 @@ lauf_runtime_fiber* lauf_runtime_fiber::create(lauf_runtime_process*    process,
 
 void lauf_runtime_fiber::destroy(lauf_runtime_process* process, lauf_runtime_fiber* fiber)
 {
-    process->memory[fiber->handle_allocation].status = lauf::allocation_status::freed;
+    process->memory.free(process->vm->page_allocator, fiber->handle_allocation);
 
     if (fiber->prev_fiber == nullptr)
         process->fiber_list = fiber->next_fiber;
@@ -70,6 +70,10 @@ void lauf_runtime_process::init(lauf_runtime_process* process, lauf_vm* vm,
 
     process->memory.init(vm, program);
     process->remaining_steps = vm->step_limit;
+
+    process->vstack_grow_count             = 0;
+    process->cstack_grow_count             = 0;
+    process->undefined_function_call_count = 0;
 }
 
 LAUF_NOINLINE void lauf_runtime_process::do_cleanup(lauf_runtime_process* process)
@@ -84,7 +88,9 @@ LAUF_NOINLINE void lauf_runtime_process::do_cleanup(lauf_runtime_process* proces
 
         if (alloc.source == lauf::allocation_source::heap_memory)
         {
-            if (alloc.split == lauf::allocation_split::unsplit)
+            if (vm->uses_slab_allocator())
+                ; // We free everything at once below.
+            else if (alloc.split == lauf::allocation_split::unsplit)
                 vm->heap_allocator.free_alloc(vm->heap_allocator.user_data, alloc.ptr, alloc.size);
             else if (alloc.split == lauf::allocation_split::split_first)
                 // We don't know the full size.
@@ -97,6 +103,8 @@ LAUF_NOINLINE void lauf_runtime_process::do_cleanup(lauf_runtime_process* proces
             lauf_runtime_fiber::destroy(process, static_cast<lauf_runtime_fiber*>(alloc.ptr));
         }
     }
+    if (vm->uses_slab_allocator())
+        vm->slab_allocator.clear(vm->page_allocator);
 
     process->memory.clear(vm);
 }
@@ -328,6 +336,8 @@ bool lauf_runtime_destroy_fiber(lauf_runtime_process* process, lauf_runtime_fibe
 
                 alloc.status = lauf::allocation_status::freed;
             }
+            process->memory.recycle_freed(process->vm->page_allocator,
+                                          frame_ptr->first_local_alloc, local_alloc_count);
         }
     }
 
@@ -387,3 +397,35 @@ bool lauf_runtime_increment_step(lauf_runtime_process* process)
     return true;
 }
 
+bool lauf_runtime_set_heap_limit(lauf_runtime_process* process, size_t max_heap_size,
+                                 size_t max_heap_allocations)
+{
+    auto vm_limit = process->vm->max_heap_size;
+    if (vm_limit != 0 && (max_heap_size == 0 || max_heap_size > vm_limit))
+        return false;
+
+    process->memory.set_heap_limit(max_heap_size, max_heap_allocations);
+    return true;
+}
+
+lauf_runtime_stats lauf_runtime_get_stats(lauf_runtime_process* process)
+{
+    lauf_runtime_stats result;
+
+    result.heap_size             = process->memory.heap_size();
+    result.peak_heap_size        = process->memory.peak_heap_size();
+    result.heap_allocation_count = process->memory.heap_count();
+    result.allocation_table_size = process->memory.next_index();
+
+    result.vstack_grow_count = process->vstack_grow_count;
+    result.cstack_grow_count = process->cstack_grow_count;
+    result.vm_mapped_bytes   = process->vm->page_allocator.allocated_bytes();
+
+    auto& gc              = process->memory.gc_statistics();
+    result.gc_count       = gc.count;
+    result.gc_bytes_freed = gc.bytes_freed;
+    result.gc_pause_ns    = gc.pause_ns;
+
+    result.undefined_function_call_count = process->undefined_function_call_count;
+    return result;
+}
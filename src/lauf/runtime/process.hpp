@@ -140,6 +140,11 @@ struct lauf_runtime_process
 
     std::size_t remaining_steps;
 
+    // Statistics, see lauf_runtime_get_stats().
+    std::size_t vstack_grow_count;
+    std::size_t cstack_grow_count;
+    std::size_t undefined_function_call_count;
+
     static void init(lauf_runtime_process* process, lauf_vm* vm, const lauf_asm_program* program);
 
     static void do_cleanup(lauf_runtime_process* process);
@@ -0,0 +1,949 @@
+// Copyright (C) 2022-2023 Jonathan Müller and lauf contributors
+// SPDX-License-Identifier: BSL-1.0
+
+#include <lauf/runtime/snapshot.hpp>
+
+#include <algorithm>
+#include <iterator>
+#include <lauf/asm/module.hpp>
+#include <lauf/asm/program.hpp>
+#include <lauf/runtime/process.hpp>
+#include <lauf/vm.hpp>
+#include <lauf/vm_execute.hpp>
+#include <lauf/writer.hpp>
+
+namespace
+{
+std::uint32_t alignment_of(const void* ptr)
+{
+    // We don't know the alignment that was requested, so we use the alignment the pointer has.
+    auto address = reinterpret_cast<std::uintptr_t>(ptr);
+    if (address == 0)
+        return 1;
+
+    auto shift = std::min(__builtin_ctzll(address), 12);
+    return std::uint32_t(1) << shift;
+}
+} // namespace
+
+lauf_runtime_snapshot* lauf_runtime_snapshot_process(lauf_runtime_process* process)
+{
+    // We don't know which allocations are segments of each other.
+    if (process->memory.is_gc_in_progress() || process->memory.has_segments())
+        return nullptr;
+    for (auto fiber = process->fiber_list; fiber != nullptr; fiber = fiber->next_fiber)
+        if (fiber->status == lauf_runtime_fiber::running)
+            return nullptr;
+
+    auto result             = new lauf_runtime_snapshot();
+    result->program         = process->program;
+    result->cur_generation  = process->memory.cur_generation();
+    result->remaining_steps = process->remaining_steps;
+
+    auto count = process->memory.next_index();
+    result->allocations.assign(process->memory.begin(), process->memory.end());
+    result->pointer_maps.resize(count);
+    for (auto index = std::uint32_t(0); index != count; ++index)
+    {
+        auto& alloc = process->memory[index];
+        if (auto map = process->memory.get_pointer_map(index))
+            result->pointer_maps[index] = *map;
+
+        if (alloc.source == lauf::allocation_source::heap_memory
+            && alloc.status != lauf::allocation_status::freed)
+        {
+            if (alloc.split != lauf::allocation_split::unsplit)
+            {
+                // We can't tell which parts belong to the same memory.
+                delete result;
+                return nullptr;
+            }
+
+            auto offset = result->add_data(alloc.ptr, alloc.size);
+            result->memory.push_back({index, alignment_of(alloc.ptr), offset});
+        }
+    }
+
+    // Mutable globals with a definition are owned by the process, native ones by the host.
+    lauf::for_each_global(process->program, [&](std::uint32_t index, const auto& global) {
+        auto& alloc = process->memory[index];
+        if (global.is_mutable && global.has_definition()
+            && alloc.status != lauf::allocation_status::freed)
+        {
+            auto offset = result->add_data(alloc.ptr, alloc.size);
+            result->memory.push_back({index, 1, offset});
+        }
+    });
+
+    result->chunk_size = 0;
+    result->cur_fiber  = std::size_t(-1);
+    for (auto fiber = process->fiber_list; fiber != nullptr; fiber = fiber->next_fiber)
+    {
+        if (fiber == process->cur_fiber)
+            result->cur_fiber = result->fibers.size();
+
+        lauf::snapshot_fiber snapshot;
+
+        snapshot.cstack_capacity = fiber->cstack.capacity();
+        snapshot.cstack_offset   = result->data.size();
+        snapshot.first_chunk     = result->chunks.size();
+        fiber->cstack.for_each_chunk([&](unsigned char* memory, std::size_t size) {
+            result->chunk_size = size;
+            result->add_data(memory, size);
+            result->chunks.push_back(reinterpret_cast<std::uintptr_t>(memory));
+        });
+        snapshot.chunk_count = result->chunks.size() - snapshot.first_chunk;
+
+        auto vstack_base         = fiber->vstack.base();
+        auto vstack_ptr          = fiber->status == lauf_runtime_fiber::done
+                                       ? vstack_base - fiber->root_function()->sig.output_count
+                                       : fiber->suspension_point.vstack_ptr;
+        snapshot.vstack_capacity = fiber->vstack.capacity();
+        snapshot.vstack_size     = std::size_t(vstack_base - vstack_ptr);
+        snapshot.vstack_offset
+            = result->add_data(vstack_ptr, snapshot.vstack_size * sizeof(lauf_runtime_value));
+
+        result->fibers.push_back(snapshot);
+    }
+    if (result->cur_fiber == std::size_t(-1))
+        result->cur_fiber = result->fibers.size();
+
+    return result;
+}
+
+const lauf_asm_program* lauf_runtime_snapshot_program(const lauf_runtime_snapshot* snapshot)
+{
+    return &snapshot->program;
+}
+
+void lauf_runtime_destroy_snapshot(lauf_runtime_snapshot* snapshot)
+{
+    delete snapshot;
+}
+
+bool lauf::restore_snapshot(lauf_runtime_process* process, const lauf_runtime_snapshot& snapshot)
+{
+    auto vm      = process->vm;
+    auto success = true;
+
+    // The process already has the globals, we only need to copy their contents.
+    auto allocations = snapshot.allocations;
+    for (auto index = std::uint32_t(0); index != process->memory.next_index(); ++index)
+        allocations[index].ptr = process->memory[index].ptr;
+
+    for (auto& memory : snapshot.memory)
+    {
+        auto& alloc = allocations[memory.index];
+        if (alloc.source == lauf::allocation_source::heap_memory)
+        {
+            // The alignment is only guessed from the original address, so it can be bigger than
+            // what the allocator supports and what was actually requested.
+            for (auto alignment = std::size_t(memory.alignment);; alignment /= 2)
+            {
+                alloc.ptr = vm->heap_allocator.heap_alloc(vm->heap_allocator.user_data,
+                                                          alloc.size, alignment);
+                if (alloc.ptr != nullptr || alignment <= alignof(std::max_align_t))
+                    break;
+            }
+            if (alloc.ptr == nullptr)
+            {
+                // We keep going, so the process is consistent and can be destroyed.
+                alloc.status = lauf::allocation_status::freed;
+                success      = false;
+                continue;
+            }
+        }
+
+        std::memcpy(alloc.ptr, snapshot.data.data() + memory.data_offset, alloc.size);
+    }
+
+    // The memory of the chunks of all new stacks, in the same order as snapshot.chunks.
+    std::vector<unsigned char*> new_chunks;
+    new_chunks.reserve(snapshot.chunks.size());
+    // Maps an address in the stack of the original fiber to the new one.
+    auto relocate = [&](const lauf::snapshot_fiber& fiber, const void* ptr) -> void* {
+        auto address = reinterpret_cast<std::uintptr_t>(ptr);
+        for (auto i = fiber.first_chunk; i != fiber.first_chunk + fiber.chunk_count; ++i)
+            // Pointers to the end of the chunk memory are fine as well.
+            if (snapshot.chunks[i] <= address
+                && address <= snapshot.chunks[i] + snapshot.chunk_size)
+                return new_chunks[i] + (address - snapshot.chunks[i]);
+        return nullptr;
+    };
+
+    lauf_runtime_fiber* last_fiber = nullptr;
+    for (auto& snapshot_fiber : snapshot.fibers)
+    {
+        lauf::cstack cstack;
+        cstack.init(vm->page_allocator, snapshot_fiber.cstack_capacity);
+
+        auto data = snapshot.data.data() + snapshot_fiber.cstack_offset;
+        cstack.for_each_chunk([&](unsigned char* memory, std::size_t size) {
+            assert(size == snapshot.chunk_size);
+            if (new_chunks.size() == snapshot_fiber.first_chunk + snapshot_fiber.chunk_count)
+                // The new stack can have more chunks, if the real page size is bigger.
+                return;
+
+            std::memcpy(memory, data, size);
+            data += size;
+            new_chunks.push_back(memory);
+        });
+
+        // The fiber object is at the beginning of the stack, but all its pointers are stale.
+        auto fiber    = static_cast<lauf_runtime_fiber*>(cstack.base());
+        fiber->cstack = cstack;
+
+        fiber->vstack.init(vm->page_allocator, snapshot_fiber.vstack_capacity);
+        fiber->suspension_point.vstack_ptr = fiber->vstack.base() - snapshot_fiber.vstack_size;
+        std::memcpy(fiber->suspension_point.vstack_ptr,
+                    snapshot.data.data() + snapshot_fiber.vstack_offset,
+                    snapshot_fiber.vstack_size * sizeof(lauf_runtime_value));
+
+        fiber->suspension_point.frame_ptr = static_cast<lauf_runtime_stack_frame*>(
+            relocate(snapshot_fiber, fiber->suspension_point.frame_ptr));
+        if (fiber->status == lauf_runtime_fiber::done)
+            // The frames have been popped already.
+            fiber->suspension_point.frame_ptr = &fiber->trampoline_frame;
+        for (auto frame = fiber->suspension_point.frame_ptr; !frame->is_trampoline_frame();
+             frame = frame->prev)
+            frame->prev
+                = static_cast<lauf_runtime_stack_frame*>(relocate(snapshot_fiber, frame->prev));
+
+        // We keep the order of the fiber list.
+        fiber->prev_fiber = last_fiber;
+        fiber->next_fiber = nullptr;
+        if (last_fiber != nullptr)
+            last_fiber->next_fiber = fiber;
+        else
+            process->fiber_list = fiber;
+        last_fiber = fiber;
+
+        allocations[fiber->handle_allocation].ptr = fiber;
+        if (&snapshot_fiber - snapshot.fibers.data() == std::ptrdiff_t(snapshot.cur_fiber))
+            process->cur_fiber = fiber;
+    }
+
+    // Local memory is somewhere on the stack of a fiber.
+    for (auto& alloc : allocations)
+    {
+        if (alloc.source != lauf::allocation_source::local_memory
+            || alloc.status == lauf::allocation_status::freed)
+            continue;
+
+        for (auto& snapshot_fiber : snapshot.fibers)
+            if (auto ptr = relocate(snapshot_fiber, alloc.ptr))
+            {
+                alloc.ptr = ptr;
+                break;
+            }
+    }
+
+    process->memory.restore(vm->page_allocator, allocations.data(), allocations.size(),
+                            snapshot.pointer_maps.data(), snapshot.cur_generation);
+
+    // We continue with the steps that were remaining, unless the VM has a stricter limit.
+    if (vm->step_limit == 0
+        || (snapshot.remaining_steps != 0 && snapshot.remaining_steps < vm->step_limit))
+        process->remaining_steps = snapshot.remaining_steps;
+    return success;
+}
+
+//=== serialization ===//
+namespace
+{
+constexpr char snapshot_magic[8] = {'L', 'A', 'U', 'F', 'S', 'N', 'P', '1'};
+
+// A pointer into the code of the program stored in the data of a snapshot.
+struct code_relocation
+{
+    std::uint64_t data_offset;
+    // Index of the module, or trampoline_module for lauf::trampoline_code.
+    std::uint32_t module;
+    // Index of the function in program_code.
+    std::uint32_t function;
+    // Index of the instruction, or function_pointer for a pointer to the function itself.
+    std::uint32_t inst;
+};
+constexpr auto trampoline_module = std::uint32_t(-1);
+constexpr auto function_pointer  = std::uint32_t(-1);
+
+// All functions of the program that have code, i.e. the functions and chunks of every module.
+// Pointers into the code are serialized as indices into it.
+class program_code
+{
+public:
+    explicit program_code(const lauf_asm_program& program)
+    {
+        auto add_module = [&](const lauf_asm_module* mod) {
+            auto& fns = _modules.emplace_back();
+            for (auto fn = lauf::get_functions(mod).first; fn != nullptr; fn = fn->next)
+                fns.push_back(fn);
+            for (auto chunk = lauf::get_chunks(mod).first; chunk != nullptr; chunk = chunk->next)
+                fns.push_back(chunk->fn);
+        };
+
+        add_module(program._mod);
+        if (auto extra = lauf::try_get_extra_data(program))
+            for (auto submod : extra->submodules)
+                add_module(submod.mod);
+    }
+
+    std::size_t module_count() const
+    {
+        return _modules.size();
+    }
+    std::size_t function_count(std::size_t module) const
+    {
+        return _modules[module].size();
+    }
+    const lauf_asm_function* function(std::size_t module, std::size_t function) const
+    {
+        return _modules[module][function];
+    }
+
+    // Returns false if the pointer doesn't point into the program.
+    bool index_of(const lauf_asm_function* fn, code_relocation& reloc) const
+    {
+        for (auto module = 0u; module != _modules.size(); ++module)
+            for (auto function = 0u; function != _modules[module].size(); ++function)
+                if (_modules[module][function] == fn)
+                {
+                    reloc.module   = module;
+                    reloc.function = function;
+                    reloc.inst     = function_pointer;
+                    return true;
+                }
+        return false;
+    }
+    bool index_of(const lauf_asm_inst* ip, code_relocation& reloc) const
+    {
+        if (ip >= lauf::trampoline_code && ip < std::end(lauf::trampoline_code))
+        {
+            reloc.module   = trampoline_module;
+            reloc.function = 0;
+            reloc.inst     = std::uint32_t(ip - lauf::trampoline_code);
+            return true;
+        }
+
+        for (auto module = 0u; module != _modules.size(); ++module)
+            for (auto function = 0u; function != _modules[module].size(); ++function)
+            {
+                auto fn = _modules[module][function];
+                // The return address of the last call can be one past the end.
+                if (ip >= fn->insts && ip <= fn->insts + fn->inst_count)
+                {
+                    reloc.module   = module;
+                    reloc.function = function;
+                    reloc.inst     = std::uint32_t(ip - fn->insts);
+                    return true;
+                }
+            }
+        return false;
+    }
+
+    // Returns nullptr if the indices are invalid.
+    const void* pointer_of(const code_relocation& reloc) const
+    {
+        if (reloc.module == trampoline_module)
+            return reloc.inst < std::size(lauf::trampoline_code)
+                       ? lauf::trampoline_code + reloc.inst
+                       : nullptr;
+        else if (reloc.module >= _modules.size()
+                 || reloc.function >= _modules[reloc.module].size())
+            return nullptr;
+
+        auto fn = _modules[reloc.module][reloc.function];
+        if (reloc.inst == function_pointer)
+            return fn;
+        else if (reloc.inst <= fn->inst_count)
+            return fn->insts + reloc.inst;
+        else
+            return nullptr;
+    }
+
+private:
+    std::vector<std::vector<const lauf_asm_function*>> _modules;
+};
+
+constexpr auto fiber_ip_offset
+    = offsetof(lauf_runtime_fiber, suspension_point) + offsetof(lauf::registers, ip);
+constexpr auto fiber_frame_ptr_offset
+    = offsetof(lauf_runtime_fiber, suspension_point) + offsetof(lauf::registers, frame_ptr);
+constexpr auto fiber_trampoline_offset = offsetof(lauf_runtime_fiber, trampoline_frame);
+
+template <typename T>
+T load(const lauf_runtime_snapshot& snapshot, std::size_t offset)
+{
+    T result;
+    std::memcpy(&result, snapshot.data.data() + offset, sizeof(T));
+    return result;
+}
+
+// Returns the offset in the data of a stack frame in the stack of the original fiber.
+bool frame_offset_of(const lauf_runtime_snapshot& snapshot, const lauf::snapshot_fiber& fiber,
+                     std::uintptr_t address, std::size_t& result)
+{
+    for (auto i = std::size_t(0); i != fiber.chunk_count; ++i)
+    {
+        auto chunk = snapshot.chunks[fiber.first_chunk + i];
+        if (chunk <= address && address <= chunk + snapshot.chunk_size
+            && sizeof(lauf_runtime_stack_frame) <= chunk + snapshot.chunk_size - address)
+        {
+            result = fiber.cstack_offset + i * snapshot.chunk_size + (address - chunk);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Calls f(offset, is_trampoline) for every active stack frame of the fiber and its trampoline
+// frame. The fiber must have valid stack memory.
+// Returns false if the frames are corrupted.
+template <typename Fn>
+bool for_each_frame(const lauf_runtime_snapshot& snapshot, const lauf::snapshot_fiber& fiber,
+                    Fn f)
+{
+    static_assert(sizeof(lauf_runtime_fiber) <= lauf::cstack::chunk_size());
+    auto trampoline_offset = fiber.cstack_offset + fiber_trampoline_offset;
+    // restore_snapshot() stops at the frame without a previous frame.
+    if (load<std::uintptr_t>(snapshot, trampoline_offset + offsetof(lauf_runtime_stack_frame, prev))
+        != 0)
+        return false;
+    f(trampoline_offset, true);
+
+    auto status = load<lauf_runtime_fiber::state_t>(snapshot, fiber.cstack_offset
+                                                                  + offsetof(lauf_runtime_fiber,
+                                                                             status));
+    if (status == lauf_runtime_fiber::done)
+        // The frames have been popped already.
+        return true;
+
+    auto trampoline = snapshot.chunks[fiber.first_chunk] + fiber_trampoline_offset;
+    auto frame      = load<std::uintptr_t>(snapshot, fiber.cstack_offset + fiber_frame_ptr_offset);
+    // Every frame has a different address, so there can't be more frames than that.
+    for (auto count = snapshot.data.size() / sizeof(lauf_runtime_stack_frame); frame != trampoline;
+         --count)
+    {
+        std::size_t offset;
+        if (count == 0 || !frame_offset_of(snapshot, fiber, frame, offset))
+            return false;
+
+        f(offset, false);
+        frame = load<std::uintptr_t>(snapshot, offset + offsetof(lauf_runtime_stack_frame, prev));
+    }
+    return true;
+}
+
+// Calls f(offset, is_function, is_required) for every pointer into the code that is stored in the
+// stacks of the fibers.
+// Returns false if the frames are corrupted.
+template <typename Fn>
+bool for_each_code_pointer(const lauf_runtime_snapshot& snapshot, Fn f)
+{
+    for (auto& fiber : snapshot.fibers)
+    {
+        auto status = load<lauf_runtime_fiber::state_t>(snapshot, fiber.cstack_offset
+                                                                      + offsetof(lauf_runtime_fiber,
+                                                                                 status));
+        // A fiber that is done is never resumed.
+        f(fiber.cstack_offset + fiber_ip_offset, false, status != lauf_runtime_fiber::done);
+
+        auto valid = for_each_frame(snapshot, fiber, [&](std::size_t offset, bool is_trampoline) {
+            f(offset + offsetof(lauf_runtime_stack_frame, function), true, true);
+            // The trampoline frame doesn't return anywhere.
+            f(offset + offsetof(lauf_runtime_stack_frame, return_ip), false, !is_trampoline);
+        });
+        if (!valid)
+            return false;
+    }
+
+    return true;
+}
+template <typename T>
+void write_value(lauf_writer* writer, T value)
+{
+    writer->write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+class snapshot_reader
+{
+public:
+    explicit snapshot_reader(const void* data, std::size_t size)
+    : _cur(static_cast<const unsigned char*>(data)), _end(_cur + size)
+    {}
+
+    template <typename T>
+    bool read(T& result)
+    {
+        if (std::size_t(_end - _cur) < sizeof(T))
+            return false;
+
+        std::memcpy(&result, _cur, sizeof(T));
+        _cur += sizeof(T);
+        return true;
+    }
+
+    // Reads a count of objects that each take at least the given number of bytes.
+    bool read_count(std::size_t& result, std::size_t min_size)
+    {
+        std::uint64_t count;
+        if (!read(count) || count > std::size_t(_end - _cur) / min_size)
+            return false;
+
+        result = std::size_t(count);
+        return true;
+    }
+
+    bool read_bytes(void* result, std::size_t size)
+    {
+        if (std::size_t(_end - _cur) < size)
+            return false;
+
+        std::memcpy(result, _cur, size);
+        _cur += size;
+        return true;
+    }
+
+    bool at_end() const
+    {
+        return _cur == _end;
+    }
+
+private:
+    const unsigned char* _cur;
+    const unsigned char* _end;
+};
+
+bool is_valid_range(const lauf_runtime_snapshot& snapshot, std::size_t offset, std::size_t size)
+{
+    return offset <= snapshot.data.size() && size <= snapshot.data.size() - offset;
+}
+
+// Checks everything lauf::restore_snapshot() relies on.
+bool is_valid_snapshot(const lauf_runtime_snapshot& snapshot)
+{
+    // The globals need to match the ones of the program.
+    std::vector<const lauf_asm_global*> globals;
+    lauf::for_each_global(snapshot.program, [&](std::uint32_t index, const auto& global) {
+        if (index >= globals.size())
+            globals.resize(index + 1);
+        globals[index] = &global;
+    });
+    if (globals.size() > snapshot.allocations.size())
+        return false;
+    for (auto index = std::size_t(0); index != globals.size(); ++index)
+    {
+        if (globals[index] == nullptr)
+            return false;
+        auto& global = *globals[index];
+        auto& alloc  = snapshot.allocations[index];
+
+        auto size = global.size;
+        if (!global.has_definition())
+        {
+            auto extra      = lauf::try_get_extra_data(snapshot.program);
+            auto definition = extra == nullptr ? nullptr : extra->find_definition(&global);
+            size            = definition == nullptr ? 0 : definition->size;
+        }
+
+        if (alloc.source
+                != (global.is_mutable ? lauf::allocation_source::static_mut_memory
+                                      : lauf::allocation_source::static_const_memory)
+            || alloc.size != std::uint32_t(size))
+            return false;
+    }
+    auto global_count = globals.size();
+
+    for (auto& memory : snapshot.memory)
+    {
+        if (memory.index >= snapshot.allocations.size())
+            return false;
+
+        auto& alloc = snapshot.allocations[memory.index];
+        if (!is_valid_range(snapshot, memory.data_offset, alloc.size))
+            return false;
+        else if (memory.index < global_count)
+        {
+            // Only globals owned by the process have their memory in the snapshot.
+            auto& global = *globals[memory.index];
+            if (!global.is_mutable || !global.has_definition())
+                return false;
+        }
+        else if (alloc.source != lauf::allocation_source::heap_memory
+                 || memory.alignment == 0 || (memory.alignment & (memory.alignment - 1)) != 0)
+            return false;
+    }
+
+    if (snapshot.chunk_size != lauf::cstack::chunk_size()
+        || snapshot.cur_fiber > snapshot.fibers.size())
+        return false;
+    auto next_chunk = std::size_t(0);
+    std::vector<bool> is_fiber_handle(snapshot.allocations.size());
+    for (auto& fiber : snapshot.fibers)
+    {
+        // restore_snapshot() allocates the chunks in order.
+        auto max_chunk_count = (fiber.cstack_capacity + lauf::page_allocator::page_size - 1)
+                               / lauf::page_allocator::page_size;
+        if (fiber.first_chunk != next_chunk || fiber.chunk_count == 0
+            || fiber.chunk_count > snapshot.chunks.size() - fiber.first_chunk
+            || fiber.chunk_count > max_chunk_count
+            || !is_valid_range(snapshot, fiber.cstack_offset,
+                               fiber.chunk_count * snapshot.chunk_size)
+            || fiber.vstack_size > fiber.vstack_capacity
+            || !is_valid_range(snapshot, fiber.vstack_offset,
+                               fiber.vstack_size * sizeof(lauf_runtime_value)))
+            return false;
+        next_chunk += fiber.chunk_count;
+
+        if (!for_each_frame(snapshot, fiber, [](std::size_t, bool) {}))
+            return false;
+
+        // Every fiber needs its own handle.
+        lauf_runtime_fiber object;
+        std::memcpy(static_cast<void*>(&object), snapshot.data.data() + fiber.cstack_offset,
+                    sizeof(object));
+        if (object.status > lauf_runtime_fiber::done
+            || object.handle_allocation >= snapshot.allocations.size()
+            || is_fiber_handle[object.handle_allocation])
+            return false;
+        is_fiber_handle[object.handle_allocation] = true;
+    }
+
+    std::vector<bool> has_memory(snapshot.allocations.size());
+    for (auto& memory : snapshot.memory)
+        has_memory[memory.index] = true;
+    for (auto index = std::size_t(0); index != snapshot.allocations.size(); ++index)
+    {
+        auto& alloc = snapshot.allocations[index];
+        if (alloc.status == lauf::allocation_status::freed)
+        {
+            if (is_fiber_handle[index])
+                return false;
+            continue;
+        }
+
+        // Everything that is not a global needs to be restored.
+        switch (alloc.source)
+        {
+        case lauf::allocation_source::static_const_memory:
+        case lauf::allocation_source::static_mut_memory:
+            if (index >= global_count)
+                return false;
+            break;
+        case lauf::allocation_source::local_memory: {
+            auto address  = reinterpret_cast<std::uintptr_t>(alloc.ptr);
+            auto is_local = std::any_of(snapshot.chunks.begin(), snapshot.chunks.end(),
+                                        [&](std::uintptr_t chunk) {
+                                            return chunk <= address
+                                                   && address <= chunk + snapshot.chunk_size;
+                                        });
+            if (!is_local)
+                return false;
+            break;
+        }
+        case lauf::allocation_source::heap_memory:
+            if (!has_memory[index])
+                return false;
+            break;
+        case lauf::allocation_source::fiber_memory:
+            if (!is_fiber_handle[index])
+                return false;
+            break;
+        }
+    }
+
+    return true;
+}
+} // namespace
+
+bool lauf_runtime_write_snapshot(const lauf_runtime_snapshot* snapshot, lauf_writer* writer)
+{
+    program_code                 code(snapshot->program);
+    std::vector<code_relocation> relocations;
+    auto                         data    = snapshot->data;
+    auto                         success = true;
+    auto                         valid   = for_each_code_pointer(
+        *snapshot, [&](std::size_t offset, bool is_function, bool is_required) {
+            code_relocation reloc;
+            reloc.data_offset = offset;
+
+            auto ptr = load<const void*>(*snapshot, offset);
+            if (ptr == nullptr)
+                success = success && !is_required;
+            else if (is_function)
+                success = success
+                          && code.index_of(static_cast<const lauf_asm_function*>(ptr), reloc);
+            else
+                success
+                    = success && code.index_of(static_cast<const lauf_asm_inst*>(ptr), reloc);
+
+            if (ptr != nullptr)
+            {
+                relocations.push_back(reloc);
+                // The address is meaningless in a different process.
+                std::memset(data.data() + offset, 0, sizeof(void*));
+            }
+        });
+    if (!valid || !success)
+        return false;
+
+    writer->write(snapshot_magic, sizeof(snapshot_magic));
+
+    // The shape of the program, to detect snapshots of a different program.
+    write_value<std::uint64_t>(writer, code.module_count());
+    for (auto module = std::size_t(0); module != code.module_count(); ++module)
+    {
+        write_value<std::uint64_t>(writer, code.function_count(module));
+        for (auto function = std::size_t(0); function != code.function_count(module); ++function)
+            write_value<std::uint32_t>(writer, code.function(module, function)->inst_count);
+    }
+
+    write_value<std::uint8_t>(writer, snapshot->cur_generation);
+    write_value<std::uint64_t>(writer, snapshot->remaining_steps);
+    write_value<std::uint64_t>(writer, snapshot->chunk_size);
+    write_value<std::uint64_t>(writer, snapshot->cur_fiber);
+
+    write_value<std::uint64_t>(writer, snapshot->allocations.size());
+    for (auto index = std::size_t(0); index != snapshot->allocations.size(); ++index)
+    {
+        auto& alloc = snapshot->allocations[index];
+        // The pointer is only used to identify local memory in the stacks.
+        write_value<std::uint64_t>(writer, reinterpret_cast<std::uintptr_t>(alloc.ptr));
+        write_value<std::uint32_t>(writer, alloc.size);
+        write_value<std::uint8_t>(writer, alloc.generation);
+        write_value<std::uint8_t>(writer, std::uint8_t(alloc.source));
+        write_value<std::uint8_t>(writer, std::uint8_t(alloc.status));
+        write_value<std::uint8_t>(writer, std::uint8_t(alloc.gc));
+
+        auto flags = std::uint8_t(0);
+        flags |= alloc.is_gc_weak ? 1 : 0;
+        flags |= alloc.is_gc_dirty ? 2 : 0;
+        flags |= alloc.is_gc_young ? 4 : 0;
+        flags |= alloc.has_pointer_map ? 8 : 0;
+        write_value<std::uint8_t>(writer, flags);
+
+        write_value(writer, snapshot->pointer_maps[index]);
+    }
+
+    write_value<std::uint64_t>(writer, snapshot->memory.size());
+    for (auto& memory : snapshot->memory)
+    {
+        write_value<std::uint32_t>(writer, memory.index);
+        write_value<std::uint32_t>(writer, memory.alignment);
+        write_value<std::uint64_t>(writer, memory.data_offset);
+    }
+
+    write_value<std::uint64_t>(writer, snapshot->fibers.size());
+    for (auto& fiber : snapshot->fibers)
+    {
+        write_value<std::uint64_t>(writer, fiber.cstack_capacity);
+        write_value<std::uint64_t>(writer, fiber.cstack_offset);
+        write_value<std::uint64_t>(writer, fiber.first_chunk);
+        write_value<std::uint64_t>(writer, fiber.chunk_count);
+        write_value<std::uint64_t>(writer, fiber.vstack_capacity);
+        write_value<std::uint64_t>(writer, fiber.vstack_size);
+        write_value<std::uint64_t>(writer, fiber.vstack_offset);
+    }
+
+    write_value<std::uint64_t>(writer, snapshot->chunks.size());
+    for (auto chunk : snapshot->chunks)
+        write_value<std::uint64_t>(writer, chunk);
+
+    write_value<std::uint64_t>(writer, relocations.size());
+    for (auto& reloc : relocations)
+    {
+        write_value<std::uint64_t>(writer, reloc.data_offset);
+        write_value<std::uint32_t>(writer, reloc.module);
+        write_value<std::uint32_t>(writer, reloc.function);
+        write_value<std::uint32_t>(writer, reloc.inst);
+    }
+
+    write_value<std::uint64_t>(writer, data.size());
+    writer->write(reinterpret_cast<const char*>(data.data()), data.size());
+    return true;
+}
+
+namespace
+{
+bool read_snapshot(lauf_runtime_snapshot& snapshot, snapshot_reader& reader)
+{
+    char magic[sizeof(snapshot_magic)];
+    if (!reader.read_bytes(magic, sizeof(magic))
+        || std::memcmp(magic, snapshot_magic, sizeof(magic)) != 0)
+        return false;
+
+    program_code  code(snapshot.program);
+    std::uint64_t module_count;
+    if (!reader.read(module_count) || module_count != code.module_count())
+        return false;
+    for (auto module = std::size_t(0); module != code.module_count(); ++module)
+    {
+        std::uint64_t function_count;
+        if (!reader.read(function_count) || function_count != code.function_count(module))
+            return false;
+
+        for (auto function = std::size_t(0); function != code.function_count(module); ++function)
+        {
+            std::uint32_t inst_count;
+            if (!reader.read(inst_count)
+                || inst_count != code.function(module, function)->inst_count)
+                return false;
+        }
+    }
+
+    std::uint64_t remaining_steps, chunk_size, cur_fiber;
+    if (!reader.read(snapshot.cur_generation) || !reader.read(remaining_steps)
+        || !reader.read(chunk_size) || !reader.read(cur_fiber))
+        return false;
+    snapshot.remaining_steps = std::size_t(remaining_steps);
+    snapshot.chunk_size      = std::size_t(chunk_size);
+    snapshot.cur_fiber       = std::size_t(cur_fiber);
+
+    std::size_t allocation_count;
+    if (!reader.read_count(allocation_count, 25) || allocation_count > UINT32_MAX)
+        return false;
+    snapshot.allocations.resize(allocation_count);
+    snapshot.pointer_maps.resize(allocation_count);
+    for (auto index = std::size_t(0); index != allocation_count; ++index)
+    {
+        std::uint64_t ptr;
+        std::uint8_t  source, status, gc, flags;
+
+        auto& alloc = snapshot.allocations[index];
+        if (!reader.read(ptr) || !reader.read(alloc.size) || !reader.read(alloc.generation)
+            || !reader.read(source) || !reader.read(status) || !reader.read(gc)
+            || !reader.read(flags) || !reader.read(snapshot.pointer_maps[index]))
+            return false;
+        if (source > std::uint8_t(lauf::allocation_source::fiber_memory)
+            || status > std::uint8_t(lauf::allocation_status::poison)
+            || gc > std::uint8_t(lauf::gc_tracking::reachable_explicit))
+            return false;
+
+        alloc.ptr             = reinterpret_cast<void*>(std::uintptr_t(ptr));
+        alloc.source          = lauf::allocation_source(source);
+        alloc.status          = lauf::allocation_status(status);
+        alloc.split           = lauf::allocation_split::unsplit;
+        alloc.gc              = lauf::gc_tracking(gc);
+        alloc.is_gc_weak      = (flags & 1) != 0;
+        alloc.is_gc_dirty     = (flags & 2) != 0;
+        alloc.is_gc_young     = (flags & 4) != 0;
+        alloc.has_pointer_map = (flags & 8) != 0;
+
+        if (alloc.has_pointer_map && snapshot.pointer_maps[index].element_words == 0)
+            return false;
+    }
+
+    std::size_t memory_count;
+    if (!reader.read_count(memory_count, 16))
+        return false;
+    snapshot.memory.resize(memory_count);
+    for (auto& memory : snapshot.memory)
+    {
+        std::uint64_t data_offset;
+        if (!reader.read(memory.index) || !reader.read(memory.alignment)
+            || !reader.read(data_offset))
+            return false;
+        memory.data_offset = std::size_t(data_offset);
+    }
+
+    std::size_t fiber_count;
+    if (!reader.read_count(fiber_count, 7 * 8))
+        return false;
+    snapshot.fibers.resize(fiber_count);
+    for (auto& fiber : snapshot.fibers)
+    {
+        std::uint64_t fields[7];
+        for (auto& field : fields)
+            if (!reader.read(field))
+                return false;
+
+        fiber.cstack_capacity = std::size_t(fields[0]);
+        fiber.cstack_offset   = std::size_t(fields[1]);
+        fiber.first_chunk     = std::size_t(fields[2]);
+        fiber.chunk_count     = std::size_t(fields[3]);
+        fiber.vstack_capacity = std::size_t(fields[4]);
+        fiber.vstack_size     = std::size_t(fields[5]);
+        fiber.vstack_offset   = std::size_t(fields[6]);
+    }
+
+    std::size_t chunk_count;
+    if (!reader.read_count(chunk_count, 8))
+        return false;
+    snapshot.chunks.resize(chunk_count);
+    for (auto& chunk : snapshot.chunks)
+    {
+        std::uint64_t address;
+        if (!reader.read(address))
+            return false;
+        chunk = std::uintptr_t(address);
+    }
+
+    std::size_t relocation_count;
+    if (!reader.read_count(relocation_count, 20))
+        return false;
+    std::vector<code_relocation> relocations(relocation_count);
+    for (auto& reloc : relocations)
+        if (!reader.read(reloc.data_offset) || !reader.read(reloc.module)
+            || !reader.read(reloc.function) || !reader.read(reloc.inst))
+            return false;
+
+    std::size_t data_size;
+    if (!reader.read_count(data_size, 1))
+        return false;
+    snapshot.data.resize(data_size);
+    if (!reader.read_bytes(snapshot.data.data(), data_size) || !reader.at_end())
+        return false;
+
+    // We can only look at the stacks once we know they're valid.
+    if (!is_valid_snapshot(snapshot))
+        return false;
+
+    // Every pointer into the code needs to be where we expect it.
+    std::sort(relocations.begin(), relocations.end(),
+              [](const code_relocation& lhs, const code_relocation& rhs) {
+                  return lhs.data_offset < rhs.data_offset;
+              });
+    auto success = true;
+    auto patched = std::size_t(0);
+    auto valid   = for_each_code_pointer(snapshot, [&](std::size_t offset, bool is_function,
+                                                     bool is_required) {
+        auto reloc = std::lower_bound(relocations.begin(), relocations.end(), offset,
+                                      [](const code_relocation& reloc, std::size_t offset) {
+                                          return reloc.data_offset < offset;
+                                      });
+        if (reloc == relocations.end() || reloc->data_offset != offset)
+        {
+            success = success && !is_required;
+            return;
+        }
+
+        auto ptr = code.pointer_of(*reloc);
+        if (ptr == nullptr || is_function != (reloc->inst == function_pointer)
+            || (is_function && reloc->module == trampoline_module))
+        {
+            success = false;
+            return;
+        }
+
+        std::memcpy(snapshot.data.data() + offset, &ptr, sizeof(ptr));
+        ++patched;
+    });
+    return valid && success && patched == relocations.size();
+}
+} // namespace
+
+lauf_runtime_snapshot* lauf_runtime_read_snapshot(const lauf_asm_program* program,
+                                                  const void* data, size_t size)
+{
+    auto            result = new lauf_runtime_snapshot();
+    snapshot_reader reader(data, size);
+
+    result->program = *program;
+    if (!read_snapshot(*result, reader))
+    {
+        delete result;
+        return nullptr;
+    }
+
+    return result;
+}
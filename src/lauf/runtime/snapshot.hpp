@@ -0,0 +1,81 @@
+// Copyright (C) 2022-2023 Jonathan Müller and lauf contributors
+// SPDX-License-Identifier: BSL-1.0
+
+#ifndef SRC_LAUF_RUNTIME_SNAPSHOT_HPP_INCLUDED
+#define SRC_LAUF_RUNTIME_SNAPSHOT_HPP_INCLUDED
+
+#include <lauf/runtime/snapshot.h>
+
+#include <lauf/asm/program.h>
+#include <lauf/runtime/memory.hpp>
+#include <vector>
+
+namespace lauf
+{
+// The contents of memory that is owned by the process.
+struct snapshot_memory
+{
+    std::uint32_t index;
+    // Only for heap memory, the alignment it needs to be allocated with.
+    std::uint32_t alignment;
+    std::size_t   data_offset;
+};
+
+struct snapshot_fiber
+{
+    // The memory of all chunks of the cstack, which starts with the lauf_runtime_fiber object.
+    // It still contains the pointers into the stacks of the original process.
+    std::size_t cstack_capacity;
+    std::size_t cstack_offset;
+    // The range of its chunks in chunks.
+    std::size_t first_chunk, chunk_count;
+
+    // The values on top of the vstack.
+    std::size_t vstack_capacity;
+    std::size_t vstack_size;
+    std::size_t vstack_offset;
+};
+} // namespace lauf
+
+struct lauf_runtime_snapshot
+{
+    lauf_asm_program program;
+
+    // The allocation table, the pointers still refer to the memory of the original process.
+    std::vector<lauf::allocation> allocations;
+    // Indexed by allocation index, but only valid for allocations that have a pointer map.
+    std::vector<lauf::pointer_map> pointer_maps;
+    std::uint8_t                   cur_generation;
+    std::size_t                    remaining_steps;
+
+    std::vector<lauf::snapshot_memory> memory;
+    // In the order of the fiber list.
+    std::vector<lauf::snapshot_fiber> fibers;
+    // The addresses of the memory of each cstack chunk in the original process.
+    std::vector<std::uintptr_t> chunks;
+    // The size of the memory of each chunk.
+    std::size_t chunk_size;
+    // Index of the current fiber, or fibers.size() if there is none.
+    std::size_t cur_fiber;
+
+    // Memory contents referenced by the offsets.
+    std::vector<unsigned char> data;
+
+    std::size_t add_data(const void* ptr, std::size_t size)
+    {
+        auto offset = data.size();
+        data.insert(data.end(), static_cast<const unsigned char*>(ptr),
+                    static_cast<const unsigned char*>(ptr) + size);
+        return offset;
+    }
+};
+
+namespace lauf
+{
+// Restores the state of the snapshot into a process that has just been initialized.
+// Returns false if memory couldn't be allocated, the process can then only be destroyed.
+bool restore_snapshot(lauf_runtime_process* process, const lauf_runtime_snapshot& snapshot);
+} // namespace lauf
+
+#endif // SRC_LAUF_RUNTIME_SNAPSHOT_HPP_INCLUDED
+
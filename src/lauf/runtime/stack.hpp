@@ -159,6 +159,20 @@ public:
         return _capacity;
     }
 
+    // The size of the usable memory of each chunk.
+    static constexpr std::size_t chunk_size()
+    {
+        return page_allocator::page_size - sizeof(chunk);
+    }
+
+    // Calls f(memory, size) for the usable memory of every chunk in order.
+    template <typename Fn>
+    void for_each_chunk(Fn f) const
+    {
+        for (auto cur = _first; cur != nullptr; cur = cur->next)
+            f(cur->memory(), std::size_t(cur->end() - cur->memory()));
+    }
+
 private:
     chunk*      _first    = nullptr;
     std::size_t _capacity = 0;
@@ -173,12 +187,16 @@ class vstack
 public:
     void init(page_allocator& alloc, std::size_t initial_size)
     {
-        _block = alloc.allocate(initial_size * sizeof(lauf_runtime_value));
+        _block       = alloc.allocate(initial_size * sizeof(lauf_runtime_value));
+        _reservation = {nullptr, 0};
     }
 
     void clear(page_allocator& alloc)
     {
-        alloc.deallocate(_block);
+        if (_reservation.ptr != nullptr)
+            alloc.unreserve(_reservation, _block.size);
+        else
+            alloc.deallocate(_block);
     }
 
     lauf_runtime_value* base() const
@@ -198,26 +216,72 @@ public:
         return _block.size / sizeof(lauf_runtime_value);
     }
 
-    void grow(page_allocator& alloc, lauf_runtime_value*& vstack_ptr)
+    // Doubles the capacity, max_capacity is the capacity after which we panic anyway.
+    void grow(page_allocator& alloc, lauf_runtime_value*& vstack_ptr, std::size_t max_capacity)
     {
-        auto cur_size = std::size_t(base() - vstack_ptr);
+        auto new_size = 2 * _block.size;
+        auto max_size = max_capacity * sizeof(lauf_runtime_value);
+
+        if (_reservation.ptr != nullptr)
+        {
+            // The pages below the stack are reserved, so we can grow in place without moving it.
+            auto new_ptr = static_cast<unsigned char*>(_block.ptr) - _block.size;
+            if (new_size <= _reservation.size && alloc.commit(new_ptr, _block.size))
+            {
+                _block = {new_ptr, new_size};
+                return;
+            }
+        }
+        else if (new_size <= max_size)
+        {
+            // We're growing for the first time: reserve address space for the biggest stack we
+            // can grow into, and move to its top.
+            // This is the only time we need to move, all further growth happens in place.
+            auto reservation_size = new_size;
+            while (2 * reservation_size <= max_size)
+                reservation_size *= 2;
+
+            auto reservation = alloc.reserve(reservation_size);
+            if (reservation.ptr != nullptr)
+            {
+                auto new_ptr = static_cast<unsigned char*>(reservation.ptr) + reservation.size
+                               - new_size;
+                if (alloc.commit(new_ptr, new_size))
+                {
+                    move_to(alloc, {new_ptr, new_size}, vstack_ptr);
+                    _reservation = reservation;
+                    return;
+                }
+
+                alloc.unreserve(reservation, 0);
+            }
+        }
 
-        auto new_size  = 2 * _block.size;
-        auto new_block = alloc.allocate(new_size);
+        // Otherwise, we move to a new block.
+        move_to(alloc, alloc.allocate(new_size), vstack_ptr);
+        _reservation = {nullptr, 0};
+    }
+
+private:
+    // Moves the stack to the end of the new block and frees the current one.
+    void move_to(page_allocator& alloc, page_block new_block, lauf_runtime_value*& vstack_ptr)
+    {
+        auto cur_size = std::size_t(base() - vstack_ptr);
 
         // We have filled [vstack_ptr, base) with cur_size values.
         // Need to copy them into [new_block.end - cur_size, new_block.end)
         auto dest = static_cast<lauf_runtime_value*>(new_block.ptr)
                     + new_block.size / sizeof(lauf_runtime_value) - cur_size;
         std::memcpy(dest, vstack_ptr, cur_size * sizeof(lauf_runtime_value));
-        alloc.deallocate(_block);
+        clear(alloc);
 
         _block     = new_block;
         vstack_ptr = base() - cur_size;
     }
 
-private:
     page_block _block;
+    // If set, the address space of the stack, _block is at its end.
+    page_block _reservation = {nullptr, 0};
 };
 } // namespace lauf
 
@@ -171,13 +171,15 @@ public:
         return block->array[idx];
     }
 
+    // The current block is empty after popping its first element, so the back can be in the
+    // previous one.
     T& back()
     {
-        return _cur_block->array[_next_idx - 1];
+        return back(0);
     }
     const T& back() const
     {
-        return _cur_block->array[_next_idx - 1];
+        return back(0);
     }
 
     T& back(std::size_t idx)
@@ -27,8 +27,13 @@
 
 struct lauf::page_allocator::free_list_node
 {
-    std::size_t     size;
+    std::size_t size;
+    // Neighbors in _free_list.
+    free_list_node* prev;
     free_list_node* next;
+    // Neighbors in the bucket.
+    free_list_node* prev_in_bucket;
+    free_list_node* next_in_bucket;
 
     void* end()
     {
@@ -44,32 +49,178 @@ const auto real_page_size = [] {
     assert(result % lauf::page_allocator::page_size == 0);
     return result;
 }();
+
+// Faults in fresh memory, so the first access doesn't have to.
+void prefault_pages(void* ptr, std::size_t size)
+{
+#ifdef MADV_POPULATE_WRITE
+    if (::madvise(ptr, size, MADV_POPULATE_WRITE) == 0)
+        return;
+#endif
+
+    // The memory is zero, so writing zero doesn't change it.
+    for (auto offset = std::size_t(0); offset < size; offset += real_page_size)
+        static_cast<volatile unsigned char*>(ptr)[offset] = 0;
 }
 
-lauf::page_block lauf::page_allocator::allocate(std::size_t size)
+void* map_pages(std::size_t size)
 {
-    size = round_to_multiple_of_alignment(size, real_page_size);
+    auto pages = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    assert(pages != MAP_FAILED); // NOLINT: macro
+    return pages;
+}
 
-    // Find a page_count pages in the free list.
-    free_list_node* prev = nullptr;
-    for (auto cur = _free_list; cur != nullptr; prev = cur, cur = cur->next)
-        if (cur->size >= size)
-        {
-            LAUF_PAGE_ALLOCATOR_DO_LOG("allocate(%zu): found %zu in cache", size, cur->size);
+#ifdef MADV_HUGEPAGE
+// Maps memory that starts at a huge page boundary, so the OS can back it by huge pages.
+void* map_huge_pages(std::size_t size)
+{
+    constexpr auto huge_page_size = lauf::page_allocator::huge_page_size;
+
+    // We map more than necessary and unmap the misaligned parts at both ends.
+    auto memory = static_cast<unsigned char*>(map_pages(size + huge_page_size));
+    auto offset = lauf::align_offset(memory, huge_page_size);
+    if (offset > 0)
+        ::munmap(memory, offset);
+    ::munmap(memory + offset + size, huge_page_size - offset);
 
-            // Remove block from free list.
-            if (prev == nullptr)
-                _free_list = cur->next;
-            else
-                prev->next = cur->next;
+    auto pages = memory + offset;
+    ::madvise(pages, size, MADV_HUGEPAGE);
+    return pages;
+}
+#endif
+}
+
+std::size_t lauf::page_allocator::bucket_of(std::size_t size)
+{
+    auto pages  = size / real_page_size;
+    auto bucket = std::size_t(0);
+    for (; pages > 1 && bucket + 1 < bucket_count; pages /= 2)
+        ++bucket;
+    return bucket;
+}
+
+void lauf::page_allocator::add_to_bucket(free_list_node* node)
+{
+    auto& head           = _buckets[bucket_of(node->size)];
+    node->prev_in_bucket = nullptr;
+    node->next_in_bucket = head;
+    if (head != nullptr)
+        head->prev_in_bucket = node;
+    head = node;
+}
+
+void lauf::page_allocator::remove_from_bucket(free_list_node* node)
+{
+    if (node->prev_in_bucket != nullptr)
+        node->prev_in_bucket->next_in_bucket = node->next_in_bucket;
+    else
+        _buckets[bucket_of(node->size)] = node->next_in_bucket;
+    if (node->next_in_bucket != nullptr)
+        node->next_in_bucket->prev_in_bucket = node->prev_in_bucket;
+}
 
-            // We're always returning the entire set of pages we know about.
-            return {cur, cur->size};
+void lauf::page_allocator::unlink(free_list_node* node)
+{
+    if (node->prev != nullptr)
+        node->prev->next = node->next;
+    else
+        _free_list = node->next;
+    if (node->next != nullptr)
+        node->next->prev = node->prev;
+}
+
+void lauf::page_allocator::take_front(free_list_node* node, std::size_t size)
+{
+    assert(size <= node->size);
+    remove_from_bucket(node);
+    if (size == node->size)
+    {
+        unlink(node);
+    }
+    else
+    {
+        // The rest of the block takes its place.
+        auto rest = ::new (reinterpret_cast<unsigned char*>(node) + size)
+            free_list_node{node->size - size, node->prev, node->next, nullptr, nullptr};
+        if (rest->prev != nullptr)
+            rest->prev->next = rest;
+        else
+            _free_list = rest;
+        if (rest->next != nullptr)
+            rest->next->prev = rest;
+        add_to_bucket(rest);
+    }
+
+    _cached_bytes -= size;
+}
+
+void lauf::page_allocator::trim_cache()
+{
+    if (_max_cached_bytes == 0)
+        return;
+
+    while (_cached_bytes > _max_cached_bytes)
+    {
+        // We release memory of the biggest blocks first, so the others can still be re-used.
+        auto bucket = bucket_count - 1;
+        while (_buckets[bucket] == nullptr)
+            --bucket;
+        auto node = _buckets[bucket];
+
+        auto excess = round_to_multiple_of_alignment(_cached_bytes - _max_cached_bytes,
+                                                     real_page_size);
+        if (excess >= node->size)
+        {
+            excess = node->size;
+            remove_from_bucket(node);
+            unlink(node);
+            ::munmap(node, excess);
+        }
+        else
+        {
+            // We only need to release the end of the block.
+            remove_from_bucket(node);
+            node->size -= excess;
+            ::munmap(node->end(), excess);
+            add_to_bucket(node);
         }
 
+        LAUF_PAGE_ALLOCATOR_DO_LOG("trim_cache(): released %zu", excess);
+        _cached_bytes -= excess;
+        _allocated_bytes -= excess;
+    }
+}
+
+lauf::page_block lauf::page_allocator::allocate(std::size_t size)
+{
+    size = round_to_multiple_of_alignment(size, real_page_size);
+
+    // Find a cached block that is big enough: any block in a bigger bucket is.
+    for (auto bucket = bucket_of(size); bucket != bucket_count; ++bucket)
+        for (auto cur = _buckets[bucket]; cur != nullptr; cur = cur->next_in_bucket)
+            if (cur->size >= size)
+            {
+                LAUF_PAGE_ALLOCATOR_DO_LOG("allocate(%zu): found %zu in cache", size, cur->size);
+
+                // We only take the pages we need, the rest stays in the cache.
+                take_front(cur, size);
+                return {cur, size};
+            }
+
     // Allocate new set of pages.
-    auto pages = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    assert(pages != MAP_FAILED); // NOLINT: macro
+    void* pages;
+#ifdef MADV_HUGEPAGE
+    if (_use_huge_pages && size >= huge_page_size)
+    {
+        // Memory that is not a multiple of the huge page size would use small pages anyway.
+        size  = round_to_multiple_of_alignment(size, huge_page_size);
+        pages = map_huge_pages(size);
+    }
+    else
+#endif
+        pages = map_pages(size);
+    if (_prefault)
+        prefault_pages(pages, size);
     _allocated_bytes += size;
 
     LAUF_PAGE_ALLOCATOR_DO_LOG("allocate(%zu): mmap", size);
@@ -78,13 +229,22 @@ lauf::page_block lauf::page_allocator::allocate(std::size_t size)
 
 std::size_t lauf::page_allocator::try_extend(page_block block, std::size_t new_size)
 {
-    // We know that we can't extend it using the free list:
-    // * upon allocation we return the maximal sequence of contiguous blocks
-    // * when deallocating we merge everything to keep it contiguous
-    // So the only way to extend it is to ask the OS.
-
     new_size = round_to_multiple_of_alignment(new_size, real_page_size);
 
+    // We can take the pages of a cached block that directly follows it.
+    auto end = reinterpret_cast<std::uintptr_t>(block.ptr) + block.size;
+    for (auto cur = _free_list; cur != nullptr && reinterpret_cast<std::uintptr_t>(cur) <= end;
+         cur      = cur->next)
+        if (reinterpret_cast<std::uintptr_t>(cur) == end && block.size + cur->size >= new_size)
+        {
+            LAUF_PAGE_ALLOCATOR_DO_LOG("try_extend({%p, %zu}, %zu): from cache", block.ptr,
+                                       block.size, new_size);
+            take_front(cur, new_size - block.size);
+            return new_size;
+        }
+
+    // Otherwise, we need to ask the OS.
+
     auto ptr = ::mremap(block.ptr, block.size, new_size, 0);
     if (ptr == MAP_FAILED) // NOLINT: macro
     {
@@ -95,28 +255,61 @@ std::size_t lauf::page_allocator::try_extend(page_block block, std::size_t new_s
 
     _allocated_bytes += new_size - block.size;
     assert(ptr == block.ptr);
+    if (_prefault)
+        prefault_pages(static_cast<unsigned char*>(block.ptr) + block.size, new_size - block.size);
 
-    LAUF_PAGE_ALLOCATOR_DO_LOG("try_extend({%p, %zu}, %zu): failed", block.ptr, block.size,
+    LAUF_PAGE_ALLOCATOR_DO_LOG("try_extend({%p, %zu}, %zu): mremap", block.ptr, block.size,
                                new_size);
     return new_size;
 }
 
 void lauf::page_allocator::deallocate(page_block block)
 {
-    block.size = round_to_multiple_of_alignment(block.size, real_page_size);
+    block.size   = round_to_multiple_of_alignment(block.size, real_page_size);
+    auto address = reinterpret_cast<std::uintptr_t>(block.ptr);
 
-    // Merge with an existing page block if possible.
-    for (auto cur = _free_list; cur != nullptr; cur = cur->next)
-        if (cur->end() == block.ptr)
-        {
-            cur->size += block.size;
-            LAUF_PAGE_ALLOCATOR_DO_LOG("deallocate({%p, %zu}): merged", block.ptr, block.size);
-            return;
-        }
+    // Find the free blocks before and after it.
+    free_list_node* prev = nullptr;
+    auto            next = _free_list;
+    while (next != nullptr && reinterpret_cast<std::uintptr_t>(next) < address)
+    {
+        prev = next;
+        next = next->next;
+    }
+
+    free_list_node* node;
+    if (prev != nullptr && prev->end() == block.ptr)
+    {
+        LAUF_PAGE_ALLOCATOR_DO_LOG("deallocate({%p, %zu}): merged with previous", block.ptr,
+                                   block.size);
+        remove_from_bucket(prev);
+        prev->size += block.size;
+        node = prev;
+    }
+    else
+    {
+        LAUF_PAGE_ALLOCATOR_DO_LOG("deallocate({%p, %zu}): added", block.ptr, block.size);
+        node = ::new (block.ptr) free_list_node{block.size, prev, next, nullptr, nullptr};
+        if (prev != nullptr)
+            prev->next = node;
+        else
+            _free_list = node;
+        if (next != nullptr)
+            next->prev = node;
+    }
+
+    if (next != nullptr && node->end() == next)
+    {
+        LAUF_PAGE_ALLOCATOR_DO_LOG("deallocate({%p, %zu}): merged with next", block.ptr,
+                                   block.size);
+        remove_from_bucket(next);
+        unlink(next);
+        node->size += next->size;
+    }
+    add_to_bucket(node);
 
-    // Add to free list.
-    _free_list = ::new (block.ptr) free_list_node{block.size, _free_list};
-    LAUF_PAGE_ALLOCATOR_DO_LOG("deallocate({%p, %zu}): not merged", block.ptr, block.size);
+    _cached_bytes += block.size;
+    trim_cache();
 }
 
 std::size_t lauf::page_allocator::release()
@@ -133,6 +326,52 @@ std::size_t lauf::page_allocator::release()
         cur = next;
     }
 
+    _free_list = nullptr;
+    for (auto& bucket : _buckets)
+        bucket = nullptr;
+    _cached_bytes = 0;
+
     return _allocated_bytes;
 }
 
+lauf::page_block lauf::page_allocator::reserve(std::size_t size)
+{
+    size = round_to_multiple_of_alignment(size, real_page_size);
+
+    auto pages
+        = ::mmap(nullptr, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (pages == MAP_FAILED) // NOLINT: macro
+    {
+        LAUF_PAGE_ALLOCATOR_DO_LOG("reserve(%zu): failed", size);
+        return {nullptr, 0};
+    }
+
+    LAUF_PAGE_ALLOCATOR_DO_LOG("reserve(%zu): %p", size, pages);
+    return {pages, size};
+}
+
+bool lauf::page_allocator::commit(void* ptr, std::size_t size)
+{
+    assert(is_aligned(ptr, real_page_size));
+    size = round_to_multiple_of_alignment(size, real_page_size);
+
+    if (::mprotect(ptr, size, PROT_READ | PROT_WRITE) != 0)
+    {
+        LAUF_PAGE_ALLOCATOR_DO_LOG("commit(%p, %zu): failed", ptr, size);
+        return false;
+    }
+
+    if (_prefault)
+        prefault_pages(ptr, size);
+    _allocated_bytes += size;
+
+    LAUF_PAGE_ALLOCATOR_DO_LOG("commit(%p, %zu)", ptr, size);
+    return true;
+}
+
+void lauf::page_allocator::unreserve(page_block block, std::size_t committed_size)
+{
+    LAUF_PAGE_ALLOCATOR_DO_LOG("unreserve({%p, %zu})", block.ptr, block.size);
+    ::munmap(block.ptr, block.size);
+    _allocated_bytes -= round_to_multiple_of_alignment(committed_size, real_page_size);
+}
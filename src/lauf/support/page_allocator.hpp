@@ -18,12 +18,20 @@ struct page_block
 class page_allocator
 {
 public:
-    constexpr page_allocator() : _free_list(nullptr), _allocated_bytes(0) {}
+    constexpr page_allocator() : page_allocator(false, false, 0) {}
+    // If max_cached_bytes is zero, the cache is unlimited.
+    constexpr explicit page_allocator(bool use_huge_pages, bool prefault,
+                                      std::size_t max_cached_bytes)
+    : _free_list(nullptr), _buckets{}, _allocated_bytes(0), _cached_bytes(0),
+      _max_cached_bytes(max_cached_bytes), _use_huge_pages(use_huge_pages), _prefault(prefault)
+    {}
 
     //=== page query ===//
     // We hardcode the page size to a compile-time constant that is <= and divisible by the actual
     // page size.
     static constexpr std::size_t page_size = 4096;
+    // Blocks at least that big are backed by transparent huge pages, if enabled.
+    static constexpr std::size_t huge_page_size = 2 * 1024 * 1024;
 
     static void* page_of(void* address)
     {
@@ -39,18 +47,60 @@ public:
     // Returns the size it could extend to.
     std::size_t try_extend(page_block block, std::size_t size);
 
-    /// Adds to a cache only.
+    /// Adds to a cache, which returns memory to the OS once it exceeds its limit.
     void deallocate(page_block block);
 
     /// Frees all pages from the cache.
     std::size_t release();
 
+    //=== reservation ===//
+    // Reserves address space that can't be accessed until it is committed.
+    // Returns a null block if there isn't enough address space.
+    page_block reserve(std::size_t size);
+
+    // Makes the pages [ptr, ptr + size) of a reserved block accessible.
+    bool commit(void* ptr, std::size_t size);
+
+    // Returns a reserved block, of which committed_size bytes have been committed, to the OS.
+    // It never goes into the cache.
+    void unreserve(page_block block, std::size_t committed_size);
+
+    /// The number of bytes currently mapped, including the cache.
+    std::size_t allocated_bytes() const
+    {
+        return _allocated_bytes;
+    }
+    /// The number of bytes in the cache.
+    std::size_t cached_bytes() const
+    {
+        return _cached_bytes;
+    }
+
 private:
     // Stored at the beginning of a free page block.
     struct free_list_node;
 
+    // Bucket i contains the free blocks of [2^i, 2^(i+1)) pages, the last one all bigger blocks.
+    static constexpr std::size_t bucket_count = 16;
+    static std::size_t           bucket_of(std::size_t size);
+
+    void add_to_bucket(free_list_node* node);
+    void remove_from_bucket(free_list_node* node);
+    // Removes the node from _free_list only.
+    void unlink(free_list_node* node);
+    // Removes the first size bytes of the free block from the cache.
+    void take_front(free_list_node* node, std::size_t size);
+    // Releases memory until the cache is within its limit.
+    void trim_cache();
+
+    // All free blocks sorted by address.
     free_list_node* _free_list;
+    free_list_node* _buckets[bucket_count];
     std::size_t     _allocated_bytes;
+    std::size_t     _cached_bytes;
+    std::size_t     _max_cached_bytes;
+    bool            _use_huge_pages;
+    bool            _prefault;
 };
 } // namespace lauf
 
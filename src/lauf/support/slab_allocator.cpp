@@ -0,0 +1,237 @@
+// Copyright (C) 2022-2023 Jonathan Müller and lauf contributors
+// SPDX-License-Identifier: BSL-1.0
+
+#include <lauf/support/slab_allocator.hpp>
+
+#include <cstring>
+#include <new>
+#include <sys/mman.h>
+
+namespace
+{
+constexpr auto large_size_class = std::uint32_t(-1);
+
+// Number of pages we request from the page allocator at once.
+constexpr auto slab_block_size = 16 * lauf::page_allocator::page_size;
+
+std::uint32_t size_class_of(std::size_t size, std::size_t alignment)
+{
+    auto chunk_size = size < alignment ? alignment : size;
+
+    auto size_class = std::uint32_t(0);
+    for (auto cur = lauf::slab_allocator::min_chunk_size; cur < chunk_size; cur *= 2)
+        ++size_class;
+    return size_class;
+}
+
+constexpr std::size_t chunk_size_of(std::uint32_t size_class)
+{
+    return lauf::slab_allocator::min_chunk_size << size_class;
+}
+} // namespace
+
+struct lauf::slab_allocator::page_header
+{
+    std::uint32_t size_class;
+};
+
+struct lauf::slab_allocator::large_header : page_header
+{
+    // The entire mapping, which starts at or before the header.
+    void*         mapping;
+    std::size_t   size;
+    bool          leaked;
+    large_header* prev;
+    large_header* next;
+};
+
+struct lauf::slab_allocator::free_chunk
+{
+    free_chunk* next;
+};
+
+namespace
+{
+template <typename Header>
+void link(Header*& list, Header* header)
+{
+    header->prev = nullptr;
+    header->next = list;
+    if (list != nullptr)
+        list->prev = header;
+    list = header;
+}
+
+template <typename Header>
+void unlink(Header*& list, Header* header)
+{
+    if (header->prev == nullptr)
+        list = header->next;
+    else
+        header->prev->next = header->next;
+    if (header->next != nullptr)
+        header->next->prev = header->prev;
+}
+} // namespace
+
+lauf::slab_allocator::page_header* lauf::slab_allocator::header_of(void* ptr)
+{
+    auto page = page_allocator::page_of(ptr);
+    if (page == ptr)
+        // Only big allocations aligned to a page start at the beginning of a page, their header is
+        // in the page before it.
+        page = static_cast<unsigned char*>(ptr) - page_allocator::page_size;
+    return static_cast<page_header*>(page);
+}
+
+void* lauf::slab_allocator::allocate(page_allocator& allocator, std::size_t size,
+                                     std::size_t alignment)
+{
+    if (size > max_chunk_size || alignment > max_chunk_size)
+    {
+        // We place the header at the beginning of the first page, and the memory after it.
+        // If the memory needs to be aligned to a page, we place it after the first page instead,
+        // and need enough padding to align it.
+        auto offset  = round_to_multiple_of_alignment(sizeof(large_header), alignment);
+        auto padding = std::size_t(0);
+        if (offset >= page_allocator::page_size)
+        {
+            offset  = page_allocator::page_size;
+            padding = alignment - page_allocator::page_size;
+        }
+
+        auto mapping_size = offset + padding + size;
+        auto mapping      = ::mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE,
+                                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapping == MAP_FAILED) // NOLINT: macro
+            return nullptr;
+
+        auto memory = static_cast<unsigned char*>(mapping) + offset;
+        memory += align_offset(memory, alignment);
+
+        auto header        = ::new (header_of(memory)) large_header{};
+        header->size_class = large_size_class;
+        header->mapping    = mapping;
+        header->size       = mapping_size;
+        link(_large_list, header);
+
+        // Memory fresh from the OS is already zero.
+        return memory;
+    }
+
+    auto size_class = size_class_of(size, alignment);
+    auto chunk_size = chunk_size_of(size_class);
+    if (_free_lists[size_class] == nullptr)
+    {
+        if (_cur_page == _end_page)
+        {
+            auto block = allocator.allocate(slab_block_size);
+            _blocks.push_back(allocator, block);
+            _cur_page = static_cast<unsigned char*>(block.ptr);
+            _end_page = _cur_page + block.size;
+        }
+
+        // Take the next page and split it into chunks.
+        // The first chunk that doesn't overlap the header is properly aligned.
+        auto page = _cur_page;
+        _cur_page += page_allocator::page_size;
+        ::new (page) page_header{size_class};
+
+        auto first = round_to_multiple_of_alignment(sizeof(page_header), chunk_size);
+        for (auto offset = first; offset + chunk_size <= page_allocator::page_size;
+             offset += chunk_size)
+            _free_lists[size_class]
+                = ::new (page + offset) free_chunk{_free_lists[size_class]};
+    }
+
+    auto chunk              = _free_lists[size_class];
+    _free_lists[size_class] = chunk->next;
+
+    // The page might have been used before, so we need to zero it ourselves.
+    std::memset(chunk, 0, size);
+    return chunk;
+}
+
+void lauf::slab_allocator::deallocate(void* ptr, std::size_t)
+{
+    auto header = header_of(ptr);
+    if (header->size_class == large_size_class)
+    {
+        auto large = static_cast<large_header*>(header);
+        unlink(large->leaked ? _leaked_large_list : _large_list, large);
+        ::munmap(large->mapping, large->size);
+    }
+    else
+    {
+        _free_lists[header->size_class]
+            = ::new (ptr) free_chunk{_free_lists[header->size_class]};
+    }
+}
+
+void lauf::slab_allocator::leak(page_allocator& allocator, void* ptr)
+{
+    auto header = header_of(ptr);
+    if (header->size_class == large_size_class)
+    {
+        auto large = static_cast<large_header*>(header);
+        if (!large->leaked)
+        {
+            unlink(_large_list, large);
+            link(_leaked_large_list, large);
+            large->leaked = true;
+        }
+    }
+    else
+    {
+        // We keep the entire block the chunk is in.
+        for (auto i = 0u; i != _blocks.size(); ++i)
+        {
+            auto block = _blocks[i];
+            if (ptr >= block.ptr && ptr < static_cast<unsigned char*>(block.ptr) + block.size)
+            {
+                _leaked_blocks.push_back(allocator, block);
+                _blocks[i] = _blocks.back();
+                _blocks.pop_back();
+                break;
+            }
+        }
+    }
+}
+
+void lauf::slab_allocator::clear(page_allocator& allocator)
+{
+    for (auto block : _blocks)
+        allocator.deallocate(block);
+    _blocks.clear(allocator);
+
+    // The remaining chunks of the leaked blocks are lost until they are deallocated.
+    for (auto& list : _free_lists)
+        list = nullptr;
+    _cur_page = _end_page = nullptr;
+
+    while (_large_list != nullptr)
+    {
+        auto next = _large_list->next;
+        ::munmap(_large_list->mapping, _large_list->size);
+        _large_list = next;
+    }
+}
+
+void lauf::slab_allocator::destroy(page_allocator& allocator)
+{
+    clear(allocator);
+
+    for (auto block : _leaked_blocks)
+        allocator.deallocate(block);
+    _leaked_blocks.clear(allocator);
+
+    while (_leaked_large_list != nullptr)
+    {
+        auto next = _leaked_large_list->next;
+        ::munmap(_leaked_large_list->mapping, _leaked_large_list->size);
+        _leaked_large_list = next;
+    }
+
+    _blocks.shrink_to_fit(allocator);
+    _leaked_blocks.shrink_to_fit(allocator);
+}
@@ -0,0 +1,80 @@
+// Copyright (C) 2022-2023 Jonathan Müller and lauf contributors
+// SPDX-License-Identifier: BSL-1.0
+
+#ifndef SRC_LAUF_SUPPORT_SLAB_ALLOCATOR_HPP_INCLUDED
+#define SRC_LAUF_SUPPORT_SLAB_ALLOCATOR_HPP_INCLUDED
+
+#include <lauf/config.h>
+#include <lauf/support/array.hpp>
+#include <lauf/support/page_allocator.hpp>
+
+namespace lauf
+{
+/// A heap allocator that is not thread-safe.
+///
+/// Small allocations are served from pages that are split into chunks of a fixed size class.
+/// Big allocations get their own pages directly from the OS, which are zeroed lazily.
+/// All memory except for leaked memory can be released at once by calling `clear()`.
+class slab_allocator
+{
+public:
+    static constexpr std::size_t min_chunk_size = 16;
+    static constexpr std::size_t max_chunk_size = 1024;
+
+    slab_allocator()
+    : _free_lists{}, _cur_page(nullptr), _end_page(nullptr), _large_list(nullptr),
+      _leaked_large_list(nullptr)
+    {}
+
+    slab_allocator(const slab_allocator&)            = delete;
+    slab_allocator& operator=(const slab_allocator&) = delete;
+
+    ~slab_allocator()
+    {
+        assert(_blocks.empty() && _leaked_blocks.empty() && _large_list == nullptr
+               && _leaked_large_list == nullptr);
+    }
+
+    // Returns zeroed memory, or nullptr if the request cannot be satisfied.
+    void* allocate(page_allocator& allocator, std::size_t size, std::size_t alignment);
+
+    // size may be 0 if it is not known.
+    void deallocate(void* ptr, std::size_t size);
+
+    // Ensures that the memory is not freed by clear(), only by deallocate() or destroy().
+    void leak(page_allocator& allocator, void* ptr);
+
+    // Frees all memory at once, except for leaked memory.
+    void clear(page_allocator& allocator);
+
+    // Frees all memory, including leaked memory, and the memory used for bookkeeping.
+    void destroy(page_allocator& allocator);
+
+private:
+    static constexpr std::size_t size_class_count = 7;
+    static_assert(min_chunk_size << (size_class_count - 1) == max_chunk_size);
+
+    // Stored at the beginning of every page.
+    struct page_header;
+    struct large_header;
+    // Stored in a chunk that is free.
+    struct free_chunk;
+
+    static page_header* header_of(void* ptr);
+
+    free_chunk* _free_lists[size_class_count];
+    // The current page block slabs are taken from.
+    unsigned char* _cur_page;
+    unsigned char* _end_page;
+    // All page blocks used for slabs, except for the ones in _leaked_blocks.
+    lauf::array<page_block> _blocks;
+    // Page blocks that contain at least one leaked chunk.
+    lauf::array<page_block> _leaked_blocks;
+    // Doubly-linked lists of all big allocations that have and haven't been leaked.
+    large_header* _large_list;
+    large_header* _leaked_large_list;
+};
+} // namespace lauf
+
+#endif // SRC_LAUF_SUPPORT_SLAB_ALLOCATOR_HPP_INCLUDED
+
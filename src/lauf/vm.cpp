@@ -7,6 +7,7 @@
 #include <cstdio>
 #include <cstdlib>
 #include <lauf/lib/debug.hpp>
+#include <lauf/runtime/snapshot.hpp>
 
 const lauf_vm_allocator lauf_vm_null_allocator
     = {nullptr, [](void*, size_t, size_t) -> void* { return nullptr; },
@@ -19,6 +20,16 @@ const lauf_vm_allocator lauf_vm_malloc_allocator
        },
        [](void*, void* memory, size_t) { std::free(memory); }};
 
+const lauf_vm_allocator lauf_vm_slab_allocator
+    = {nullptr,
+       [](void* user_data, size_t size, size_t alignment) {
+           auto vm = static_cast<lauf_vm*>(user_data);
+           return vm->slab_allocator.allocate(vm->page_allocator, size, alignment);
+       },
+       [](void* user_data, void* memory, size_t size) {
+           static_cast<lauf_vm*>(user_data)->slab_allocator.deallocate(memory, size);
+       }};
+
 const lauf_vm_options lauf_default_vm_options = [] {
     lauf_vm_options result{};
 
@@ -28,8 +39,20 @@ const lauf_vm_options lauf_default_vm_options = [] {
     result.initial_cstack_size_in_bytes = 16 * 1024ull;
     result.max_cstack_size_in_bytes     = 512 * 1024ull;
 
+    result.use_huge_pages = false;
+    result.prefault_pages = false;
+
+    result.max_page_cache_size_in_bytes = 0;
+
     result.step_limit = 0;
 
+    result.generational_gc = false;
+    result.gc_thread_count = 1;
+
+    result.gc_min_heap_threshold = 0;
+    result.gc_heap_growth_factor = 2;
+    result.max_heap_size         = 0;
+
     result.panic_handler = {nullptr, [](void*, lauf_runtime_process* process, const char* msg) {
                                 std::fprintf(stderr, "[lauf] panic: %s\n",
                                              msg == nullptr ? "(invalid message pointer)" : msg);
@@ -64,6 +87,8 @@ lauf_vm_allocator lauf_vm_set_allocator(lauf_vm* vm, lauf_vm_allocator a)
 {
     auto old           = vm->heap_allocator;
     vm->heap_allocator = a;
+    if (vm->uses_slab_allocator())
+        vm->heap_allocator.user_data = vm;
     return old;
 }
 
@@ -93,15 +118,44 @@ lauf_runtime_process* lauf_vm_start_process(lauf_vm* vm, const lauf_asm_program*
     return &vm->process;
 }
 
+lauf_runtime_process* lauf_vm_start_process_from_snapshot(lauf_vm*                     vm,
+                                                          const lauf_runtime_snapshot* snapshot)
+{
+    lauf_runtime_process::init(&vm->process, vm, &snapshot->program);
+    if (!lauf::restore_snapshot(&vm->process, *snapshot))
+    {
+        lauf_runtime_destroy_process(&vm->process);
+        return nullptr;
+    }
+    return &vm->process;
+}
+
 bool lauf_vm_execute(lauf_vm* vm, const lauf_asm_program* program, const lauf_runtime_value* input,
                      lauf_runtime_value* output)
 {
     auto fn = program->_entry;
 
+    lauf_asm_chunk::cache_key cache_key{};
+    if (fn->chunk != nullptr)
+    {
+        cache_key = {lauf::get_globals_version(fn->module), vm->step_limit, vm->max_vstack_size,
+                     vm->max_cstack_size};
+        if (auto cached_outputs = fn->chunk->get_cached_outputs(cache_key))
+        {
+            // The chunk is pure, so executing it again produces the same result.
+            for (auto i = 0u; i != fn->sig.output_count; ++i)
+                output[i] = cached_outputs[i];
+            return true;
+        }
+    }
+
     lauf_runtime_process::init(&vm->process, vm, program);
     auto result = lauf_runtime_call(&vm->process, fn, input, output);
     lauf_runtime_process::cleanup(&vm->process);
 
+    if (result && fn->chunk != nullptr)
+        fn->chunk->cache_outputs(cache_key, output);
+
     return result;
 }
 
@@ -9,12 +9,15 @@
 #include <lauf/runtime/process.hpp>
 #include <lauf/support/arena.hpp>
 #include <lauf/support/page_allocator.hpp>
+#include <lauf/support/slab_allocator.hpp>
 
 struct lauf_vm : lauf::intrinsic_arena<lauf_vm>
 {
     lauf_vm_panic_handler panic_handler;
     lauf_vm_allocator     heap_allocator;
     lauf::page_allocator  page_allocator;
+    // Used by lauf_vm_slab_allocator.
+    lauf::slab_allocator slab_allocator;
 
     // In number of elements.
     std::size_t initial_vstack_size;
@@ -25,26 +28,55 @@ struct lauf_vm : lauf::intrinsic_arena<lauf_vm>
 
     std::size_t step_limit;
 
+    bool        generational_gc;
+    std::size_t gc_thread_count;
+    std::size_t gc_min_heap_threshold;
+    double      gc_heap_growth_factor;
+    std::size_t max_heap_size;
+
     lauf_runtime_process process;
     void*                user_data;
 
     explicit lauf_vm(lauf::arena_key key, lauf_vm_options options)
     : lauf::intrinsic_arena<lauf_vm>(key), panic_handler(options.panic_handler),
       heap_allocator(options.allocator),
+      page_allocator(options.use_huge_pages, options.prefault_pages,
+                     options.max_page_cache_size_in_bytes),
       initial_vstack_size(options.initial_vstack_size_in_elements),
       max_vstack_size(options.max_vstack_size_in_elements),
       initial_cstack_size(options.initial_cstack_size_in_bytes),
       max_cstack_size(options.max_cstack_size_in_bytes), step_limit(options.step_limit),
+      generational_gc(options.generational_gc), gc_thread_count(options.gc_thread_count),
+      gc_min_heap_threshold(options.gc_min_heap_threshold),
+      gc_heap_growth_factor(options.gc_heap_growth_factor), max_heap_size(options.max_heap_size),
       user_data(options.user_data)
-    {}
+    {
+        if (uses_slab_allocator())
+            heap_allocator.user_data = this;
+
+        if (options.prefault_pages)
+        {
+            // We put the memory for the stacks of the first fiber in the cache.
+            auto vstack = page_allocator.allocate(initial_vstack_size * sizeof(lauf_runtime_value));
+            auto cstack = page_allocator.allocate(initial_cstack_size);
+            page_allocator.deallocate(vstack);
+            page_allocator.deallocate(cstack);
+        }
+    }
 
     ~lauf_vm()
     {
         process.memory.destroy(this);
+        slab_allocator.destroy(page_allocator);
 
         [[maybe_unused]] auto leaked_bytes = page_allocator.release();
         assert(leaked_bytes == 0);
     }
+
+    bool uses_slab_allocator() const
+    {
+        return heap_allocator.heap_alloc == lauf_vm_slab_allocator.heap_alloc;
+    }
 };
 
 #endif // SRC_LAUF_VM_HPP_INCLUDED
@@ -71,7 +71,9 @@ LAUF_NOINLINE bool allocate_more_vstack_space(const lauf_asm_inst*      ip,
                                               lauf_runtime_stack_frame* frame_ptr,
                                               lauf_runtime_process*     process)
 {
-    process->cur_fiber->vstack.grow(process->vm->page_allocator, vstack_ptr);
+    ++process->vstack_grow_count;
+    process->cur_fiber->vstack.grow(process->vm->page_allocator, vstack_ptr,
+                                     process->vm->max_vstack_size);
     if (LAUF_UNLIKELY(process->cur_fiber->vstack.capacity() > process->vm->max_vstack_size))
         LAUF_DO_PANIC("vstack overflow");
 
@@ -83,6 +85,7 @@ LAUF_NOINLINE bool allocate_more_cstack_space(const lauf_asm_inst*      ip,
                                               lauf_runtime_stack_frame* frame_ptr,
                                               lauf_runtime_process*     process)
 {
+    ++process->cstack_grow_count;
     process->cur_fiber->cstack.grow(process->vm->page_allocator, frame_ptr);
     if (LAUF_UNLIKELY(process->cur_fiber->cstack.capacity() > process->vm->max_cstack_size))
         LAUF_DO_PANIC("cstack overflow");
@@ -90,7 +93,10 @@ LAUF_NOINLINE bool allocate_more_cstack_space(const lauf_asm_inst*      ip,
     LAUF_VM_DISPATCH;
 }
 
-#define LAUF_DO_CALL(Callee)                                                                       \
+#define LAUF_DO_CALL(Callee) LAUF_DO_CALL_RETURN_AFTER(Callee, ip)
+
+// Same as LAUF_DO_CALL(), but the callee returns to the instruction after LastIp.
+#define LAUF_DO_CALL_RETURN_AFTER(Callee, LastIp)                                                  \
     {                                                                                              \
         /* Check that we have enough space left on the vstack. */                                  \
         if (auto remaining = vstack_ptr - process->cur_fiber->vstack.limit();                      \
@@ -98,7 +104,7 @@ LAUF_NOINLINE bool allocate_more_cstack_space(const lauf_asm_inst*      ip,
             LAUF_TAIL_CALL return allocate_more_vstack_space(ip, vstack_ptr, frame_ptr, process);  \
                                                                                                    \
         /* Create a new stack frame. */                                                            \
-        auto new_frame = process->cur_fiber->cstack.new_call_frame(frame_ptr, (Callee), ip);       \
+        auto new_frame = process->cur_fiber->cstack.new_call_frame(frame_ptr, (Callee), LastIp);   \
         if (LAUF_UNLIKELY(new_frame == nullptr))                                                   \
             LAUF_TAIL_CALL return allocate_more_cstack_space(ip, vstack_ptr, frame_ptr, process);  \
                                                                                                    \
@@ -111,9 +117,12 @@ LAUF_NOINLINE bool call_undefined_function(const lauf_asm_inst* ip, lauf_runtime
                                            lauf_runtime_stack_frame* frame_ptr,
                                            lauf_runtime_process*     process)
 {
-    auto callee
-        = lauf::uncompress_pointer_offset<lauf_asm_function>(frame_ptr->function, ip->call.offset);
-    assert(ip->op() == lauf::asm_op::call && callee->insts == nullptr);
+    auto is_long = ip->op() == lauf::asm_op::call_long;
+    auto callee  = lauf::uncompress_pointer_offset<lauf_asm_function>(frame_ptr->function,
+                                                                     is_long ? lauf::long_offset(ip)
+                                                                             : ip->call.offset);
+    assert((is_long || ip->op() == lauf::asm_op::call) && callee->insts == nullptr);
+    ++process->undefined_function_call_count;
 
     auto definition = [&] {
         auto extra = lauf::try_get_extra_data(process->program);
@@ -151,12 +160,12 @@ LAUF_NOINLINE bool call_undefined_function(const lauf_asm_inst* ip, lauf_runtime
             std::swap(*lhs, *rhs);
 
         // Continue after the call, as we know completely took care of it.
-        ++ip;
+        ip += is_long ? 2 : 1;
         LAUF_VM_DISPATCH;
     }
     else
     {
-        LAUF_DO_CALL(definition->external);
+        LAUF_DO_CALL_RETURN_AFTER(definition->external, is_long ? ip + 1 : ip);
         LAUF_VM_DISPATCH;
     }
 }
@@ -221,6 +230,8 @@ LAUF_VM_EXECUTE(return_free)
         alloc.status = lauf::allocation_status::freed;
     }
     process->memory.remove_freed();
+    process->memory.recycle_freed(process->vm->page_allocator, frame_ptr->first_local_alloc,
+                                  ip->return_free.value);
 
     ip        = frame_ptr->return_ip;
     frame_ptr = frame_ptr->prev;
@@ -254,6 +265,40 @@ LAUF_VM_EXECUTE_BRANCH(le, <=)
 LAUF_VM_EXECUTE_BRANCH(ge, >=)
 LAUF_VM_EXECUTE_BRANCH(gt, >)
 
+LAUF_VM_EXECUTE(jump_long)
+{
+    ip += lauf::long_offset(ip);
+    LAUF_VM_DISPATCH;
+}
+
+#define LAUF_VM_EXECUTE_BRANCH_LONG(CC, Comp)                                                      \
+    LAUF_VM_EXECUTE(branch_##CC##_long)                                                            \
+    {                                                                                              \
+        auto condition = vstack_ptr[0].as_sint;                                                    \
+        ++vstack_ptr;                                                                              \
+                                                                                                   \
+        if (condition Comp 0)                                                                      \
+            ip += lauf::long_offset(ip);                                                           \
+        else                                                                                       \
+            ip += 2;                                                                               \
+                                                                                                   \
+        LAUF_VM_DISPATCH;                                                                          \
+    }
+
+LAUF_VM_EXECUTE_BRANCH_LONG(eq, ==)
+LAUF_VM_EXECUTE_BRANCH_LONG(ne, !=)
+LAUF_VM_EXECUTE_BRANCH_LONG(lt, <)
+LAUF_VM_EXECUTE_BRANCH_LONG(le, <=)
+LAUF_VM_EXECUTE_BRANCH_LONG(ge, >=)
+LAUF_VM_EXECUTE_BRANCH_LONG(gt, >)
+
+LAUF_VM_EXECUTE(offset_ext)
+{
+    // It is skipped by the preceding instruction, so never actually executed.
+    ++ip;
+    LAUF_VM_DISPATCH;
+}
+
 LAUF_VM_EXECUTE(panic)
 {
     auto msg = lauf_runtime_get_cstr(process, vstack_ptr[0].as_address);
@@ -347,6 +392,19 @@ LAUF_VM_EXECUTE(call)
     LAUF_VM_DISPATCH;
 }
 
+LAUF_VM_EXECUTE(call_long)
+{
+    auto callee = lauf::uncompress_pointer_offset<lauf_asm_function>(frame_ptr->function,
+                                                                     lauf::long_offset(ip));
+
+    if (LAUF_UNLIKELY(callee->insts == nullptr))
+        LAUF_TAIL_CALL return call_undefined_function(ip, vstack_ptr, frame_ptr, process);
+
+    // We need to skip the offset_ext instruction when returning.
+    LAUF_DO_CALL_RETURN_AFTER(callee, ip + 1);
+    LAUF_VM_DISPATCH;
+}
+
 LAUF_VM_EXECUTE(call_indirect)
 {
     auto ptr    = vstack_ptr[0].as_function_address;
@@ -521,6 +579,20 @@ LAUF_VM_EXECUTE(function_addr)
     LAUF_VM_DISPATCH;
 }
 
+LAUF_VM_EXECUTE(function_addr_long)
+{
+    auto fn = lauf::uncompress_pointer_offset<lauf_asm_function>(frame_ptr->function,
+                                                                 lauf::long_offset(ip));
+
+    --vstack_ptr;
+    vstack_ptr[0].as_function_address.index        = fn->function_idx;
+    vstack_ptr[0].as_function_address.input_count  = fn->sig.input_count;
+    vstack_ptr[0].as_function_address.output_count = fn->sig.output_count;
+
+    ip += 2;
+    LAUF_VM_DISPATCH;
+}
+
 LAUF_VM_EXECUTE(local_addr)
 {
     auto allocation_idx = frame_ptr->first_local_alloc + ip->local_addr.index;
@@ -661,6 +733,19 @@ LAUF_VM_EXECUTE(select)
     LAUF_VM_DISPATCH;
 }
 
+LAUF_VM_EXECUTE(select_unchecked)
+{
+    auto idx = vstack_ptr[0].as_uint;
+    ++vstack_ptr;
+
+    auto value = vstack_ptr[idx];
+    vstack_ptr += ip->select_unchecked.idx;
+    vstack_ptr[0] = value;
+
+    ++ip;
+    LAUF_VM_DISPATCH;
+}
+
 //=== memory ===//
 LAUF_VM_EXECUTE(setup_local_alloc)
 {
@@ -751,6 +836,7 @@ LAUF_VM_EXECUTE(deref_mut)
         if (LAUF_UNLIKELY(ptr == nullptr))
             goto panic;
 
+        process->memory.write_barrier(process->vm->page_allocator, address.allocation);
         vstack_ptr[0].as_native_ptr = const_cast<void*>(ptr);
     }
 
@@ -761,6 +847,17 @@ panic:
     LAUF_DO_PANIC("invalid address");
 }
 
+LAUF_VM_EXECUTE(deref_unchecked)
+{
+    auto address = vstack_ptr[0].as_address;
+
+    auto& alloc                 = process->memory[address.allocation];
+    vstack_ptr[0].as_native_ptr = alloc.unchecked_offset(address.offset);
+
+    ++ip;
+    LAUF_VM_DISPATCH;
+}
+
 LAUF_VM_EXECUTE(array_element)
 {
     auto address = vstack_ptr[1].as_address;
@@ -823,6 +920,7 @@ LAUF_VM_EXECUTE(store_global_value)
 {
     auto allocation = get_global_allocation_idx(frame_ptr, process, ip->store_global_value.value);
     auto memory     = process->memory[allocation].ptr;
+    process->memory.write_barrier(process->vm->page_allocator, std::uint32_t(allocation));
 
     *reinterpret_cast<lauf_runtime_value*>(memory) = vstack_ptr[0];
     ++vstack_ptr;
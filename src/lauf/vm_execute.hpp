@@ -31,7 +31,8 @@ bool _vm_dispatch(const lauf_asm_inst* ip, lauf_runtime_value* vstack_ptr,
 
 namespace lauf
 {
-constexpr lauf_asm_inst trampoline_code[3] = {
+// It is inline, so that every translation unit agrees on its address.
+inline constexpr lauf_asm_inst trampoline_code[3] = {
     // We need one nop instruction in front, so we can use it for fiber creation.
     // (Resume will always increment the ip first, which goes to the real call instruction)
     lauf_asm_inst(),
@@ -13,6 +13,7 @@
 #include <lauf/asm/program.h>
 
 #include <lauf/runtime/process.h>
+#include <lauf/runtime/snapshot.h>
 #include <lauf/runtime/stacktrace.h>
 #include <lauf/runtime/value.h>
 
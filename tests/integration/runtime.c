@@ -21,6 +21,13 @@ void* lauf_heap_alloc_array(uint64_t count, uint64_t size, uint64_t alignment)
     return lauf_heap_alloc(count * rounded_size, alignment);
 }
 
+void* lauf_heap_alloc_typed(uint64_t pointer_map, uint64_t count, uint64_t size,
+                            uint64_t alignment)
+{
+    (void)pointer_map;
+    return lauf_heap_alloc_array(count, size, alignment);
+}
+
 void lauf_heap_free(void* ptr)
 {
     free(ptr);
@@ -31,6 +38,17 @@ uint64_t lauf_heap_gc(void)
     return 0;
 }
 
+uint64_t lauf_heap_gc_step(uint64_t budget_bytes)
+{
+    (void)budget_bytes;
+    return 1;
+}
+
+uint64_t lauf_heap_gc_minor(void)
+{
+    return 0;
+}
+
 void lauf_memory_copy(void* dest, void* src, uint64_t count)
 {
     memmove(dest, src, count);
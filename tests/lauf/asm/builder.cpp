@@ -5,12 +5,15 @@
 
 #include <doctest/doctest.h>
 #include <lauf/asm/module.hpp>
+#include <lauf/asm/program.h>
 #include <lauf/asm/type.h>
 #include <lauf/backend/dump.h>
 #include <lauf/lib/debug.h>
 #include <lauf/lib/int.h>
 #include <lauf/lib/test.h>
 #include <lauf/runtime/builtin.h>
+#include <lauf/runtime/stack.hpp>
+#include <lauf/vm.h>
 #include <lauf/writer.h>
 #include <vector>
 
@@ -90,6 +93,10 @@ TEST_CASE("lauf_asm_build_string_literal")
     auto abc2 = lauf_asm_build_string_literal(b, "abc");
     CHECK(abc2 == abc);
 
+    auto xyz = lauf_asm_add_global(mod, LAUF_ASM_GLOBAL_READ_ONLY);
+    lauf_asm_define_data_global(mod, xyz, {4, 1}, "xyz");
+    CHECK(lauf_asm_build_string_literal(b, "xyz") == xyz);
+
     lauf_asm_destroy_builder(b);
     lauf_asm_destroy_module(mod);
 }
@@ -159,6 +166,71 @@ TEST_CASE("lauf_asm_inst_branch2")
     CHECK(same[0].pop_top.idx == 0);
 }
 
+TEST_CASE("long jumps")
+{
+    auto mod = lauf_asm_create_module("test");
+    auto fn  = lauf_asm_add_function(mod, "test", {1, 1});
+    auto b   = lauf_asm_create_builder(lauf_asm_default_build_options);
+
+    lauf_asm_build(b, mod, fn);
+    auto loop = lauf_asm_declare_block(b, 1);
+    auto exit = lauf_asm_declare_block(b, 1);
+    lauf_asm_inst_jump(b, loop);
+
+    // The loop is too big for a 24 bit offset.
+    lauf_asm_build_block(b, loop);
+    for (auto i = 0; i != (1 << 23) / 3 + 1; ++i)
+    {
+        lauf_asm_inst_uint(b, 1);
+        lauf_asm_inst_call_builtin(b, lauf_lib_int_uadd(LAUF_LIB_INT_OVERFLOW_WRAP));
+    }
+    lauf_asm_inst_pick(b, 0);
+    lauf_asm_inst_branch(b, exit, loop);
+
+    lauf_asm_build_block(b, exit);
+    lauf_asm_inst_return(b);
+    REQUIRE(lauf_asm_build_finish(b));
+    CHECK(fn->verified);
+
+    auto branch = fn->insts + fn->inst_count - 4;
+    REQUIRE(branch->op() == lauf::asm_op::branch_eq_long);
+    CHECK(branch[1].op() == lauf::asm_op::offset_ext);
+    CHECK(branch[lauf::long_offset(branch) - 1].op() == lauf::asm_op::block);
+    CHECK(branch + lauf::long_offset(branch) == fn->insts + 2);
+
+    lauf_asm_destroy_builder(b);
+    lauf_asm_destroy_module(mod);
+}
+
+TEST_CASE("debug locations in big blocks")
+{
+    auto mod = lauf_asm_create_module("test");
+    auto fn  = lauf_asm_add_function(mod, "test", {1, 1});
+    auto b   = lauf_asm_create_builder(lauf_asm_default_build_options);
+
+    // The block has more instructions than fit into 16 bit.
+    lauf_asm_build(b, mod, fn);
+    for (auto i = 0; i != 40 * 1000; ++i)
+    {
+        lauf_asm_inst_uint(b, 1);
+        lauf_asm_inst_call_builtin(b, lauf_lib_int_uadd(LAUF_LIB_INT_OVERFLOW_WRAP));
+    }
+    auto loc = lauf_asm_debug_location{1, 42, 11, false, 1};
+    lauf_asm_build_debug_location(b, loc);
+    lauf_asm_inst_return(b);
+    REQUIRE(lauf_asm_build_finish(b));
+    REQUIRE(fn->inst_count > UINT16_MAX);
+
+    auto ret = fn->insts + fn->inst_count - 1;
+    CHECK(ret->op() == lauf::asm_op::return_);
+    CHECK(lauf_asm_debug_location_eq(lauf_asm_find_debug_location_of_instruction(mod, ret), loc));
+    CHECK(!lauf_asm_debug_location_eq(
+        lauf_asm_find_debug_location_of_instruction(mod, fn->insts + UINT16_MAX), loc));
+
+    lauf_asm_destroy_builder(b);
+    lauf_asm_destroy_module(mod);
+}
+
 TEST_CASE("lauf_asm_inst_uint")
 {
     auto build_uint = [](lauf_uint value) {
@@ -401,7 +473,78 @@ TEST_CASE("lauf_asm_inst_local_addr")
     });
     REQUIRE(multiple.size() == 1);
     CHECK(multiple[0].op() == lauf::asm_op::local_addr);
-    CHECK(multiple[0].local_addr.index == 1);
+    // Index of the allocation, and only the local whose address escapes has one.
+    CHECK(multiple[0].local_addr.index == 0);
+
+    auto escaping = build({0, 2}, [](lauf_asm_module*, lauf_asm_builder* b) {
+        auto loc1 = lauf_asm_build_local(b, {8, 8});
+        lauf_asm_build_local(b, {8, 8});
+        auto loc3 = lauf_asm_build_local(b, {8, 8});
+        lauf_asm_inst_local_addr(b, loc3);
+        lauf_asm_inst_local_addr(b, loc1);
+    });
+    REQUIRE(escaping.size() == 2);
+    CHECK(escaping[0].op() == lauf::asm_op::local_addr);
+    CHECK(escaping[0].local_addr.index == 1);
+    CHECK(escaping[1].op() == lauf::asm_op::local_addr);
+    CHECK(escaping[1].local_addr.index == 0);
+
+    auto member = build({0, 1}, [](lauf_asm_module*, lauf_asm_builder* b) {
+        lauf_asm_layout members[] = {lauf_asm_type_value.layout, lauf_asm_type_value.layout};
+        auto            loc       = lauf_asm_build_local(b, lauf_asm_aggregate_layout(members, 2));
+        lauf_asm_inst_local_addr(b, loc);
+        lauf_asm_inst_aggregate_member(b, 1, members, 2);
+        lauf_asm_inst_load_field(b, lauf_asm_type_value, 0);
+    });
+    REQUIRE(member.size() == 1);
+    CHECK(member[0].op() == lauf::asm_op::load_local_value);
+    CHECK(member[0].load_local_value.offset == sizeof(lauf_runtime_stack_frame) + 8);
+
+    auto element = build({0, 0}, [](lauf_asm_module*, lauf_asm_builder* b) {
+        auto loc = lauf_asm_build_local(b, lauf_asm_array_layout(lauf_asm_type_value.layout, 4));
+        lauf_asm_inst_uint(b, 42);
+        lauf_asm_inst_local_addr(b, loc);
+        lauf_asm_inst_uint(b, 3);
+        lauf_asm_inst_array_element(b, lauf_asm_type_value.layout);
+        lauf_asm_inst_store_field(b, lauf_asm_type_value, 0);
+    });
+    REQUIRE(element.size() == 2);
+    CHECK(element[0].op() == lauf::asm_op::push);
+    CHECK(element[1].op() == lauf::asm_op::store_local_value);
+    CHECK(element[1].store_local_value.offset == sizeof(lauf_runtime_stack_frame) + 3 * 8);
+}
+
+TEST_CASE("local allocations")
+{
+    auto mod = lauf_asm_create_module("test");
+    auto fn  = lauf_asm_add_function(mod, "test", {0, 1});
+
+    auto b = lauf_asm_create_builder(lauf_asm_default_build_options);
+    lauf_asm_build(b, mod, fn);
+    auto scratch = lauf_asm_build_local(b, {16, 8});
+    auto escaped = lauf_asm_build_local(b, {8, 8});
+    lauf_asm_inst_local_addr(b, scratch);
+    lauf_asm_inst_load_field(b, lauf_asm_type_value, 0);
+    lauf_asm_inst_pop(b, 0);
+    lauf_asm_inst_local_addr(b, escaped);
+    lauf_asm_inst_return(b);
+    REQUIRE(lauf_asm_build_finish(b));
+    lauf_asm_destroy_builder(b);
+
+    // Only the escaped local gets an allocation, the other one just reserves storage.
+    REQUIRE(fn->inst_count == 6);
+    CHECK(fn->insts[0].op() == lauf::asm_op::setup_local_alloc);
+    CHECK(fn->insts[0].setup_local_alloc.value == 1);
+    CHECK(fn->insts[1].op() == lauf::asm_op::local_storage);
+    CHECK(fn->insts[1].local_storage.value == 16);
+    CHECK(fn->insts[2].op() == lauf::asm_op::local_alloc);
+    CHECK(fn->insts[3].op() == lauf::asm_op::block);
+    CHECK(fn->insts[4].op() == lauf::asm_op::local_addr);
+    CHECK(fn->insts[4].local_addr.index == 0);
+    CHECK(fn->insts[5].op() == lauf::asm_op::return_free);
+    CHECK(fn->insts[5].return_free.value == 1);
+
+    lauf_asm_destroy_module(mod);
 }
 
 TEST_CASE("lauf_asm_inst_cc")
@@ -544,6 +687,143 @@ TEST_CASE("lauf_asm_inst_roll")
     CHECK(roll2[0].roll.idx == 2);
 }
 
+TEST_CASE("shuffle elimination")
+{
+    auto swap_swap = build({2, 2}, [](lauf_asm_module*, lauf_asm_builder* b) {
+        lauf_asm_inst_roll(b, 1);
+        lauf_asm_inst_roll(b, 1);
+    });
+    REQUIRE(swap_swap.empty());
+
+    auto roll_cycle = build({3, 3}, [](lauf_asm_module*, lauf_asm_builder* b) {
+        lauf_asm_inst_roll(b, 2);
+        lauf_asm_inst_roll(b, 2);
+        lauf_asm_inst_roll(b, 2);
+    });
+    REQUIRE(roll_cycle.empty());
+
+    auto pick_pop = build({2, 2}, [](lauf_asm_module*, lauf_asm_builder* b) {
+        lauf_asm_inst_pick(b, 1);
+        lauf_asm_inst_pop(b, 2);
+    });
+    REQUIRE(pick_pop.size() == 1);
+    CHECK(pick_pop[0].op() == lauf::asm_op::swap);
+    CHECK(pick_pop[0].swap.idx == 1);
+
+    auto roll_pop = build({3, 1}, [](lauf_asm_module*, lauf_asm_builder* b) {
+        lauf_asm_inst_roll(b, 2);
+        lauf_asm_inst_pop(b, 1);
+        lauf_asm_inst_pop(b, 1);
+    });
+    REQUIRE(roll_pop.size() == 2);
+    CHECK(roll_pop[0].op() == lauf::asm_op::pop_top);
+    CHECK(roll_pop[1].op() == lauf::asm_op::pop_top);
+
+    auto minimal = build({3, 4}, [](lauf_asm_module*, lauf_asm_builder* b) {
+        lauf_asm_inst_pick(b, 2);
+        lauf_asm_inst_roll(b, 1);
+    });
+    REQUIRE(minimal.size() == 2);
+    CHECK(minimal[0].op() == lauf::asm_op::pick);
+    CHECK(minimal[1].op() == lauf::asm_op::swap);
+
+    auto separated = build({2, 1}, [](lauf_asm_module*, lauf_asm_builder* b) {
+        lauf_asm_inst_roll(b, 1);
+        lauf_asm_inst_call_builtin(b, lauf_lib_int_sadd(LAUF_LIB_INT_OVERFLOW_WRAP));
+        lauf_asm_inst_pick(b, 0);
+        lauf_asm_inst_pop(b, 1);
+    });
+    REQUIRE(separated.size() == 3);
+    CHECK(separated[0].op() == lauf::asm_op::swap);
+    CHECK(separated[1].op() == lauf::asm_op::call_builtin_no_regs);
+    CHECK(separated[2].op() == lauf::asm_op::call_builtin_sig);
+}
+
+TEST_CASE("lauf_asm_build_get_stats")
+{
+    auto mod = lauf_asm_create_module("test");
+    auto fn  = lauf_asm_add_function(mod, "test", {2, 2});
+
+    auto b = lauf_asm_create_builder(lauf_asm_default_build_options);
+    lauf_asm_build(b, mod, fn);
+    lauf_asm_inst_roll(b, 1);
+    lauf_asm_inst_roll(b, 1);
+    lauf_asm_inst_pick(b, 1);
+    lauf_asm_inst_pop(b, 2);
+    lauf_asm_inst_return(b);
+    REQUIRE(lauf_asm_build_finish(b));
+    CHECK(lauf_asm_build_get_stats(b).eliminated_shuffles == 3);
+
+    lauf_asm_destroy_builder(b);
+    lauf_asm_destroy_module(mod);
+}
+
+TEST_CASE("local promotion")
+{
+    auto store_local = [](lauf_asm_builder* b, lauf_asm_local* local, lauf_uint value) {
+        lauf_asm_inst_uint(b, value);
+        lauf_asm_inst_local_addr(b, local);
+        lauf_asm_inst_store_field(b, lauf_asm_type_value, 0);
+    };
+    auto load_local = [](lauf_asm_builder* b, lauf_asm_local* local) {
+        lauf_asm_inst_local_addr(b, local);
+        lauf_asm_inst_load_field(b, lauf_asm_type_value, 0);
+    };
+
+    auto diamond = build({1, 1}, [&](lauf_asm_module*, lauf_asm_builder* b) {
+        auto x = lauf_asm_build_local(b, lauf_asm_type_value.layout);
+
+        auto if_true  = lauf_asm_declare_block(b, 0);
+        auto if_false = lauf_asm_declare_block(b, 0);
+        auto join     = lauf_asm_declare_block(b, 0);
+        lauf_asm_inst_branch(b, if_true, if_false);
+
+        lauf_asm_build_block(b, if_true);
+        store_local(b, x, 1);
+        lauf_asm_inst_jump(b, join);
+
+        lauf_asm_build_block(b, if_false);
+        store_local(b, x, 2);
+        lauf_asm_inst_jump(b, join);
+
+        lauf_asm_build_block(b, join);
+        load_local(b, x);
+    });
+    REQUIRE(diamond.size() == 4);
+    CHECK(diamond[0].op() == lauf::asm_op::branch_eq);
+    CHECK(diamond[1].op() == lauf::asm_op::push);
+    CHECK(diamond[2].op() == lauf::asm_op::jump);
+    CHECK(diamond[3].op() == lauf::asm_op::push);
+
+    auto live = build({1, 1}, [&](lauf_asm_module*, lauf_asm_builder* b) {
+        auto x = lauf_asm_build_local(b, lauf_asm_type_value.layout);
+
+        auto if_true  = lauf_asm_declare_block(b, 0);
+        auto if_false = lauf_asm_declare_block(b, 0);
+        auto join     = lauf_asm_declare_block(b, 0);
+        lauf_asm_inst_branch(b, if_true, if_false);
+
+        lauf_asm_build_block(b, if_true);
+        store_local(b, x, 1);
+        lauf_asm_inst_jump(b, join);
+
+        lauf_asm_build_block(b, if_false);
+        store_local(b, x, 2);
+        lauf_asm_inst_jump(b, join);
+
+        lauf_asm_build_block(b, join);
+        load_local(b, x);
+        // x is still needed here, so we can't promote it.
+        load_local(b, x);
+        lauf_asm_inst_call_builtin(b, lauf_lib_int_uadd(LAUF_LIB_INT_OVERFLOW_WRAP));
+    });
+    REQUIRE(live.size() == 10);
+    CHECK(live[2].op() == lauf::asm_op::store_local_value);
+    CHECK(live[5].op() == lauf::asm_op::store_local_value);
+    CHECK(live[6].op() == lauf::asm_op::load_local_value);
+    CHECK(live[7].op() == lauf::asm_op::load_local_value);
+}
+
 TEST_CASE("lauf_asm_inst_select")
 {
     auto basic
@@ -551,6 +831,14 @@ TEST_CASE("lauf_asm_inst_select")
     REQUIRE(basic.size() == 1);
     CHECK(basic[0].op() == lauf::asm_op::select);
     CHECK(basic[0].select.idx == 1);
+
+    auto bool_index = build({3, 1}, [](lauf_asm_module*, lauf_asm_builder* b) {
+        lauf_asm_inst_cc(b, LAUF_ASM_INST_CC_EQ);
+        lauf_asm_inst_select(b, 2);
+    });
+    REQUIRE(bool_index.size() == 2);
+    CHECK(bool_index[1].op() == lauf::asm_op::select_unchecked);
+    CHECK(bool_index[1].select.idx == 1);
 }
 
 TEST_CASE("lauf_asm_inst_call")
@@ -660,3 +948,220 @@ TEST_CASE("lauf_asm_inst_aggregate_member")
     CHECK(third[0].aggregate_member.value == 16);
 }
 
+TEST_CASE("build-time evaluation")
+{
+    auto mod = lauf_asm_create_module("test");
+
+    auto add = lauf_asm_add_function(mod, "add", {2, 1});
+    auto b   = lauf_asm_create_builder(lauf_asm_default_build_options);
+    lauf_asm_build(b, mod, add);
+    lauf_asm_inst_call_builtin(b, lauf_lib_int_sadd(LAUF_LIB_INT_OVERFLOW_PANIC));
+    lauf_asm_inst_return(b);
+    REQUIRE(lauf_asm_build_finish(b));
+
+    auto impure = lauf_asm_add_function(mod, "impure", {1, 1});
+    lauf_asm_build(b, mod, impure);
+    lauf_asm_inst_pick(b, 0);
+    lauf_asm_inst_call_builtin(b, lauf_lib_test_assert);
+    lauf_asm_inst_return(b);
+    REQUIRE(lauf_asm_build_finish(b));
+    lauf_asm_destroy_builder(b);
+
+    auto build_call = [&](size_t step_limit, auto builder_fn) {
+        auto opts                  = lauf_asm_default_build_options;
+        opts.const_eval_step_limit = step_limit;
+
+        auto fn = lauf_asm_add_function(mod, "test", {0, 1});
+        auto b  = lauf_asm_create_builder(opts);
+        lauf_asm_build(b, mod, fn);
+        builder_fn(b);
+        lauf_asm_inst_return(b);
+        REQUIRE(lauf_asm_build_finish(b));
+        auto stats = lauf_asm_build_get_stats(b);
+        lauf_asm_destroy_builder(b);
+
+        std::vector<lauf_asm_inst> result;
+        for (auto i = 0; i != fn->inst_count - 1; ++i)
+            if (fn->insts[i].op() != lauf::asm_op::block)
+                result.push_back(fn->insts[i]);
+        return std::make_pair(result, stats.evaluated_calls);
+    };
+
+    SUBCASE("pure")
+    {
+        auto [insts, evaluated] = build_call(100, [&](lauf_asm_builder* b) {
+            lauf_asm_inst_uint(b, 11);
+            lauf_asm_inst_uint(b, 31);
+            lauf_asm_inst_call(b, add);
+        });
+        CHECK(evaluated == 1);
+        REQUIRE(insts.size() == 1);
+        CHECK(insts[0].op() == lauf::asm_op::push);
+        CHECK(insts[0].push.value == 42);
+    }
+    SUBCASE("disabled")
+    {
+        auto [insts, evaluated] = build_call(0, [&](lauf_asm_builder* b) {
+            lauf_asm_inst_uint(b, 11);
+            lauf_asm_inst_uint(b, 31);
+            lauf_asm_inst_call(b, add);
+        });
+        CHECK(evaluated == 0);
+        REQUIRE(insts.size() == 3);
+        CHECK(insts[2].op() == lauf::asm_op::call);
+    }
+    SUBCASE("over budget")
+    {
+        auto [insts, evaluated] = build_call(1, [&](lauf_asm_builder* b) {
+            lauf_asm_inst_uint(b, 11);
+            lauf_asm_inst_uint(b, 31);
+            lauf_asm_inst_call(b, add);
+        });
+        CHECK(evaluated == 0);
+        REQUIRE(insts.size() == 3);
+        CHECK(insts[2].op() == lauf::asm_op::call);
+    }
+    SUBCASE("panic")
+    {
+        auto [insts, evaluated] = build_call(100, [&](lauf_asm_builder* b) {
+            lauf_asm_inst_sint(b, INT64_MAX);
+            lauf_asm_inst_uint(b, 1);
+            lauf_asm_inst_call(b, add);
+        });
+        CHECK(evaluated == 0);
+        REQUIRE(!insts.empty());
+        CHECK(insts.back().op() == lauf::asm_op::call);
+    }
+    SUBCASE("constant global")
+    {
+        auto global = lauf_asm_add_global(mod, LAUF_ASM_GLOBAL_READ_ONLY);
+        auto value  = lauf_uint(42);
+        lauf_asm_define_data_global(mod, global, lauf_asm_type_value.layout, &value);
+
+        auto load = lauf_asm_add_function(mod, "load", {0, 1});
+        auto b    = lauf_asm_create_builder(lauf_asm_default_build_options);
+        lauf_asm_build(b, mod, load);
+        lauf_asm_inst_global_addr(b, global);
+        lauf_asm_inst_load_field(b, lauf_asm_type_value, 0);
+        lauf_asm_inst_return(b);
+        REQUIRE(lauf_asm_build_finish(b));
+        lauf_asm_destroy_builder(b);
+
+        auto [insts, evaluated]
+            = build_call(100, [&](lauf_asm_builder* b) { lauf_asm_inst_call(b, load); });
+        CHECK(evaluated == 1);
+        REQUIRE(insts.size() == 1);
+        CHECK(insts[0].op() == lauf::asm_op::push);
+        CHECK(insts[0].push.value == 42);
+    }
+    SUBCASE("global address")
+    {
+        auto global = lauf_asm_add_global(mod, LAUF_ASM_GLOBAL_READ_ONLY);
+        auto value  = lauf_uint(42);
+        lauf_asm_define_data_global(mod, global, lauf_asm_type_value.layout, &value);
+
+        auto addr = lauf_asm_add_function(mod, "addr", {0, 1});
+        auto b    = lauf_asm_create_builder(lauf_asm_default_build_options);
+        lauf_asm_build(b, mod, addr);
+        lauf_asm_inst_global_addr(b, global);
+        lauf_asm_inst_return(b);
+        REQUIRE(lauf_asm_build_finish(b));
+        lauf_asm_destroy_builder(b);
+
+        auto [insts, evaluated]
+            = build_call(100, [&](lauf_asm_builder* b) { lauf_asm_inst_call(b, addr); });
+        CHECK(evaluated == 0);
+        REQUIRE(insts.size() == 1);
+        CHECK(insts[0].op() == lauf::asm_op::call);
+
+        // The most recently added function is the one we've just built.
+        auto fn      = lauf::get_functions(mod).first;
+        auto vm      = lauf_create_vm(lauf_default_vm_options);
+        auto program = lauf_asm_create_program(mod, fn);
+        auto output  = lauf_runtime_value{};
+        REQUIRE(lauf_vm_execute(vm, &program, nullptr, &output));
+        CHECK(output.as_address.allocation == 0);
+        CHECK(output.as_address.generation == 0);
+        CHECK(output.as_address.offset == 0);
+        lauf_destroy_vm(vm);
+    }
+    SUBCASE("impure")
+    {
+        auto [insts, evaluated] = build_call(100, [&](lauf_asm_builder* b) {
+            lauf_asm_inst_uint(b, 1);
+            lauf_asm_inst_call(b, impure);
+        });
+        CHECK(evaluated == 0);
+        REQUIRE(insts.size() == 2);
+        CHECK(insts[1].op() == lauf::asm_op::call);
+    }
+
+    lauf_asm_destroy_module(mod);
+}
+
+TEST_CASE("verifier")
+{
+    auto mod = lauf_asm_create_module("test");
+    auto fn  = lauf_asm_add_function(mod, "test", {0, 2});
+
+    auto b = lauf_asm_create_builder(lauf_asm_default_build_options);
+    lauf_asm_build(b, mod, fn);
+    auto local = lauf_asm_build_local(b, lauf_lib_int_s32.layout);
+    lauf_asm_inst_local_addr(b, local);
+    lauf_asm_inst_load_field(b, lauf_lib_int_s32, 0);
+    // Out of bounds, so it needs to be checked at runtime.
+    lauf_asm_inst_local_addr(b, local);
+    lauf_asm_inst_uint(b, 2);
+    lauf_asm_inst_array_element(b, lauf_lib_int_s32.layout);
+    lauf_asm_inst_load_field(b, lauf_lib_int_s32, 0);
+    lauf_asm_inst_return(b);
+    REQUIRE(lauf_asm_build_finish(b));
+    lauf_asm_destroy_builder(b);
+
+    CHECK(fn->verified);
+
+    std::vector<lauf::asm_op> derefs;
+    for (auto ip = fn->insts; ip != fn->insts + fn->inst_count; ++ip)
+        if (ip->op() == lauf::asm_op::deref_const || ip->op() == lauf::asm_op::deref_unchecked)
+            derefs.push_back(ip->op());
+    REQUIRE(derefs.size() == 2);
+    CHECK(derefs[0] == lauf::asm_op::deref_unchecked);
+    CHECK(derefs[1] == lauf::asm_op::deref_const);
+
+    lauf_asm_destroy_module(mod);
+}
+
+TEST_CASE("lauf_asm_module_build_parallel")
+{
+    auto mod = lauf_asm_create_module("test");
+
+    std::vector<lauf_asm_function*> fns;
+    for (auto i = 0; i != 100; ++i)
+        fns.push_back(lauf_asm_add_function(mod, "test", {0, 1}));
+
+    auto result = lauf_asm_module_build_parallel(
+        mod, lauf_asm_default_build_options, 4, fns.size(),
+        [](lauf_asm_builder* b, lauf_asm_module* mod, size_t index, void* user_data) {
+            auto fn = static_cast<lauf_asm_function**>(user_data)[index];
+            lauf_asm_build(b, mod, fn);
+            lauf_asm_build_debug_location(b, {1, std::uint16_t(index + 1), 1, false, 0});
+            lauf_asm_inst_uint(b, index);
+            lauf_asm_inst_return(b);
+            return lauf_asm_build_finish(b);
+        },
+        fns.data());
+    CHECK(result);
+
+    for (auto i = 0u; i != fns.size(); ++i)
+    {
+        auto fn = fns[i];
+        REQUIRE(fn->insts != nullptr);
+        CHECK(fn->insts[1].op() == lauf::asm_op::push);
+        CHECK(fn->insts[1].push.value == i);
+
+        auto loc = lauf_asm_find_debug_location_of_instruction(mod, fn->insts + 1);
+        CHECK(loc.line_nr == i + 1);
+    }
+
+    lauf_asm_destroy_module(mod);
+}
@@ -87,6 +87,20 @@ TEST_CASE("array_list")
                 for (auto i = 0; i != 1024; ++i)
                     list.push_back(*arena, 42);
             }
+            SUBCASE("pop_back with back")
+            {
+                list.pop_back();
+                for (auto i = 0; i != 1023; ++i)
+                {
+                    CHECK(list.back() == 42);
+                    list.back() = 11;
+                    list.pop_back();
+                }
+                CHECK(list.size() == 0);
+
+                for (auto i = 0; i != 1024; ++i)
+                    list.push_back(*arena, 42);
+            }
 
             CHECK(list.size() == 1024);
             for (auto elem : list)
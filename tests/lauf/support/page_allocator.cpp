@@ -0,0 +1,146 @@
+// Copyright (C) 2022-2023 Jonathan Müller and lauf contributors
+// SPDX-License-Identifier: BSL-1.0
+
+#include <lauf/support/page_allocator.hpp>
+
+#include <doctest/doctest.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+TEST_CASE("page_allocator")
+{
+    SUBCASE("cache")
+    {
+        lauf::page_allocator allocator;
+
+        auto block = allocator.allocate(1);
+        REQUIRE(block.ptr != nullptr);
+        REQUIRE(block.size >= lauf::page_allocator::page_size);
+        REQUIRE(block.size % lauf::page_allocator::page_size == 0);
+        allocator.deallocate(block);
+
+        // The pages are re-used.
+        auto other = allocator.allocate(1);
+        REQUIRE(other.ptr == block.ptr);
+        allocator.deallocate(other);
+
+        REQUIRE(allocator.release() == 0);
+    }
+    SUBCASE("split and coalesce")
+    {
+        lauf::page_allocator allocator;
+
+        auto block     = allocator.allocate(3 * lauf::page_allocator::page_size);
+        auto page_size = block.size / 3;
+        allocator.deallocate(block);
+
+        // The cached block is split into pages.
+        auto a = allocator.allocate(page_size);
+        auto b = allocator.allocate(page_size);
+        auto c = allocator.allocate(page_size);
+        REQUIRE(a.ptr == block.ptr);
+        REQUIRE(b.ptr == static_cast<unsigned char*>(a.ptr) + page_size);
+        REQUIRE(c.ptr == static_cast<unsigned char*>(b.ptr) + page_size);
+        REQUIRE(allocator.cached_bytes() == 0);
+
+        // Freed pages are merged with both neighbors.
+        allocator.deallocate(b);
+        allocator.deallocate(a);
+        allocator.deallocate(c);
+        REQUIRE(allocator.cached_bytes() == block.size);
+        auto merged = allocator.allocate(block.size);
+        REQUIRE(merged.ptr == block.ptr);
+        REQUIRE(merged.size == block.size);
+
+        // It can be extended into cached pages that follow it.
+        REQUIRE(merged.ptr == a.ptr);
+        allocator.deallocate(c);
+        REQUIRE(allocator.try_extend(b, 2 * page_size) == 2 * page_size);
+        REQUIRE(allocator.cached_bytes() == 0);
+
+        allocator.deallocate(a);
+        allocator.deallocate({b.ptr, 2 * page_size});
+        REQUIRE(allocator.release() == 0);
+    }
+    SUBCASE("cache limit")
+    {
+        auto page_size = static_cast<std::size_t>(::sysconf(_SC_PAGE_SIZE));
+
+        lauf::page_allocator allocator(false, false, 2 * page_size);
+
+        auto block = allocator.allocate(4 * page_size);
+        REQUIRE(allocator.allocated_bytes() == 4 * page_size);
+
+        // Only two pages are kept.
+        allocator.deallocate(block);
+        REQUIRE(allocator.cached_bytes() == 2 * page_size);
+        REQUIRE(allocator.allocated_bytes() == 2 * page_size);
+
+        auto other = allocator.allocate(page_size);
+        REQUIRE(other.ptr == block.ptr);
+        allocator.deallocate(other);
+        REQUIRE(allocator.release() == 0);
+    }
+    SUBCASE("reserve")
+    {
+        auto page_size = static_cast<std::size_t>(::sysconf(_SC_PAGE_SIZE));
+
+        lauf::page_allocator allocator;
+
+        auto reservation = allocator.reserve(8 * page_size);
+        REQUIRE(reservation.ptr != nullptr);
+        REQUIRE(reservation.size == 8 * page_size);
+        REQUIRE(allocator.allocated_bytes() == 0);
+
+        // We commit from the top down, like the vstack.
+        auto top = static_cast<unsigned char*>(reservation.ptr) + 6 * page_size;
+        REQUIRE(allocator.commit(top, 2 * page_size));
+        top[0] = 42;
+        REQUIRE(allocator.commit(top - 2 * page_size, 2 * page_size));
+        top[-1] = 11;
+        CHECK(top[0] == 42);
+        CHECK(allocator.allocated_bytes() == 4 * page_size);
+
+        allocator.unreserve(reservation, 4 * page_size);
+        CHECK(allocator.cached_bytes() == 0);
+        REQUIRE(allocator.release() == 0);
+    }
+#ifdef MADV_HUGEPAGE
+    SUBCASE("huge pages")
+    {
+        lauf::page_allocator allocator(true, false, 0);
+        constexpr auto       huge_page_size = lauf::page_allocator::huge_page_size;
+
+        auto block = allocator.allocate(huge_page_size + 1);
+        REQUIRE(block.size == 2 * huge_page_size);
+        REQUIRE(lauf::is_aligned(block.ptr, huge_page_size));
+        REQUIRE(allocator.allocated_bytes() == block.size);
+
+        // Small blocks use normal pages.
+        auto small = allocator.allocate(1);
+        REQUIRE(small.size < huge_page_size);
+
+        allocator.deallocate(block);
+        allocator.deallocate(small);
+        REQUIRE(allocator.release() == 0);
+    }
+#endif
+#ifdef __linux__
+    SUBCASE("prefault")
+    {
+        lauf::page_allocator allocator(false, true, 0);
+
+        auto block = allocator.allocate(64 * 1024);
+
+        // All pages are resident before we access them.
+        std::vector<unsigned char> residency(block.size / lauf::page_allocator::page_size);
+        REQUIRE(::mincore(block.ptr, block.size, residency.data()) == 0);
+        for (auto page : residency)
+            REQUIRE((page & 1) != 0);
+
+        allocator.deallocate(block);
+        REQUIRE(allocator.release() == 0);
+    }
+#endif
+}
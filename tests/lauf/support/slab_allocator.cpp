@@ -0,0 +1,101 @@
+// Copyright (C) 2022-2023 Jonathan Müller and lauf contributors
+// SPDX-License-Identifier: BSL-1.0
+
+#include <lauf/support/slab_allocator.hpp>
+
+#include <cstring>
+#include <doctest/doctest.h>
+
+TEST_CASE("slab_allocator")
+{
+    lauf::page_allocator page_allocator;
+    lauf::slab_allocator allocator;
+
+    auto check_zeroed = [](void* ptr, std::size_t size) {
+        for (auto i = 0u; i != size; ++i)
+            REQUIRE(static_cast<unsigned char*>(ptr)[i] == 0);
+    };
+
+    SUBCASE("small")
+    {
+        for (auto size : {0u, 1u, 8u, 16u, 17u, 100u, 512u, 1000u, 1024u})
+        {
+            void* ptrs[64];
+            for (auto& ptr : ptrs)
+            {
+                ptr = allocator.allocate(page_allocator, size, 8);
+                REQUIRE(ptr != nullptr);
+                REQUIRE(lauf::is_aligned(ptr, 8));
+                check_zeroed(ptr, size);
+                std::memset(ptr, 'a', size);
+            }
+
+            for (auto ptr : ptrs)
+                allocator.deallocate(ptr, size);
+
+            // Memory is reused, but zeroed again.
+            auto ptr = allocator.allocate(page_allocator, size, 8);
+            REQUIRE(ptr == ptrs[63]);
+            check_zeroed(ptr, size);
+            allocator.deallocate(ptr, 0);
+        }
+    }
+    SUBCASE("aligned")
+    {
+        for (auto alignment : {16u, 64u, 256u, 1024u, 2048u, 4096u, 64u * 1024u})
+        {
+            auto ptr = allocator.allocate(page_allocator, 8, alignment);
+            REQUIRE(ptr != nullptr);
+            REQUIRE(lauf::is_aligned(ptr, alignment));
+            check_zeroed(ptr, 8);
+            std::memset(ptr, 'a', 8);
+            allocator.deallocate(ptr, 8);
+        }
+
+        // This one is freed by clear().
+        auto ptr = allocator.allocate(page_allocator, 8 * 1024u, 8 * 1024u);
+        REQUIRE(ptr != nullptr);
+        REQUIRE(lauf::is_aligned(ptr, 8 * 1024u));
+    }
+    SUBCASE("large")
+    {
+        auto size = 64 * 1024u;
+
+        auto ptr1 = allocator.allocate(page_allocator, size, 8);
+        REQUIRE(ptr1 != nullptr);
+        check_zeroed(ptr1, size);
+        std::memset(ptr1, 'a', size);
+
+        auto ptr2 = allocator.allocate(page_allocator, size, 8);
+        REQUIRE(ptr2 != nullptr);
+        check_zeroed(ptr2, size);
+
+        allocator.deallocate(ptr1, 0);
+        // ptr2 is freed by clear().
+    }
+    SUBCASE("leak")
+    {
+        auto small = allocator.allocate(page_allocator, 16, 8);
+        auto large = allocator.allocate(page_allocator, 64 * 1024u, 8);
+        auto other = allocator.allocate(page_allocator, 64 * 1024u, 8);
+        REQUIRE(small != nullptr);
+        REQUIRE(large != nullptr);
+        REQUIRE(other != nullptr);
+        allocator.leak(page_allocator, small);
+        allocator.leak(page_allocator, large);
+
+        // Leaked memory stays valid.
+        allocator.clear(page_allocator);
+        std::memset(small, 'a', 16);
+        std::memset(large, 'a', 64 * 1024u);
+        CHECK(page_allocator.allocated_bytes() > 0);
+
+        // But it can still be freed.
+        allocator.deallocate(large, 0);
+        // small is freed by destroy().
+    }
+
+    allocator.destroy(page_allocator);
+    REQUIRE(page_allocator.release() == 0);
+}
+
@@ -3,18 +3,31 @@
 
 #include <lauf/vm.h>
 
+#include <cstdio>
+#include <cstring>
 #include <doctest/doctest.h>
 #include <lauf/asm/builder.h>
 #include <lauf/asm/module.h>
+#include <lauf/asm/module.hpp>
 #include <lauf/asm/program.h>
 #include <lauf/asm/type.h>
 #include <lauf/frontend/text.h>
+#include <lauf/lib/heap.h>
+#include <lauf/lib/int.h>
+#include <lauf/lib/memory.h>
 #include <lauf/lib/test.h>
 #include <lauf/reader.h>
 #include <lauf/runtime/builtin.h>
+#include <lauf/runtime/memory.h>
 #include <lauf/runtime/process.h>
+#include <lauf/runtime/process.hpp>
+#include <lauf/runtime/snapshot.h>
 #include <lauf/runtime/stacktrace.h>
 #include <lauf/runtime/value.h>
+#include <lauf/writer.h>
+#include <sys/mman.h>
+#include <utility>
+#include <vector>
 
 namespace
 {
@@ -495,3 +508,1090 @@ TEST_CASE("lauf_asm_define_native_function")
     lauf_asm_destroy_module(mod);
 }
 
+TEST_CASE("chunk cache")
+{
+    auto vm    = lauf_create_vm(lauf_default_vm_options);
+    auto mod   = lauf_asm_create_module("test");
+    auto chunk = lauf_asm_create_chunk(mod);
+    auto b     = lauf_asm_create_builder(lauf_asm_default_build_options);
+
+    auto build_and_execute = [&](auto fn) {
+        lauf_asm_build_chunk(b, mod, chunk, {0, 1});
+        fn();
+        lauf_asm_inst_return(b);
+        REQUIRE(lauf_asm_build_finish(b));
+
+        auto               program = lauf_asm_create_program_from_chunk(mod, chunk);
+        lauf_runtime_value output;
+        REQUIRE(lauf_vm_execute_oneshot(vm, program, nullptr, &output));
+        return output.as_uint;
+    };
+
+    SUBCASE("pure")
+    {
+        CHECK(build_and_execute([&] { lauf_asm_inst_uint(b, 42); }) == 42);
+        auto insts = chunk->fn->insts;
+        CHECK(chunk->cached_outputs != nullptr);
+
+        CHECK(build_and_execute([&] { lauf_asm_inst_uint(b, 42); }) == 42);
+        CHECK(chunk->fn->insts == insts);
+        CHECK(chunk->cached_outputs != nullptr);
+
+        CHECK(build_and_execute([&] { lauf_asm_inst_uint(b, 11); }) == 11);
+    }
+    SUBCASE("redefined global")
+    {
+        auto global = lauf_asm_add_global(mod, LAUF_ASM_GLOBAL_READ_ONLY);
+        auto value  = lauf_uint(42);
+        lauf_asm_define_data_global(mod, global, lauf_asm_type_value.layout, &value);
+
+        CHECK(build_and_execute([&] {
+                  lauf_asm_inst_global_addr(b, global);
+                  lauf_asm_inst_load_field(b, lauf_asm_type_value, 0);
+              })
+              == 42);
+        CHECK(chunk->cached_outputs != nullptr);
+
+        // Executing the same code again sees the new value.
+        value = 11;
+        lauf_asm_define_data_global(mod, global, lauf_asm_type_value.layout, &value);
+
+        auto               program = lauf_asm_create_program_from_chunk(mod, chunk);
+        lauf_runtime_value output;
+        REQUIRE(lauf_vm_execute_oneshot(vm, program, nullptr, &output));
+        CHECK(output.as_uint == 11);
+    }
+    SUBCASE("vm limits")
+    {
+        CHECK(build_and_execute([&] { lauf_asm_inst_uint(b, 42); }) == 42);
+        REQUIRE(chunk->cached_outputs != nullptr);
+
+        // We change the cached output, so we can tell whether it is used.
+        chunk->cached_outputs[0].as_uint = 11;
+
+        auto               program = lauf_asm_create_program_from_chunk(mod, chunk);
+        lauf_runtime_value output;
+        REQUIRE(lauf_vm_execute(vm, &program, nullptr, &output));
+        CHECK(output.as_uint == 11);
+
+        // Whether the execution panics depends on the limits, so a different VM executes it.
+        auto options = lauf_default_vm_options;
+        options.max_cstack_size_in_bytes /= 2;
+        auto other_vm = lauf_create_vm(options);
+        REQUIRE(lauf_vm_execute(other_vm, &program, nullptr, &output));
+        CHECK(output.as_uint == 42);
+        lauf_destroy_vm(other_vm);
+
+        lauf_asm_destroy_program(program);
+    }
+    SUBCASE("impure")
+    {
+        auto global = lauf_asm_add_global(mod, LAUF_ASM_GLOBAL_READ_WRITE);
+        lauf_asm_define_data_global(mod, global, lauf_asm_type_value.layout, nullptr);
+
+        auto load_global = [&] {
+            lauf_asm_inst_global_addr(b, global);
+            lauf_asm_inst_load_field(b, lauf_asm_type_value, 0);
+        };
+
+        CHECK(build_and_execute(load_global) == 0);
+        auto insts = chunk->fn->insts;
+        CHECK(chunk->cached_outputs == nullptr);
+
+        CHECK(build_and_execute(load_global) == 0);
+        CHECK(chunk->fn->insts == insts);
+        CHECK(chunk->cached_outputs == nullptr);
+    }
+
+    lauf_asm_destroy_builder(b);
+    lauf_asm_destroy_module(mod);
+    lauf_destroy_vm(vm);
+}
+
+namespace
+{
+// A process of a program that does nothing, for testing the runtime API.
+struct noop_process
+{
+    lauf_vm*              vm;
+    lauf_asm_module*      mod;
+    lauf_asm_function*    fn;
+    lauf_asm_program      prog;
+    lauf_runtime_process* proc;
+    lauf_vm_allocator     allocator;
+
+    // setup is called with the module before the process is started.
+    template <typename Setup>
+    explicit noop_process(lauf_vm_options options, Setup setup)
+    : vm(lauf_create_vm(options)), mod(lauf_asm_create_module("test"))
+    {
+        setup(mod);
+
+        fn     = lauf_asm_add_function(mod, "noop", {0, 0});
+        auto b = lauf_asm_create_builder(lauf_asm_default_build_options);
+        lauf_asm_build(b, mod, fn);
+        lauf_asm_inst_return(b);
+        REQUIRE(lauf_asm_build_finish(b));
+        lauf_asm_destroy_builder(b);
+
+        prog      = lauf_asm_create_program(mod, fn);
+        proc      = lauf_vm_start_process(vm, &prog);
+        allocator = lauf_vm_get_allocator(vm);
+    }
+    explicit noop_process(lauf_vm_options options = lauf_default_vm_options)
+    : noop_process(options, [](lauf_asm_module*) {})
+    {}
+
+    noop_process(const noop_process&)            = delete;
+    noop_process& operator=(const noop_process&) = delete;
+
+    ~noop_process()
+    {
+        if (proc != nullptr)
+            lauf_runtime_destroy_process(proc);
+        lauf_asm_destroy_program(prog);
+        lauf_asm_destroy_module(mod);
+        lauf_destroy_vm(vm);
+    }
+
+    // Allocates heap memory for count values.
+    lauf_runtime_address alloc(std::size_t count = 1)
+    {
+        auto memory = allocator.heap_alloc(allocator.user_data, count * sizeof(lauf_runtime_value),
+                                           alignof(lauf_runtime_value));
+        return lauf_runtime_add_heap_allocation(proc, memory, count * sizeof(lauf_runtime_value));
+    }
+
+    lauf_runtime_value* get_mut_ptr(lauf_runtime_address addr, std::size_t count = 1)
+    {
+        return static_cast<lauf_runtime_value*>(lauf_runtime_get_mut_ptr(
+            proc, addr, lauf_asm_array_layout(lauf_asm_type_value.layout, count)));
+    }
+
+    bool is_freed(lauf_runtime_address addr)
+    {
+        lauf_runtime_allocation allocation;
+        REQUIRE(lauf_runtime_get_allocation(proc, addr, &allocation));
+        return allocation.permission == LAUF_RUNTIME_PERM_NONE;
+    }
+};
+
+// Adds a function that allocates 64 bytes of garbage as often as the argument says.
+lauf_asm_function* add_garbage_function(lauf_asm_module* mod)
+{
+    auto fn = lauf_asm_add_function(mod, "garbage", {1, 0});
+    auto b  = lauf_asm_create_builder(lauf_asm_default_build_options);
+    lauf_asm_build(b, mod, fn);
+    {
+        auto loop = lauf_asm_declare_block(b, 1);
+        auto body = lauf_asm_declare_block(b, 1);
+        auto exit = lauf_asm_declare_block(b, 1);
+
+        lauf_asm_inst_jump(b, loop);
+
+        lauf_asm_build_block(b, loop);
+        lauf_asm_inst_pick(b, 0);
+        lauf_asm_inst_branch(b, body, exit);
+
+        lauf_asm_build_block(b, body);
+        lauf_asm_inst_layout(b, {64, 8});
+        lauf_asm_inst_call_builtin(b, lauf_lib_heap_alloc);
+        lauf_asm_inst_pop(b, 0);
+        lauf_asm_inst_uint(b, 1);
+        lauf_asm_inst_call_builtin(b, lauf_lib_int_usub(LAUF_LIB_INT_OVERFLOW_WRAP));
+        lauf_asm_inst_jump(b, loop);
+
+        lauf_asm_build_block(b, exit);
+        lauf_asm_inst_pop(b, 0);
+        lauf_asm_inst_return(b);
+    }
+    REQUIRE(lauf_asm_build_finish(b));
+    lauf_asm_destroy_builder(b);
+    return fn;
+}
+} // namespace
+
+TEST_CASE("heap allocation reuse")
+{
+    noop_process p;
+
+    int  memory[3];
+    auto addr1 = lauf_runtime_add_heap_allocation(p.proc, &memory[0], sizeof(int));
+    auto addr2 = lauf_runtime_add_heap_allocation(p.proc, &memory[1], sizeof(int));
+
+    // addr1 is not the last allocation, so its slot can only be reused.
+    REQUIRE(lauf_runtime_leak_heap_allocation(p.proc, addr1));
+    auto addr3 = lauf_runtime_add_heap_allocation(p.proc, &memory[2], sizeof(int));
+    CHECK(addr3.allocation == addr1.allocation);
+    CHECK(addr3.generation != addr1.generation);
+
+    // The stale address does not refer to the new allocation.
+    lauf_runtime_allocation alloc;
+    CHECK(!lauf_runtime_get_allocation(p.proc, addr1, &alloc));
+    REQUIRE(lauf_runtime_get_allocation(p.proc, addr3, &alloc));
+    CHECK(alloc.ptr == &memory[2]);
+
+    // Don't let the process free the memory.
+    REQUIRE(lauf_runtime_leak_heap_allocation(p.proc, addr2));
+    REQUIRE(lauf_runtime_leak_heap_allocation(p.proc, addr3));
+}
+
+TEST_CASE("lauf_vm_slab_allocator")
+{
+    auto options      = lauf_default_vm_options;
+    options.allocator = lauf_vm_slab_allocator;
+    noop_process p(options);
+
+    auto small = p.allocator.heap_alloc(p.allocator.user_data, 16, 8);
+    auto large = p.allocator.heap_alloc(p.allocator.user_data, 64 * 1024, 8);
+    auto page  = p.allocator.heap_alloc(p.allocator.user_data, 4096, 4096);
+    REQUIRE(page != nullptr);
+    CHECK(reinterpret_cast<std::uintptr_t>(page) % 4096 == 0);
+
+    auto leak = [&](void* ptr, std::size_t size) {
+        auto addr = lauf_runtime_add_heap_allocation(p.proc, ptr, size);
+        REQUIRE(lauf_runtime_leak_heap_allocation(p.proc, addr));
+    };
+    leak(small, 16);
+    leak(large, 64 * 1024);
+    lauf_runtime_add_heap_allocation(p.proc, page, 4096);
+
+    // The process frees the memory it still owns, but not the leaked memory.
+    lauf_runtime_destroy_process(p.proc);
+    p.proc = nullptr;
+    std::memset(small, 'a', 16);
+    std::memset(large, 'a', 64 * 1024);
+    p.allocator.free_alloc(p.allocator.user_data, large, 64 * 1024);
+}
+
+TEST_CASE("lauf_runtime_gc_step")
+{
+    noop_process p;
+
+    auto root = p.alloc();
+    REQUIRE(lauf_runtime_declare_reachable(p.proc, root));
+    auto garbage = p.alloc();
+
+    // Start a collection without doing any work.
+    REQUIRE(!lauf_runtime_gc_step(p.proc, 0, nullptr));
+
+    // Allocate memory during the collection and store it in the root.
+    auto fresh = p.alloc();
+    auto ptr   = p.get_mut_ptr(root);
+    REQUIRE(ptr != nullptr);
+    ptr->as_address = fresh;
+
+    // Finish the collection using many small steps.
+    auto bytes_freed = std::size_t(0);
+    auto step_count  = 0;
+    while (true)
+    {
+        auto freed    = std::size_t(0);
+        auto finished = lauf_runtime_gc_step(p.proc, 16, &freed);
+        bytes_freed += freed;
+        ++step_count;
+        if (finished)
+            break;
+    }
+    CHECK(step_count > 1);
+    CHECK(bytes_freed == sizeof(lauf_runtime_value));
+
+    CHECK(!p.is_freed(root));
+    CHECK(!p.is_freed(fresh));
+    CHECK(p.is_freed(garbage));
+}
+
+TEST_CASE("lauf_runtime_gc_minor")
+{
+    auto options            = lauf_default_vm_options;
+    options.generational_gc = true;
+    noop_process p(options);
+
+    auto root = p.alloc();
+    REQUIRE(lauf_runtime_declare_reachable(p.proc, root));
+    auto garbage = p.alloc();
+
+    // The root survives and becomes old.
+    CHECK(lauf_runtime_gc_minor(p.proc) == sizeof(lauf_runtime_value));
+    CHECK(!p.is_freed(root));
+    CHECK(p.is_freed(garbage));
+
+    // Store a young allocation in the old root.
+    auto young = p.alloc();
+    auto ptr   = p.get_mut_ptr(root);
+    REQUIRE(ptr != nullptr);
+    ptr->as_address = young;
+    garbage         = p.alloc();
+
+    CHECK(lauf_runtime_gc_minor(p.proc) == sizeof(lauf_runtime_value));
+    CHECK(!p.is_freed(young));
+    CHECK(p.is_freed(garbage));
+
+    // Both allocations are old now, so a minor collection doesn't free young,
+    // even though it is no longer referenced.
+    p.get_mut_ptr(root)->as_uint = 0;
+    CHECK(lauf_runtime_gc_minor(p.proc) == 0);
+    CHECK(!p.is_freed(young));
+
+    // But a full one does.
+    CHECK(lauf_runtime_gc(p.proc) == sizeof(lauf_runtime_value));
+    CHECK(p.is_freed(young));
+
+    // Without collections, the nursery doesn't grow with allocations that are freed again.
+    auto nursery_size = p.proc->memory.gc_nursery_size();
+    for (auto i = 0; i != 10 * 1024; ++i)
+    {
+        lauf_runtime_allocation allocation;
+        auto                    addr = p.alloc();
+        REQUIRE(lauf_runtime_get_allocation(p.proc, addr, &allocation));
+        REQUIRE(lauf_runtime_leak_heap_allocation(p.proc, addr));
+        p.allocator.free_alloc(p.allocator.user_data, allocation.ptr, allocation.size);
+
+        auto fiber = lauf_runtime_create_fiber(p.proc, p.fn);
+        REQUIRE(lauf_runtime_destroy_fiber(p.proc, fiber));
+    }
+    CHECK(p.proc->memory.gc_nursery_size() <= nursery_size + 128);
+}
+
+TEST_CASE("lauf_runtime_set_pointer_map")
+{
+    lauf_asm_global* global = nullptr;
+    noop_process     p(lauf_default_vm_options, [&](lauf_asm_module* mod) {
+        global = lauf_asm_add_global(mod, LAUF_ASM_GLOBAL_READ_WRITE);
+        lauf_asm_define_data_global(mod, global, lauf_asm_type_value.layout, nullptr);
+        lauf_asm_set_global_pointer_map(mod, global, sizeof(lauf_runtime_value), 0);
+    });
+
+    // An array of pairs where only the second value is an address.
+    auto root = p.alloc(4);
+    REQUIRE(lauf_runtime_declare_reachable(p.proc, root));
+    CHECK(!lauf_runtime_set_pointer_map(p.proc, root, 1, 0b1));
+    CHECK(!lauf_runtime_set_pointer_map(p.proc, root, 2 * sizeof(lauf_runtime_value), 0b100));
+    REQUIRE(lauf_runtime_set_pointer_map(p.proc, root, 2 * sizeof(lauf_runtime_value), 0b10));
+
+    auto not_scanned  = p.alloc();
+    auto scanned      = p.alloc();
+    auto ptr          = p.get_mut_ptr(root, 4);
+    ptr[0].as_address = not_scanned;
+    ptr[3].as_address = scanned;
+
+    // A global without addresses.
+    auto in_global = p.alloc();
+    p.get_mut_ptr(lauf_runtime_get_global_address(p.proc, global))->as_address = in_global;
+
+    CHECK(lauf_runtime_gc(p.proc) == 2 * sizeof(lauf_runtime_value));
+    CHECK(p.is_freed(not_scanned));
+    CHECK(!p.is_freed(scanned));
+    CHECK(p.is_freed(in_global));
+
+    // Without addresses, nothing is scanned.
+    REQUIRE(lauf_runtime_set_pointer_map(p.proc, root, 1, 0));
+    CHECK(lauf_runtime_gc(p.proc) == sizeof(lauf_runtime_value));
+    CHECK(p.is_freed(scanned));
+}
+
+TEST_CASE("parallel lauf_runtime_gc")
+{
+    auto options            = lauf_default_vm_options;
+    options.gc_thread_count = 4;
+    noop_process p(options);
+
+    auto children = [&](lauf_runtime_address addr) { return p.get_mut_ptr(addr, 2); };
+
+    // A binary tree, interleaved with garbage.
+    constexpr auto node_count = 8 * 1024;
+    std::vector<lauf_runtime_address> nodes;
+    for (auto i = 0; i != node_count; ++i)
+    {
+        nodes.push_back(p.alloc(2));
+        if (i > 0)
+            children(nodes[std::size_t(i - 1) / 2])[(i - 1) % 2].as_address = nodes.back();
+        p.alloc(2);
+    }
+    REQUIRE(lauf_runtime_declare_reachable(p.proc, nodes.front()));
+
+    CHECK(lauf_runtime_gc(p.proc) == node_count * 2 * sizeof(lauf_runtime_value));
+    for (auto node : nodes)
+        REQUIRE(children(node) != nullptr);
+
+    // Cut off the right half of the tree.
+    children(nodes.front())[1].as_uint = 0;
+    auto bytes_freed = lauf_runtime_gc(p.proc);
+    CHECK(bytes_freed > 0);
+    CHECK(bytes_freed < node_count * 2 * sizeof(lauf_runtime_value));
+    CHECK(children(nodes[1]) != nullptr);
+    CHECK(children(nodes[2]) == nullptr);
+}
+
+TEST_CASE("automatic garbage collection")
+{
+    auto mod  = lauf_asm_create_module("test");
+    auto prog = lauf_asm_create_program(mod, add_garbage_function(mod));
+
+    auto options          = lauf_default_vm_options;
+    options.panic_handler = {nullptr, [](void*, lauf_runtime_process*, const char* msg) {
+                                 CHECK(msg == doctest::String("out of memory"));
+                             }};
+    options.max_heap_size = 4 * 1024;
+
+    // Allocate 64 KiB of garbage.
+    lauf_runtime_value input;
+    input.as_uint = 1024;
+
+    SUBCASE("disabled")
+    {
+        auto vm = lauf_create_vm(options);
+        CHECK(!lauf_vm_execute(vm, &prog, &input, nullptr));
+        lauf_destroy_vm(vm);
+    }
+    SUBCASE("enabled")
+    {
+        options.gc_min_heap_threshold = 1024;
+        auto vm                       = lauf_create_vm(options);
+        CHECK(lauf_vm_execute(vm, &prog, &input, nullptr));
+        lauf_destroy_vm(vm);
+    }
+    SUBCASE("generational")
+    {
+        options.gc_min_heap_threshold = 1024;
+        options.generational_gc       = true;
+        auto vm                       = lauf_create_vm(options);
+        CHECK(lauf_vm_execute(vm, &prog, &input, nullptr));
+        lauf_destroy_vm(vm);
+    }
+
+    lauf_asm_destroy_program(prog);
+    lauf_asm_destroy_module(mod);
+}
+
+TEST_CASE("lauf_runtime_get_stats")
+{
+    auto mod  = lauf_asm_create_module("test");
+    auto prog = lauf_asm_create_program(mod, add_garbage_function(mod));
+
+    auto options          = lauf_default_vm_options;
+    options.panic_handler = {nullptr, [](void*, lauf_runtime_process*, const char* msg) {
+                                 CHECK(msg == doctest::String("out of memory"));
+                             }};
+    auto vm               = lauf_create_vm(options);
+
+    lauf_runtime_value input;
+    input.as_uint = 16;
+
+    SUBCASE("counters")
+    {
+        auto process = lauf_vm_start_process(vm, &prog);
+        REQUIRE(lauf_runtime_resume(process, lauf_runtime_get_current_fiber(process), &input, 1,
+                                    nullptr, 0));
+
+        auto stats = lauf_runtime_get_stats(process);
+        CHECK(stats.heap_size == 16 * 64);
+        CHECK(stats.peak_heap_size == 16 * 64);
+        CHECK(stats.heap_allocation_count == 16);
+        CHECK(stats.allocation_table_size == 17);
+        CHECK(stats.vstack_grow_count == 0);
+        CHECK(stats.cstack_grow_count == 0);
+        CHECK(stats.vm_mapped_bytes > 0);
+        CHECK(stats.gc_count == 0);
+        CHECK(stats.undefined_function_call_count == 0);
+
+        CHECK(lauf_runtime_gc(process) == 16 * 64);
+        stats = lauf_runtime_get_stats(process);
+        CHECK(stats.heap_size == 0);
+        CHECK(stats.peak_heap_size == 16 * 64);
+        CHECK(stats.heap_allocation_count == 0);
+        CHECK(stats.gc_count == 1);
+        CHECK(stats.gc_bytes_freed == 16 * 64);
+
+        lauf_runtime_destroy_process(process);
+    }
+    SUBCASE("heap limit")
+    {
+        auto process = lauf_vm_start_process(vm, &prog);
+        REQUIRE(lauf_runtime_set_heap_limit(process, 0, 8));
+        CHECK(!lauf_runtime_resume(process, lauf_runtime_get_current_fiber(process), &input, 1,
+                                   nullptr, 0));
+        CHECK(lauf_runtime_get_stats(process).heap_allocation_count == 8);
+        lauf_runtime_destroy_process(process);
+
+        process = lauf_vm_start_process(vm, &prog);
+        REQUIRE(lauf_runtime_set_heap_limit(process, 4 * 64, 0));
+        CHECK(!lauf_runtime_resume(process, lauf_runtime_get_current_fiber(process), &input, 1,
+                                   nullptr, 0));
+        CHECK(lauf_runtime_get_stats(process).heap_size == 4 * 64);
+        lauf_runtime_destroy_process(process);
+    }
+
+    lauf_destroy_vm(vm);
+    lauf_asm_destroy_program(prog);
+    lauf_asm_destroy_module(mod);
+}
+
+TEST_CASE("vstack growth")
+{
+    auto mod = lauf_asm_create_module("test");
+    auto fn  = lauf_asm_add_function(mod, "sum", {1, 1});
+    auto b   = lauf_asm_create_builder(lauf_asm_default_build_options);
+    lauf_asm_build(b, mod, fn);
+    {
+        auto recurse = lauf_asm_declare_block(b, 1);
+        auto exit    = lauf_asm_declare_block(b, 1);
+
+        // Recursively computes n + sum(n - 1), which keeps n on the vstack of every level.
+        lauf_asm_inst_pick(b, 0);
+        lauf_asm_inst_branch(b, recurse, exit);
+
+        lauf_asm_build_block(b, recurse);
+        lauf_asm_inst_pick(b, 0);
+        lauf_asm_inst_uint(b, 1);
+        lauf_asm_inst_call_builtin(b, lauf_lib_int_usub(LAUF_LIB_INT_OVERFLOW_WRAP));
+        lauf_asm_inst_call(b, fn);
+        lauf_asm_inst_call_builtin(b, lauf_lib_int_uadd(LAUF_LIB_INT_OVERFLOW_WRAP));
+        lauf_asm_inst_return(b);
+
+        lauf_asm_build_block(b, exit);
+        lauf_asm_inst_return(b);
+    }
+    REQUIRE(lauf_asm_build_finish(b));
+    auto prog = lauf_asm_create_program(mod, fn);
+
+    auto options                     = lauf_default_vm_options;
+    options.max_cstack_size_in_bytes = 64 * 1024 * 1024ull;
+    options.panic_handler = {nullptr, [](void*, lauf_runtime_process*, const char* msg) {
+                                 CHECK(msg == doctest::String("vstack overflow"));
+                             }};
+    auto vm               = lauf_create_vm(options);
+
+    SUBCASE("grow")
+    {
+        lauf_runtime_value input;
+        input.as_uint = 4000;
+        lauf_runtime_value output;
+
+        auto process = lauf_vm_start_process(vm, &prog);
+        REQUIRE(lauf_runtime_resume(process, lauf_runtime_get_current_fiber(process), &input, 1,
+                                    &output, 1));
+        CHECK(output.as_uint == 4000 * 4001 / 2);
+        CHECK(lauf_runtime_get_stats(process).vstack_grow_count >= 2);
+        lauf_runtime_destroy_process(process);
+    }
+    SUBCASE("overflow")
+    {
+        lauf_runtime_value input;
+        input.as_uint = 64 * 1024;
+
+        auto process = lauf_vm_start_process(vm, &prog);
+        CHECK(!lauf_runtime_resume(process, lauf_runtime_get_current_fiber(process), &input, 1,
+                                   nullptr, 0));
+        lauf_runtime_destroy_process(process);
+    }
+
+    lauf_destroy_vm(vm);
+    lauf_asm_destroy_program(prog);
+    lauf_asm_destroy_builder(b);
+    lauf_asm_destroy_module(mod);
+}
+
+TEST_CASE("lauf_asm_prepare_program")
+{
+    auto mod = lauf_asm_create_module("test");
+    auto fn  = lauf_asm_add_function(mod, "test", {0, 0});
+
+    auto data = lauf_asm_add_global(mod, LAUF_ASM_GLOBAL_READ_WRITE);
+    {
+        std::uint64_t value = 42;
+        lauf_asm_define_data_global(mod, data, {sizeof(value), alignof(std::uint64_t)},
+                                    &value);
+    }
+    auto zero = lauf_asm_add_global(mod, LAUF_ASM_GLOBAL_READ_WRITE);
+    lauf_asm_define_data_global(mod, zero, {1024 * 1024, 8}, nullptr);
+
+    {
+        auto b = lauf_asm_create_builder(lauf_asm_default_build_options);
+        lauf_asm_build(b, mod, fn);
+
+        // Both globals have their initial value, even though the previous run modified them.
+        for (auto [global, value] : {std::pair(data, 42), std::pair(zero, 0)})
+        {
+            lauf_asm_inst_global_addr(b, global);
+            lauf_asm_inst_load_field(b, lauf_asm_type_value, 0);
+            lauf_asm_inst_uint(b, value);
+            lauf_asm_inst_call_builtin(b, lauf_lib_test_assert_eq);
+
+            lauf_asm_inst_uint(b, 11);
+            lauf_asm_inst_global_addr(b, global);
+            lauf_asm_inst_store_field(b, lauf_asm_type_value, 0);
+        }
+        lauf_asm_inst_return(b);
+
+        REQUIRE(lauf_asm_build_finish(b));
+        lauf_asm_destroy_builder(b);
+    }
+
+    auto program = lauf_asm_create_program(mod, fn);
+    REQUIRE(lauf_asm_prepare_program(&program));
+
+    auto vm = lauf_create_vm(lauf_default_vm_options);
+    CHECK(lauf_vm_execute(vm, &program, nullptr, nullptr));
+    CHECK(lauf_vm_execute(vm, &program, nullptr, nullptr));
+
+    // Reads the initial value of a global in a new process.
+    auto read_global = [&](const lauf_asm_global* global) {
+        auto process = lauf_vm_start_process(vm, &program);
+        auto ptr     = static_cast<const std::uint64_t*>(
+            lauf_runtime_get_const_ptr(process, lauf_runtime_get_global_address(process, global),
+                                       lauf_asm_type_value.layout));
+        REQUIRE(ptr != nullptr);
+        auto result = *ptr;
+        lauf_runtime_destroy_process(process);
+        return result;
+    };
+
+    SUBCASE("global added after preparing")
+    {
+        auto added = lauf_asm_add_global(mod, LAUF_ASM_GLOBAL_READ_WRITE);
+        {
+            std::uint64_t value = 7;
+            lauf_asm_define_data_global(mod, added, {sizeof(value), alignof(std::uint64_t)},
+                                        &value);
+        }
+        CHECK(read_global(added) == 7);
+        CHECK(read_global(data) == 42);
+        CHECK(lauf_vm_execute(vm, &program, nullptr, nullptr));
+    }
+    SUBCASE("global defined after preparing")
+    {
+        {
+            std::uint64_t value = 13;
+            lauf_asm_define_data_global(mod, data, {sizeof(value), alignof(std::uint64_t)},
+                                        &value);
+        }
+        CHECK(read_global(data) == 13);
+        CHECK(read_global(zero) == 0);
+
+        REQUIRE(lauf_asm_prepare_program(&program));
+        CHECK(read_global(data) == 13);
+        CHECK(read_global(zero) == 0);
+    }
+
+    lauf_destroy_vm(vm);
+    lauf_asm_destroy_program(program);
+    lauf_asm_destroy_module(mod);
+}
+
+TEST_CASE("constant globals")
+{
+    auto mod = lauf_asm_create_module("test");
+    auto fn  = lauf_asm_add_function(mod, "test", {0, 0});
+
+    auto global = lauf_asm_add_global(mod, LAUF_ASM_GLOBAL_READ_ONLY);
+    {
+        std::uint64_t table[] = {1, 2, 3, 4};
+        lauf_asm_define_data_global(mod, global, {sizeof(table), 64}, table);
+    }
+
+    {
+        auto b = lauf_asm_create_builder(lauf_asm_default_build_options);
+        lauf_asm_build(b, mod, fn);
+        lauf_asm_inst_return(b);
+        REQUIRE(lauf_asm_build_finish(b));
+        lauf_asm_destroy_builder(b);
+    }
+    auto program = lauf_asm_create_program(mod, fn);
+
+    auto vm1   = lauf_create_vm(lauf_default_vm_options);
+    auto proc1 = lauf_vm_start_process(vm1, &program);
+    auto vm2   = lauf_create_vm(lauf_default_vm_options);
+    auto proc2 = lauf_vm_start_process(vm2, &program);
+
+    // Both processes use the same memory, which is properly aligned.
+    auto ptr1 = lauf_runtime_get_const_ptr(proc1, lauf_runtime_get_global_address(proc1, global),
+                                           {32, 64});
+    auto ptr2 = lauf_runtime_get_const_ptr(proc2, lauf_runtime_get_global_address(proc2, global),
+                                           {32, 64});
+    REQUIRE(ptr1 != nullptr);
+    CHECK(ptr1 == ptr2);
+    CHECK(reinterpret_cast<std::uintptr_t>(ptr1) % 64 == 0);
+    CHECK(static_cast<const std::uint64_t*>(ptr1)[2] == 3);
+
+    // It cannot be written.
+    CHECK(lauf_runtime_get_mut_ptr(proc1, lauf_runtime_get_global_address(proc1, global), {8, 8})
+          == nullptr);
+
+    lauf_runtime_destroy_process(proc2);
+    lauf_destroy_vm(vm2);
+    lauf_runtime_destroy_process(proc1);
+    lauf_destroy_vm(vm1);
+
+    lauf_asm_destroy_program(program);
+    lauf_asm_destroy_module(mod);
+}
+
+TEST_CASE("lauf_vm_start_process_from_snapshot")
+{
+    auto mod       = lauf_asm_create_module("test");
+    auto table     = lauf_asm_add_global(mod, LAUF_ASM_GLOBAL_READ_WRITE);
+    auto local_ptr = lauf_asm_add_global(mod, LAUF_ASM_GLOBAL_READ_WRITE);
+    lauf_asm_define_data_global(mod, table, lauf_asm_type_value.layout, nullptr);
+    lauf_asm_define_data_global(mod, local_ptr, lauf_asm_type_value.layout, nullptr);
+
+    auto wait = lauf_asm_add_function(mod, "wait_for_request", {1, 1});
+    auto serve = lauf_asm_add_function(mod, "serve", {1, 1});
+
+    auto b = lauf_asm_create_builder(lauf_asm_default_build_options);
+    {
+        lauf_asm_build(b, mod, wait);
+
+        // Store the argument in a local whose address escapes, then suspend.
+        auto value = lauf_asm_build_local(b, lauf_asm_type_value.layout);
+        lauf_asm_inst_local_addr(b, value);
+        lauf_asm_inst_store_field(b, lauf_asm_type_value, 0);
+        lauf_asm_inst_local_addr(b, value);
+        lauf_asm_inst_global_addr(b, local_ptr);
+        lauf_asm_inst_store_field(b, lauf_asm_type_value, 0);
+
+        lauf_asm_inst_fiber_suspend(b, {0, 0});
+
+        lauf_asm_inst_global_addr(b, local_ptr);
+        lauf_asm_inst_load_field(b, lauf_asm_type_value, 0);
+        lauf_asm_inst_load_field(b, lauf_asm_type_value, 0);
+        lauf_asm_inst_return(b);
+
+        REQUIRE(lauf_asm_build_finish(b));
+    }
+    {
+        lauf_asm_build(b, mod, serve);
+
+        // Initialization: a table in heap memory.
+        lauf_asm_inst_layout(b, lauf_asm_type_value.layout);
+        lauf_asm_inst_call_builtin(b, lauf_lib_heap_alloc);
+        lauf_asm_inst_uint(b, 42);
+        lauf_asm_inst_pick(b, 1);
+        lauf_asm_inst_store_field(b, lauf_asm_type_value, 0);
+        lauf_asm_inst_global_addr(b, table);
+        lauf_asm_inst_store_field(b, lauf_asm_type_value, 0);
+
+        lauf_asm_inst_call(b, wait);
+        lauf_asm_inst_global_addr(b, table);
+        lauf_asm_inst_load_field(b, lauf_asm_type_value, 0);
+        lauf_asm_inst_load_field(b, lauf_asm_type_value, 0);
+        lauf_asm_inst_call_builtin(b, lauf_lib_int_uadd(LAUF_LIB_INT_OVERFLOW_WRAP));
+
+        // Destroy the table, which must not affect the snapshot.
+        lauf_asm_inst_uint(b, 0);
+        lauf_asm_inst_global_addr(b, table);
+        lauf_asm_inst_store_field(b, lauf_asm_type_value, 0);
+        lauf_asm_inst_return(b);
+
+        REQUIRE(lauf_asm_build_finish(b));
+    }
+    lauf_asm_destroy_builder(b);
+    auto program = lauf_asm_create_program(mod, serve);
+
+    lauf_runtime_snapshot* snapshot = nullptr;
+    {
+        auto vm = lauf_create_vm(lauf_default_vm_options);
+
+        lauf_runtime_value input;
+        input.as_uint = 7;
+        auto process  = lauf_vm_start_process(vm, &program);
+        REQUIRE(lauf_runtime_resume(process, lauf_runtime_get_current_fiber(process), &input, 1,
+                                    nullptr, 0));
+
+        snapshot = lauf_runtime_snapshot_process(process);
+        REQUIRE(snapshot != nullptr);
+        CHECK(lauf_runtime_snapshot_program(snapshot)->_entry == serve);
+
+        // The original process continues independently.
+        lauf_runtime_value output;
+        CHECK(lauf_runtime_resume(process, lauf_runtime_iterate_fibers(process), nullptr, 0,
+                                  &output, 1));
+        CHECK(output.as_uint == 49);
+
+        lauf_runtime_destroy_process(process);
+        lauf_destroy_vm(vm);
+    }
+
+    auto vm = lauf_create_vm(lauf_default_vm_options);
+    for (auto i = 0; i != 2; ++i)
+    {
+        auto process = lauf_vm_start_process_from_snapshot(vm, snapshot);
+        REQUIRE(process != nullptr);
+
+        // The table is reachable from the global, the local from the stack.
+        CHECK(lauf_runtime_gc(process) == 0);
+
+        lauf_runtime_value output;
+        CHECK(lauf_runtime_resume(process, lauf_runtime_iterate_fibers(process), nullptr, 0,
+                                  &output, 1));
+        CHECK(output.as_uint == 49);
+
+        lauf_runtime_destroy_process(process);
+    }
+
+    // The snapshot can be stored in a file and resumed by a different process.
+    {
+        auto writer = lauf_create_file_writer("lauf_snapshot.bin");
+        REQUIRE(lauf_runtime_write_snapshot(snapshot, writer));
+        lauf_destroy_writer(writer);
+
+        std::vector<unsigned char> data;
+        auto                       file = std::fopen("lauf_snapshot.bin", "rb");
+        REQUIRE(file != nullptr);
+        for (int c; (c = std::fgetc(file)) != EOF;)
+            data.push_back(static_cast<unsigned char>(c));
+        std::fclose(file);
+        std::remove("lauf_snapshot.bin");
+
+        CHECK(lauf_runtime_read_snapshot(&program, data.data(), data.size() - 1) == nullptr);
+        auto copy = lauf_runtime_read_snapshot(&program, data.data(), data.size());
+        REQUIRE(copy != nullptr);
+
+        auto process = lauf_vm_start_process_from_snapshot(vm, copy);
+        REQUIRE(process != nullptr);
+
+        lauf_runtime_value output;
+        CHECK(lauf_runtime_resume(process, lauf_runtime_iterate_fibers(process), nullptr, 0,
+                                  &output, 1));
+        CHECK(output.as_uint == 49);
+
+        lauf_runtime_destroy_process(process);
+        lauf_runtime_destroy_snapshot(copy);
+    }
+    lauf_destroy_vm(vm);
+
+    lauf_runtime_destroy_snapshot(snapshot);
+    lauf_asm_destroy_program(program);
+    lauf_asm_destroy_module(mod);
+}
+
+namespace
+{
+// Creates a function that loads the value at addr + offset.
+lauf_asm_function* add_load_function(lauf_asm_module* mod)
+{
+    auto fn = lauf_asm_add_function(mod, "load", {2, 1});
+    auto b  = lauf_asm_create_builder(lauf_asm_default_build_options);
+    lauf_asm_build(b, mod, fn);
+    lauf_asm_inst_call_builtin(b, lauf_lib_memory_addr_add(LAUF_LIB_MEMORY_ADDR_OVERFLOW_PANIC));
+    lauf_asm_inst_load_field(b, lauf_asm_type_value, 0);
+    lauf_asm_inst_return(b);
+    REQUIRE(lauf_asm_build_finish(b));
+    lauf_asm_destroy_builder(b);
+    return fn;
+}
+
+bool call_load(lauf_runtime_process* process, const lauf_asm_function* fn,
+               lauf_runtime_address addr, lauf_sint offset, std::uint64_t& result)
+{
+    lauf_runtime_value input[2];
+    input[0].as_address = addr;
+    input[1].as_sint    = offset;
+
+    lauf_runtime_value output;
+    if (!lauf_runtime_call(process, fn, input, &output))
+        return false;
+    result = output.as_uint;
+    return true;
+}
+} // namespace
+
+TEST_CASE("segmented allocations")
+{
+    auto mod    = lauf_asm_create_module("test");
+    auto global = lauf_asm_add_global(mod, LAUF_ASM_GLOBAL_READ_WRITE);
+    auto load   = add_load_function(mod);
+
+    auto distance = lauf_asm_add_function(mod, "distance", {2, 1});
+    {
+        auto b = lauf_asm_create_builder(lauf_asm_default_build_options);
+        lauf_asm_build(b, mod, distance);
+        lauf_asm_inst_call_builtin(b, lauf_lib_memory_addr_distance);
+        lauf_asm_inst_return(b);
+        REQUIRE(lauf_asm_build_finish(b));
+        lauf_asm_destroy_builder(b);
+    }
+
+    // The pages are only backed by memory once they're written.
+    constexpr auto size   = std::size_t(5) << 30;
+    auto           memory = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    REQUIRE(memory != MAP_FAILED);
+    auto bytes = static_cast<unsigned char*>(memory);
+
+    constexpr auto middle = (std::size_t(9) << 30) / 2;
+    std::uint64_t  values[] = {11, 42, 7};
+    std::memcpy(bytes, &values[0], sizeof(std::uint64_t));
+    std::memcpy(bytes + middle, &values[1], sizeof(std::uint64_t));
+    std::memcpy(bytes + size - 8, &values[2], sizeof(std::uint64_t));
+
+    auto program = lauf_asm_create_program(mod, load);
+    lauf_asm_define_native_global(&program, global, memory, size);
+
+    auto options          = lauf_default_vm_options;
+    options.panic_handler = {nullptr, [](void*, lauf_runtime_process*, const char* msg) {
+                                 CHECK(msg == doctest::String("address overflow"));
+                             }};
+    auto vm               = lauf_create_vm(options);
+    auto process          = lauf_vm_start_process(vm, &program);
+
+    auto check_allocation = [&](lauf_runtime_address addr) {
+        lauf_runtime_allocation alloc;
+        REQUIRE(lauf_runtime_get_allocation(process, addr, &alloc));
+        CHECK(alloc.ptr == memory);
+        CHECK(alloc.size == size);
+
+        // Address arithmetic moves between the segments.
+        std::uint64_t result;
+        REQUIRE(call_load(process, load, addr, 0, result));
+        CHECK(result == 11);
+        REQUIRE(call_load(process, load, addr, lauf_sint(middle), result));
+        CHECK(result == 42);
+        REQUIRE(call_load(process, load, addr, lauf_sint(size - 8), result));
+        CHECK(result == 7);
+        CHECK(!call_load(process, load, addr, lauf_sint(size + 8), result));
+
+        // Native pointers are converted to the address of their segment.
+        auto middle_addr = addr;
+        REQUIRE(lauf_runtime_get_address(process, &middle_addr, bytes + middle));
+        CHECK(middle_addr.allocation != addr.allocation);
+        CHECK(lauf_runtime_get_const_ptr(process, middle_addr, {8, 8}) == bytes + middle);
+
+        lauf_runtime_value input[2];
+        input[0].as_address = middle_addr;
+        input[1].as_address = addr;
+        lauf_runtime_value output;
+        REQUIRE(lauf_runtime_call(process, distance, input, &output));
+        CHECK(output.as_sint == lauf_sint(middle));
+
+        // Segments can't be split.
+        lauf_runtime_address addr1, addr2;
+        CHECK(!lauf_runtime_split_allocation(process, middle_addr, &addr1, &addr2));
+    };
+
+    SUBCASE("native global")
+    {
+        check_allocation(lauf_runtime_get_global_address(process, global));
+    }
+    SUBCASE("static allocation")
+    {
+        check_allocation(lauf_runtime_add_static_mut_allocation(process, memory, size));
+    }
+    SUBCASE("heap allocation")
+    {
+        auto addr = lauf_runtime_add_heap_allocation(process, memory, size);
+        check_allocation(addr);
+        CHECK(lauf_runtime_get_stats(process).heap_size == size);
+
+        // The value at index 1 of elements with 56 values; they don't line up with segments.
+        constexpr auto element_size = 56 * sizeof(lauf_runtime_value);
+        constexpr auto element      = (std::size_t(4) << 30) / element_size + 1;
+        constexpr auto offset       = element * element_size + 8;
+        auto           segment_addr = addr;
+        REQUIRE(lauf_runtime_get_address(process, &segment_addr, bytes + offset));
+        REQUIRE(lauf_runtime_set_pointer_map(process, segment_addr, element_size, 0b010));
+
+        auto allocator = lauf_vm_get_allocator(vm);
+        auto target    = lauf_runtime_add_heap_allocation(
+            process, allocator.heap_alloc(allocator.user_data, 8, 8), 8);
+        lauf_runtime_value value;
+        value.as_address = target;
+        std::memcpy(bytes + offset, &value, sizeof(value));
+
+        // It is not garbage collected, only freed explicitly, but the addresses stored in it are
+        // considered.
+        CHECK(lauf_runtime_gc(process) == 0);
+        CHECK(lauf_runtime_get_const_ptr(process, target, {8, 8}) != nullptr);
+
+        std::memset(bytes + offset, 0, sizeof(value));
+        CHECK(lauf_runtime_gc(process) == 8);
+        CHECK(lauf_runtime_get_const_ptr(process, target, {8, 8}) == nullptr);
+
+        CHECK(lauf_runtime_leak_heap_allocation(process, addr));
+        CHECK(lauf_runtime_get_stats(process).heap_size == 0);
+        CHECK(lauf_runtime_get_const_ptr(process, addr, {8, 8}) == nullptr);
+    }
+
+    lauf_runtime_destroy_process(process);
+    lauf_destroy_vm(vm);
+    ::munmap(memory, size);
+
+    lauf_asm_destroy_program(program);
+    lauf_asm_destroy_module(mod);
+}
+
+TEST_CASE("lauf_runtime_map_file")
+{
+    auto mod     = lauf_asm_create_module("test");
+    auto load    = add_load_function(mod);
+    auto program = lauf_asm_create_program(mod, load);
+
+    const auto    path     = "lauf_map_file.bin";
+    std::uint64_t values[] = {1, 2, 3};
+    {
+        auto file = std::fopen(path, "wb");
+        REQUIRE(file != nullptr);
+        std::fwrite(values, sizeof(values), 1, file);
+        std::fclose(file);
+    }
+
+    auto options          = lauf_default_vm_options;
+    options.panic_handler = {nullptr, [](void*, lauf_runtime_process*, const char*) {}};
+    auto vm               = lauf_create_vm(options);
+    auto process          = lauf_vm_start_process(vm, &program);
+
+    SUBCASE("read")
+    {
+        auto addr = lauf_runtime_map_file(process, path, LAUF_RUNTIME_PERM_READ);
+        REQUIRE(addr.allocation != lauf_runtime_address_null.allocation);
+
+        lauf_runtime_allocation alloc;
+        REQUIRE(lauf_runtime_get_allocation(process, addr, &alloc));
+        CHECK(alloc.size == sizeof(values));
+        CHECK(alloc.permission == LAUF_RUNTIME_PERM_READ);
+
+        std::uint64_t result;
+        REQUIRE(call_load(process, load, addr, 16, result));
+        CHECK(result == 3);
+
+        CHECK(lauf_runtime_unmap_file(process, addr));
+        CHECK(!call_load(process, load, addr, 16, result));
+        CHECK(!lauf_runtime_unmap_file(process, addr));
+    }
+    SUBCASE("write")
+    {
+        auto addr = lauf_runtime_map_file(process, path, LAUF_RUNTIME_PERM_READ_WRITE);
+        REQUIRE(addr.allocation != lauf_runtime_address_null.allocation);
+
+        auto ptr = static_cast<std::uint64_t*>(lauf_runtime_get_mut_ptr(process, addr, {8, 8}));
+        REQUIRE(ptr != nullptr);
+        *ptr = 42;
+
+        std::uint64_t result;
+        REQUIRE(call_load(process, load, addr, 0, result));
+        CHECK(result == 42);
+
+        // The file itself is not modified.
+        std::uint64_t contents[3];
+        auto          file = std::fopen(path, "rb");
+        REQUIRE(file != nullptr);
+        CHECK(std::fread(contents, sizeof(contents), 1, file) == 1);
+        std::fclose(file);
+        CHECK(contents[0] == 1);
+    }
+    SUBCASE("invalid")
+    {
+        auto addr
+            = lauf_runtime_map_file(process, "lauf_does_not_exist.bin", LAUF_RUNTIME_PERM_READ);
+        CHECK(addr.allocation == lauf_runtime_address_null.allocation);
+        CHECK(!lauf_runtime_unmap_file(process, lauf_runtime_address_null));
+    }
+
+    // Remaining mappings are unmapped with the process.
+    lauf_runtime_destroy_process(process);
+    lauf_destroy_vm(vm);
+    std::remove(path);
+
+    lauf_asm_destroy_program(program);
+    lauf_asm_destroy_module(mod);
+}